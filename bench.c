@@ -0,0 +1,2182 @@
+#include "trees.h"
+#include "boxes.h"
+#include "volume.h"
+#include "parser.h"
+#include "output.h"
+#include "shards.h"
+#include "image.h"
+#include "wal.h"
+#include "stats.h"
+#include "workload.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+
+#ifdef TREE_BTREE
+#define BENCH_TREE_BACKEND "btree"
+#else
+#define BENCH_TREE_BACKEND "rbtree"
+#endif
+
+
+typedef int (*bench_func_t)(int argc, char *argv[]);
+
+typedef struct bench_s {
+    const char    *name;
+    const char    *usage;
+    bench_func_t  func;
+} bench_t;
+
+
+/* fill 'keys' with a random permutation of 0,2,..,2*(n-1), so odd keys are
+ * not in the tree
+ */
+static void bench_shuffled_keys(tree_key_t *keys, long n)
+{
+    tree_key_t tmp;
+    long i, j;
+
+    for (i = 0; i < n; ++i) {
+        keys[i] = 2 * i;
+    }
+    for (i = n - 1; i > 0; --i) {
+        j       = random() % (i + 1);
+        tmp     = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+static void bench_nop_cleanup_cb(tree_value_t value)
+{
+}
+
+static long bench_num_cleaned;
+
+static void bench_count_cleanup_cb(tree_value_t value)
+{
+    ++bench_num_cleaned;
+}
+
+/*
+ * insert n distinct keys in random order, then measure exact-key lookups
+ * for n = 1e3, 1e4, ... up to max_n
+ */
+static int bench_search(int argc, char *argv[])
+{
+    long n, max_n, i, num_lookups, found;
+    double start, insert_time, search_time;
+    tree_value_t value;
+    node_t *node;
+    tree_key_t *keys;
+    tree_t tree;
+
+    max_n       = (argc > 0) ? atol(argv[0]) : 10000000;
+    num_lookups = 1000000;
+
+    printf("%10s %14s %14s\n", "keys", "insert ns/op", "search ns/op");
+    for (n = 1000; n <= max_n; n *= 10) {
+        keys = malloc(n * sizeof(*keys));
+        bench_shuffled_keys(keys, n);
+
+        tree_init(&tree);
+        value.ptr = NULL;
+        start = util_now();
+        for (i = 0; i < n; ++i) {
+            tree_insert(&tree, keys[i], value);
+        }
+        insert_time = util_now() - start;
+
+        found = 0;
+        start = util_now();
+        for (i = 0; i < num_lookups; ++i) {
+            found += !tree_search(&tree, keys[i % n], &node);
+        }
+        search_time = util_now() - start;
+
+        if (found != num_lookups) {
+            printf("search failed: found %ld of %ld keys\n", found, num_lookups);
+            return -1;
+        }
+
+        printf("%10ld %14.1f %14.1f\n", n, insert_time * 1e9 / n,
+               search_time * 1e9 / num_lookups);
+
+        tree_cleanup(&tree, bench_nop_cleanup_cb);
+        free(keys);
+    }
+
+    return 0;
+}
+
+static int bench_box_cmp(const void *a, const void *b)
+{
+    const box_t *box_a = a, *box_b = b;
+
+    if (box_a->side != box_b->side) {
+        return (box_a->side > box_b->side) - (box_a->side < box_b->side);
+    }
+    return (box_a->height > box_b->height) - (box_a->height < box_b->height);
+}
+
+/* random dimension in [0,max) with a 0.01 resolution */
+static float bench_random_dim(float max)
+{
+    return (random() % (long)(max * 100)) / 100.0;
+}
+
+/*
+ * measure GETBOX on a staircase of 'num_sides' sides, whose heights
+ * decrease as they grow so all the boxes have about the same volume. a small
+ * query fits all of them, and no side can be skipped by a scan of the sides,
+ * which the range tree of GETBOX does not depend on
+ */
+static double bench_getbox_staircase(long num_sides, long num_queries)
+{
+    float found_side, found_height, side;
+    double start, elapsed;
+    boxes_t boxes;
+    long i;
+
+    boxes_init(&boxes);
+    for (i = 1; i <= num_sides; ++i) {
+        side = i / 10.0;
+        INSERTBOX(&boxes, side, 1e6 / (side * side));
+    }
+
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        GETBOX(&boxes, 0.1, 0.1, &found_side, &found_height);
+    }
+    elapsed = util_now() - start;
+
+    boxes_cleanup(&boxes);
+    return elapsed * 1e9 / num_queries;
+}
+
+/*check queries of height -inf, which is the augmented value of the empty
+ * subtrees, against the same queries of height 0: the heights are not
+ * negative, so the answers are the same
+ * returns the number of queries whose answers differ*/
+static long bench_getbox_check_min_height(boxes_t *boxes,
+                                          const float *queries,
+                                          long num_queries)
+{
+    float side1, height1, side2, height2;
+    box_count_t top1, top2;
+    boxes_cursor_t cursor;
+    box_count_t box;
+    long i, mismatches;
+    uint64_t count;
+    int ret1, ret2;
+
+    mismatches = 0;
+    for (i = 0; i < num_queries; ++i) {
+        ret1 = GETBOX(boxes, queries[2 * i], -INFINITY, &side1, &height1);
+        ret2 = GETBOX(boxes, queries[2 * i], 0, &side2, &height2);
+        if ((ret1 != ret2) ||
+            (!ret1 && ((side1 != side2) || (height1 != height2)))) {
+            ++mismatches;
+        }
+
+        if ((boxes_topk_fit(boxes, queries[2 * i], -INFINITY, 1, &top1) !=
+             boxes_topk_fit(boxes, queries[2 * i], 0, 1, &top2)) ||
+            (!ret1 && memcmp(&top1, &top2, sizeof(top1)))) {
+            ++mismatches;
+        }
+
+        count = 0;
+        boxes_cursor_open(boxes, &cursor, queries[2 * i], INFINITY,
+                          -INFINITY, INFINITY);
+        while (!boxes_cursor_next(&cursor, &box)) {
+            count += box.count;
+        }
+        boxes_cursor_close(&cursor);
+        if (count != boxes_range_count(boxes, queries[2 * i], INFINITY, 0,
+                                       INFINITY)) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+/*
+ * fill the index with random boxes, then measure GETBOX and CHECKBOX on
+ * random queries, and GETBOX on a staircase of sides. queries of height
+ * -inf are checked against queries of height 0
+ */
+static int bench_getbox(int argc, char *argv[])
+{
+    long n, i, num_queries, found, num_sides, mismatches;
+    double start, getbox_time, checkbox_time;
+    float found_side, found_height;
+    float *queries;
+    boxes_t boxes;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_queries = (argc > 1) ? atol(argv[1]) : 100000;
+
+    boxes_init(&boxes);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, bench_random_dim(1000), bench_random_dim(1000));
+    }
+
+    queries = malloc(2 * num_queries * sizeof(*queries));
+    for (i = 0; i < 2 * num_queries; ++i) {
+        queries[i] = bench_random_dim(1000);
+    }
+
+    found = 0;
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        found += !GETBOX(&boxes, queries[2 * i], queries[2 * i + 1],
+                         &found_side, &found_height);
+    }
+    getbox_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        CHECKBOX(&boxes, queries[2 * i], queries[2 * i + 1]);
+    }
+    checkbox_time = util_now() - start;
+
+    printf("boxes: %ld, queries: %ld, found: %ld\n", n, num_queries, found);
+    printf("GETBOX:   %10.1f ns/op\n", getbox_time * 1e9 / num_queries);
+    printf("CHECKBOX: %10.1f ns/op\n", checkbox_time * 1e9 / num_queries);
+    boxes_print_pool_stats(&boxes, "pool ");
+
+    mismatches = bench_getbox_check_min_height(
+            &boxes, queries, (num_queries < 1000) ? num_queries : 1000);
+    free(queries);
+    boxes_cleanup(&boxes);
+    if (mismatches) {
+        printf("getbox failed: %ld queries of height -inf differ\n",
+               mismatches);
+        return -1;
+    }
+
+    /* the sides are 10 times more per row, and the time is about the same */
+    for (num_sides = 100; num_sides <= 10000; num_sides *= 10) {
+        printf("GETBOX of a staircase of %6ld sides: %12.1f ns/op\n",
+               num_sides, bench_getbox_staircase(num_sides,
+                                                  10000000 / num_sides));
+    }
+    return 0;
+}
+
+/* order of boxes_topk_fit(): volume, then side and height */
+static int bench_topk_cmp(const void *a, const void *b)
+{
+    const box_count_t *box_a = a, *box_b = b;
+    float volume_a = box_a->side * box_a->side * box_a->height;
+    float volume_b = box_b->side * box_b->side * box_b->height;
+
+    if (volume_a != volume_b) {
+        return (volume_a > volume_b) - (volume_a < volume_b);
+    } else if (box_a->side != box_b->side) {
+        return (box_a->side > box_b->side) - (box_a->side < box_b->side);
+    }
+    return (box_a->height > box_b->height) - (box_a->height < box_b->height);
+}
+
+/* check boxes_topk_fit against GETBOX and a sort of all the fitting boxes
+ * from a cursor, and boxes_range_count against a scan of all the boxes
+ */
+static long bench_topk_check(boxes_t *boxes, const box_t *all, size_t num_all,
+                             const float *queries, long num_queries, long k)
+{
+    box_count_t *topk, *fits;
+    size_t n, num_fits, capacity, j;
+    uint64_t count, expected;
+    float side_lo, side_hi, height_lo, height_hi;
+    float found_side, found_height;
+    boxes_cursor_t cursor;
+    long i, num_errors;
+
+    topk       = malloc(k * sizeof(*topk));
+    fits       = NULL;
+    capacity   = 0;
+    num_errors = 0;
+    for (i = 0; i < num_queries; ++i) {
+        n = boxes_topk_fit(boxes, queries[2 * i], queries[2 * i + 1], k, topk);
+        if (GETBOX(boxes, queries[2 * i], queries[2 * i + 1], &found_side,
+                   &found_height)) {
+            num_errors += (n != 0);
+        } else if ((n == 0) || (topk[0].side != found_side) ||
+                   (topk[0].height != found_height)) {
+            ++num_errors;
+        }
+
+        num_fits = 0;
+        boxes_cursor_open(boxes, &cursor, queries[2 * i], INFINITY,
+                          queries[2 * i + 1], INFINITY);
+        for (;;) {
+            if (num_fits == capacity) {
+                capacity = capacity ? (2 * capacity) : 1024;
+                fits     = realloc(fits, capacity * sizeof(*fits));
+            }
+            if (boxes_cursor_next(&cursor, &fits[num_fits])) {
+                break;
+            }
+            ++num_fits;
+        }
+        boxes_cursor_close(&cursor);
+
+        qsort(fits, num_fits, sizeof(*fits), bench_topk_cmp);
+        if (n != ((num_fits < k) ? num_fits : k)) {
+            ++num_errors;
+            continue;
+        }
+        for (j = 0; j < n; ++j) {
+            if (bench_topk_cmp(&topk[j], &fits[j]) ||
+                (topk[j].count != fits[j].count)) {
+                ++num_errors;
+                break;
+            }
+        }
+
+        /* bounds between the 0.01 grid of the boxes, so the key delta does
+         * not matter
+         */
+        side_lo   = queries[2 * i] + 0.005;
+        height_lo = queries[2 * i + 1] + 0.005;
+        side_hi   = side_lo + bench_random_dim(100);
+        height_hi = height_lo + bench_random_dim(100);
+        expected  = 0;
+        for (j = 0; j < num_all; ++j) {
+            expected += (all[j].side >= side_lo) && (all[j].side <= side_hi) &&
+                        (all[j].height >= height_lo) &&
+                        (all[j].height <= height_hi);
+        }
+        count = boxes_range_count(boxes, side_lo, side_hi, height_lo,
+                                  height_hi);
+        num_errors += (count != expected);
+    }
+
+    free(fits);
+    free(topk);
+    return num_errors;
+}
+
+/*
+ * fill the index with random boxes, check the top-k and range queries, then
+ * measure boxes_topk_fit against k rounds of GETBOX and REMOVEBOX (with the
+ * boxes inserted back), and boxes_range_count
+ */
+static int bench_topk(int argc, char *argv[])
+{
+    double start, topk_time, rounds_time, range_time;
+    long n, k, i, j, num_queries, num_errors, num_found;
+    float *queries, *found;
+    box_count_t *topk;
+    size_t num_all;
+    boxes_t boxes;
+    box_t *all;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    k           = (argc > 1) ? atol(argv[1]) : 16;
+    num_queries = (argc > 2) ? atol(argv[2]) : 10000;
+    if (k <= 0) {
+        printf("k must be positive\n");
+        return -1;
+    }
+
+    boxes_init(&boxes);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, bench_random_dim(1000), bench_random_dim(1000));
+    }
+
+    queries = malloc(2 * num_queries * sizeof(*queries));
+    for (i = 0; i < 2 * num_queries; ++i) {
+        queries[i] = bench_random_dim(1000);
+    }
+    topk  = malloc(k * sizeof(*topk));
+    found = malloc(2 * k * sizeof(*found));
+
+    if (boxes_collect(&boxes, &all, &num_all)) {
+        printf("out of memory\n");
+        return -1;
+    }
+    num_errors = bench_topk_check(&boxes, all, num_all, queries,
+                                  (num_queries < 100) ? num_queries : 100, k);
+    free(all);
+    if (num_errors) {
+        printf("topk failed: %ld wrong queries\n", num_errors);
+        return -1;
+    }
+
+    num_found = 0;
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        num_found += boxes_topk_fit(&boxes, queries[2 * i],
+                                    queries[2 * i + 1], k, topk);
+    }
+    topk_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        for (j = 0; j < k; ++j) {
+            if (GETBOX(&boxes, queries[2 * i], queries[2 * i + 1],
+                       &found[2 * j], &found[2 * j + 1])) {
+                break;
+            }
+            REMOVEBOX(&boxes, found[2 * j], found[2 * j + 1]);
+        }
+        while (j-- > 0) {
+            INSERTBOX(&boxes, found[2 * j], found[2 * j + 1]);
+        }
+    }
+    rounds_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        num_found += boxes_range_count(&boxes, queries[2 * i],
+                                       queries[2 * i] + 10,
+                                       queries[2 * i + 1],
+                                       queries[2 * i + 1] + 10);
+    }
+    range_time = util_now() - start;
+
+    printf("boxes: %ld, k: %ld, queries: %ld, found: %ld\n", n, k,
+           num_queries, num_found);
+    printf("topk:          %10.1f ns/op\n", topk_time * 1e9 / num_queries);
+    printf("GETBOX rounds: %10.1f ns/op\n", rounds_time * 1e9 / num_queries);
+    printf("range count:   %10.1f ns/op\n", range_time * 1e9 / num_queries);
+
+    free(found);
+    free(topk);
+    free(queries);
+    boxes_cleanup(&boxes);
+    return 0;
+}
+
+/*
+ * measure INSERTBOX of random boxes, then REMOVEBOX of all of them, and the
+ * same with 'count' boxes of each size at once by INSERTBOX_N and REMOVEBOX_N
+ */
+static int bench_update(int argc, char *argv[])
+{
+    double start, insert_time, remove_time, insert_n_time, remove_n_time;
+    long n, i, count, failed;
+    size_t num_left;
+    box_t *left;
+    float *dims;
+    boxes_t boxes;
+
+    n     = (argc > 0) ? atol(argv[0]) : 1000000;
+    count = (argc > 1) ? atol(argv[1]) : 10000;
+
+    dims = malloc(2 * n * sizeof(*dims));
+    for (i = 0; i < 2 * n; ++i) {
+        dims[i] = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes);
+
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, dims[2 * i], dims[2 * i + 1]);
+    }
+    insert_time = util_now() - start;
+
+    boxes_print_pool_stats(&boxes, "pool ");
+
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        REMOVEBOX(&boxes, dims[2 * i], dims[2 * i + 1]);
+    }
+    remove_time = util_now() - start;
+
+    failed = 0;
+    start  = util_now();
+    for (i = 0; i < n; ++i) {
+        failed += INSERTBOX_N(&boxes, dims[2 * i], dims[2 * i + 1], count);
+    }
+    insert_n_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        failed += REMOVEBOX_N(&boxes, dims[2 * i], dims[2 * i + 1], count);
+    }
+    remove_n_time = util_now() - start;
+
+    boxes_collect(&boxes, &left, &num_left);
+    free(left);
+    if (failed || num_left) {
+        printf("update failed: %ld counted updates failed, %zu boxes left\n",
+               -failed, num_left);
+        return -1;
+    }
+
+    printf("boxes: %ld, count: %ld\n", n, count);
+    printf("INSERTBOX:   %10.1f ns/op\n", insert_time * 1e9 / n);
+    printf("REMOVEBOX:   %10.1f ns/op\n", remove_time * 1e9 / n);
+    printf("INSERTBOX_N: %10.1f ns/op\n", insert_n_time * 1e9 / n);
+    printf("REMOVEBOX_N: %10.1f ns/op\n", remove_n_time * 1e9 / n);
+
+    boxes_cleanup(&boxes);
+    free(dims);
+    return 0;
+}
+
+/*
+ * compare tree backends: insert n keys in random order, upper bound of
+ * random keys, a full in-order scan, and removal of all keys in random order
+ */
+static int bench_tree(int argc, char *argv[])
+{
+    double start, insert_time, ub_time, scan_time, remove_time, cleanup_time;
+    long n, i, num_lookups, found, scanned;
+    tree_value_t value;
+    node_t *node;
+    tree_key_t *keys;
+    tree_t tree;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_lookups = 1000000;
+
+    keys = malloc(n * sizeof(*keys));
+    bench_shuffled_keys(keys, n);
+
+    tree_init(&tree);
+    value.ptr = NULL;
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        tree_insert(&tree, keys[i], value);
+    }
+    insert_time = util_now() - start;
+
+    found = 0;
+    start = util_now();
+    for (i = 0; i < num_lookups; ++i) {
+        found += !tree_ub(&tree, keys[i % n] - 1, &node);
+    }
+    ub_time = util_now() - start;
+
+    scanned = 0;
+    start = util_now();
+    if (!tree_ub(&tree, TREE_KEY_MIN, &node)) {
+        do {
+            ++scanned;
+        } while (!tree_successor(&tree, &node));
+    }
+    scan_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        if (!tree_search(&tree, keys[n - 1 - i], &node)) {
+            tree_delete(&tree, node);
+        }
+    }
+    remove_time = util_now() - start;
+    if (!tree_is_empty(&tree)) {
+        printf("tree failed: not empty after removing all the keys\n");
+        return -1;
+    }
+
+    /* tear down a full tree, which visits every node without a stack */
+    for (i = 0; i < n; ++i) {
+        tree_insert(&tree, keys[i], value);
+    }
+    bench_num_cleaned = 0;
+    start = util_now();
+    tree_cleanup(&tree, bench_count_cleanup_cb);
+    cleanup_time = util_now() - start;
+
+    if ((found != num_lookups) || (scanned != n) ||
+        (bench_num_cleaned != n) || !tree_is_empty(&tree)) {
+        printf("tree failed: found %ld of %ld, scanned %ld of %ld, cleaned "
+               "%ld of %ld\n", found, num_lookups, scanned, n,
+               bench_num_cleaned, n);
+        return -1;
+    }
+
+    printf("backend: %s, keys: %ld\n", BENCH_TREE_BACKEND, n);
+    printf("insert: %10.1f ns/op\n", insert_time * 1e9 / n);
+    printf("ub:     %10.1f ns/op\n", ub_time * 1e9 / num_lookups);
+    printf("scan:   %10.1f ns/key\n", scan_time * 1e9 / n);
+    printf("remove: %10.1f ns/op\n", remove_time * 1e9 / n);
+    printf("cleanup:%10.1f ns/key\n", cleanup_time * 1e9 / n);
+
+    free(keys);
+    return 0;
+}
+
+/*
+ * compare the dispatched volume_argmin kernel to the scalar loop, on arrays
+ * of n random boxes
+ */
+static int bench_volume(int argc, char *argv[])
+{
+    double start, scalar_time, kernel_time;
+    long n, i, num_iters;
+    size_t scalar_i, kernel_i;
+    float scalar_min, kernel_min;
+    float *sides, *heights;
+
+    n         = (argc > 0) ? atol(argv[0]) : 16;
+    num_iters = 100000000 / n;
+
+    sides   = malloc(n * sizeof(*sides));
+    heights = malloc(n * sizeof(*heights));
+    for (i = 0; i < n; ++i) {
+        sides[i]   = bench_random_dim(1000);
+        heights[i] = bench_random_dim(1000);
+    }
+
+    scalar_i = 0;
+    start = util_now();
+    for (i = 0; i < num_iters; ++i) {
+        sides[0] = i;   /* keep the calls from being hoisted */
+        scalar_i += volume_argmin_scalar(sides, heights, n, &scalar_min);
+    }
+    scalar_time = util_now() - start;
+
+    kernel_i = 0;
+    start = util_now();
+    for (i = 0; i < num_iters; ++i) {
+        sides[0] = i;
+        kernel_i += volume_argmin(sides, heights, n, &kernel_min);
+    }
+    kernel_time = util_now() - start;
+
+    if ((scalar_i != kernel_i) || (scalar_min != kernel_min)) {
+        printf("volume failed: kernel result differs from scalar\n");
+        return -1;
+    }
+
+    printf("boxes: %ld, kernel: %s\n", n, volume_kernel_name());
+    printf("scalar: %10.2f ns/box\n", scalar_time * 1e9 / (num_iters * n));
+    printf("kernel: %10.2f ns/box\n", kernel_time * 1e9 / (num_iters * n));
+
+    free(heights);
+    free(sides);
+    return 0;
+}
+
+/*
+ * fill the index with random boxes, then compare separate GETBOX calls to
+ * boxes_getbox_batch on the same random queries
+ */
+static int bench_batch(int argc, char *argv[])
+{
+    double start, single_time, batch_time;
+    result_t *results;
+    query_t *queries;
+    long n, i, num_queries, mismatches;
+    float found_side, found_height;
+    boxes_t boxes;
+    int ret;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_queries = (argc > 1) ? atol(argv[1]) : 100000;
+
+    boxes_init(&boxes);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, bench_random_dim(1000), bench_random_dim(1000));
+    }
+
+    queries = malloc(num_queries * sizeof(*queries));
+    results = malloc(num_queries * sizeof(*results));
+    for (i = 0; i < num_queries; ++i) {
+        queries[i].side   = bench_random_dim(1000);
+        queries[i].height = bench_random_dim(1000);
+    }
+
+    /* warm the caches the same for both, which matters for a few queries */
+    for (i = 0; i < num_queries; ++i) {
+        GETBOX(&boxes, queries[i].side, queries[i].height, &found_side,
+               &found_height);
+    }
+
+    start = util_now();
+    if (boxes_getbox_batch(&boxes, queries, num_queries, results)) {
+        printf("batch failed\n");
+        return -1;
+    }
+    batch_time = util_now() - start;
+
+    mismatches = 0;
+    start = util_now();
+    for (i = 0; i < num_queries; ++i) {
+        ret = GETBOX(&boxes, queries[i].side, queries[i].height, &found_side,
+                     &found_height);
+        mismatches += (results[i].found != !ret) ||
+                      (!ret && ((results[i].side != found_side) ||
+                                (results[i].height != found_height)));
+    }
+    single_time = util_now() - start;
+
+    if (mismatches) {
+        printf("batch failed: %ld results differ from GETBOX\n", mismatches);
+        return -1;
+    }
+
+    printf("boxes: %ld, queries: %ld\n", n, num_queries);
+    printf("GETBOX: %10.1f ns/op\n", single_time * 1e9 / num_queries);
+    printf("batch:  %10.1f ns/op\n", batch_time * 1e9 / num_queries);
+
+    free(results);
+    free(queries);
+    boxes_cleanup(&boxes);
+    return 0;
+}
+
+/*
+ * compare INSERTBOX of random boxes to boxes_bulk_load of the same boxes,
+ * unsorted and sorted
+ */
+static int bench_load(int argc, char *argv[])
+{
+    double start, insert_time, load_time, sorted_time;
+    boxes_t boxes;
+    box_t *input;
+    long n, i;
+
+    n = (argc > 0) ? atol(argv[0]) : 1000000;
+
+    input = malloc(n * sizeof(*input));
+    for (i = 0; i < n; ++i) {
+        input[i].side   = bench_random_dim(1000);
+        input[i].height = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes);
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+    }
+    insert_time = util_now() - start;
+    boxes_cleanup(&boxes);
+
+    start = util_now();
+    if (boxes_bulk_load(&boxes, input, n)) {
+        printf("load failed\n");
+        return -1;
+    }
+    load_time = util_now() - start;
+    boxes_cleanup(&boxes);
+
+    /* the input is sorted now, so the next load skips sorting */
+    qsort(input, n, sizeof(*input), bench_box_cmp);
+    start = util_now();
+    boxes_bulk_load(&boxes, input, n);
+    sorted_time = util_now() - start;
+    boxes_cleanup(&boxes);
+
+    printf("boxes: %ld\n", n);
+    printf("INSERTBOX:     %10.1f ns/box\n", insert_time * 1e9 / n);
+    printf("load unsorted: %10.1f ns/box\n", load_time * 1e9 / n);
+    printf("load sorted:   %10.1f ns/box\n", sorted_time * 1e9 / n);
+
+    free(input);
+    return 0;
+}
+
+/* parse the commands of 'path', and sum their arguments */
+static int bench_parse_file(const char *path, long *num_p, float *sum_p)
+{
+    command_t command;
+    parser_t parser;
+
+    if (parser_open(&parser, path)) {
+        return -1;
+    }
+    *num_p = 0;
+    *sum_p = 0;
+    while (parser_next(&parser, &command) > 0) {
+        *sum_p += command.arg1 + command.arg2;
+        ++*num_p;
+    }
+    parser_close(&parser);
+    return 0;
+}
+
+/* compare the parser to strtof on numbers which are longer than its stack
+ * copy, such as 0.000...0001e<k>, on their own and followed by a long line
+ * @return the number of numbers which differ */
+static long bench_parse_check_long(void)
+{
+    char buf[1024];
+    const char *end;
+    long k, num_differ;
+    float value;
+    char *q;
+    int len;
+
+    num_differ = 0;
+    for (k = 100; k <= 600; k += 100) {
+        q = buf;
+        q += sprintf(q, "0.");
+        memset(q, '0', k);
+        q += k;
+        len = (q - buf) + sprintf(q, "1e%ld", k + 1);
+        end = parser_parse_float(buf, buf + len, &value);
+        if ((end != buf + len) || (value != strtof(buf, NULL))) {
+            ++num_differ;
+        }
+
+        /* the line is long, but the number is not */
+        len = sprintf(buf, "inf%*s,1)", (int)k, "");
+        end = parser_parse_float(buf, buf + len, &value);
+        if ((end != buf + 3) || (value != INFINITY)) {
+            ++num_differ;
+        }
+    }
+    return num_differ;
+}
+
+/*
+ * write n random commands to a temporary file, then compare reading it with
+ * fgets and sscanf to the command file parser, which maps the file, or reads
+ * it through a buffer from a pipe
+ */
+static int bench_parse(int argc, char *argv[])
+{
+    static const char *names[] = {"INSERTBOX", "REMOVEBOX", "GETBOX",
+                                  "CHECKBOX"};
+    char path[] = "/tmp/bench_parse_XXXXXX";
+    double start, scanf_time, parser_time, pipe_time;
+    char line[100], command_name[100], pipe_path[64];
+    float arg1, arg2, sum_scanf, sum_parser, sum_pipe;
+    long n, i, num_scanf, num_parser, num_pipe, num_differ;
+    FILE *fp;
+    int fd, ret;
+
+    n = (argc > 0) ? atol(argv[0]) : 10000000;
+
+    num_differ = bench_parse_check_long();
+    if (num_differ > 0) {
+        printf("parse failed: %ld long numbers differ from strtof\n",
+               num_differ);
+        return -1;
+    }
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("failed to create '%s': %m\n", path);
+        return -1;
+    }
+    fp = fdopen(fd, "w");
+    for (i = 0; i < n; ++i) {
+        fprintf(fp, "%s(%.2f,%.2f)\n", names[random() % 4],
+                bench_random_dim(1000), bench_random_dim(1000));
+    }
+    fclose(fp);
+
+    /* the way main() used to read command files */
+    num_scanf = 0;
+    sum_scanf = 0;
+    start = util_now();
+    fp = fopen(path, "r");
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        const char *p = line;
+        char *q = command_name;
+
+        while ((*p != '\0') && (*p != '(')) {
+            *(q++) = *(p++);
+        }
+        *q = '\0';
+        if (sscanf(p, "(%f,%f)", &arg1, &arg2) == 2) {
+            sum_scanf += arg1 + arg2;
+            ++num_scanf;
+        }
+    }
+    fclose(fp);
+    scanf_time = util_now() - start;
+
+    start = util_now();
+    if (bench_parse_file(path, &num_parser, &sum_parser)) {
+        printf("failed to open '%s': %m\n", path);
+        unlink(path);
+        return -1;
+    }
+    parser_time = util_now() - start;
+
+    /* the same file from a pipe, which can not be mapped */
+    snprintf(line, sizeof(line), "cat %s", path);
+    start = util_now();
+    fp = popen(line, "r");
+    if (fp == NULL) {
+        printf("failed to run '%s': %m\n", line);
+        unlink(path);
+        return -1;
+    }
+    snprintf(pipe_path, sizeof(pipe_path), "/dev/fd/%d", fileno(fp));
+    ret = bench_parse_file(pipe_path, &num_pipe, &sum_pipe);
+    pclose(fp);
+    pipe_time = util_now() - start;
+
+    unlink(path);
+
+    if (ret || (num_scanf != n) || (num_parser != n) || (num_pipe != n) ||
+        (sum_scanf != sum_parser) || (sum_pipe != sum_parser)) {
+        printf("parse failed: scanf %ld, parser %ld, pipe %ld of %ld "
+               "lines\n", num_scanf, num_parser, num_pipe, n);
+        return -1;
+    }
+
+    printf("lines: %ld\n", n);
+    printf("fgets+sscanf: %10.1f ns/line\n", scanf_time * 1e9 / n);
+    printf("parser:       %10.1f ns/line\n", parser_time * 1e9 / n);
+    printf("parser, pipe: %10.1f ns/line\n", pipe_time * 1e9 / n);
+    return 0;
+}
+
+/*
+ * compare printf of n random GETBOX results to the output writer, both
+ * writing to /dev/null
+ */
+static int bench_output(int argc, char *argv[])
+{
+    double start, printf_time, output_time;
+    output_t output;
+    float *dims;
+    long n, i;
+    FILE *fp;
+    int fd;
+
+    n = (argc > 0) ? atol(argv[0]) : 10000000;
+
+    dims = malloc(4 * n * sizeof(*dims));
+    for (i = 0; i < 4 * n; ++i) {
+        dims[i] = bench_random_dim(1000);
+    }
+
+    fp = fopen("/dev/null", "w");
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        fprintf(fp, "The minimal volume of a box which can fit "
+                "(side: %.2f height: %.2f) is: (side: %.2f height: %.2f)\n",
+                dims[4 * i], dims[4 * i + 1], dims[4 * i + 2],
+                dims[4 * i + 3]);
+    }
+    fclose(fp);
+    printf_time = util_now() - start;
+
+    fd = open("/dev/null", O_WRONLY);
+    output_init(&output, fd, OUTPUT_TEXT);
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        output_getbox(&output, 0, dims[4 * i], dims[4 * i + 1],
+                      dims[4 * i + 2], dims[4 * i + 3]);
+    }
+    output_cleanup(&output);
+    output_time = util_now() - start;
+    close(fd);
+
+    printf("results: %ld\n", n);
+    printf("printf: %10.1f ns/result\n", printf_time * 1e9 / n);
+    printf("output: %10.1f ns/result\n", output_time * 1e9 / n);
+
+    free(dims);
+    return 0;
+}
+
+/* random dimension in [0,max) with a 0.01 resolution, for threads, from
+ * the sequence of their own 'state' */
+static float bench_thread_random_dim(uint64_t *state, float max)
+{
+    return (util_random(state) % (long)(max * 100)) / 100.0;
+}
+
+/* work of a thread of the concurrent benchmarks */
+typedef struct bench_thread_s {
+    pthread_t    thread;
+    boxes_t      *boxes;
+    shards_t     *shards;
+    uint64_t     seed;
+    long         num_ops;
+    int          write_percent;
+    long         errors;
+} bench_thread_t;
+
+/* random queries, and 'write_percent' of the time insert and remove a box */
+static void *bench_concurrent_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    float side, height, found_side, found_height;
+    long i;
+
+    for (i = 0; i < t->num_ops; ++i) {
+        side   = bench_thread_random_dim(&t->seed, 1000);
+        height = bench_thread_random_dim(&t->seed, 1000);
+        if ((long)(util_random(&t->seed) % 100) < t->write_percent) {
+            INSERTBOX(t->boxes, side, height);
+            REMOVEBOX(t->boxes, side, height);
+        } else if (i % 2) {
+            GETBOX(t->boxes, side, height, &found_side, &found_height);
+        } else {
+            CHECKBOX(t->boxes, side, height);
+        }
+    }
+    return NULL;
+}
+
+/* start 'num_threads' threads running 'func', and wait for them */
+static void bench_run_threads(bench_thread_t *threads, int num_threads,
+                              void *(*func)(void*))
+{
+    int i;
+
+    for (i = 0; i < num_threads; ++i) {
+        pthread_create(&threads[i].thread, NULL, func, &threads[i]);
+    }
+    for (i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i].thread, NULL);
+    }
+}
+
+/*
+ * fill concurrent boxes with random boxes, then measure the throughput of a
+ * read-mostly mix of operations with 1, 2, 4, ... up to max_threads threads
+ */
+static int bench_concurrent(int argc, char *argv[])
+{
+    long n, i, ops_per_thread;
+    int num_threads, max_threads, write_percent;
+    bench_thread_t *threads;
+    double start, elapsed, ops_per_sec, base_ops_per_sec;
+    boxes_t boxes;
+
+    n              = (argc > 0) ? atol(argv[0]) : 1000000;
+    max_threads    = (argc > 1) ? atoi(argv[1]) : 64;
+    write_percent  = (argc > 2) ? atoi(argv[2]) : 1;
+    ops_per_thread = 200000;
+
+    boxes_init_concurrent(&boxes);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, bench_random_dim(1000), bench_random_dim(1000));
+    }
+
+    threads = calloc(max_threads, sizeof(*threads));
+
+    printf("boxes: %ld, writes: %d%%\n", n, write_percent);
+    printf("%8s %14s %14s\n", "threads", "ops/sec", "speedup");
+    base_ops_per_sec = 0;
+    for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        for (i = 0; i < num_threads; ++i) {
+            threads[i].boxes         = &boxes;
+            threads[i].seed          = i + 1;
+            threads[i].num_ops       = ops_per_thread;
+            threads[i].write_percent = write_percent;
+        }
+
+        start = util_now();
+        bench_run_threads(threads, num_threads, bench_concurrent_thread);
+        elapsed = util_now() - start;
+
+        ops_per_sec = num_threads * ops_per_thread / elapsed;
+        if (num_threads == 1) {
+            base_ops_per_sec = ops_per_sec;
+        }
+        printf("%8d %14.0f %14.2f\n", num_threads, ops_per_sec,
+               ops_per_sec / base_ops_per_sec);
+    }
+
+    free(threads);
+    boxes_cleanup(&boxes);
+    return 0;
+}
+
+/* insert a box, check that queries find it, and remove it */
+static void *bench_stress_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    float side, height, found_side, found_height;
+    long i;
+
+    for (i = 0; i < t->num_ops; ++i) {
+        side   = bench_thread_random_dim(&t->seed, 100);
+        height = bench_thread_random_dim(&t->seed, 100);
+
+        INSERTBOX(t->boxes, side, height);
+        if (GETBOX(t->boxes, side, height, &found_side, &found_height) ||
+            (found_side < side - 0.002) || (found_height < height - 0.002)) {
+            ++t->errors;
+        }
+        if (CHECKBOX(t->boxes, side, height)) {
+            ++t->errors;
+        }
+        if (REMOVEBOX(t->boxes, side, height)) {
+            ++t->errors;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * run threads which insert, query and remove their own boxes on the same
+ * concurrent boxes, and check every result, and that no boxes are left
+ */
+static int bench_stress(int argc, char *argv[])
+{
+    bench_thread_t *threads;
+    int i, num_threads;
+    long num_ops, errors;
+    boxes_t boxes;
+
+    num_threads = (argc > 0) ? atoi(argv[0]) : 16;
+    num_ops     = (argc > 1) ? atol(argv[1]) : 100000;
+
+    boxes_init_concurrent(&boxes);
+
+    threads = calloc(num_threads, sizeof(*threads));
+    for (i = 0; i < num_threads; ++i) {
+        threads[i].boxes   = &boxes;
+        threads[i].seed    = i + 1;
+        threads[i].num_ops = num_ops;
+    }
+    bench_run_threads(threads, num_threads, bench_stress_thread);
+
+    errors = 0;
+    for (i = 0; i < num_threads; ++i) {
+        errors += threads[i].errors;
+    }
+    free(threads);
+
+    if (errors || !tree_is_empty(&boxes.sidetree)) {
+        printf("stress failed: %ld errors, %s\n", errors,
+               tree_is_empty(&boxes.sidetree) ? "empty" : "not empty");
+        boxes_cleanup(&boxes);
+        return -1;
+    }
+
+    printf("threads: %d, ops: %ld, ok\n", num_threads, num_ops);
+    boxes_cleanup(&boxes);
+    return 0;
+}
+
+/* insert random boxes to the boxes or the shards, whichever is set */
+static void *bench_shards_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    float side, height;
+    long i;
+
+    for (i = 0; i < t->num_ops; ++i) {
+        side   = bench_thread_random_dim(&t->seed, 1000);
+        height = bench_thread_random_dim(&t->seed, 1000);
+        if (t->shards != NULL) {
+            shards_insertbox(t->shards, side, height);
+        } else {
+            INSERTBOX(t->boxes, side, height);
+        }
+    }
+    return NULL;
+}
+
+/* compare GETBOX and CHECKBOX of random queries on boxes and shards */
+static long bench_shards_compare(boxes_t *boxes, shards_t *shards,
+                                 long num_queries)
+{
+    float side, height, side1, height1, side2, height2;
+    long i, mismatches;
+    int ret1, ret2;
+
+    mismatches = 0;
+    for (i = 0; i < num_queries; ++i) {
+        side   = bench_random_dim(1000);
+        height = bench_random_dim(1000);
+        ret1 = GETBOX(boxes, side, height, &side1, &height1);
+        ret2 = shards_getbox(shards, side, height, &side2, &height2);
+        mismatches += (ret1 != ret2) ||
+                      (!ret1 && ((side1 != side2) || (height1 != height2)));
+        mismatches += CHECKBOX(boxes, side, height) !=
+                      shards_checkbox(shards, side, height);
+    }
+    return mismatches;
+}
+
+/*
+ * check that sharded boxes give the same results as a single boxes_t, then
+ * compare parallel INSERTBOX of random boxes on concurrent boxes and on
+ * shards
+ */
+static int bench_shards(int argc, char *argv[])
+{
+    double start, boxes_time, shards_time;
+    int num_shards, num_threads, i;
+    bench_thread_t *threads;
+    long n, mismatches;
+    shards_t shards;
+    boxes_t boxes;
+    box_t *input;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_shards  = (argc > 1) ? atoi(argv[1]) : 16;
+    num_threads = (argc > 2) ? atoi(argv[2]) : 16;
+
+    /* skewed sides, to exercise the rebalance */
+    input = malloc(n * sizeof(*input));
+    for (i = 0; i < n; ++i) {
+        input[i].side   = (i % 2) ? bench_random_dim(10) :
+                                    bench_random_dim(1000);
+        input[i].height = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes);
+    shards_init(&shards, num_shards);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+        shards_insertbox(&shards, input[i].side, input[i].height);
+    }
+    mismatches = bench_shards_compare(&boxes, &shards, 10000);
+
+    for (i = 0; i < n; i += 2) {
+        mismatches += REMOVEBOX(&boxes, input[i].side, input[i].height) !=
+                      shards_removebox(&shards, input[i].side,
+                                       input[i].height);
+    }
+    mismatches += bench_shards_compare(&boxes, &shards, 10000);
+
+    boxes_cleanup(&boxes);
+    shards_cleanup(&shards);
+    free(input);
+
+    if (mismatches) {
+        printf("shards failed: %ld results differ from boxes\n", mismatches);
+        return -1;
+    }
+
+    threads = calloc(num_threads, sizeof(*threads));
+
+    boxes_init_concurrent(&boxes);
+    for (i = 0; i < num_threads; ++i) {
+        threads[i].boxes   = &boxes;
+        threads[i].seed    = i + 1;
+        threads[i].num_ops = n / num_threads;
+    }
+    start = util_now();
+    bench_run_threads(threads, num_threads, bench_shards_thread);
+    boxes_time = util_now() - start;
+    boxes_cleanup(&boxes);
+
+    shards_init(&shards, num_shards);
+    for (i = 0; i < num_threads; ++i) {
+        threads[i].shards  = &shards;
+        threads[i].seed    = i + 1;
+    }
+    start = util_now();
+    bench_run_threads(threads, num_threads, bench_shards_thread);
+    shards_time = util_now() - start;
+    shards_cleanup(&shards);
+
+    free(threads);
+
+    printf("boxes: %ld, shards: %d, threads: %d\n", n, num_shards,
+           num_threads);
+    printf("boxes INSERTBOX:  %10.1f ns/op\n", boxes_time * 1e9 / n);
+    printf("shards INSERTBOX: %10.1f ns/op\n", shards_time * 1e9 / n);
+    return 0;
+}
+
+/* compare GETBOX and CHECKBOX of a snapshot to the results recorded when it
+ * was taken
+ */
+static long bench_snapshot_compare(const boxes_snapshot_t *snapshot,
+                                   const box_t *queries, const int *rets,
+                                   const box_t *found, long num_queries)
+{
+    float found_side, found_height;
+    long i, mismatches;
+    int ret;
+
+    mismatches = 0;
+    for (i = 0; i < num_queries; ++i) {
+        ret = boxes_snapshot_getbox(snapshot, queries[i].side,
+                                    queries[i].height, &found_side,
+                                    &found_height);
+        mismatches += (ret != rets[2 * i]) ||
+                      (!ret && ((found_side != found[i].side) ||
+                                (found_height != found[i].height)));
+        mismatches += boxes_snapshot_checkbox(snapshot, queries[i].side,
+                                              queries[i].height) !=
+                      rets[2 * i + 1];
+    }
+    return mismatches;
+}
+
+/*
+ * check that a snapshot keeps its results while the boxes are updated, and
+ * measure taking a snapshot against copying the boxes, and the cost of
+ * keeping snapshots on INSERTBOX and REMOVEBOX
+ */
+static int bench_snapshot(int argc, char *argv[])
+{
+    double start, plain_time, versioned_time, snapshot_time, copy_time;
+    long n, i, num_queries, mismatches;
+    boxes_snapshot_t snapshot;
+    box_t *input, *queries, *found, *collected;
+    boxes_t boxes, copy;
+    size_t num_collected;
+    int *rets;
+
+    n           = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_queries = (argc > 1) ? atol(argv[1]) : 10000;
+
+    input = malloc(n * sizeof(*input));
+    for (i = 0; i < n; ++i) {
+        input[i].side   = bench_random_dim(1000);
+        input[i].height = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes);
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+    }
+    for (i = 0; i < n; i += 2) {
+        REMOVEBOX(&boxes, input[i].side, input[i].height);
+    }
+    plain_time = util_now() - start;
+    boxes_cleanup(&boxes);
+
+    boxes_init(&boxes);
+    boxes_enable_snapshots(&boxes);
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+    }
+    for (i = 0; i < n; i += 2) {
+        REMOVEBOX(&boxes, input[i].side, input[i].height);
+    }
+    versioned_time = util_now() - start;
+
+    /* record the results at the time of the snapshot */
+    queries = malloc(num_queries * sizeof(*queries));
+    found   = malloc(num_queries * sizeof(*found));
+    rets    = malloc(2 * num_queries * sizeof(*rets));
+    for (i = 0; i < num_queries; ++i) {
+        queries[i].side   = bench_random_dim(1000);
+        queries[i].height = bench_random_dim(1000);
+        rets[2 * i]     = GETBOX(&boxes, queries[i].side, queries[i].height,
+                                 &found[i].side, &found[i].height);
+        rets[2 * i + 1] = CHECKBOX(&boxes, queries[i].side,
+                                   queries[i].height);
+    }
+
+    start = util_now();
+    boxes_snapshot(&boxes, &snapshot);
+    snapshot_time = util_now() - start;
+
+    start = util_now();
+    boxes_collect(&boxes, &collected, &num_collected);
+    boxes_init(&copy);
+    boxes_bulk_load(&copy, collected, num_collected);
+    copy_time = util_now() - start;
+    boxes_cleanup(&copy);
+    free(collected);
+
+    mismatches = bench_snapshot_compare(&snapshot, queries, rets, found,
+                                        num_queries);
+
+    /* change the boxes under the snapshot */
+    for (i = 0; i < n; i += 2) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+    }
+    for (i = 1; i < n; i += 4) {
+        REMOVEBOX(&boxes, input[i].side, input[i].height);
+    }
+    mismatches += bench_snapshot_compare(&snapshot, queries, rets, found,
+                                         num_queries);
+
+    /* the snapshot outlives the boxes */
+    boxes_cleanup(&boxes);
+    mismatches += bench_snapshot_compare(&snapshot, queries, rets, found,
+                                         num_queries);
+    boxes_snapshot_release(&snapshot);
+
+    free(rets);
+    free(found);
+    free(queries);
+    free(input);
+
+    if (mismatches) {
+        printf("snapshot failed: %ld results differ\n", mismatches);
+        return -1;
+    }
+
+    printf("boxes: %ld, backend: %s\n", n, BENCH_TREE_BACKEND);
+    printf("update:             %10.1f ns/op\n",
+           plain_time * 1e9 / (n + n / 2));
+    printf("update, snapshots:  %10.1f ns/op\n",
+           versioned_time * 1e9 / (n + n / 2));
+    printf("snapshot:           %10.1f us\n", snapshot_time * 1e6);
+    printf("copy:               %10.1f us\n", copy_time * 1e6);
+    return 0;
+}
+
+/* compare GETBOX and CHECKBOX of random queries on boxes and on an image */
+static long bench_image_compare(boxes_t *boxes, const image_t *image,
+                                long num_queries)
+{
+    float side, height, side1, height1, side2, height2;
+    long i, mismatches;
+    int ret1, ret2;
+
+    mismatches = 0;
+    for (i = 0; i < num_queries; ++i) {
+        side   = bench_random_dim(1000);
+        height = bench_random_dim(1000);
+        ret1 = GETBOX(boxes, side, height, &side1, &height1);
+        ret2 = image_getbox(image, side, height, &side2, &height2);
+        mismatches += (ret1 != ret2) ||
+                      (!ret1 && ((side1 != side2) || (height1 != height2)));
+        mismatches += CHECKBOX(boxes, side, height) !=
+                      image_checkbox(image, side, height);
+    }
+    return mismatches;
+}
+
+/*
+ * save random boxes to an image, check that the image and the boxes loaded
+ * from it give the same results, and measure the time to the first query
+ * after a restart: mapping the image, loading it, or inserting the boxes
+ */
+static int bench_image(int argc, char *argv[])
+{
+    double start, save_time, open_time, load_time, insert_time;
+    float found_side, found_height;
+    box_t *input, *all1, *all2;
+    boxes_t boxes, loaded;
+    long n, i, mismatches;
+    const char *path;
+    size_t n1, n2;
+    image_t image;
+
+    n    = (argc > 0) ? atol(argv[0]) : 1000000;
+    path = (argc > 1) ? argv[1] : "bench.img";
+
+    input = malloc(n * sizeof(*input));
+    for (i = 0; i < n; ++i) {
+        input[i].side   = bench_random_dim(1000);
+        input[i].height = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes);
+    start = util_now();
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes, input[i].side, input[i].height);
+    }
+    GETBOX(&boxes, 500, 500, &found_side, &found_height);
+    insert_time = util_now() - start;
+
+    start = util_now();
+    if (boxes_save(&boxes, path)) {
+        perror("boxes_save");
+        return -1;
+    }
+    save_time = util_now() - start;
+
+    start = util_now();
+    if (image_open(&image, path)) {
+        perror("image_open");
+        return -1;
+    }
+    image_getbox(&image, 500, 500, &found_side, &found_height);
+    open_time = util_now() - start;
+
+    boxes_init(&loaded);
+    start = util_now();
+    if (boxes_load(&loaded, path)) {
+        perror("boxes_load");
+        return -1;
+    }
+    GETBOX(&loaded, 500, 500, &found_side, &found_height);
+    load_time = util_now() - start;
+
+    mismatches  = bench_image_compare(&boxes, &image, 100000);
+    mismatches += bench_image_compare(&loaded, &image, 100000);
+
+    /* the loaded boxes have the same refcounts */
+    for (i = 0; i < n; i += 2) {
+        mismatches += REMOVEBOX(&boxes, input[i].side, input[i].height) !=
+                      REMOVEBOX(&loaded, input[i].side, input[i].height);
+    }
+    boxes_collect(&boxes, &all1, &n1);
+    boxes_collect(&loaded, &all2, &n2);
+    mismatches += (n1 != n2) || memcmp(all1, all2, n1 * sizeof(*all1));
+    free(all2);
+    free(all1);
+
+    image_close(&image);
+    boxes_cleanup(&loaded);
+    boxes_cleanup(&boxes);
+    unlink(path);
+    free(input);
+
+    if (mismatches) {
+        printf("image failed: %ld results differ\n", mismatches);
+        return -1;
+    }
+
+    printf("boxes: %ld, backend: %s, image: %s\n", n, BENCH_TREE_BACKEND,
+           path);
+    printf("save:              %10.2f ms\n", save_time * 1e3);
+    printf("first query after:\n");
+    printf("  image_open:      %10.2f ms\n", open_time * 1e3);
+    printf("  boxes_load:      %10.2f ms\n", load_time * 1e3);
+    printf("  INSERTBOX:       %10.2f ms\n", insert_time * 1e3);
+    return 0;
+}
+
+/* compare all the boxes, with their refcounts */
+static long bench_compare_collected(boxes_t *boxes1, boxes_t *boxes2)
+{
+    box_t *all1, *all2;
+    size_t n1, n2;
+    long mismatches;
+
+    boxes_collect(boxes1, &all1, &n1);
+    boxes_collect(boxes2, &all2, &n2);
+    mismatches = (n1 != n2) || memcmp(all1, all2, n1 * sizeof(*all1));
+    free(all2);
+    free(all1);
+    return mismatches;
+}
+
+/* recover boxes from the log and image, and compare them to 'boxes' */
+static long bench_wal_recover(boxes_t *boxes, const char *image_path,
+                              const char *log_path, double *time_p)
+{
+    wal_config_t config;
+    boxes_t recovered;
+    long mismatches;
+    double start;
+    wal_t wal;
+
+    wal_config_default(&config);
+    config.is_async           = 1;
+    config.group_delay_ms     = 0;
+    config.checkpoint_records = 0;
+
+    boxes_init(&recovered);
+    start = util_now();
+    if (wal_open(&wal, &recovered, image_path, log_path, &config)) {
+        perror("wal_open");
+        boxes_cleanup(&recovered);
+        return 1;
+    }
+    *time_p = util_now() - start;
+
+    mismatches = bench_compare_collected(boxes, &recovered);
+    wal_close(&wal);
+    boxes_cleanup(&recovered);
+    return mismatches;
+}
+
+/* insert random boxes, each durable when INSERTBOX returns */
+static void *bench_wal_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+    long i;
+
+    for (i = 0; i < t->num_ops; ++i) {
+        INSERTBOX(t->boxes, bench_thread_random_dim(&t->seed, 1000),
+                  bench_thread_random_dim(&t->seed, 1000));
+    }
+    return NULL;
+}
+
+/*
+ * measure INSERTBOX with an async write-ahead log, for several group sizes,
+ * and with a durable one, for several threads whose updates are synced
+ * together. then check that recovering from the image and the log of random
+ * updates (with checkpoints, and a torn record at the end) gives the same
+ * boxes
+ */
+static int bench_wal(int argc, char *argv[])
+{
+    static const size_t group_sizes[] = {1, 16, 256, 4096};
+    static const int thread_counts[] = {1, 4, 16};
+    double start, elapsed, recover_time;
+    char image_path[256], log_path[256];
+    bench_thread_t threads[16];
+    const char *prefix;
+    wal_config_t config;
+    long n, num_ops, i, mismatches;
+    wal_record_t torn;
+    boxes_t boxes;
+    size_t g;
+    wal_t wal;
+    int fd, t;
+
+    n      = (argc > 0) ? atol(argv[0]) : 1000000;
+    prefix = (argc > 1) ? argv[1] : "bench";
+    snprintf(image_path, sizeof(image_path), "%s.img", prefix);
+    snprintf(log_path, sizeof(log_path), "%s.log", prefix);
+
+    printf("boxes: %ld, log: %s\n", n, log_path);
+    printf("%10s %14s\n", "async group", "insert ns/op");
+    for (g = 0; g < sizeof(group_sizes) / sizeof(group_sizes[0]); ++g) {
+        unlink(image_path);
+        unlink(log_path);
+
+        wal_config_default(&config);
+        config.is_async           = 1;
+        config.group_size         = group_sizes[g];
+        config.checkpoint_records = 0;
+
+        /* syncing every update is too slow for all of them */
+        num_ops = (group_sizes[g] < 256) ? n / 100 : n;
+
+        boxes_init(&boxes);
+        if (wal_open(&wal, &boxes, image_path, log_path, &config)) {
+            perror("wal_open");
+            return -1;
+        }
+        start = util_now();
+        for (i = 0; i < num_ops; ++i) {
+            INSERTBOX(&boxes, bench_random_dim(1000), bench_random_dim(1000));
+        }
+        wal_sync(&wal);
+        elapsed = util_now() - start;
+        wal_close(&wal);
+        boxes_cleanup(&boxes);
+
+        printf("%10zu %14.1f\n", group_sizes[g], elapsed * 1e9 / num_ops);
+    }
+
+    /* every update waits for its sync, which is shared by the updates of
+     * the other threads
+     */
+    printf("%10s %14s %14s\n", "durable threads", "insert ns/op",
+           "records/sync");
+    for (g = 0; g < sizeof(thread_counts) / sizeof(thread_counts[0]); ++g) {
+        unlink(image_path);
+        unlink(log_path);
+
+        wal_config_default(&config);
+        config.checkpoint_records = 0;
+        num_ops = n / 100 / thread_counts[g] + 1;
+
+        boxes_init_concurrent(&boxes);
+        if (wal_open(&wal, &boxes, image_path, log_path, &config)) {
+            perror("wal_open");
+            return -1;
+        }
+        for (t = 0; t < thread_counts[g]; ++t) {
+            threads[t].boxes   = &boxes;
+            threads[t].seed    = t + 1;
+            threads[t].num_ops = num_ops;
+        }
+        start = util_now();
+        bench_run_threads(threads, thread_counts[g], bench_wal_thread);
+        elapsed = util_now() - start;
+        num_ops *= thread_counts[g];
+
+        printf("%10d %14.1f %14.1f\n", thread_counts[g],
+               elapsed * 1e9 / num_ops,
+               (double)num_ops / (wal.num_syncs ? wal.num_syncs : 1));
+        wal_close(&wal);
+        boxes_cleanup(&boxes);
+    }
+
+    /* random updates with checkpoints. after wal_sync() there are no
+     * records for the group thread to sync, so the files do not change
+     * while recovering from them
+     */
+    unlink(image_path);
+    unlink(log_path);
+    wal_config_default(&config);
+    config.is_async           = 1;
+    config.group_delay_ms     = 0;
+    config.checkpoint_records = n / 4 + 1;
+
+    boxes_init(&boxes);
+    if (wal_open(&wal, &boxes, image_path, log_path, &config)) {
+        perror("wal_open");
+        return -1;
+    }
+    for (i = 0; i < n; ++i) {
+        if (random() % 4) {
+            INSERTBOX(&boxes, bench_random_dim(100), bench_random_dim(100));
+        } else {
+            REMOVEBOX(&boxes, bench_random_dim(100), bench_random_dim(100));
+        }
+    }
+    if (wal_sync(&wal)) {
+        perror("wal_sync");
+        return -1;
+    }
+    mismatches = bench_wal_recover(&boxes, image_path, log_path,
+                                   &recover_time);
+
+    /* a crash in the middle of writing a record */
+    memset(&torn, 0xff, sizeof(torn));
+    fd = open(log_path, O_WRONLY | O_APPEND);
+    if (fd >= 0) {
+        mismatches += write(fd, &torn, sizeof(torn) / 2) < 0;
+        close(fd);
+    }
+    mismatches += bench_wal_recover(&boxes, image_path, log_path,
+                                    &elapsed);
+
+    wal_close(&wal);
+    boxes_cleanup(&boxes);
+    unlink(image_path);
+    unlink(log_path);
+
+    if (mismatches) {
+        printf("wal failed: the recovered boxes differ\n");
+        return -1;
+    }
+    printf("recover %ld updates: %.2f ms\n", n, recover_time * 1e3);
+    return 0;
+}
+
+/*
+ * fill two copies of the index with the same random boxes, then take the
+ * minimal box fitting random queries from one with GETBOX and REMOVEBOX, and
+ * from the other with boxes_take_best_fit, checking both take the same boxes
+ */
+static int bench_take(int argc, char *argv[])
+{
+    double start, rounds_time, take_time;
+    float *dims, *queries, *found1, *found2;
+    long n, i, num_ops, found;
+    boxes_t boxes1, boxes2;
+
+    n       = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_ops = (argc > 1) ? atol(argv[1]) : 100000;
+
+    dims = malloc(2 * n * sizeof(*dims));
+    for (i = 0; i < 2 * n; ++i) {
+        dims[i] = bench_random_dim(1000);
+    }
+    queries = malloc(2 * num_ops * sizeof(*queries));
+    for (i = 0; i < 2 * num_ops; ++i) {
+        queries[i] = bench_random_dim(1000);
+    }
+    found1 = calloc(2 * num_ops, sizeof(*found1));
+    found2 = calloc(2 * num_ops, sizeof(*found2));
+
+    boxes_init(&boxes1);
+    boxes_init(&boxes2);
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(&boxes1, dims[2 * i], dims[2 * i + 1]);
+        INSERTBOX(&boxes2, dims[2 * i], dims[2 * i + 1]);
+    }
+
+    found = 0;
+    start = util_now();
+    for (i = 0; i < num_ops; ++i) {
+        if (!GETBOX(&boxes1, queries[2 * i], queries[2 * i + 1],
+                    &found1[2 * i], &found1[2 * i + 1])) {
+            REMOVEBOX(&boxes1, found1[2 * i], found1[2 * i + 1]);
+            ++found;
+        }
+    }
+    rounds_time = util_now() - start;
+
+    start = util_now();
+    for (i = 0; i < num_ops; ++i) {
+        boxes_take_best_fit(&boxes2, queries[2 * i], queries[2 * i + 1],
+                            &found2[2 * i], &found2[2 * i + 1]);
+    }
+    take_time = util_now() - start;
+
+    if (memcmp(found1, found2, 2 * num_ops * sizeof(*found1)) ||
+        bench_compare_collected(&boxes1, &boxes2)) {
+        printf("take failed: the boxes differ from GETBOX and REMOVEBOX\n");
+        return -1;
+    }
+
+    printf("boxes: %ld, ops: %ld, taken: %ld\n", n, num_ops, found);
+    printf("GETBOX+REMOVEBOX: %10.1f ns/op\n", rounds_time * 1e9 / num_ops);
+    printf("take best fit:    %10.1f ns/op\n", take_time * 1e9 / num_ops);
+
+    boxes_cleanup(&boxes2);
+    boxes_cleanup(&boxes1);
+    free(found2);
+    free(found1);
+    free(queries);
+    free(dims);
+    return 0;
+}
+
+/* fill a single side with 'n' heights and remove the upper half of them,
+ * then measure INSERTBOX and REMOVEBOX of a lower box of the side, and GETBOX
+ * of the side, which would walk over all the tombstones if they were not
+ * skipped */
+static double bench_churn_side(boxes_t *boxes, long n, long num_ops,
+                               float *found)
+{
+    double start;
+    long i;
+
+    for (i = 0; i < n; ++i) {
+        INSERTBOX(boxes, 1, 1 + i / 100.0);
+    }
+    for (i = n / 2; i < n; ++i) {
+        REMOVEBOX(boxes, 1, 1 + i / 100.0);
+    }
+
+    start = util_now();
+    for (i = 0; i < num_ops; ++i) {
+        INSERTBOX(boxes, 1, 0.5);
+        REMOVEBOX(boxes, 1, 0.5);
+        GETBOX(boxes, 1, 1 + (i % n) / 100.0, &found[2 * i],
+               &found[2 * i + 1]);
+    }
+    return util_now() - start;
+}
+
+/* remove each box and insert it back, or insert a fresh box instead, into
+ * boxes without and with tombstones, and GETBOX on the result */
+static int bench_churn(int argc, char *argv[])
+{
+    double start, flap_time[2], replace_time[2], getbox_time[2], side_time[2];
+    float *dims, *live, *fresh, *queries, *found[2];
+    long n, i, j, num_ops;
+    double ratio;
+    boxes_t boxes[2];
+    int b;
+
+    n       = (argc > 0) ? atol(argv[0]) : 1000000;
+    num_ops = (argc > 1) ? atol(argv[1]) : 1000000;
+    ratio   = (argc > 2) ? atof(argv[2]) : 0.25;
+    if (n < 1 || !(ratio > 0 && ratio <= 1)) {
+        printf("churn needs num_boxes > 0 and a ratio in (0,1]\n");
+        return -1;
+    }
+
+    dims = malloc(2 * n * sizeof(*dims));
+    for (i = 0; i < 2 * n; ++i) {
+        dims[i] = bench_random_dim(1000);
+    }
+    live  = malloc(2 * n * sizeof(*live));
+    fresh = malloc(2 * num_ops * sizeof(*fresh));
+    for (i = 0; i < 2 * num_ops; ++i) {
+        fresh[i] = bench_random_dim(1000);
+    }
+    queries = malloc(2 * num_ops * sizeof(*queries));
+    for (i = 0; i < 2 * num_ops; ++i) {
+        queries[i] = bench_random_dim(1000);
+    }
+
+    boxes_init(&boxes[0]);
+    boxes_init(&boxes[1]);
+    if (boxes_enable_tombstones(&boxes[1], ratio)) {
+        printf("churn failed: cannot enable tombstones: %m\n");
+        return -1;
+    }
+
+    for (b = 0; b < 2; ++b) {
+        memcpy(live, dims, 2 * n * sizeof(*live));
+        for (i = 0; i < n; ++i) {
+            INSERTBOX(&boxes[b], live[2 * i], live[2 * i + 1]);
+        }
+
+        /* the refcount of a box drops to 0 and comes back */
+        start = util_now();
+        for (i = 0; i < num_ops; ++i) {
+            j = i % n;
+            REMOVEBOX(&boxes[b], live[2 * j], live[2 * j + 1]);
+            INSERTBOX(&boxes[b], live[2 * j], live[2 * j + 1]);
+        }
+        flap_time[b] = util_now() - start;
+
+        /* the removed boxes do not come back */
+        start = util_now();
+        for (i = 0; i < num_ops; ++i) {
+            j = i % n;
+            REMOVEBOX(&boxes[b], live[2 * j], live[2 * j + 1]);
+            INSERTBOX(&boxes[b], fresh[2 * i], fresh[2 * i + 1]);
+            live[2 * j]     = fresh[2 * i];
+            live[2 * j + 1] = fresh[2 * i + 1];
+        }
+        replace_time[b] = util_now() - start;
+
+        found[b] = calloc(2 * num_ops, sizeof(*found[b]));
+        start = util_now();
+        for (i = 0; i < num_ops; ++i) {
+            GETBOX(&boxes[b], queries[2 * i], queries[2 * i + 1],
+                   &found[b][2 * i], &found[b][2 * i + 1]);
+        }
+        getbox_time[b] = util_now() - start;
+    }
+
+    if (memcmp(found[0], found[1], 2 * num_ops * sizeof(*found[0])) ||
+        bench_compare_collected(&boxes[0], &boxes[1])) {
+        printf("churn failed: the boxes differ with tombstones\n");
+        return -1;
+    }
+
+    printf("boxes: %ld, ops: %ld, tombstones: %zu of %zu heights\n", n,
+           num_ops, boxes[1].num_tombstones, boxes[1].num_heights);
+    if (boxes_compact(&boxes[1]) ||
+        bench_compare_collected(&boxes[0], &boxes[1])) {
+        printf("churn failed: the boxes differ after compaction\n");
+        return -1;
+    }
+
+    for (b = 0; b < 2; ++b) {
+        boxes_cleanup(&boxes[b]);
+        boxes_init(&boxes[b]);
+    }
+    boxes_enable_tombstones(&boxes[1], ratio);
+    for (b = 0; b < 2; ++b) {
+        side_time[b] = bench_churn_side(&boxes[b], n, num_ops, found[b]);
+    }
+    if (memcmp(found[0], found[1], 2 * num_ops * sizeof(*found[0])) ||
+        bench_compare_collected(&boxes[0], &boxes[1])) {
+        printf("churn failed: a side differs with tombstones\n");
+        return -1;
+    }
+
+    printf("%-22s %12s %12s\n", "ns/op", "plain", "tombstones");
+    printf("%-22s %12.1f %12.1f\n", "REMOVEBOX+INSERTBOX",
+           flap_time[0] * 1e9 / num_ops, flap_time[1] * 1e9 / num_ops);
+    printf("%-22s %12.1f %12.1f\n", "REMOVEBOX+new box",
+           replace_time[0] * 1e9 / num_ops, replace_time[1] * 1e9 / num_ops);
+    printf("%-22s %12.1f %12.1f\n", "GETBOX",
+           getbox_time[0] * 1e9 / num_ops, getbox_time[1] * 1e9 / num_ops);
+    printf("%-22s %12.1f %12.1f\n", "one side, half removed",
+           side_time[0] * 1e9 / num_ops, side_time[1] * 1e9 / num_ops);
+
+    boxes_cleanup(&boxes[1]);
+    boxes_cleanup(&boxes[0]);
+    free(found[1]);
+    free(found[0]);
+    free(queries);
+    free(fresh);
+    free(live);
+    free(dims);
+    return 0;
+}
+
+/* parse the arguments of a workload: <dist> <mix> [num_boxes] [num_ops]
+ * [seed] */
+static int bench_workload_config(int argc, char *argv[],
+                                 workload_config_t *config)
+{
+    int dist, mix;
+
+    workload_config_default(config);
+    if (argc < 2) {
+        printf("missing distribution and mix\n");
+        return -1;
+    }
+
+    dist = workload_dist_parse(argv[0]);
+    mix  = workload_mix_parse(argv[1]);
+    if ((dist < 0) || (mix < 0)) {
+        printf("unknown workload '%s %s': distributions are uniform, zipf "
+               "and clustered, mixes are insert, query and churn\n",
+               argv[0], argv[1]);
+        return -1;
+    }
+
+    config->dist = dist;
+    config->mix  = mix;
+    if (argc > 2) {
+        config->num_boxes = strtoull(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        config->num_ops = strtoull(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        config->seed = strtoull(argv[4], NULL, 0);
+    }
+    return 0;
+}
+
+/*
+ * write the commands of a workload to stdout, as a command file for boxes
+ */
+static int bench_gen(int argc, char *argv[])
+{
+    static const char *names[] = {"INSERTBOX", "REMOVEBOX", "GETBOX",
+                                  "CHECKBOX"};
+    workload_config_t config;
+    workload_t workload;
+    command_t command;
+
+    if (bench_workload_config(argc, argv, &config)) {
+        return -1;
+    }
+    if (workload_init(&workload, &config)) {
+        printf("failed to initialize the workload: %m\n");
+        return -1;
+    }
+
+    while (workload_next(&workload, &command)) {
+        printf("%s(%.2f,%.2f)\n", names[command.type], command.arg1,
+               command.arg2);
+    }
+
+    workload_cleanup(&workload);
+    return 0;
+}
+
+/* commands of a workload which are generated at once, and then run */
+#define BENCH_WORKLOAD_CHUNK    65536
+
+/*
+ * run a workload: insert the boxes, then measure the throughput and latency
+ * percentiles of every command of the mix, and the peak RSS. latencies
+ * include the ~20ns of reading the clock.
+ */
+static int bench_workload(int argc, char *argv[])
+{
+    static const char *names[] = {"INSERTBOX", "REMOVEBOX", "GETBOX",
+                                  "CHECKBOX"};
+    static stats_histogram_t histograms[4];
+    const stats_histogram_t *histogram;
+    uint64_t num_ops, fill_ns, mix_ns, start, end;
+    float found_side, found_height;
+    workload_config_t config;
+    command_t *commands;
+    workload_t workload;
+    struct rusage usage;
+    boxes_t boxes;
+    size_t n, i;
+    int type;
+
+    if (bench_workload_config(argc, argv, &config)) {
+        return -1;
+    }
+    if (workload_init(&workload, &config)) {
+        printf("failed to initialize the workload: %m\n");
+        return -1;
+    }
+
+    commands = malloc(BENCH_WORKLOAD_CHUNK * sizeof(*commands));
+    boxes_init(&boxes);
+
+    fill_ns = 0;
+    mix_ns  = 0;
+    num_ops = 0;
+    do {
+        for (n = 0; n < BENCH_WORKLOAD_CHUNK; ++n) {
+            if (!workload_next(&workload, &commands[n])) {
+                break;
+            }
+        }
+
+        for (i = 0; i < n; ++i, ++num_ops) {
+            start = util_now_ns();
+            switch (commands[i].type) {
+            case COMMAND_INSERTBOX:
+                INSERTBOX(&boxes, commands[i].arg1, commands[i].arg2);
+                break;
+            case COMMAND_REMOVEBOX:
+                REMOVEBOX(&boxes, commands[i].arg1, commands[i].arg2);
+                break;
+            case COMMAND_GETBOX:
+                GETBOX(&boxes, commands[i].arg1, commands[i].arg2,
+                       &found_side, &found_height);
+                break;
+            default:
+                CHECKBOX(&boxes, commands[i].arg1, commands[i].arg2);
+                break;
+            }
+            end = util_now_ns();
+
+            if (num_ops < config.num_boxes) {
+                fill_ns += end - start;
+            } else {
+                mix_ns += end - start;
+                stats_histogram_record(&histograms[commands[i].type],
+                                       end - start);
+            }
+        }
+    } while (n == BENCH_WORKLOAD_CHUNK);
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("workload: %s %s, backend: %s, boxes: %llu, ops: %llu, "
+           "seed: %llu\n", workload_dist_name(config.dist),
+           workload_mix_name(config.mix), BENCH_TREE_BACKEND,
+           (unsigned long long)config.num_boxes,
+           (unsigned long long)config.num_ops,
+           (unsigned long long)config.seed);
+    if (config.num_boxes) {
+        printf("fill:      %12.0f ops/sec\n",
+               config.num_boxes * 1e9 / (fill_ns ? fill_ns : 1));
+    }
+    printf("%-9s %12s %12s %10s %10s %10s\n", "command", "count",
+           "ops/sec", "p50 ns", "p99 ns", "p99.9 ns");
+    for (type = 0; type < 4; ++type) {
+        histogram = &histograms[type];
+        if (histogram->count == 0) {
+            continue;
+        }
+        printf("%-9s %12llu %12.0f %10llu %10llu %10llu\n", names[type],
+               (unsigned long long)histogram->count,
+               histogram->count * 1e9 / (histogram->sum ? histogram->sum : 1),
+               (unsigned long long)stats_histogram_percentile(histogram, 50),
+               (unsigned long long)stats_histogram_percentile(histogram, 99),
+               (unsigned long long)stats_histogram_percentile(histogram,
+                                                              99.9));
+    }
+    if (config.num_ops) {
+        printf("mix:       %12.0f ops/sec\n",
+               config.num_ops * 1e9 / (mix_ns ? mix_ns : 1));
+    }
+    printf("peak RSS:  %12.1f MB\n", usage.ru_maxrss / 1024.0);
+
+    boxes_cleanup(&boxes);
+    workload_cleanup(&workload);
+    free(commands);
+    return 0;
+}
+
+static const bench_t benchmarks[] = {
+    {"search", "[max_keys]", bench_search},
+    {"getbox", "[num_boxes] [num_queries]", bench_getbox},
+    {"topk", "[num_boxes] [k] [num_queries]", bench_topk},
+    {"take", "[num_boxes] [num_ops]", bench_take},
+    {"churn", "[num_boxes] [num_ops] [tombstone_ratio]", bench_churn},
+    {"update", "[num_boxes] [count]", bench_update},
+    {"batch", "[num_boxes] [num_queries]", bench_batch},
+    {"load", "[num_boxes]", bench_load},
+    {"tree", "[num_keys]", bench_tree},
+    {"volume", "[num_boxes]", bench_volume},
+    {"parse", "[num_lines]", bench_parse},
+    {"output", "[num_results]", bench_output},
+    {"concurrent", "[num_boxes] [max_threads] [write_percent]",
+     bench_concurrent},
+    {"stress", "[num_threads] [num_ops]", bench_stress},
+    {"shards", "[num_boxes] [num_shards] [num_threads]", bench_shards},
+    {"snapshot", "[num_boxes] [num_queries]", bench_snapshot},
+    {"image", "[num_boxes] [path]", bench_image},
+    {"wal", "[num_updates] [path-prefix]", bench_wal},
+    {"workload", "<uniform|zipf|clustered> <insert|query|churn> [num_boxes] "
+     "[num_ops] [seed]", bench_workload},
+    {"gen", "<uniform|zipf|clustered> <insert|query|churn> [num_boxes] "
+     "[num_ops] [seed]", bench_gen},
+    {NULL}
+};
+
+int main(int argc, char *argv[])
+{
+    const bench_t *bench;
+
+    if (argc >= 2) {
+        for (bench = benchmarks; bench->name != NULL; ++bench) {
+            if (!strcmp(argv[1], bench->name)) {
+                srandom(1);
+                return bench->func(argc - 2, argv + 2);
+            }
+        }
+    }
+
+    printf("Usage: %s <benchmark> [args]\n", argv[0]);
+    for (bench = benchmarks; bench->name != NULL; ++bench) {
+        printf("    %s %s\n", bench->name, bench->usage);
+    }
+    return -1;
+}
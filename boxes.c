@@ -1,149 +1,1884 @@
 #include "boxes.h"
 #include "util.h"
+#include "volume.h"
+#include "image.h"
+#include "wal.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <math.h>
+#include <errno.h>
 
 
-/*insert a box with given side length and height length to a given box tree
+/* number of objects in each slab of the boxes pools */
+#define BOXES_POOL_SLAB_OBJS 1024
+
+/* number of GETBOX candidates whose volumes are compared at once */
+#define BOXES_SCAN_BATCH     16
+
+/* batches with less than one GETBOX query per this many boxes are answered
+ * one query at a time
+ */
+#define BOXES_BATCH_MAX_BOXES_PER_QUERY 32
+
+/* tombstones are not compacted while there are less than this many */
+#define BOXES_COMPACT_MIN_TOMBSTONES    1024
+
+
+/* lock the boxes for a query, if they are concurrent */
+static void boxes_read_lock(boxes_t *boxes)
+{
+    if (boxes->is_concurrent) {
+        pthread_rwlock_rdlock(&boxes->lock);
+    }
+}
+
+/* lock the boxes for an update, if they are concurrent */
+static void boxes_write_lock(boxes_t *boxes)
+{
+    if (boxes->is_concurrent) {
+        pthread_rwlock_wrlock(&boxes->lock);
+    }
+}
+
+static void boxes_unlock(boxes_t *boxes)
+{
+    if (boxes->is_concurrent) {
+        pthread_rwlock_unlock(&boxes->lock);
+    }
+}
+
+/* augmented value of a height node of boxes with tombstones: BOXES_LIVE
+ * unless it is a tombstone, so walks skip whole subtrees of tombstones
+ */
+#define BOXES_LIVE  TREE_KEY_MAX
+
+static tree_key_t boxes_height_augment_cb(tree_value_t value)
+{
+    return (value.count > 0) ? BOXES_LIVE : TREE_KEY_MIN;
+}
+
+static tree_t *boxes_new_height_tree(boxes_t *boxes)
+{
+    tree_t *height_tree;
+
+    height_tree = (tree_t*)pool_alloc(&boxes->tree_pool);
+    if (boxes->max_tombstone_ratio > 0) {
+        tree_init_augmented(height_tree, boxes_height_augment_cb);
+    } else {
+        tree_init(height_tree);
+    }
+    tree_set_pool(height_tree, &boxes->height_node_pool);
+    return height_tree;
+}
+
+/* are box dimensions equal, like the keys of the trees */
+static int boxes_dim_equal(float dim1, float dim2)
+{
+    return tree_key_equal(tree_key_from_float(dim1),
+                          tree_key_from_float(dim2));
+}
+
+/* tree_ub and tree_successor of a height tree, skipping tombstones, see
+ * boxes_enable_tombstones()
+ * time complexity O(log(m))*/
+static int boxes_height_ub(const boxes_t *boxes, const tree_t *height_tree,
+                           tree_key_t height, node_t **node_p)
+{
+    if (boxes->max_tombstone_ratio > 0) {
+        return tree_ub_augmented(height_tree, height, BOXES_LIVE, node_p);
+    }
+    return tree_ub(height_tree, height, node_p);
+}
+
+static int boxes_height_successor(const boxes_t *boxes,
+                                  const tree_t *height_tree, node_t **node_p)
+{
+    if (boxes->max_tombstone_ratio > 0) {
+        return tree_successor_augmented(height_tree, BOXES_LIVE, node_p);
+    }
+    return tree_successor(height_tree, node_p);
+}
+
+/* the maximal height of a side, or TREE_KEY_MIN */
+static tree_key_t boxes_max_height(const tree_t *height_tree)
+{
+    node_t *last;
+
+    if (tree_last(height_tree, &last)) {
+        return TREE_KEY_MIN;
+    }
+    return tree_node_get_key(last);
+}
+
+/* the maximal height of a side which is not a tombstone, or TREE_KEY_MIN */
+static tree_key_t boxes_max_live_height(const tree_t *height_tree)
+{
+    node_t *last;
+
+    if (tree_last_augmented(height_tree, BOXES_LIVE, &last)) {
+        return TREE_KEY_MIN;
+    }
+    return tree_node_get_key(last);
+}
+
+/* the persistent copy of the boxes keeps a persistent height tree of every
+ * side, whose root is the value of the side node
+ */
+static const ptree_ops_t boxes_height_ptree_ops = {NULL, NULL, NULL};
+
+/* augmented value of a persistent side node: the maximal height of the side
+ */
+static tree_key_t boxes_side_ptree_augment_cb(tree_value_t value)
+{
+    const ptree_node_t *last = ptree_last((ptree_node_t*)value.ptr);
+
+    return (last != NULL) ? last->key : TREE_KEY_MIN;
+}
+
+static void boxes_side_ptree_ref_cb(tree_value_t value)
+{
+    ptree_node_ref((ptree_node_t*)value.ptr);
+}
+
+static void boxes_side_ptree_unref_cb(tree_value_t value)
+{
+    ptree_node_unref(&boxes_height_ptree_ops, (ptree_node_t*)value.ptr);
+}
+
+static const ptree_ops_t boxes_side_ptree_ops = {
+    boxes_side_ptree_augment_cb,
+    boxes_side_ptree_ref_cb,
+    boxes_side_ptree_unref_cb
+};
+
+/* change of the count of a box in the persistent copy */
+typedef struct boxes_version_update_s {
+    tree_key_t  height;
+    int64_t     delta;
+} boxes_version_update_t;
+
+static void boxes_version_count_cb(tree_value_t *value, void *arg)
+{
+    value->count += *(int64_t*)arg;
+}
+
+/* update the persistent height tree of a side */
+static void boxes_version_heights_cb(tree_value_t *value, void *arg)
+{
+    boxes_version_update_t *update = arg;
+    const ptree_node_t *height_node;
+    tree_value_t count;
+    ptree_t heights;
+
+    heights.root = (ptree_node_t*)value->ptr;
+    heights.ops  = &boxes_height_ptree_ops;
+
+    height_node = ptree_find(heights.root, update->height);
+    if (height_node == NULL) {
+        count.count = update->delta;
+        ptree_insert(&heights, update->height, count);
+    } else if (height_node->value.count + update->delta == 0) {
+        ptree_delete(&heights, update->height);
+    } else {
+        ptree_update(&heights, update->height, boxes_version_count_cb,
+                     &update->delta);
+    }
+
+    value->ptr = heights.root;
+}
+
+/*add 'delta' to the count of the box with exactly these keys in the
+ * persistent copy, like the boxes were updated
+ * time complexity O(log(n*m))*/
+static void boxes_version_add(boxes_t *boxes, tree_key_t side,
+                              tree_key_t height, int64_t delta)
+{
+    boxes_version_update_t update;
+    const ptree_node_t *side_node;
+    tree_value_t value, count;
+    ptree_t heights;
+
+    if (!boxes->has_snapshots) {
+        return;
+    }
+
+    side_node = ptree_find(boxes->versions.root, side);
+    if (side_node == NULL) {
+        ptree_init(&heights, &boxes_height_ptree_ops);
+        count.count = delta;
+        ptree_insert(&heights, height, count);
+        value.ptr = heights.root;
+        ptree_insert(&boxes->versions, side, value);
+        return;
+    }
+
+    update.height = height;
+    update.delta  = delta;
+    ptree_update(&boxes->versions, side, boxes_version_heights_cb, &update);
+
+    side_node = ptree_find(boxes->versions.root, side);
+    if (side_node->value.ptr == NULL) {
+        ptree_delete(&boxes->versions, side);
+    }
+}
+
+/*add a box, which is new or was a tombstone, to the range tree. if out of
+ * memory, the range tree is dropped, and GETBOX scans the sides instead.
+ * time complexity O(log(N)^2), amortized*/
+static void boxes_volumes_insert(boxes_t *boxes, tree_key_t side,
+                                 tree_key_t height)
+{
+    if (boxes->has_volumes && vtree_insert(&boxes->volumes, side, height)) {
+        vtree_cleanup(&boxes->volumes);
+        boxes->has_volumes = 0;
+    }
+}
+
+/*remove a box whose refcount dropped to 0 from the range tree
+ * time complexity O(log(N)^2), amortized*/
+static void boxes_volumes_delete(boxes_t *boxes, tree_key_t side,
+                                 tree_key_t height)
+{
+    if (boxes->has_volumes) {
+        vtree_delete(&boxes->volumes, side, height);
+    }
+}
+
+/*build the range tree of boxes whose trees were built from sorted boxes. a
+ * range tree which was dropped is built again.
+ * time complexity O(N*log(N))*/
+static void boxes_volumes_build(boxes_t *boxes)
+{
+    node_t *side_node, *height_node;
+    tree_t *height_tree;
+    vtree_box_t *all;
+    size_t n;
+
+    vtree_cleanup(&boxes->volumes);
+    boxes->has_volumes = 0;
+    all = malloc((boxes->num_heights + 1) * sizeof(*all));
+    if (all == NULL) {
+        return;
+    }
+
+    n = 0;
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            if (boxes_height_ub(boxes, height_tree, TREE_KEY_MIN,
+                                &height_node)) {
+                continue;
+            }
+            do {
+                all[n].side   = tree_node_get_key(side_node);
+                all[n].height = tree_node_get_key(height_node);
+                ++n;
+            } while (!boxes_height_successor(boxes, height_tree,
+                                             &height_node));
+        } while (!tree_successor(&boxes->sidetree, &side_node));
+    }
+
+    boxes->has_volumes = !vtree_build(&boxes->volumes, all, n);
+    free(all);
+}
+
+/*insert 'n' boxes with given side length and height length to a given box
+ * tree
+ * returns -1 if the refcount of the box would overflow, and nothing is
+ * inserted
  * time complexity O(log(n*m))*/
+static int boxes_insert(boxes_t *boxes, tree_key_t side, tree_key_t height,
+                        uint64_t n)
+{
+    tree_value_t value, count;
+    tree_t *height_tree;
+    node_t *side_node, *height_node;
+    int ret;
+
+    if (n == 0) {
+        return 0;
+    }
+    count.count = n;
+
+    ret = tree_search(&boxes->sidetree, side, &side_node);
+    if (ret) {
+        /* side not found - create new side tree. the height is added before
+         * the side is inserted, since the side tree is augmented by the
+         * maximal height of each side.
+         */
+        height_tree = boxes_new_height_tree(boxes);
+        tree_insert(height_tree, height, count);
+        value.ptr = height_tree;
+        tree_insert(&boxes->sidetree, side, value);
+        ++boxes->num_heights;
+        boxes_version_add(boxes, side, height, n);
+        boxes_volumes_insert(boxes, side, height);
+        return 0;
+    }
+
+    /* side found - check if height exists */
+    side        = tree_node_get_key(side_node);
+    height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+    ret = tree_search(height_tree, height, &height_node);
+    if (!ret) {
+        /* height found - add to refcount */
+        count = tree_node_get_value(height_node);
+        if (count.count > UINT64_MAX - n) {
+            return -1;
+        }
+        count.count += n;
+        tree_node_set_value(height_node, count);
+        if (count.count == n) {
+            /* a tombstone came back, maybe as the maximal height */
+            --boxes->num_tombstones;
+            tree_augment_update(height_tree, height_node);
+            tree_augment_update(&boxes->sidetree, side_node);
+            boxes_volumes_insert(boxes, side,
+                                 tree_node_get_key(height_node));
+        }
+        boxes_version_add(boxes, side, tree_node_get_key(height_node), n);
+        return 0;
+    }
+
+    /* new height, which may be the new maximal height of the side */
+    tree_insert(height_tree, height, count);
+    tree_augment_update(&boxes->sidetree, side_node);
+    ++boxes->num_heights;
+    boxes_version_add(boxes, side, height, n);
+    boxes_volumes_insert(boxes, side, height);
+    return 0;
+}
+
+/*log an update of the boxes, which are locked for writing, and set '*lsn_p'
+ * to its LSN (0 without a log)
+ * returns nonzero if a checkpoint is due after unlocking them*/
+static int boxes_log(boxes_t *boxes, command_type_t command, float side,
+                     float height, uint64_t count, uint64_t *lsn_p)
+{
+    if (boxes->wal == NULL) {
+        *lsn_p = 0;
+        return 0;
+    }
+    return wal_append(boxes->wal, command, side, height, count, lsn_p);
+}
+
+/* wait for the logged update of 'lsn' to be durable, unless the log is
+ * async, and take a checkpoint which is due, with the boxes unlocked */
+static void boxes_commit(boxes_t *boxes, uint64_t lsn, int is_due)
+{
+    /* a failure is returned by the next sync of the log */
+    if ((lsn > 0) && !boxes->wal->config.is_async) {
+        wal_wait(boxes->wal, lsn);
+    }
+    if (is_due) {
+        wal_checkpoint(boxes->wal);
+    }
+}
+
+int INSERTBOX_N(boxes_t *boxes, float side, float height, uint64_t n)
+{
+    uint64_t lsn;
+    int ret, is_due;
+    STATS_TIMER_START(timer);
+
+    lsn    = 0;
+    is_due = 0;
+    boxes_write_lock(boxes);
+    ret = boxes_insert(boxes, tree_key_from_float(side),
+                       tree_key_from_float(height), n);
+    if (!ret && (n > 0)) {
+        is_due = boxes_log(boxes, COMMAND_INSERTBOX, side, height, n,
+                           &lsn);
+    }
+    boxes_unlock(boxes);
+    STATS_TIMER_END(timer, STATS_OP_INSERTBOX);
+    boxes_commit(boxes, lsn, is_due);
+    return ret;
+}
+
 void INSERTBOX(boxes_t *boxes, float side, float height)
 {
-    tree_t *height_tree;
-    node_t *found_node;
-    int *countptr;
+    INSERTBOX_N(boxes, side, height, 1);
+}
+
+/*add all the boxes to the persistent copy
+ * time complexity O(n*log(n))*/
+static void boxes_version_build(boxes_t *boxes)
+{
+    node_t *side_node, *height_node;
+    tree_t *height_tree;
+
+    if (!boxes->has_snapshots ||
+        tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        return;
+    }
+
+    do {
+        height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+        if (boxes_height_ub(boxes, height_tree, TREE_KEY_MIN, &height_node)) {
+            continue;
+        }
+        do {
+            boxes_version_add(boxes, tree_node_get_key(side_node),
+                              tree_node_get_key(height_node),
+                              tree_node_get_value(height_node).count);
+        } while (!boxes_height_successor(boxes, height_tree, &height_node));
+    } while (!tree_successor(&boxes->sidetree, &side_node));
+}
+
+/* order boxes by side, then by height */
+static int boxes_box_cmp(const void *a, const void *b)
+{
+    const box_t *box_a = a, *box_b = b;
+
+    if (box_a->side != box_b->side) {
+        return (box_a->side > box_b->side) - (box_a->side < box_b->side);
+    }
+    return (box_a->height > box_b->height) - (box_a->height < box_b->height);
+}
+
+static int boxes_key_cmp(const void *a, const void *b)
+{
+    tree_key_t ka = *(const tree_key_t*)a, kb = *(const tree_key_t*)b;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/*build the index from an array of boxes
+ * time complexity O(n) for sorted boxes, O(nlog(n)) otherwise*/
+static int boxes_do_bulk_load(boxes_t *boxes, const box_t *input, size_t n)
+{
+    size_t num_sides, max_group, num_heights, i, j, k;
+    tree_value_t *side_values, *height_values;
+    tree_key_t *side_keys, *height_keys;
+    box_t *sorted_copy;
+    const box_t *sorted;
+    tree_t *height_tree;
+    int ret;
+
+    if (!tree_is_empty(&boxes->sidetree)) {
+        for (i = 0; i < n; ++i) {
+            boxes_insert(boxes, tree_key_from_float(input[i].side),
+                         tree_key_from_float(input[i].height), 1);
+        }
+        return 0;
+    }
+
+    ret           = -1;
+    sorted_copy   = NULL;
+    side_keys     = NULL;
+    side_values   = NULL;
+    height_keys   = NULL;
+    height_values = NULL;
+
+    sorted = input;
+    for (i = 1; i < n; ++i) {
+        if (boxes_box_cmp(&input[i - 1], &input[i]) > 0) {
+            sorted_copy = malloc(n * sizeof(*sorted_copy));
+            if (sorted_copy == NULL) {
+                goto out_free;
+            }
+            memcpy(sorted_copy, input, n * sizeof(*sorted_copy));
+            qsort(sorted_copy, n, sizeof(*sorted_copy), boxes_box_cmp);
+            sorted = sorted_copy;
+            break;
+        }
+    }
+
+    /* like INSERTBOX of the sorted boxes, a side within the delta of the
+     * first side of a group joins the group
+     */
+    num_sides = 0;
+    max_group = 0;
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; (j < n) && boxes_dim_equal(sorted[j].side,
+                                                   sorted[i].side); ++j);
+        if (j - i > max_group) {
+            max_group = j - i;
+        }
+        ++num_sides;
+    }
+
+    side_keys     = malloc((num_sides + 1) * sizeof(*side_keys));
+    side_values   = malloc((num_sides + 1) * sizeof(*side_values));
+    height_keys   = malloc((max_group + 1) * sizeof(*height_keys));
+    height_values = malloc((max_group + 1) * sizeof(*height_values));
+    if ((side_keys == NULL) || (side_values == NULL) ||
+        (height_keys == NULL) || (height_values == NULL)) {
+        goto out_free;
+    }
+
+    num_sides = 0;
+    for (i = 0; i < n; i = j) {
+        /* heights of the group, which are only out of order if it has
+         * several distinct sides
+         */
+        for (j = i; (j < n) && boxes_dim_equal(sorted[j].side,
+                                               sorted[i].side); ++j) {
+            height_keys[j - i] = tree_key_from_float(sorted[j].height);
+        }
+        if (sorted[j - 1].side != sorted[i].side) {
+            qsort(height_keys, j - i, sizeof(*height_keys), boxes_key_cmp);
+        }
+
+        /* merge heights within the delta into refcounts */
+        num_heights = 0;
+        for (k = 0; k < j - i; ++k) {
+            if ((num_heights > 0) &&
+                tree_key_equal(height_keys[k],
+                               height_keys[num_heights - 1])) {
+                ++height_values[num_heights - 1].count;
+            } else {
+                height_keys[num_heights]         = height_keys[k];
+                height_values[num_heights].count = 1;
+                ++num_heights;
+            }
+        }
+
+        height_tree = boxes_new_height_tree(boxes);
+        tree_build_sorted(height_tree, height_keys, height_values,
+                          num_heights);
+        boxes->num_heights += num_heights;
+
+        side_keys[num_sides]       = tree_key_from_float(sorted[i].side);
+        side_values[num_sides].ptr = height_tree;
+        ++num_sides;
+    }
+
+    tree_build_sorted(&boxes->sidetree, side_keys, side_values, num_sides);
+    boxes_version_build(boxes);
+    boxes_volumes_build(boxes);
+    ret = 0;
+
+out_free:
+    free(height_values);
+    free(height_keys);
+    free(side_values);
+    free(side_keys);
+    free(sorted_copy);
+    return ret;
+}
+
+int boxes_bulk_load(boxes_t *boxes, const box_t *input, size_t n)
+{
+    uint64_t lsn;
+    size_t i;
+    int ret, is_due;
+
+    boxes_write_lock(boxes);
+    ret = boxes_do_bulk_load(boxes, input, n);
+    lsn    = 0;
+    is_due = 0;
+    for (i = 0; !ret && (i < n); ++i) {
+        is_due |= boxes_log(boxes, COMMAND_INSERTBOX, input[i].side,
+                            input[i].height, 1, &lsn);
+    }
+    boxes_unlock(boxes);
+    boxes_commit(boxes, lsn, is_due);
+    return ret;
+}
+
+int boxes_save(boxes_t *boxes, const char *path)
+{
+    uint8_t *data;
+    size_t size;
+    int ret;
+
+    /* updates wait for the image to be built in memory, not written */
+    boxes_read_lock(boxes);
+    data = image_build(&boxes->sidetree,
+                       (boxes->wal != NULL) ? wal_last_lsn(boxes->wal) : 0,
+                       &size);
+    boxes_unlock(boxes);
+    if (data == NULL) {
+        return -1;
+    }
+
+    ret = image_write(data, size, path);
+    free(data);
+    return ret;
+}
+
+/*check that the boxes of an image can be added to the boxes, without any
+ * refcount overflowing
+ * time complexity O(n*log(n))*/
+static int boxes_image_fits(boxes_t *boxes, const image_t *image)
+{
+    node_t *side_node, *height_node;
+    tree_t *height_tree;
+    size_t i, j;
+
+    for (i = 0; i < image->num_sides; ++i) {
+        if (tree_search(&boxes->sidetree, image->side_keys[i], &side_node)) {
+            continue;
+        }
+        height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+        for (j = image->height_starts[i]; j < image->height_starts[i + 1];
+             ++j) {
+            if (!tree_search(height_tree, image->height_keys[j],
+                             &height_node) &&
+                (tree_node_get_value(height_node).count >
+                 UINT64_MAX - image->counts[j])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*build the index from the sorted sections of an image
+ * if a refcount would overflow, nothing is added
+ * time complexity O(n), or O(n*log(n)) if the boxes are not empty*/
+static int boxes_do_load(boxes_t *boxes, const image_t *image)
+{
+    size_t i, j, start, end, max_group;
+    tree_value_t *side_values, *height_values;
+    tree_t *height_tree;
+
+    if (!tree_is_empty(&boxes->sidetree)) {
+        if (!boxes_image_fits(boxes, image)) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+        for (i = 0; i < image->num_sides; ++i) {
+            for (j = image->height_starts[i]; j < image->height_starts[i + 1];
+                 ++j) {
+                boxes_insert(boxes, image->side_keys[i],
+                             image->height_keys[j], image->counts[j]);
+            }
+        }
+        return 0;
+    }
+
+    max_group = 0;
+    for (i = 0; i < image->num_sides; ++i) {
+        if (image->height_starts[i + 1] - image->height_starts[i] >
+            max_group) {
+            max_group = image->height_starts[i + 1] - image->height_starts[i];
+        }
+    }
+
+    side_values   = malloc((image->num_sides + 1) * sizeof(*side_values));
+    height_values = malloc((max_group + 1) * sizeof(*height_values));
+    if ((side_values == NULL) || (height_values == NULL)) {
+        free(height_values);
+        free(side_values);
+        return -1;
+    }
+
+    /* the keys of the image are those of the trees it was saved from */
+    for (i = 0; i < image->num_sides; ++i) {
+        start = image->height_starts[i];
+        end   = image->height_starts[i + 1];
+        for (j = start; j < end; ++j) {
+            height_values[j - start].count = image->counts[j];
+        }
+
+        height_tree = boxes_new_height_tree(boxes);
+        tree_build_sorted(height_tree, &image->height_keys[start],
+                          height_values, end - start);
+        side_values[i].ptr = height_tree;
+    }
+
+    tree_build_sorted(&boxes->sidetree, image->side_keys, side_values,
+                      image->num_sides);
+    boxes->num_heights = image->num_heights;
+    boxes_version_build(boxes);
+    boxes_volumes_build(boxes);
+
+    free(height_values);
+    free(side_values);
+    return 0;
+}
+
+int boxes_load_image(boxes_t *boxes, const image_t *image)
+{
+    uint64_t lsn;
+    size_t i, j;
+    int ret, is_due;
+
+    boxes_write_lock(boxes);
+    ret = boxes_do_load(boxes, image);
+
+    /* logged like INSERTBOX_N of every box */
+    lsn    = 0;
+    is_due = 0;
+    for (i = 0; !ret && (boxes->wal != NULL) && (i < image->num_sides); ++i) {
+        for (j = image->height_starts[i]; j < image->height_starts[i + 1];
+             ++j) {
+            is_due |= boxes_log(boxes, COMMAND_INSERTBOX,
+                                tree_key_to_float(image->side_keys[i]),
+                                tree_key_to_float(image->height_keys[j]),
+                                image->counts[j], &lsn);
+        }
+    }
+    boxes_unlock(boxes);
+    boxes_commit(boxes, lsn, is_due);
+    return ret;
+}
+
+int boxes_load(boxes_t *boxes, const char *path)
+{
+    image_t image;
+    int ret;
+
+    ret = image_open(&image, path);
+    if (ret) {
+        return ret;
+    }
+
+    ret = boxes_load_image(boxes, &image);
+    image_close(&image);
+    return ret;
+}
+
+static void boxes_nop_cleanup_cb(tree_value_t value)
+{
+}
+
+/*drop the tombstones of boxes which are locked for writing. height trees
+ * with tombstones are rebuilt from their other heights into new trees, which
+ * replace them once they are built, and sides which have only tombstones are
+ * deleted. if out of memory, the trees which were not rebuilt keep their
+ * tombstones.
+ * time complexity O(n*m)*/
+static int boxes_do_compact(boxes_t *boxes)
+{
+    size_t num_sides, num_dead, max_group, group, num_live, i;
+    tree_value_t *height_values, value;
+    tree_key_t *dead_sides, *height_keys;
+    node_t *side_node, *height_node;
+    tree_t *height_tree, *new_tree;
+    int ret;
+
+    if (boxes->num_tombstones == 0) {
+        return 0;
+    }
+
+    /* size the arrays by the sides and the largest height tree */
+    num_sides = 0;
+    max_group = 0;
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            group       = 0;
+            if (!tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                do {
+                    ++group;
+                } while (!tree_successor(height_tree, &height_node));
+            }
+            if (group > max_group) {
+                max_group = group;
+            }
+            ++num_sides;
+        } while (!tree_successor(&boxes->sidetree, &side_node));
+    }
+
+    ret           = -1;
+    num_dead      = 0;
+    dead_sides    = malloc((num_sides + 1) * sizeof(*dead_sides));
+    height_keys   = malloc((max_group + 1) * sizeof(*height_keys));
+    height_values = malloc((max_group + 1) * sizeof(*height_values));
+    if ((dead_sides == NULL) || (height_keys == NULL) ||
+        (height_values == NULL)) {
+        goto out_free;
+    }
+
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            group       = 0;
+            num_live    = 0;
+            if (!tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                do {
+                    ++group;
+                    if (tree_node_get_value(height_node).count == 0) {
+                        continue;
+                    }
+                    height_keys[num_live]   = tree_node_get_key(height_node);
+                    height_values[num_live] = tree_node_get_value(height_node);
+                    ++num_live;
+                } while (!tree_successor(height_tree, &height_node));
+            }
+
+            if (num_live == group) {
+                continue;
+            } else if (num_live == 0) {
+                /* deleted after the walk, since a deletion invalidates the
+                 * nodes of a B+-tree
+                 */
+                dead_sides[num_dead++] = tree_node_get_key(side_node);
+                continue;
+            }
+
+            new_tree = (tree_t*)pool_alloc(&boxes->tree_pool);
+            if (new_tree == NULL) {
+                goto out_dead;
+            }
+            tree_init_augmented(new_tree, boxes_height_augment_cb);
+            tree_set_pool(new_tree, &boxes->height_node_pool);
+            if (tree_build_sorted(new_tree, height_keys, height_values,
+                                  num_live)) {
+                pool_free(&boxes->tree_pool, new_tree);
+                goto out_dead;
+            }
+
+            /* the maximal height of the side is the same */
+            tree_cleanup(height_tree, boxes_nop_cleanup_cb);
+            pool_free(&boxes->tree_pool, height_tree);
+            value.ptr = new_tree;
+            tree_node_set_value(side_node, value);
+            boxes->num_heights    -= group - num_live;
+            boxes->num_tombstones -= group - num_live;
+        } while (!tree_successor(&boxes->sidetree, &side_node));
+    }
+    ret = 0;
+
+out_dead:
+    for (i = 0; i < num_dead; ++i) {
+        tree_search(&boxes->sidetree, dead_sides[i], &side_node);
+        height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+        group       = 0;
+        if (!tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+            do {
+                ++group;
+            } while (!tree_successor(height_tree, &height_node));
+        }
+
+        tree_delete(&boxes->sidetree, side_node);
+        tree_cleanup(height_tree, boxes_nop_cleanup_cb);
+        pool_free(&boxes->tree_pool, height_tree);
+        boxes->num_heights    -= group;
+        boxes->num_tombstones -= group;
+    }
+
+out_free:
+    free(height_values);
+    free(height_keys);
+    free(dead_sides);
+    return ret;
+}
+
+/*remove 'n' boxes which were found, by their nodes in the side tree and
+ * the height tree, and which have a refcount of at least 'n'
+ * time complexity O(log(m*n)), and O(n*m) for a compaction of the
+ * tombstones*/
+static void boxes_remove_node(boxes_t *boxes, node_t *side_node,
+                              node_t *height_node, uint64_t n)
+{
+    tree_t *height_tree;
+    tree_value_t count;
+
+    height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+    boxes_version_add(boxes, tree_node_get_key(side_node),
+                      tree_node_get_key(height_node), -(int64_t)n);
+
+    /* decrement refcount */
+    count = tree_node_get_value(height_node);
+    count.count -= n;
+    tree_node_set_value(height_node, count);
+    if (count.count == 0) {
+        boxes_volumes_delete(boxes, tree_node_get_key(side_node),
+                             tree_node_get_key(height_node));
+    }
+
+    if ((count.count == 0) && (boxes->max_tombstone_ratio > 0)) {
+        /* keep a tombstone, which may have been the maximal height */
+        ++boxes->num_tombstones;
+        tree_augment_update(height_tree, height_node);
+        tree_augment_update(&boxes->sidetree, side_node);
+        if ((boxes->num_tombstones >= BOXES_COMPACT_MIN_TOMBSTONES) &&
+            (boxes->num_tombstones >
+             boxes->max_tombstone_ratio * boxes->num_heights)) {
+            boxes_do_compact(boxes); /* kept if out of memory */
+        }
+    } else if (count.count == 0) {
+        /* remove entry from height tree */
+        tree_delete(height_tree, height_node);
+        --boxes->num_heights;
+
+        if (tree_is_empty(height_tree)) {
+            /* height tree became empty, remove entry from side tree */
+            tree_delete(&boxes->sidetree, side_node);
+            pool_free(&boxes->tree_pool, height_tree);
+        } else {
+            tree_augment_update(&boxes->sidetree, side_node);
+        }
+    }
+}
+
+/*remove 'n' of a specific box from box tree that has side and height length
+ * given. returns -1 if there are less, and nothing is removed
+ * time complexity O(log(m*n))*/
+static int boxes_remove(boxes_t *boxes, tree_key_t side, tree_key_t height,
+                        uint64_t n)
+{
+    node_t *side_node, *height_node;
+    tree_t *height_tree;
+    int ret;
+
+    ret = tree_search(&boxes->sidetree, side, &side_node);
+    if (ret) {
+        return -1; /* side not found */
+    }
+
+    height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+    ret = tree_search(height_tree, height, &height_node);
+    if (ret) {
+        return -1; /* height not found */
+    }
+
+    if (tree_node_get_value(height_node).count < n) {
+        return -1; /* not enough boxes */
+    } else if (n > 0) {
+        boxes_remove_node(boxes, side_node, height_node, n);
+    }
+    return 0;
+}
+
+int REMOVEBOX_N(boxes_t *boxes, float side, float height, uint64_t n)
+{
+    uint64_t lsn;
+    int ret, is_due;
+    STATS_TIMER_START(timer);
+
+    lsn    = 0;
+    is_due = 0;
+    boxes_write_lock(boxes);
+    ret = boxes_remove(boxes, tree_key_from_float(side),
+                       tree_key_from_float(height), n);
+    if (!ret && (n > 0)) {
+        is_due = boxes_log(boxes, COMMAND_REMOVEBOX, side, height, n,
+                           &lsn);
+    }
+    boxes_unlock(boxes);
+    STATS_TIMER_END(timer, STATS_OP_REMOVEBOX);
+    boxes_commit(boxes, lsn, is_due);
+    return ret;
+}
+
+int REMOVEBOX(boxes_t *boxes, float side, float height)
+{
+    return REMOVEBOX_N(boxes, side, height, 1);
+}
+
+/*collect all the boxes, repeated by their refcount
+ * time complexity o(n)*/
+int boxes_collect(boxes_t *boxes, box_t **boxes_p, size_t *n_p)
+{
+    node_t *side_node, *height_node;
+    size_t n, capacity;
+    box_t *all, *new_all;
+    tree_t *height_tree;
+    uint64_t i, count;
+
+    boxes_read_lock(boxes);
+
+    all      = NULL;
+    n        = 0;
+    capacity = 0;
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            if (tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                continue;
+            }
+            do {
+                count = tree_node_get_value(height_node).count;
+                if (n + count > capacity) {
+                    capacity = 2 * (n + count);
+                    new_all  = NULL;
+                    if (count < SIZE_MAX / (2 * sizeof(*all)) - n) {
+                        new_all = realloc(all, capacity * sizeof(*all));
+                    }
+                    if (new_all == NULL) {
+                        free(all);
+                        boxes_unlock(boxes);
+                        return -1;
+                    }
+                    all = new_all;
+                }
+                for (i = 0; i < count; ++i) {
+                    all[n].side   = tree_key_to_float(
+                                        tree_node_get_key(side_node));
+                    all[n].height = tree_key_to_float(
+                                        tree_node_get_key(height_node));
+                    ++n;
+                }
+            } while (!tree_successor(height_tree, &height_node));
+        } while (!tree_successor(&boxes->sidetree, &side_node));
+    }
+
+    boxes_unlock(boxes);
+    *boxes_p = all;
+    *n_p     = n;
+    return 0;
+}
+
+/* add the candidate boxes in the batch, which come after all the boxes
+ * considered so far, to the minimal box found
+ */
+static void boxes_flush_candidates(const float *sides, const float *heights,
+                                   node_t *const *side_nodes,
+                                   node_t *const *height_nodes, size_t num,
+                                   int *is_found_p, float *min_volume_p,
+                                   node_t **side_node_p,
+                                   node_t **height_node_p)
+{
+    float volume;
+    size_t i;
+
+    if (num == 0) {
+        return;
+    }
+
+    i = volume_argmin(sides, heights, num, &volume);
+    if (!*is_found_p || (volume < *min_volume_p)) {
+        *min_volume_p  = volume;
+        *side_node_p   = side_nodes[i];
+        *height_node_p = height_nodes[i];
+        *is_found_p    = 1;
+    }
+}
+
+/* find the minimal volume box which can contain (side,height) without the
+ * range tree. sides are scanned in increasing order, skipping subtrees which
+ * do not have a large enough height. once side^2*height is not lower than
+ * the best volume found so far, no remaining side can improve it.
+ * time complexity O(k*log(n*m)), k being the number of sides scanned, which
+ * is n in the worst case*/
+static int boxes_scan_ub_node(boxes_t *boxes, tree_key_t side,
+                              tree_key_t height, node_t **side_node_p,
+                              node_t **height_node_p)
+{
+    float cand_sides[BOXES_SCAN_BATCH], cand_heights[BOXES_SCAN_BATCH];
+    node_t *cand_side_nodes[BOXES_SCAN_BATCH];
+    node_t *cand_height_nodes[BOXES_SCAN_BATCH];
+    node_t *side_node, *height_node;
+    float found_side, min_volume;
+    float min_height;
+    tree_t *height_tree;
+    size_t num_cands;
+    int is_found;
+    int ret;
+
+    ret = tree_ub_augmented(&boxes->sidetree, side, height, &side_node);
+    if (ret) {
+        return -1; /* side too big, or no side has a large enough height */
+    }
+
+    /* lowest height which tree_ub may return, with the key tolerance */
+    min_height = tree_key_to_float(height) - 2 * TREE_KEY_TOLERANCE;
+
+    /* collect the lowest feasible height of every side in batches, and find
+     * the minimal volume of each batch at once. the pruning uses the minimal
+     * volume of the previous batches, and boxes of pruned sides can not have
+     * a lower volume, so the result is the same as one box at a time.
+     */
+    is_found   = 0;
+    min_volume = INFINITY;
+    num_cands  = 0;
+    do {
+        STATS_INC(STATS_SIDES_SCANNED);
+        found_side = tree_key_to_float(tree_node_get_key(side_node));
+        if (is_found && (found_side >= 0) && (min_height >= 0) &&
+            (found_side * found_side * min_height >= min_volume)) {
+            break; /* remaining sides are too big to have a lower volume */
+        }
+
+        /* search in height tree */
+        height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+        ret = boxes_height_ub(boxes, height_tree, height, &height_node);
+        if (!ret) {
+            cand_sides[num_cands]        = found_side;
+            cand_heights[num_cands]      = tree_key_to_float(
+                                        tree_node_get_key(height_node));
+            cand_side_nodes[num_cands]   = side_node;
+            cand_height_nodes[num_cands] = height_node;
+            if (++num_cands == BOXES_SCAN_BATCH) {
+                boxes_flush_candidates(cand_sides, cand_heights,
+                                       cand_side_nodes, cand_height_nodes,
+                                       num_cands, &is_found, &min_volume,
+                                       side_node_p, height_node_p);
+                num_cands = 0;
+            }
+        }
+
+        /* go to next side which has a large enough height */
+        ret = tree_successor_augmented(&boxes->sidetree, height, &side_node);
+    } while (!ret);
+
+    boxes_flush_candidates(cand_sides, cand_heights, cand_side_nodes,
+                           cand_height_nodes, num_cands, &is_found,
+                           &min_volume, side_node_p, height_node_p);
+    return is_found ? 0 : -1;
+}
+
+/* find the minimal volume box which can contain (side,height) in the range
+ * tree, or by scanning the sides if it was dropped.
+ * the nodes of the box are returned, so it may be removed without searching
+ * for it again
+ * time complexity O(log(N)^2) for N distinct boxes*/
+static int boxes_find_ub_node(boxes_t *boxes, tree_key_t side,
+                              tree_key_t height, node_t **side_node_p,
+                              node_t **height_node_p)
+{
+    tree_t *height_tree;
+    vtree_box_t box;
+
+    if (!boxes->has_volumes) {
+        return boxes_scan_ub_node(boxes, side, height, side_node_p,
+                                  height_node_p);
+    }
+
+    if (vtree_find(&boxes->volumes, side, height, &box)) {
+        return -1;
+    }
+
+    /* keys in a tree differ by more than the key delta, so the exact keys
+     * are found at their own nodes
+     */
+    tree_search(&boxes->sidetree, box.side, side_node_p);
+    height_tree = (tree_t*)tree_node_get_value(*side_node_p).ptr;
+    tree_search(height_tree, box.height, height_node_p);
+    return 0;
+}
+
+static int boxes_find_ub(boxes_t *boxes, tree_key_t side, tree_key_t height,
+                         float *found_side_p, float *found_height_p)
+{
+    node_t *side_node, *height_node;
+
+    if (boxes_find_ub_node(boxes, side, height, &side_node, &height_node)) {
+        return -1;
+    }
+
+    *found_side_p   = tree_key_to_float(tree_node_get_key(side_node));
+    *found_height_p = tree_key_to_float(tree_node_get_key(height_node));
+    return 0;
+}
+
+int GETBOX(boxes_t *boxes, float side, float height, float *found_side_p,
+           float *found_height_p)
+{
     int ret;
+    STATS_TIMER_START(timer);
 
-    ret = tree_search(&boxes->sidetree, side, &found_node);
-    if (ret) {
-        /* side not found - create new side tree */
-        height_tree = (tree_t*)malloc(sizeof(*height_tree));
-        tree_init(height_tree);
-        tree_insert(&boxes->sidetree, side, height_tree);
-        /* ... continue to creating new refcount variable */
+    boxes_read_lock(boxes);
+    ret = boxes_find_ub(boxes, tree_key_from_float(side),
+                        tree_key_from_float(height), found_side_p,
+                        found_height_p);
+    boxes_unlock(boxes);
+    STATS_TIMER_END(timer, STATS_OP_GETBOX);
+    return ret;
+}
+
+/*find the minimal box like GETBOX, and remove it by the nodes it was found
+ * at, under a single write lock
+ * time complexity O(log(N)^2) like GETBOX, and O(log(N)^2) amortized to
+ * remove*/
+int boxes_take_best_fit(boxes_t *boxes, float side, float height,
+                        float *found_side_p, float *found_height_p)
+{
+    node_t *side_node, *height_node;
+    uint64_t lsn;
+    int ret, is_due;
+    STATS_TIMER_START(timer);
+
+    lsn    = 0;
+    is_due = 0;
+    boxes_write_lock(boxes);
+    ret = boxes_find_ub_node(boxes, tree_key_from_float(side),
+                             tree_key_from_float(height), &side_node,
+                             &height_node);
+    if (!ret) {
+        *found_side_p   = tree_key_to_float(tree_node_get_key(side_node));
+        *found_height_p = tree_key_to_float(tree_node_get_key(height_node));
+        boxes_remove_node(boxes, side_node, height_node, 1);
+        is_due = boxes_log(boxes, COMMAND_REMOVEBOX, *found_side_p,
+                           *found_height_p, 1, &lsn);
+    }
+    boxes_unlock(boxes);
+    STATS_TIMER_END(timer, STATS_OP_TAKEBOX);
+    boxes_commit(boxes, lsn, is_due);
+    return ret;
+}
+
+/*check if there is a side large enough whose maximal height is large enough
+ * time complexity O(log(n))*/
+int CHECKBOX(boxes_t* boxes, float side, float height)
+{
+    int ret;
+    STATS_TIMER_START(timer);
+
+    boxes_read_lock(boxes);
+    ret = tree_has_augmented(&boxes->sidetree, tree_key_from_float(side),
+                             tree_key_from_float(height));
+    boxes_unlock(boxes);
+    STATS_TIMER_END(timer, STATS_OP_CHECKBOX);
+    return ret;
+}
+
+static float boxes_volume(const box_count_t *box)
+{
+    return box->side * box->side * box->height;
+}
+
+/* is 'a' a better box than 'b', in the order of boxes_topk_fit() */
+static int boxes_topk_less(const box_count_t *a, const box_count_t *b)
+{
+    float volume_a = boxes_volume(a), volume_b = boxes_volume(b);
+
+    if (volume_a != volume_b) {
+        return volume_a < volume_b;
+    } else if (a->side != b->side) {
+        return a->side < b->side;
     } else {
-        /* side found - check if height exists */
-        height_tree = (tree_t*)tree_node_get_value(found_node);
-        ret = tree_search(height_tree, height, &found_node);
-        if (!ret) {
-            countptr = (int*)tree_node_get_value(found_node);
-            ++(*countptr); /* height found - increment refcount */
-            return;
+        return a->height < b->height;
+    }
+}
+
+/* move the box at 'i' down the max-heap of the worst box, until both of its
+ * children are better
+ */
+static void boxes_topk_sift_down(box_count_t *heap, size_t n, size_t i)
+{
+    box_count_t tmp;
+    size_t child;
+
+    while ((child = 2 * i + 1) < n) {
+        if ((child + 1 < n) &&
+            boxes_topk_less(&heap[child], &heap[child + 1])) {
+            ++child;
         }
+        if (!boxes_topk_less(&heap[i], &heap[child])) {
+            break;
+        }
+        tmp         = heap[i];
+        heap[i]     = heap[child];
+        heap[child] = tmp;
+        i           = child;
     }
+}
 
-    /* create new refcount variable */
-    countptr = (int*)malloc(sizeof(*countptr));
-    *countptr = 1;
-    tree_insert(height_tree, height, countptr);
+/* add a box to the max-heap of the worst box, which has room for it */
+static void boxes_topk_push(box_count_t *heap, size_t n,
+                            const box_count_t *box)
+{
+    size_t i, parent;
+
+    for (i = n; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (!boxes_topk_less(&heap[parent], box)) {
+            break;
+        }
+        heap[i] = heap[parent];
+    }
+    heap[i] = *box;
 }
 
-/*remove a specific box from box tree that has side and height length given
- * time complexity O(log(m*n))*/
-int REMOVEBOX(boxes_t *boxes, float side, float height)
+/* the boxes found so far are kept in a max-heap, so the worst of them is
+ * replaced by a better box in O(log(k)). the heights of a side are scanned in
+ * increasing order, whose volumes do not decrease, until a box is not better
+ * than the worst. once k boxes are found, sides are pruned like GETBOX does
+ * with the volume of the worst.
+ */
+static size_t boxes_do_topk_fit(boxes_t *boxes, tree_key_t side,
+                                tree_key_t height, size_t k,
+                                box_count_t *heap)
 {
     node_t *side_node, *height_node;
+    float found_side, min_height;
     tree_t *height_tree;
-    int *countptr;
-    int ret;
+    box_count_t box, tmp;
+    size_t n, i;
 
-    ret = tree_search(&boxes->sidetree, side, &side_node);
-    if (ret) {
-        return -1; /* side not found */
+    if ((k == 0) ||
+        tree_ub_augmented(&boxes->sidetree, side, height, &side_node)) {
+        return 0;
     }
 
-    height_tree = (tree_t*)tree_node_get_value(side_node);
-    ret = tree_search(height_tree, height, &height_node);
-    if (ret) {
-        return -1; /* height not found */
+    /* lowest height which tree_ub may return, with the key tolerance */
+    min_height = tree_key_to_float(height) - 2 * TREE_KEY_TOLERANCE;
+
+    n = 0;
+    do {
+        STATS_INC(STATS_SIDES_SCANNED);
+        found_side = tree_key_to_float(tree_node_get_key(side_node));
+        if ((n == k) && (found_side >= 0) && (min_height >= 0) &&
+            (found_side * found_side * min_height >= boxes_volume(&heap[0]))) {
+            break; /* remaining sides are too big to have a lower volume */
+        }
+
+        height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+        if (boxes_height_ub(boxes, height_tree, height, &height_node)) {
+            continue;
+        }
+        do {
+            box.side   = found_side;
+            box.height = tree_key_to_float(tree_node_get_key(height_node));
+            box.count  = tree_node_get_value(height_node).count;
+            if (n < k) {
+                boxes_topk_push(heap, n++, &box);
+            } else if (boxes_topk_less(&box, &heap[0])) {
+                heap[0] = box;
+                boxes_topk_sift_down(heap, n, 0);
+            } else {
+                break; /* higher boxes of this side are not better */
+            }
+        } while (!boxes_height_successor(boxes, height_tree, &height_node));
+    } while (!tree_successor_augmented(&boxes->sidetree, height, &side_node));
+
+    /* heap sort, moving the worst box to the end */
+    for (i = n; i > 1; --i) {
+        tmp         = heap[0];
+        heap[0]     = heap[i - 1];
+        heap[i - 1] = tmp;
+        boxes_topk_sift_down(heap, i - 1, 0);
     }
+    return n;
+}
 
-    /* decrement refcount */
-    countptr = (int*)tree_node_get_value(height_node);
-    --(*countptr);
+size_t boxes_topk_fit(boxes_t *boxes, float side, float height, size_t k,
+                      box_count_t *results)
+{
+    size_t n;
 
-    if (*countptr == 0) {
-        /* remove entry from height tree */
-        tree_delete(height_tree, height_node);
-        free(countptr);
+    boxes_read_lock(boxes);
+    n = boxes_do_topk_fit(boxes, tree_key_from_float(side),
+                          tree_key_from_float(height), k, results);
+    boxes_unlock(boxes);
+    return n;
+}
 
-        if (tree_is_empty(height_tree)) {
-            /* height tree became empty, remove entry from side tree */
-            tree_delete(&boxes->sidetree, side_node);
-            free(height_tree);
+/* move the cursor to the first box in range of its side, or to the next side
+ * which has one
+ */
+static void boxes_cursor_seek(boxes_cursor_t *cursor)
+{
+    tree_t *sidetree = &cursor->boxes->sidetree;
+    tree_t *height_tree;
+
+    while (cursor->side_node != NULL) {
+        if (!tree_key_ge(cursor->side_hi,
+                         tree_node_get_key(cursor->side_node))) {
+            cursor->side_node = NULL; /* past the last side in range */
+            break;
+        }
+
+        STATS_INC(STATS_SIDES_SCANNED);
+        height_tree = (tree_t*)tree_node_get_value(cursor->side_node).ptr;
+        if (!boxes_height_ub(cursor->boxes, height_tree, cursor->height_lo,
+                             &cursor->height_node) &&
+            tree_key_ge(cursor->height_hi,
+                        tree_node_get_key(cursor->height_node))) {
+            break;
+        }
+
+        /* the next side whose maximal height is large enough */
+        if (tree_successor_augmented(sidetree, cursor->height_lo,
+                                     &cursor->side_node)) {
+            cursor->side_node = NULL;
         }
     }
+}
 
-    return 0;
+/* open a cursor of boxes which are locked by the caller */
+static void boxes_do_cursor_open(boxes_t *boxes, boxes_cursor_t *cursor,
+                                 tree_key_t side_lo, tree_key_t side_hi,
+                                 tree_key_t height_lo, tree_key_t height_hi)
+{
+    cursor->boxes       = boxes;
+    cursor->side_hi     = side_hi;
+    cursor->height_lo   = height_lo;
+    cursor->height_hi   = height_hi;
+    cursor->height_node = NULL;
+    if (tree_ub_augmented(&boxes->sidetree, side_lo, height_lo,
+                          &cursor->side_node)) {
+        cursor->side_node = NULL;
+    }
+    boxes_cursor_seek(cursor);
 }
 
-static int boxes_find_ub(boxes_t *boxes, float side, float height,
-                         float *found_side_p, float *found_height_p,
-                         int find_first)
+static int boxes_do_cursor_next(boxes_cursor_t *cursor, box_count_t *box)
 {
-    node_t *side_node, *height_node;
-    float found_side, found_height;
-    float volume, min_volume;
+    tree_t *sidetree = &cursor->boxes->sidetree;
     tree_t *height_tree;
+
+    if (cursor->side_node == NULL) {
+        return -1;
+    }
+
+    box->side   = tree_key_to_float(tree_node_get_key(cursor->side_node));
+    box->height = tree_key_to_float(tree_node_get_key(cursor->height_node));
+    box->count  = tree_node_get_value(cursor->height_node).count;
+
+    /* the next height of the side, or the first one of the next side */
+    height_tree = (tree_t*)tree_node_get_value(cursor->side_node).ptr;
+    if (boxes_height_successor(cursor->boxes, height_tree,
+                               &cursor->height_node) ||
+        !tree_key_ge(cursor->height_hi,
+                     tree_node_get_key(cursor->height_node))) {
+        if (tree_successor_augmented(sidetree, cursor->height_lo,
+                                     &cursor->side_node)) {
+            cursor->side_node = NULL;
+        }
+        boxes_cursor_seek(cursor);
+    }
+    return 0;
+}
+
+void boxes_cursor_open(boxes_t *boxes, boxes_cursor_t *cursor, float side_lo,
+                       float side_hi, float height_lo, float height_hi)
+{
+    boxes_read_lock(boxes);
+    boxes_do_cursor_open(boxes, cursor, tree_key_from_float(side_lo),
+                         tree_key_from_float(side_hi),
+                         tree_key_from_float(height_lo),
+                         tree_key_from_float(height_hi));
+}
+
+int boxes_cursor_next(boxes_cursor_t *cursor, box_count_t *box)
+{
+    return boxes_do_cursor_next(cursor, box);
+}
+
+void boxes_cursor_close(boxes_cursor_t *cursor)
+{
+    boxes_unlock(cursor->boxes);
+    cursor->side_node = NULL;
+}
+
+uint64_t boxes_range_count(boxes_t *boxes, float side_lo, float side_hi,
+                           float height_lo, float height_hi)
+{
+    boxes_cursor_t cursor;
+    box_count_t box;
+    uint64_t count;
+
+    count = 0;
+    boxes_read_lock(boxes);
+    boxes_do_cursor_open(boxes, &cursor, tree_key_from_float(side_lo),
+                         tree_key_from_float(side_hi),
+                         tree_key_from_float(height_lo),
+                         tree_key_from_float(height_hi));
+    while (!boxes_do_cursor_next(&cursor, &box)) {
+        count += box.count;
+    }
+    boxes_unlock(boxes);
+    return count;
+}
+
+void boxes_enable_snapshots(boxes_t *boxes)
+{
+    boxes_write_lock(boxes);
+    if (!boxes->has_snapshots) {
+        ptree_init(&boxes->versions, &boxes_side_ptree_ops);
+        boxes->has_snapshots = 1;
+        boxes_version_build(boxes);
+    }
+    boxes_unlock(boxes);
+}
+
+void boxes_snapshot(boxes_t *boxes, boxes_snapshot_t *snapshot)
+{
+    assert(boxes->has_snapshots);
+
+    /* updates change the references of the root, so they are excluded */
+    boxes_read_lock(boxes);
+    ptree_copy(&boxes->versions, &snapshot->sidetree);
+    boxes_unlock(boxes);
+}
+
+void boxes_snapshot_release(boxes_snapshot_t *snapshot)
+{
+    ptree_release(&snapshot->sidetree);
+}
+
+/*like boxes_find_ub, on the persistent copy
+ * time complexity O(k*log(n*m)), k being the number of sides scanned*/
+int boxes_snapshot_getbox(const boxes_snapshot_t *snapshot, float side,
+                          float height, float *found_side_p,
+                          float *found_height_p)
+{
+    const ptree_node_t *side_node, *height_node;
+    float found_side, found_height, volume, min_volume;
+    float min_height;
+    tree_key_t side_key, height_key;
+    ptree_iter_t iter;
     int is_found;
-    int ret;
 
-    ret = tree_ub(&boxes->sidetree, side, &side_node);
-    if (ret) {
-        return -1; /* side too big*/
+    side_key   = tree_key_from_float(side);
+    height_key = tree_key_from_float(height);
+
+    /* lowest height which ptree_ub may return, with the key tolerance */
+    min_height = tree_key_to_float(height_key) - 2 * TREE_KEY_TOLERANCE;
+
+    is_found   = 0;
+    min_volume = INFINITY;
+    for (side_node = ptree_iter_ub_augmented(&iter, snapshot->sidetree.root,
+                                             side_key, height_key);
+         side_node != NULL;
+         side_node = ptree_iter_next_augmented(&iter, height_key)) {
+        found_side = tree_key_to_float(side_node->key);
+        if (is_found && (found_side >= 0) && (min_height >= 0) &&
+            (found_side * found_side * min_height >= min_volume)) {
+            break; /* remaining sides are too big to have a lower volume */
+        }
+
+        height_node = ptree_ub((const ptree_node_t*)side_node->value.ptr,
+                               height_key);
+        if (height_node == NULL) {
+            continue;
+        }
+
+        found_height = tree_key_to_float(height_node->key);
+        volume       = found_side * found_side * found_height;
+        if (!is_found || (volume < min_volume)) {
+            min_volume      = volume;
+            *found_side_p   = found_side;
+            *found_height_p = found_height;
+            is_found        = 1;
+        }
     }
 
-    is_found = 0;
-    do {
-        /* search in height tree */
-        found_side  = tree_node_get_key(side_node);
-        height_tree = tree_node_get_value(side_node);
-        ret = tree_ub(height_tree, height, &height_node);
-        if (!ret) {
-            /* found in height tree */
-            found_height = tree_node_get_key(height_node);
-            volume = found_side * found_side * found_height;
-            if (!is_found || (volume < min_volume)) {
-                min_volume      = volume;
-                *found_side_p   = found_side;
-                *found_height_p = found_height;
-                is_found        = 1;
-                if (find_first) {
-                    return 0;
+    return is_found ? 0 : -1;
+}
+
+int boxes_snapshot_checkbox(const boxes_snapshot_t *snapshot, float side,
+                            float height)
+{
+    return ptree_has_augmented(snapshot->sidetree.root,
+                               tree_key_from_float(side),
+                               tree_key_from_float(height));
+}
+
+/* query of a batch, with its position in the batch */
+typedef struct boxes_batch_query_s {
+    tree_key_t  side;
+    tree_key_t  height;
+    size_t      index;
+} boxes_batch_query_t;
+
+/* a candidate box of the batch sweep */
+typedef struct boxes_best_s {
+    result_t box;
+    float    volume;
+} boxes_best_t;
+
+/* order queries by decreasing side */
+static int boxes_batch_query_cmp(const void *a, const void *b)
+{
+    tree_key_t side_a = ((const boxes_batch_query_t*)a)->side;
+    tree_key_t side_b = ((const boxes_batch_query_t*)b)->side;
+
+    return (side_a < side_b) - (side_a > side_b);
+}
+
+/* copy the queries, sorted by decreasing side
+ * time complexity o(nlogn)*/
+static boxes_batch_query_t *boxes_sort_queries(const query_t *queries,
+                                               size_t n)
+{
+    boxes_batch_query_t *sorted;
+    size_t i;
+
+    sorted = malloc(n * sizeof(*sorted));
+    if (sorted == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; ++i) {
+        sorted[i].side   = tree_key_from_float(queries[i].side);
+        sorted[i].height = tree_key_from_float(queries[i].height);
+        sorted[i].index  = i;
+    }
+    qsort(sorted, n, sizeof(*sorted), boxes_batch_query_cmp);
+    return sorted;
+}
+
+/* collect the side nodes in increasing order, and count all the heights
+ * time complexity o(n)*/
+static node_t **boxes_collect_sides(boxes_t *boxes, size_t *num_sides_p,
+                                    size_t *num_heights_p)
+{
+    node_t **sides, **new_sides, *node, *height_node;
+    size_t num_sides, num_heights, capacity;
+    tree_t *height_tree;
+
+    sides       = NULL;
+    capacity    = 0;
+    num_sides   = 0;
+    num_heights = 0;
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &node)) {
+        do {
+            if (num_sides == capacity) {
+                capacity  = capacity ? (2 * capacity) : 64;
+                new_sides = realloc(sides, capacity * sizeof(*sides));
+                if (new_sides == NULL) {
+                    free(sides);
+                    return NULL;
                 }
+                sides = new_sides;
+            }
+            sides[num_sides++] = node;
+
+            height_tree = (tree_t*)tree_node_get_value(node).ptr;
+            if (!boxes_height_ub(boxes, height_tree, TREE_KEY_MIN,
+                                 &height_node)) {
+                do {
+                    ++num_heights;
+                } while (!boxes_height_successor(boxes, height_tree,
+                                                 &height_node));
+            }
+        } while (!tree_successor(&boxes->sidetree, &node));
+    }
+
+    *num_sides_p   = num_sides;
+    *num_heights_p = num_heights;
+    return (sides != NULL) ? sides : malloc(sizeof(*sides));
+}
+
+/* is 'a' a better box than 'b': lower volume, then lower side and height,
+ * which is the box GETBOX returns out of boxes of the same volume
+ */
+static int boxes_best_less(const boxes_best_t *a, const boxes_best_t *b)
+{
+    if (!a->box.found || !b->box.found) {
+        return a->box.found;
+    } else if (a->volume != b->volume) {
+        return a->volume < b->volume;
+    } else if (a->box.side != b->box.side) {
+        return a->box.side < b->box.side;
+    } else {
+        return a->box.height < b->box.height;
+    }
+}
+
+/* the sweep adds sides in decreasing order, so the boxes it has added are
+ * exactly the ones whose side fits the current query. it keeps the best of
+ * them in a fenwick tree over the heights in decreasing order, so the best
+ * box whose height fits a query is a prefix minimum.
+ * time complexity o((n+m)log(m)) for n queries and m boxes*/
+static int boxes_do_getbox_batch(boxes_t *boxes, const query_t *queries,
+                                 size_t n, result_t *results)
+{
+    size_t num_sides, num_heights, num_ranks, lo, hi, mid, i, pos;
+    boxes_batch_query_t *sorted;
+    boxes_best_t *fenwick, cand, best;
+    node_t **sides, *height_node;
+    tree_key_t *heights, height;
+    tree_t *height_tree;
+    long next_side;
+    int ret;
+
+    /* the sweep visits all the boxes, which does not pay off for a few
+     * queries
+     */
+    if (n * BOXES_BATCH_MAX_BOXES_PER_QUERY <
+        boxes->num_heights - boxes->num_tombstones) {
+        for (i = 0; i < n; ++i) {
+            results[i].found = !boxes_find_ub(boxes,
+                                    tree_key_from_float(queries[i].side),
+                                    tree_key_from_float(queries[i].height),
+                                    &results[i].side, &results[i].height);
+        }
+        return 0;
+    }
+
+    ret     = -1;
+    heights = NULL;
+    fenwick = NULL;
+    sorted  = NULL;
+    sides   = boxes_collect_sides(boxes, &num_sides, &num_heights);
+    if (sides == NULL) {
+        goto out_free;
+    }
+
+    sorted = boxes_sort_queries(queries, n);
+    if (sorted == NULL) {
+        goto out_free;
+    }
+
+    /* distinct heights of all the boxes, in increasing order */
+    heights = malloc((num_heights + 1) * sizeof(*heights));
+    if (heights == NULL) {
+        goto out_free;
+    }
+    num_ranks = 0;
+    for (i = 0; i < num_sides; ++i) {
+        height_tree = (tree_t*)tree_node_get_value(sides[i]).ptr;
+        if (!boxes_height_ub(boxes, height_tree, TREE_KEY_MIN,
+                             &height_node)) {
+            do {
+                heights[num_ranks++] = tree_node_get_key(height_node);
+            } while (!boxes_height_successor(boxes, height_tree,
+                                             &height_node));
+        }
+    }
+    qsort(heights, num_ranks, sizeof(*heights), boxes_key_cmp);
+    for (i = 0, num_heights = 0; i < num_ranks; ++i) {
+        if ((num_heights == 0) || (heights[i] != heights[num_heights - 1])) {
+            heights[num_heights++] = heights[i];
+        }
+    }
+
+    fenwick = calloc(num_heights + 1, sizeof(*fenwick));
+    if (fenwick == NULL) {
+        goto out_free;
+    }
+
+    next_side = (long)num_sides - 1;
+    for (i = 0; i < n; ++i) {
+        /* add the boxes of all the sides which fit the query */
+        while ((next_side >= 0) &&
+               tree_key_ge(tree_node_get_key(sides[next_side]),
+                           sorted[i].side)) {
+            cand.box.found = 1;
+            cand.box.side  = tree_key_to_float(
+                                    tree_node_get_key(sides[next_side]));
+            height_tree = (tree_t*)tree_node_get_value(sides[next_side]).ptr;
+            if (!boxes_height_ub(boxes, height_tree, TREE_KEY_MIN,
+                                 &height_node)) {
+                do {
+                    height          = tree_node_get_key(height_node);
+                    cand.box.height = tree_key_to_float(height);
+                    cand.volume     = cand.box.side * cand.box.side *
+                                      cand.box.height;
+
+                    /* position of the height in decreasing order */
+                    lo = 0;
+                    hi = num_heights;
+                    while (lo < hi) {
+                        mid = (lo + hi) / 2;
+                        if (heights[mid] < height) {
+                            lo = mid + 1;
+                        } else {
+                            hi = mid;
+                        }
+                    }
+                    for (pos = num_heights - lo; pos <= num_heights;
+                         pos += pos & -pos) {
+                        if (boxes_best_less(&cand, &fenwick[pos])) {
+                            fenwick[pos] = cand;
+                        }
+                    }
+                } while (!boxes_height_successor(boxes, height_tree,
+                                                 &height_node));
             }
+            --next_side;
         }
 
-        /* not found in height tree, go to next height tree (next side node) */
-        ret = tree_successor(&boxes->sidetree, &side_node);
-    } while (!ret);
+        /* the lowest height which fits the query */
+        lo = 0;
+        hi = num_heights;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (tree_key_ge(heights[mid], sorted[i].height)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
 
-    return is_found ? 0 : -1;
+        /* the best box of all the heights from it and up */
+        best.box.found = 0;
+        for (pos = num_heights - lo; pos > 0; pos -= pos & -pos) {
+            if (boxes_best_less(&fenwick[pos], &best)) {
+                best = fenwick[pos];
+            }
+        }
+        results[sorted[i].index] = best.box;
+    }
+
+    ret = 0;
+
+out_free:
+    free(fenwick);
+    free(heights);
+    free(sides);
+    free(sorted);
+    return ret;
 }
 
-int GETBOX(boxes_t *boxes, float side, float height, float *found_side_p,
-           float *found_height_p)
+int boxes_getbox_batch(boxes_t *boxes, const query_t *queries, size_t n,
+                       result_t *results)
 {
-    return boxes_find_ub(boxes, side, height, found_side_p, found_height_p, 0);
+    int ret;
+
+    boxes_read_lock(boxes);
+    ret = boxes_do_getbox_batch(boxes, queries, n, results);
+    boxes_unlock(boxes);
+    return ret;
 }
 
-int CHECKBOX(boxes_t* boxes, float side, float height)
+/* sweep the sides in decreasing order like boxes_getbox_batch, keeping the
+ * maximal height of the sides which fit the query
+ * time complexity o(nlogn+m) for n queries and m sides*/
+static int boxes_do_checkbox_batch(boxes_t *boxes, const query_t *queries,
+                                   size_t n, result_t *results)
 {
-    float found_side, found_height;
-    return boxes_find_ub(boxes, side, height, &found_side, &found_height, 1);
+    boxes_batch_query_t *sorted;
+    tree_key_t max_height, height;
+    node_t *side_node;
+    tree_t *height_tree;
+    int has_side;
+    size_t i;
+
+    sorted = boxes_sort_queries(queries, n);
+    if (sorted == NULL) {
+        return -1;
+    }
+
+    has_side   = !tree_last(&boxes->sidetree, &side_node);
+    max_height = TREE_KEY_MIN;
+    for (i = 0; i < n; ++i) {
+        while (has_side &&
+               tree_key_ge(tree_node_get_key(side_node), sorted[i].side)) {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            height      = (boxes->max_tombstone_ratio > 0) ?
+                          boxes_max_live_height(height_tree) :
+                          boxes_max_height(height_tree);
+            if (height > max_height) {
+                max_height = height;
+            }
+            has_side = !tree_predecessor(&boxes->sidetree, &side_node);
+        }
+
+        results[sorted[i].index].found =
+                        tree_key_ge(max_height, sorted[i].height);
+    }
+
+    free(sorted);
+    return 0;
+}
+
+int boxes_checkbox_batch(boxes_t *boxes, const query_t *queries, size_t n,
+                         result_t *results)
+{
+    int ret;
+
+    boxes_read_lock(boxes);
+    ret = boxes_do_checkbox_batch(boxes, queries, n, results);
+    boxes_unlock(boxes);
+    return ret;
 }
 
-static void boxes_height_tree_print(int indent, void *value, const char *prefix)
+static void boxes_height_tree_print(int indent, tree_value_t value,
+                                    const char *prefix)
 {
-    int *refcount = (int*)value;
-    printf("%s%*s   + ref=%d\n", prefix, indent, "", *refcount);
+    printf("%s%*s   + ref=%llu\n", prefix, indent, "",
+           (unsigned long long)value.count);
 }
 
-static void boxes_side_tree_print(int indent, void *value, const char *prefix)
+static void boxes_side_tree_print(int indent, tree_value_t value,
+                                  const char *prefix)
 {
-    tree_t *height_tree = (tree_t*)value;
+    tree_t *height_tree = (tree_t*)value.ptr;
     char *inner_prefix, *p;
     int i;
 
@@ -165,31 +1900,221 @@ static void boxes_side_tree_print(int indent, void *value, const char *prefix)
 
 void boxes_print(boxes_t *boxes, const char *prefix)
 {
+    boxes_read_lock(boxes);
     tree_print(&boxes->sidetree, boxes_side_tree_print, prefix);
+    boxes_unlock(boxes);
+}
+
+/* augmented value of a side tree node: the maximal height of the side */
+static tree_key_t boxes_side_augment_cb(tree_value_t value)
+{
+    return boxes_max_height((tree_t*)value.ptr);
+}
+
+/* the same, for boxes with tombstones */
+static tree_key_t boxes_side_live_augment_cb(tree_value_t value)
+{
+    return boxes_max_live_height((tree_t*)value.ptr);
+}
+
+static void boxes_init_sidetree(boxes_t *boxes)
+{
+    tree_init_augmented(&boxes->sidetree, boxes_side_augment_cb);
+    tree_set_pool(&boxes->sidetree, &boxes->side_node_pool);
 }
 
 void boxes_init(boxes_t *boxes)
 {
-    tree_init(&boxes->sidetree);
+    pool_init(&boxes->side_node_pool, tree_node_size(1),
+              BOXES_POOL_SLAB_OBJS);
+    pool_init(&boxes->height_node_pool, tree_node_size(0),
+              BOXES_POOL_SLAB_OBJS);
+    pool_init(&boxes->tree_pool, sizeof(tree_t), BOXES_POOL_SLAB_OBJS);
+    boxes_init_sidetree(boxes);
+    boxes->is_concurrent       = 0;
+    boxes->has_snapshots       = 0;
+    boxes->wal                 = NULL;
+    boxes->max_tombstone_ratio = 0;
+    boxes->num_heights         = 0;
+    boxes->num_tombstones      = 0;
+    vtree_init(&boxes->volumes);
+    boxes->has_volumes         = 1;
+}
+
+void boxes_init_concurrent(boxes_t *boxes)
+{
+    pthread_rwlockattr_t attr;
+
+    boxes_init(boxes);
+
+    /* prefer writers, so a steady stream of queries does not starve them */
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+                        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&boxes->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    boxes->is_concurrent = 1;
+}
+
+int boxes_enable_tombstones(boxes_t *boxes, double max_ratio)
+{
+    int ret;
+
+    if (!(max_ratio > 0) || (max_ratio > 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ret = 0;
+    boxes_write_lock(boxes);
+    if (boxes->max_tombstone_ratio > 0) {
+        boxes->max_tombstone_ratio = max_ratio;
+    } else if (!tree_is_empty(&boxes->sidetree)) {
+        errno = EBUSY;
+        ret   = -1;
+    } else {
+        /* the height trees are augmented by whether a height is a tombstone
+         */
+        pool_cleanup(&boxes->height_node_pool);
+        pool_init(&boxes->height_node_pool, tree_node_size(1),
+                  BOXES_POOL_SLAB_OBJS);
+        tree_init_augmented(&boxes->sidetree, boxes_side_live_augment_cb);
+        tree_set_pool(&boxes->sidetree, &boxes->side_node_pool);
+        boxes->max_tombstone_ratio = max_ratio;
+    }
+    boxes_unlock(boxes);
+    return ret;
+}
+
+int boxes_compact(boxes_t *boxes)
+{
+    int ret;
+
+    boxes_write_lock(boxes);
+    ret = boxes_do_compact(boxes);
+    boxes_unlock(boxes);
+    return ret;
 }
 
-static void boxes_height_tree_cleanup_cb(void *value)
+static void boxes_pool_stats_print(const pool_t *pool, const char *name,
+                                   const char *prefix)
 {
-    int *refcount = (int*)value;
+    pool_stats_t stats;
+
+    pool_get_stats(pool, &stats);
+    printf("%s%-13s %6zu slabs, %10zu used, %10zu free, %10zu capacity, "
+           "%3zu bytes/object, %12zu bytes\n", prefix, name, stats.num_slabs,
+           stats.num_used, stats.num_free, stats.capacity, stats.obj_size,
+           stats.bytes);
+}
 
-    assert(refcount != NULL);
-    free(refcount);
+void boxes_print_pool_stats(boxes_t *boxes, const char *prefix)
+{
+    boxes_read_lock(boxes);
+    boxes_pool_stats_print(&boxes->side_node_pool, "sides", prefix);
+    boxes_pool_stats_print(&boxes->height_node_pool, "heights", prefix);
+    boxes_pool_stats_print(&boxes->tree_pool, "trees", prefix);
+    boxes_pool_stats_print(&boxes->volumes.node_pool, "ranges", prefix);
+    boxes_pool_stats_print(&boxes->volumes.height_node_pool, "range heights",
+                           prefix);
+    boxes_unlock(boxes);
 }
 
-static void boxes_side_tree_cleanup_cb(void *value)
+void boxes_stats_dump(boxes_t *boxes, FILE *file)
 {
-    tree_t *height_tree = (tree_t*)value;
+    size_t num_sides, num_heights, num_tombstones, depth, max_depth;
+    pool_stats_t side_stats, height_stats, tree_stats, range_stats;
+    pool_stats_t range_height_stats;
+    node_t *side_node, *height_node;
+    tree_t *height_tree;
+    uint64_t num_boxes;
+    size_t sum_depth;
 
-    tree_cleanup(height_tree, boxes_height_tree_cleanup_cb);
-    free(height_tree);
+    boxes_read_lock(boxes);
+
+    num_sides   = 0;
+    num_heights = 0;
+    num_boxes   = 0;
+    max_depth   = 0;
+    sum_depth   = 0;
+    if (!tree_ub(&boxes->sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (tree_t*)tree_node_get_value(side_node).ptr;
+            depth = tree_depth(height_tree);
+            if (depth > max_depth) {
+                max_depth = depth;
+            }
+            sum_depth += depth;
+            ++num_sides;
+
+            if (tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                continue;
+            }
+            do {
+                num_boxes += tree_node_get_value(height_node).count;
+                ++num_heights;
+            } while (!tree_successor(height_tree, &height_node));
+        } while (!tree_successor(&boxes->sidetree, &side_node));
+    }
+    depth          = tree_depth(&boxes->sidetree);
+    num_tombstones = boxes->num_tombstones;
+
+    pool_get_stats(&boxes->side_node_pool, &side_stats);
+    pool_get_stats(&boxes->height_node_pool, &height_stats);
+    pool_get_stats(&boxes->tree_pool, &tree_stats);
+    pool_get_stats(&boxes->volumes.node_pool, &range_stats);
+    pool_get_stats(&boxes->volumes.height_node_pool, &range_height_stats);
+
+    boxes_unlock(boxes);
+
+    fprintf(file, "%-16s %16llu\n", "boxes", (unsigned long long)num_boxes);
+    fprintf(file, "%-16s %16zu\n", "sides", num_sides);
+    fprintf(file, "%-16s %16zu\n", "heights", num_heights);
+    fprintf(file, "%-16s %16zu\n", "tombstones", num_tombstones);
+    fprintf(file, "%-16s %16zu\n", "side depth", depth);
+    fprintf(file, "%-16s %16zu\n", "max height depth", max_depth);
+    fprintf(file, "%-16s %16.2f\n", "avg height depth",
+            num_sides ? (double)sum_depth / num_sides : 0.0);
+    fprintf(file, "%-16s %16zu\n", "pool bytes",
+            side_stats.bytes + height_stats.bytes + tree_stats.bytes +
+            range_stats.bytes + range_height_stats.bytes);
+    stats_dump(file);
 }
 
+#ifdef TREE_BTREE
+static void boxes_height_tree_cleanup_cb(tree_value_t value)
+{
+    tree_cleanup((tree_t*)value.ptr, boxes_nop_cleanup_cb);
+}
+#endif
+
 void boxes_cleanup(boxes_t *boxes)
 {
-    tree_cleanup(&boxes->sidetree, boxes_side_tree_cleanup_cb);
+#ifdef TREE_BTREE
+    /* the btree backend does not allocate its nodes from the pools */
+    tree_cleanup(&boxes->sidetree, boxes_height_tree_cleanup_cb);
+#endif
+
+    /* all the trees and their nodes live in the pools, so there is no need
+     * to traverse the trees
+     */
+    pool_cleanup(&boxes->side_node_pool);
+    pool_cleanup(&boxes->height_node_pool);
+    pool_cleanup(&boxes->tree_pool);
+    boxes_init_sidetree(boxes);
+    boxes->num_heights    = 0;
+    boxes->num_tombstones = 0;
+    vtree_cleanup(&boxes->volumes);
+    boxes->has_volumes    = 1;
+
+    /* snapshots which were taken keep their own references */
+    if (boxes->has_snapshots) {
+        ptree_release(&boxes->versions);
+        boxes->has_snapshots = 0;
+    }
+
+    if (boxes->is_concurrent) {
+        pthread_rwlock_destroy(&boxes->lock);
+        boxes->is_concurrent = 0;
+    }
 }
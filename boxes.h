@@ -2,29 +2,288 @@
 #define _BOXES_H
 
 #include "trees.h"
+#include "pool.h"
+#include "ptree.h"
+#include "vtree.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+
+/* box of a bulk load */
+typedef struct box_s {
+    float   side;
+    float   height;
+} box_t;
+
+
+/* GETBOX/CHECKBOX query of a batch */
+typedef struct query_s {
+    float   side;
+    float   height;
+} query_t;
+
+
+/* result of a batch query */
+typedef struct result_s {
+    int     found;      /* nonzero if a box was found */
+    float   side;       /* the box found by GETBOX */
+    float   height;
+} result_t;
+
+
+/* box of a top-k or range query, with the number of times it is inserted */
+typedef struct box_count_s {
+    float       side;
+    float       height;
+    uint64_t    count;
+} box_count_t;
+
+
+struct wal_s;
 
 
 typedef struct boxes_s {
     tree_t  sidetree;
+    pool_t  side_node_pool;     /* side tree nodes */
+    pool_t  height_node_pool;   /* height tree nodes, holding the refcounts */
+    pool_t  tree_pool;          /* height trees */
+    int     is_concurrent;      /* nonzero if 'lock' is used */
+    pthread_rwlock_t lock;      /* held for reading by queries, and for
+                                 * writing by updates */
+    int     has_snapshots;      /* nonzero if 'versions' is kept */
+    ptree_t versions;           /* persistent copy of the boxes */
+    struct wal_s *wal;          /* log of the updates, or NULL */
+    double  max_tombstone_ratio;    /* 0 if heights whose refcount drops to
+                                     * 0 are deleted, see
+                                     * boxes_enable_tombstones() */
+    size_t  num_heights;        /* height nodes, including tombstones */
+    size_t  num_tombstones;     /* height nodes whose refcount is 0 */
+    vtree_t volumes;            /* range tree of the boxes which are not
+                                 * tombstones, which GETBOX searches */
+    int     has_volumes;        /* zero once 'volumes' ran out of memory,
+                                 * and GETBOX scans the sides instead */
 } boxes_t;
 
 
+/* Frozen view of the boxes, see boxes_snapshot() */
+typedef struct boxes_snapshot_s {
+    ptree_t sidetree;
+} boxes_snapshot_t;
+
+
+/* Streaming cursor over the boxes in a range, see boxes_cursor_open() */
+typedef struct boxes_cursor_s {
+    boxes_t     *boxes;
+    tree_key_t  side_hi;
+    tree_key_t  height_lo;
+    tree_key_t  height_hi;
+    node_t      *side_node;     /* side of the next box, NULL at the end */
+    node_t      *height_node;   /* next box of the side, NULL after its last
+                                 * box in range */
+} boxes_cursor_t;
+
+
 void boxes_init(boxes_t *boxes);
+
+/* like boxes_init, but the operations may be called from several threads
+ * at once. GETBOX, CHECKBOX and the batch queries run in parallel with each
+ * other, and INSERTBOX, REMOVEBOX and bulk load run alone.
+ */
+void boxes_init_concurrent(boxes_t *boxes);
 void boxes_cleanup(boxes_t *boxes);
 void boxes_print(boxes_t *boxes, const char *prefix);
 
+/* keep a persistent copy of the boxes, which boxes_snapshot() takes
+ * versions of. updates change both the boxes and the copy, which copies only
+ * the paths to the changed nodes that are shared with a snapshot.
+ * time complexity O(n*log(n)) for the boxes already inserted
+ */
+void boxes_enable_snapshots(boxes_t *boxes);
+
+/* take a snapshot of boxes with snapshots enabled, in O(1). the snapshot is
+ * not changed by later updates, may be queried from any thread without
+ * locking, and must be released.
+ */
+void boxes_snapshot(boxes_t *boxes, boxes_snapshot_t *snapshot);
+void boxes_snapshot_release(boxes_snapshot_t *snapshot);
+
+/* GETBOX and CHECKBOX of the boxes as they were when the snapshot was taken
+ */
+int boxes_snapshot_getbox(const boxes_snapshot_t *snapshot, float side,
+                          float height, float *found_side_p,
+                          float *found_height_p);
+int boxes_snapshot_checkbox(const boxes_snapshot_t *snapshot, float side,
+                            float height);
+
+/* keep the height node of a box whose refcount drops to 0 as a tombstone,
+ * instead of deleting it (and its side, if it was the last height). a box
+ * which is inserted again reuses the nodes, without rotations or
+ * allocations. the height trees are augmented by which heights are
+ * tombstones, so queries skip them in O(log(m)) however many there are, and
+ * once more than 'max_ratio' (in (0,1]) of the heights are tombstones,
+ * REMOVEBOX compacts the trees, which is amortized O(1/max_ratio) per
+ * removal. must be called while the boxes are empty, or to change the ratio.
+ *
+ * @return 0 on success, -1 with errno EINVAL if the ratio is out of range,
+ * or EBUSY if there are boxes which were inserted without tombstones
+ */
+int boxes_enable_tombstones(boxes_t *boxes, double max_ratio);
+
+/* drop all the tombstones, by rebuilding the height trees which have any
+ * from their other heights, and deleting the sides which have only
+ * tombstones.
+ * time complexity O(n*m)
+ *
+ * @return 0 on success, -1 if out of memory (the trees which were not
+ * rebuilt keep their tombstones)
+ */
+int boxes_compact(boxes_t *boxes);
+
+/* print memory usage of the pools the boxes are allocated from */
+void boxes_print_pool_stats(boxes_t *boxes, const char *prefix);
+
+/* print the size and depth of the trees, then the latency histograms and
+ * counters of all the boxes (see stats.h), which are compiled in by
+ * 'make STATS=1'
+ */
+void boxes_stats_dump(boxes_t *boxes, FILE *file);
+
 void INSERTBOX(boxes_t *boxes, float side, float height);
+
+/* insert 'n' boxes of the same size at once, by adding to the refcount of
+ * the box, which is logged as a single update.
+ *
+ * @return 0 on success, -1 if the refcount would overflow 64 bits, and
+ * nothing is inserted
+ */
+int INSERTBOX_N(boxes_t *boxes, float side, float height, uint64_t n);
+
+/* insert 'n' boxes at once. if the index is empty, the boxes are sorted
+ * (unless they already are), merged into refcounts, and the trees are built
+ * directly, without any rotations. otherwise, the boxes are inserted one by
+ * one. sides and heights within the key delta are merged like INSERTBOX of
+ * the sorted boxes does.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int boxes_bulk_load(boxes_t *boxes, const box_t *input, size_t n);
 int REMOVEBOX(boxes_t *boxes, float side, float height);
 
+/* remove 'n' boxes of the same size at once, by subtracting from the
+ * refcount of the box
+ *
+ * @return 0 on success, -1 if there are less than 'n' such boxes, and
+ * nothing is removed
+ */
+int REMOVEBOX_N(boxes_t *boxes, float side, float height, uint64_t n);
+
+/* get all the boxes in increasing order of side, then height. a box which
+ * was inserted k times appears k times. the array is allocated with malloc
+ * into *boxes_p (NULL if there are no boxes).
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int boxes_collect(boxes_t *boxes, box_t **boxes_p, size_t *n_p);
+
+/* write a binary image of the boxes to 'path' (see image.h), which a
+ * restart may load, or query in place with image_open(). updates wait
+ * while the image is built in memory, in O(n*m), but not while it is
+ * written and synced.
+ *
+ * @return 0 on success, -1 on failure with errno set
+ */
+int boxes_save(boxes_t *boxes, const char *path);
+
+/* load the boxes of an image saved by boxes_save(). if the boxes are empty,
+ * the trees are built from the sorted image directly, in O(n). otherwise,
+ * the boxes are inserted one by one.
+ *
+ * @return 0 on success, -1 on failure with errno set (EINVAL if the file is
+ * not a valid image)
+ */
+int boxes_load(boxes_t *boxes, const char *path);
+
+/* like boxes_load, from an image which was opened with image_open() */
+struct image_s;
+int boxes_load_image(boxes_t *boxes, const struct image_s *image);
+
 /* get minimal box which can contain (side,height)
+ * the box is found in the range tree of the boxes (see vtree.h), in
+ * O(log(N)^2) for N distinct boxes, whatever their sides and heights are. an
+ * update which adds or removes a distinct box keeps the range tree, in
+ * O(log(N)^2) amortized, and it takes O(N*log(N)) memory.
+ * if the range tree ran out of memory, the sides from 'side' up are scanned
+ * instead, skipping subtrees without a large enough height, until
+ * side^2*height cannot beat the best volume found, in O(n*log(m)) at worst.
  *
  * @return 0 if found, -1 if not found
  */
 int GETBOX(boxes_t *boxes, float side, float height, float *found_side_p,
            float *found_height_p);
 
+/* get the minimal box which can contain (side,height) like GETBOX, and
+ * remove it like REMOVEBOX, in one operation. the box is removed by the
+ * nodes it was found at, without searching for it again, and no update runs
+ * between finding and removing it. it is logged as a REMOVEBOX.
+ *
+ * @return 0 if found and removed, -1 if not found
+ */
+int boxes_take_best_fit(boxes_t *boxes, float side, float height,
+                        float *found_side_p, float *found_height_p);
+
 /* @return 0 if found, -1 if not found
  */
 int CHECKBOX(boxes_t *boxes, float side, float height);
 
+/* get the 'k' minimal volume boxes which can contain (side,height), in one
+ * scan of the sides like GETBOX. the boxes are in increasing order of
+ * volume, then side and height, so the first one is the box GETBOX returns,
+ * and each box has the number of times it is inserted. 'results' has room
+ * for 'k' boxes.
+ * time complexity O(s*log(n*m) + b*log(k)), for s sides and b boxes scanned
+ *
+ * @return the number of boxes found, at most 'k'
+ */
+size_t boxes_topk_fit(boxes_t *boxes, float side, float height, size_t k,
+                      box_count_t *results);
+
+/* count the boxes with side in [side_lo,side_hi] and height in
+ * [height_lo,height_hi] (up to the key delta), counting a box as many times
+ * as it is inserted. sides which have no height in range are skipped.
+ */
+uint64_t boxes_range_count(boxes_t *boxes, float side_lo, float side_hi,
+                           float height_lo, float height_hi);
+
+/* stream the boxes in a range like boxes_range_count(), in increasing order
+ * of side, then height, without collecting them. an open cursor holds the
+ * boxes locked for reading, so the boxes must not be updated until it is
+ * closed. pass INFINITY as a high bound to leave the range open.
+ *
+ * boxes_cursor_next() returns 0 and the next box, or -1 at the end.
+ */
+void boxes_cursor_open(boxes_t *boxes, boxes_cursor_t *cursor, float side_lo,
+                       float side_hi, float height_lo, float height_hi);
+int boxes_cursor_next(boxes_cursor_t *cursor, box_count_t *box);
+void boxes_cursor_close(boxes_cursor_t *cursor);
+
+/* answer 'n' GETBOX queries at once, with the same results as GETBOX.
+ * the queries are sorted by side, and answered in a single sweep of all the
+ * boxes, which is faster than separate GETBOX calls for large batches.
+ * batches which are small compared to the number of boxes are answered with
+ * separate GETBOX calls.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int boxes_getbox_batch(boxes_t *boxes, const query_t *queries, size_t n,
+                       result_t *results);
+
+/* answer 'n' CHECKBOX queries at once, only 'found' is set in the results
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int boxes_checkbox_batch(boxes_t *boxes, const query_t *queries, size_t n,
+                         result_t *results);
+
 #endif
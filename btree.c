@@ -0,0 +1,1043 @@
+/*
+ * B+-tree implementation of the tree API in trees.h, selected at build time
+ * with TREE_BTREE.
+ *
+ * Keys and values are kept in wide leaves, which are linked in key order so
+ * successors are found by stepping along a leaf. Every node takes (and is
+ * aligned to) BTREE_NODE_SIZE bytes, so the leaf of a node_t entry pointer
+ * is found by masking the pointer.
+ */
+#include "trees.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+
+#define BTREE_NODE_SIZE   512
+#define BTREE_LEAF_KEYS   28
+#define BTREE_FANOUT      30
+#define BTREE_LEAF_MIN    (BTREE_LEAF_KEYS / 2)
+#define BTREE_INNER_MIN   (BTREE_FANOUT / 2)
+
+
+typedef struct btree_inner_s btree_inner_t;
+typedef struct btree_leaf_s  btree_leaf_t;
+
+
+/* header of both leaves and inner nodes */
+struct btree_node_s {
+    btree_inner_t   *parent;
+    int             is_leaf;
+    int             num;    /* number of keys in a leaf, children in a node */
+};
+
+struct btree_leaf_s {
+    btree_node_t    hdr;
+    btree_leaf_t    *prev;
+    btree_leaf_t    *next;
+    tree_key_t      keys[BTREE_LEAF_KEYS];
+    tree_key_t      own_aug[BTREE_LEAF_KEYS];
+    tree_value_t    values[BTREE_LEAF_KEYS];
+};
+
+struct btree_inner_s {
+    btree_node_t    hdr;
+    tree_key_t      keys[BTREE_FANOUT - 1]; /* keys[i] is larger than all the
+                                               keys of children[i], and not
+                                               larger than those of i+1 */
+    tree_key_t      aug[BTREE_FANOUT];      /* maximal augmented value of
+                                               each child */
+    btree_node_t    *children[BTREE_FANOUT];
+};
+
+_Static_assert(sizeof(btree_leaf_t) <= BTREE_NODE_SIZE, "leaf too large");
+_Static_assert(sizeof(btree_inner_t) <= BTREE_NODE_SIZE, "node too large");
+
+
+/* @return nonzero if 'k' is larger or equal to 'key', up to tree_key_equal.
+ * this holds for a suffix of the keys in order.
+ */
+static int key_ge(tree_key_t k, tree_key_t key)
+{
+    return tree_key_ge(k, key);
+}
+
+static node_t *btree_entry(const btree_leaf_t *leaf, int i)
+{
+    return (node_t*)&leaf->keys[i];
+}
+
+static btree_leaf_t *btree_entry_leaf(const node_t *node)
+{
+    return (btree_leaf_t*)((uintptr_t)node & ~(uintptr_t)(BTREE_NODE_SIZE - 1));
+}
+
+static int btree_entry_index(const node_t *node)
+{
+    return (const tree_key_t*)node - btree_entry_leaf(node)->keys;
+}
+
+static btree_node_t *btree_new_node(int is_leaf)
+{
+    btree_node_t *node;
+
+    STATS_INC(STATS_NODE_ALLOCS);
+    node = aligned_alloc(BTREE_NODE_SIZE, BTREE_NODE_SIZE);
+    node->parent  = NULL;
+    node->is_leaf = is_leaf;
+    node->num     = 0;
+    if (is_leaf) {
+        ((btree_leaf_t*)node)->prev = NULL;
+        ((btree_leaf_t*)node)->next = NULL;
+    }
+    return node;
+}
+
+void tree_init(tree_t *tree)
+{
+    tree->root    = NULL;
+    tree->augment = NULL;
+    tree->pool    = NULL;
+}
+
+void tree_init_augmented(tree_t *tree, tree_augment_cb_t augment)
+{
+    tree_init(tree);
+    tree->augment = augment;
+}
+
+size_t tree_node_size(int augmented)
+{
+    return BTREE_NODE_SIZE;
+}
+
+void tree_set_pool(tree_t *tree, pool_t *pool)
+{
+    assert(tree_is_empty(tree));
+    tree->pool = pool;
+}
+
+/* free the nodes bottom up by the parent pointers, without a stack. an inner
+ * node is left for its last child that is still there, which is dropped from
+ * it, so it is freed once it has none.
+ */
+void tree_cleanup(tree_t *tree, tree_cleanup_cb_t cb)
+{
+    btree_node_t *node, *parent;
+    btree_leaf_t *leaf;
+    int i;
+
+    node = tree->root;
+    while (node != NULL) {
+        if (!node->is_leaf && node->num > 0) {
+            node = ((btree_inner_t*)node)->children[--node->num];
+            continue;
+        }
+
+        if (node->is_leaf) {
+            leaf = (btree_leaf_t*)node;
+            for (i = 0; i < node->num; ++i) {
+                cb(leaf->values[i]);
+            }
+        }
+        parent = (node->parent != NULL) ? &node->parent->hdr : NULL;
+        STATS_INC(STATS_NODE_FREES);
+        free(node);
+        node = parent;
+    }
+    tree->root = NULL;
+}
+
+int tree_is_empty(const tree_t *tree)
+{
+    return tree->root == NULL;
+}
+
+static void btree_do_print(const btree_node_t *node, int indent,
+                           tree_print_cb_t cb, const char *prefix)
+{
+    const btree_leaf_t *leaf;
+    const btree_inner_t *inner;
+    int i;
+
+    if (node->is_leaf) {
+        leaf = (const btree_leaf_t*)node;
+        for (i = 0; i < node->num; ++i) {
+            printf("%s%*s[e] %.2f\n", prefix, indent, "",
+                   tree_key_to_float(leaf->keys[i]));
+            cb(indent + 2, leaf->values[i], prefix);
+        }
+    } else {
+        inner = (const btree_inner_t*)node;
+        for (i = 0; i < node->num; ++i) {
+            if (i > 0) {
+                printf("%s%*s[k] %.2f\n", prefix, indent, "",
+                       tree_key_to_float(inner->keys[i - 1]));
+            }
+            btree_do_print(inner->children[i], indent + 2, cb, prefix);
+        }
+    }
+}
+
+void tree_print(const tree_t *tree, tree_print_cb_t cb, const char *prefix)
+{
+    if (tree->root != NULL) {
+        btree_do_print(tree->root, 0, cb, prefix);
+    }
+}
+
+/* index of the first key in the leaf which is key_ge() 'key' */
+static int btree_leaf_ub(const btree_leaf_t *leaf, tree_key_t key)
+{
+    int lo = 0, hi = leaf->hdr.num, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (key_ge(leaf->keys[mid], key)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* index of the child which may hold the first key which is key_ge() 'key'.
+ * if it does not, it is the first key of the next leaf.
+ */
+static int btree_inner_ub(const btree_inner_t *inner, tree_key_t key)
+{
+    int lo = 0, hi = inner->hdr.num - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (key_ge(inner->keys[mid], key)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* find the first entry which is key_ge() 'key'
+ * time complexity o(logn)*/
+static int btree_ub(const tree_t *tree, tree_key_t key, btree_leaf_t **leaf_p,
+                    int *index_p)
+{
+    btree_node_t *node;
+    btree_leaf_t *leaf;
+    int i;
+
+    if (tree->root == NULL) {
+        return -1;
+    }
+
+    node = tree->root;
+    while (!node->is_leaf) {
+        STATS_INC(STATS_NODES_VISITED);
+        node = ((btree_inner_t*)node)->children[
+                        btree_inner_ub((btree_inner_t*)node, key)];
+    }
+
+    STATS_INC(STATS_NODES_VISITED);
+    leaf = (btree_leaf_t*)node;
+    i    = btree_leaf_ub(leaf, key);
+    if (i == leaf->hdr.num) {
+        /* all keys of the next leaf are larger than a separator which is
+         * key_ge() 'key'
+         */
+        leaf = leaf->next;
+        i    = 0;
+        if (leaf == NULL) {
+            return -1;
+        }
+    }
+
+    *leaf_p  = leaf;
+    *index_p = i;
+    return 0;
+}
+
+int tree_search(const tree_t *tree, tree_key_t key, node_t **node_p)
+{
+    btree_leaf_t *leaf;
+    int ret, i;
+
+    /* the first key which is key_ge() 'key' is either equal to it, or any
+     * later key is even larger
+     */
+    ret = btree_ub(tree, key, &leaf, &i);
+    if (ret || !tree_key_equal(leaf->keys[i], key)) {
+        return -1; /* not found */
+    }
+
+    *node_p = btree_entry(leaf, i);
+    return 0;
+}
+
+int tree_ub(const tree_t *tree, tree_key_t key, node_t **node_p)
+{
+    btree_leaf_t *leaf;
+    int ret, i;
+
+    ret = btree_ub(tree, key, &leaf, &i);
+    if (ret) {
+        return -1;
+    }
+
+    *node_p = btree_entry(leaf, i);
+    return 0;
+}
+
+static int btree_child_index(const btree_inner_t *parent,
+                             const btree_node_t *child)
+{
+    int i;
+
+    for (i = 0; parent->children[i] != child; ++i) {
+        assert(i < parent->hdr.num);
+    }
+    return i;
+}
+
+static tree_key_t btree_node_aug(const btree_node_t *node)
+{
+    const tree_key_t *augs;
+    tree_key_t aug;
+    int i;
+
+    if (node->is_leaf) {
+        augs = ((const btree_leaf_t*)node)->own_aug;
+    } else {
+        augs = ((const btree_inner_t*)node)->aug;
+    }
+
+    aug = TREE_KEY_MIN;
+    for (i = 0; i < node->num; ++i) {
+        if (augs[i] > aug) {
+            aug = augs[i];
+        }
+    }
+    return aug;
+}
+
+/* recalculate the augmented values on the path from 'node' to the root
+ * time complexity o(logn)*/
+static void btree_augment_path(tree_t *tree, btree_node_t *node)
+{
+    btree_inner_t *parent;
+
+    if (!tree->augment) {
+        return;
+    }
+
+    for (; node->parent != NULL; node = &parent->hdr) {
+        parent = node->parent;
+        parent->aug[btree_child_index(parent, node)] = btree_node_aug(node);
+    }
+}
+
+/* add 'right', whose keys are not lower than 'key', after 'left' in the
+ * parent of 'left', splitting the parent if needed
+ */
+static void btree_insert_parent(tree_t *tree, btree_node_t *left,
+                                tree_key_t key, btree_node_t *right)
+{
+    btree_node_t *children[BTREE_FANOUT + 1];
+    tree_key_t keys[BTREE_FANOUT], augs[BTREE_FANOUT + 1];
+    btree_inner_t *parent, *sibling;
+    int idx, num, half, i;
+
+    STATS_INC(STATS_ROTATIONS); /* a split of 'left' */
+    parent = left->parent;
+    if (parent == NULL) {
+        /* left was the root - grow a new root */
+        parent = (btree_inner_t*)btree_new_node(0);
+        parent->hdr.num     = 2;
+        parent->keys[0]     = key;
+        parent->children[0] = left;
+        parent->children[1] = right;
+        parent->aug[0]      = btree_node_aug(left);
+        parent->aug[1]      = btree_node_aug(right);
+        left->parent        = parent;
+        right->parent       = parent;
+        tree->root          = &parent->hdr;
+        return;
+    }
+
+    idx = btree_child_index(parent, left);
+    num = parent->hdr.num;
+    if (num < BTREE_FANOUT) {
+        memmove(&parent->keys[idx + 1], &parent->keys[idx],
+                (num - 1 - idx) * sizeof(parent->keys[0]));
+        memmove(&parent->children[idx + 2], &parent->children[idx + 1],
+                (num - 1 - idx) * sizeof(parent->children[0]));
+        memmove(&parent->aug[idx + 2], &parent->aug[idx + 1],
+                (num - 1 - idx) * sizeof(parent->aug[0]));
+        parent->keys[idx]         = key;
+        parent->children[idx + 1] = right;
+        parent->aug[idx]          = btree_node_aug(left);
+        parent->aug[idx + 1]      = btree_node_aug(right);
+        right->parent             = parent;
+        ++parent->hdr.num;
+        btree_augment_path(tree, &parent->hdr);
+        return;
+    }
+
+    /* the parent is full - split it, half of the children move to a new
+     * sibling, and the key between the halves moves up
+     */
+    for (i = 0; i <= idx; ++i) {
+        children[i] = parent->children[i];
+        augs[i]     = parent->aug[i];
+    }
+    for (i = idx + 1; i < num; ++i) {
+        children[i + 1] = parent->children[i];
+        augs[i + 1]     = parent->aug[i];
+    }
+    children[idx + 1] = right;
+    augs[idx]         = btree_node_aug(left);
+    augs[idx + 1]     = btree_node_aug(right);
+    memcpy(keys, parent->keys, idx * sizeof(keys[0]));
+    keys[idx] = key;
+    memcpy(&keys[idx + 1], &parent->keys[idx],
+           (num - 1 - idx) * sizeof(keys[0]));
+
+    half    = (num + 1) / 2;
+    sibling = (btree_inner_t*)btree_new_node(0);
+
+    parent->hdr.num = half;
+    memcpy(parent->children, children, half * sizeof(children[0]));
+    memcpy(parent->aug, augs, half * sizeof(augs[0]));
+    memcpy(parent->keys, keys, (half - 1) * sizeof(keys[0]));
+
+    sibling->hdr.num = num + 1 - half;
+    memcpy(sibling->children, &children[half],
+           sibling->hdr.num * sizeof(children[0]));
+    memcpy(sibling->aug, &augs[half], sibling->hdr.num * sizeof(augs[0]));
+    memcpy(sibling->keys, &keys[half], (sibling->hdr.num - 1) * sizeof(keys[0]));
+
+    right->parent = parent;
+    for (i = 0; i < sibling->hdr.num; ++i) {
+        sibling->children[i]->parent = sibling;
+    }
+
+    btree_insert_parent(tree, &parent->hdr, keys[half - 1], &sibling->hdr);
+}
+
+static void btree_leaf_insert_at(btree_leaf_t *leaf, int i, tree_key_t key,
+                                 tree_key_t own_aug, tree_value_t value)
+{
+    int num = leaf->hdr.num;
+
+    memmove(&leaf->keys[i + 1], &leaf->keys[i],
+            (num - i) * sizeof(tree_key_t));
+    memmove(&leaf->own_aug[i + 1], &leaf->own_aug[i],
+            (num - i) * sizeof(tree_key_t));
+    memmove(&leaf->values[i + 1], &leaf->values[i],
+            (num - i) * sizeof(tree_value_t));
+    leaf->keys[i]    = key;
+    leaf->own_aug[i] = own_aug;
+    leaf->values[i]  = value;
+    ++leaf->hdr.num;
+}
+
+int tree_insert(tree_t *tree, tree_key_t key, tree_value_t value)
+{
+    btree_leaf_t *leaf, *right;
+    btree_node_t *node;
+    tree_key_t own_aug;
+    int i, lo, hi, half;
+
+    if (tree->root == NULL) {
+        tree->root = btree_new_node(1);
+    }
+
+    /* find the leaf by exact order, keys equal to a separator go right */
+    node = tree->root;
+    while (!node->is_leaf) {
+        lo = 0;
+        hi = node->num - 1;
+        while (lo < hi) {
+            i = (lo + hi) / 2;
+            if (key < ((btree_inner_t*)node)->keys[i]) {
+                hi = i;
+            } else {
+                lo = i + 1;
+            }
+        }
+        node = ((btree_inner_t*)node)->children[lo];
+    }
+
+    leaf = (btree_leaf_t*)node;
+    for (i = 0; (i < leaf->hdr.num) && (leaf->keys[i] < key); ++i);
+    if ((i < leaf->hdr.num) && (leaf->keys[i] == key)) {
+        return -1; /* already exists */
+    }
+
+    own_aug = tree->augment ? tree->augment(value) : TREE_KEY_MIN;
+
+    if (leaf->hdr.num < BTREE_LEAF_KEYS) {
+        btree_leaf_insert_at(leaf, i, key, own_aug, value);
+        btree_augment_path(tree, &leaf->hdr);
+        return 0;
+    }
+
+    /* the leaf is full - move its upper half to a new leaf */
+    half  = BTREE_LEAF_KEYS / 2;
+    right = (btree_leaf_t*)btree_new_node(1);
+    right->hdr.num = BTREE_LEAF_KEYS - half;
+    memcpy(right->keys, &leaf->keys[half],
+           right->hdr.num * sizeof(tree_key_t));
+    memcpy(right->own_aug, &leaf->own_aug[half],
+           right->hdr.num * sizeof(tree_key_t));
+    memcpy(right->values, &leaf->values[half],
+           right->hdr.num * sizeof(tree_value_t));
+    leaf->hdr.num = half;
+
+    if (i <= half) {
+        btree_leaf_insert_at(leaf, i, key, own_aug, value);
+    } else {
+        btree_leaf_insert_at(right, i - half, key, own_aug, value);
+    }
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != NULL) {
+        leaf->next->prev = right;
+    }
+    leaf->next = right;
+
+    btree_insert_parent(tree, &leaf->hdr, right->keys[0], &right->hdr);
+    return 0;
+}
+
+int tree_build_sorted(tree_t *tree, const tree_key_t *keys,
+                      const tree_value_t *values, size_t n)
+{
+    size_t num, num_parents, i, j, k, pos, count;
+    btree_leaf_t *leaf, *prev;
+    btree_inner_t *inner;
+    btree_node_t **level;
+    tree_key_t *mins;
+
+    if (!tree_is_empty(tree)) {
+        return -1;
+    } else if (n == 0) {
+        return 0;
+    }
+
+    /* spread the keys evenly over the leaves, so they are at least half
+     * full, and keep the lowest key of every node for the separators
+     */
+    num   = (n + BTREE_LEAF_KEYS - 1) / BTREE_LEAF_KEYS;
+    level = malloc(num * sizeof(*level));
+    mins  = malloc(num * sizeof(*mins));
+    if ((level == NULL) || (mins == NULL)) {
+        free(level);
+        free(mins);
+        return -1;
+    }
+
+    prev = NULL;
+    pos  = 0;
+    for (i = 0; i < num; ++i) {
+        count = n / num + (i < n % num);
+        leaf  = (btree_leaf_t*)btree_new_node(1);
+        leaf->hdr.num = count;
+        memcpy(leaf->keys, &keys[pos], count * sizeof(tree_key_t));
+        memcpy(leaf->values, &values[pos], count * sizeof(tree_value_t));
+        for (k = 0; k < count; ++k) {
+            leaf->own_aug[k] = tree->augment ? tree->augment(values[pos + k]) :
+                                               TREE_KEY_MIN;
+        }
+        leaf->prev = prev;
+        if (prev != NULL) {
+            prev->next = leaf;
+        }
+        prev     = leaf;
+        level[i] = &leaf->hdr;
+        mins[i]  = keys[pos];
+        pos     += count;
+    }
+
+    /* build the inner levels the same way, until a single root is left */
+    while (num > 1) {
+        num_parents = (num + BTREE_FANOUT - 1) / BTREE_FANOUT;
+        for (i = 0, j = 0; i < num_parents; ++i, j += count) {
+            count = num / num_parents + (i < num % num_parents);
+            inner = (btree_inner_t*)btree_new_node(0);
+            inner->hdr.num = count;
+            for (k = 0; k < count; ++k) {
+                inner->children[k]         = level[j + k];
+                inner->aug[k]              = btree_node_aug(level[j + k]);
+                inner->children[k]->parent = inner;
+                if (k > 0) {
+                    inner->keys[k - 1] = mins[j + k];
+                }
+            }
+            level[i] = &inner->hdr;
+            mins[i]  = mins[j];
+        }
+        num = num_parents;
+    }
+
+    tree->root = level[0];
+    free(level);
+    free(mins);
+    return 0;
+}
+
+static void btree_leaf_remove_at(btree_leaf_t *leaf, int i)
+{
+    int num = leaf->hdr.num;
+
+    memmove(&leaf->keys[i], &leaf->keys[i + 1],
+            (num - i - 1) * sizeof(tree_key_t));
+    memmove(&leaf->own_aug[i], &leaf->own_aug[i + 1],
+            (num - i - 1) * sizeof(tree_key_t));
+    memmove(&leaf->values[i], &leaf->values[i + 1],
+            (num - i - 1) * sizeof(tree_value_t));
+    --leaf->hdr.num;
+}
+
+/* remove separator 'i' and child 'i+1' from an inner node */
+static void btree_inner_remove_at(btree_inner_t *inner, int i)
+{
+    int num = inner->hdr.num;
+
+    memmove(&inner->keys[i], &inner->keys[i + 1],
+            (num - i - 2) * sizeof(inner->keys[0]));
+    memmove(&inner->children[i + 1], &inner->children[i + 2],
+            (num - i - 2) * sizeof(inner->children[0]));
+    memmove(&inner->aug[i + 1], &inner->aug[i + 2],
+            (num - i - 2) * sizeof(inner->aug[0]));
+    --inner->hdr.num;
+}
+
+/* move the last entry/child of children[idx-1] to the front of children[idx] */
+static void btree_borrow_left(btree_inner_t *parent, int idx)
+{
+    btree_node_t *node = parent->children[idx];
+    btree_node_t *left = parent->children[idx - 1];
+    btree_leaf_t *leaf, *left_leaf;
+    btree_inner_t *inner, *left_inner;
+    int num = node->num;
+
+    STATS_INC(STATS_ROTATIONS);
+    if (node->is_leaf) {
+        leaf      = (btree_leaf_t*)node;
+        left_leaf = (btree_leaf_t*)left;
+        btree_leaf_insert_at(leaf, 0, left_leaf->keys[left->num - 1],
+                             left_leaf->own_aug[left->num - 1],
+                             left_leaf->values[left->num - 1]);
+        --left->num;
+        parent->keys[idx - 1] = leaf->keys[0];
+    } else {
+        inner      = (btree_inner_t*)node;
+        left_inner = (btree_inner_t*)left;
+        memmove(&inner->keys[1], &inner->keys[0],
+                (num - 1) * sizeof(inner->keys[0]));
+        memmove(&inner->children[1], &inner->children[0],
+                num * sizeof(inner->children[0]));
+        memmove(&inner->aug[1], &inner->aug[0], num * sizeof(inner->aug[0]));
+        inner->keys[0]         = parent->keys[idx - 1];
+        inner->children[0]     = left_inner->children[left->num - 1];
+        inner->aug[0]          = left_inner->aug[left->num - 1];
+        parent->keys[idx - 1]  = left_inner->keys[left->num - 2];
+        inner->children[0]->parent = inner;
+        ++node->num;
+        --left->num;
+    }
+
+    parent->aug[idx - 1] = btree_node_aug(left);
+    parent->aug[idx]     = btree_node_aug(node);
+}
+
+/* move the first entry/child of children[idx+1] to the end of children[idx] */
+static void btree_borrow_right(btree_inner_t *parent, int idx)
+{
+    btree_node_t *node  = parent->children[idx];
+    btree_node_t *right = parent->children[idx + 1];
+    btree_leaf_t *leaf, *right_leaf;
+    btree_inner_t *inner, *right_inner;
+    int num = node->num;
+
+    STATS_INC(STATS_ROTATIONS);
+    if (node->is_leaf) {
+        leaf       = (btree_leaf_t*)node;
+        right_leaf = (btree_leaf_t*)right;
+        btree_leaf_insert_at(leaf, num, right_leaf->keys[0],
+                             right_leaf->own_aug[0], right_leaf->values[0]);
+        btree_leaf_remove_at(right_leaf, 0);
+        parent->keys[idx] = right_leaf->keys[0];
+    } else {
+        inner       = (btree_inner_t*)node;
+        right_inner = (btree_inner_t*)right;
+        inner->keys[num - 1]     = parent->keys[idx];
+        inner->children[num]     = right_inner->children[0];
+        inner->aug[num]          = right_inner->aug[0];
+        inner->children[num]->parent = inner;
+        parent->keys[idx]        = right_inner->keys[0];
+        memmove(&right_inner->keys[0], &right_inner->keys[1],
+                (right->num - 2) * sizeof(right_inner->keys[0]));
+        memmove(&right_inner->children[0], &right_inner->children[1],
+                (right->num - 1) * sizeof(right_inner->children[0]));
+        memmove(&right_inner->aug[0], &right_inner->aug[1],
+                (right->num - 1) * sizeof(right_inner->aug[0]));
+        ++node->num;
+        --right->num;
+    }
+
+    parent->aug[idx]     = btree_node_aug(node);
+    parent->aug[idx + 1] = btree_node_aug(right);
+}
+
+/* merge children[idx+1] into children[idx] and release it */
+static void btree_merge(btree_inner_t *parent, int idx)
+{
+    btree_node_t *left  = parent->children[idx];
+    btree_node_t *right = parent->children[idx + 1];
+    btree_leaf_t *left_leaf, *right_leaf;
+    btree_inner_t *left_inner, *right_inner;
+    int i;
+
+    STATS_INC(STATS_ROTATIONS);
+    if (left->is_leaf) {
+        left_leaf  = (btree_leaf_t*)left;
+        right_leaf = (btree_leaf_t*)right;
+        memcpy(&left_leaf->keys[left->num], right_leaf->keys,
+               right->num * sizeof(tree_key_t));
+        memcpy(&left_leaf->own_aug[left->num], right_leaf->own_aug,
+               right->num * sizeof(tree_key_t));
+        memcpy(&left_leaf->values[left->num], right_leaf->values,
+               right->num * sizeof(tree_value_t));
+        left_leaf->next = right_leaf->next;
+        if (right_leaf->next != NULL) {
+            right_leaf->next->prev = left_leaf;
+        }
+    } else {
+        left_inner  = (btree_inner_t*)left;
+        right_inner = (btree_inner_t*)right;
+        left_inner->keys[left->num - 1] = parent->keys[idx];
+        memcpy(&left_inner->keys[left->num], right_inner->keys,
+               (right->num - 1) * sizeof(tree_key_t));
+        memcpy(&left_inner->aug[left->num], right_inner->aug,
+               right->num * sizeof(tree_key_t));
+        for (i = 0; i < right->num; ++i) {
+            left_inner->children[left->num + i] = right_inner->children[i];
+            right_inner->children[i]->parent    = left_inner;
+        }
+    }
+
+    left->num += right->num;
+    STATS_INC(STATS_NODE_FREES);
+    free(right);
+
+    btree_inner_remove_at(parent, idx);
+    parent->aug[idx] = btree_node_aug(left);
+}
+
+/* restore the minimal fill of 'node' after a removal from it */
+static void btree_rebalance(tree_t *tree, btree_node_t *node)
+{
+    btree_inner_t *parent;
+    int idx, min;
+
+    parent = node->parent;
+    if (parent == NULL) {
+        /* the root may have less entries, but shrinks when left with none
+         * or with a single child
+         */
+        if (node->is_leaf && (node->num == 0)) {
+            tree->root = NULL;
+            STATS_INC(STATS_NODE_FREES);
+            free(node);
+        } else if (!node->is_leaf && (node->num == 1)) {
+            tree->root = ((btree_inner_t*)node)->children[0];
+            tree->root->parent = NULL;
+            STATS_INC(STATS_NODE_FREES);
+            free(node);
+        }
+        return;
+    }
+
+    min = node->is_leaf ? BTREE_LEAF_MIN : BTREE_INNER_MIN;
+    if (node->num >= min) {
+        btree_augment_path(tree, node);
+        return;
+    }
+
+    idx = btree_child_index(parent, node);
+    if ((idx > 0) && (parent->children[idx - 1]->num > min)) {
+        btree_borrow_left(parent, idx);
+        btree_augment_path(tree, &parent->hdr);
+    } else if ((idx < parent->hdr.num - 1) &&
+               (parent->children[idx + 1]->num > min)) {
+        btree_borrow_right(parent, idx);
+        btree_augment_path(tree, &parent->hdr);
+    } else {
+        btree_merge(parent, (idx > 0) ? (idx - 1) : idx);
+        btree_rebalance(tree, &parent->hdr);
+    }
+}
+
+void tree_delete(tree_t *tree, node_t *node)
+{
+    btree_leaf_t *leaf = btree_entry_leaf(node);
+
+    btree_leaf_remove_at(leaf, btree_entry_index(node));
+    btree_rebalance(tree, &leaf->hdr);
+}
+
+tree_key_t tree_node_get_key(node_t *node)
+{
+    return btree_entry_leaf(node)->keys[btree_entry_index(node)];
+}
+
+tree_value_t tree_node_get_value(node_t *node)
+{
+    return btree_entry_leaf(node)->values[btree_entry_index(node)];
+}
+
+void tree_node_set_value(node_t *node, tree_value_t value)
+{
+    btree_entry_leaf(node)->values[btree_entry_index(node)] = value;
+}
+
+int tree_successor(const tree_t *tree, node_t **node_p)
+{
+    btree_leaf_t *leaf = btree_entry_leaf(*node_p);
+    int i = btree_entry_index(*node_p);
+
+    STATS_INC(STATS_SUCCESSOR_STEPS);
+    if (i + 1 < leaf->hdr.num) {
+        *node_p = btree_entry(leaf, i + 1);
+        return 0;
+    } else if (leaf->next != NULL) {
+        *node_p = btree_entry(leaf->next, 0);
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+int tree_predecessor(const tree_t *tree, node_t **node_p)
+{
+    btree_leaf_t *leaf = btree_entry_leaf(*node_p);
+    int i = btree_entry_index(*node_p);
+
+    if (i > 0) {
+        *node_p = btree_entry(leaf, i - 1);
+        return 0;
+    } else if (leaf->prev != NULL) {
+        *node_p = btree_entry(leaf->prev, leaf->prev->hdr.num - 1);
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+size_t tree_depth(const tree_t *tree)
+{
+    const btree_node_t *node;
+    size_t depth;
+
+    depth = 0;
+    for (node = tree->root; node != NULL;
+         node = node->is_leaf ? NULL : ((btree_inner_t*)node)->children[0]) {
+        ++depth;
+    }
+    return depth;
+}
+
+int tree_last(const tree_t *tree, node_t **node_p)
+{
+    btree_node_t *node;
+
+    if (tree->root == NULL) {
+        return -1;
+    }
+
+    node = tree->root;
+    while (!node->is_leaf) {
+        node = ((btree_inner_t*)node)->children[node->num - 1];
+    }
+
+    *node_p = btree_entry((btree_leaf_t*)node, node->num - 1);
+    return 0;
+}
+
+void tree_augment_update(tree_t *tree, node_t *node)
+{
+    btree_leaf_t *leaf = btree_entry_leaf(node);
+    int i = btree_entry_index(node);
+
+    if (!tree->augment) {
+        return;
+    }
+
+    leaf->own_aug[i] = tree->augment(leaf->values[i]);
+    btree_augment_path(tree, &leaf->hdr);
+}
+
+/* find the first entry under 'node' whose own augmented value is at least
+ * 'min'. the augmented value of node must be at least 'min'.
+ */
+static node_t *btree_first_augmented(const btree_node_t *node, tree_key_t min)
+{
+    const btree_inner_t *inner;
+    const btree_leaf_t *leaf;
+    int i;
+
+    while (!node->is_leaf) {
+        STATS_INC(STATS_NODES_VISITED);
+        inner = (const btree_inner_t*)node;
+        for (i = 0; !tree_key_ge(inner->aug[i], min); ++i) {
+            assert(i < node->num);
+        }
+        node = inner->children[i];
+    }
+
+    STATS_INC(STATS_NODES_VISITED);
+    leaf = (const btree_leaf_t*)node;
+    for (i = 0; !tree_key_ge(leaf->own_aug[i], min); ++i) {
+        assert(i < node->num);
+    }
+    return btree_entry(leaf, i);
+}
+
+static node_t *btree_do_ub_augmented(const btree_node_t *node, tree_key_t key,
+                                     tree_key_t min)
+{
+    const btree_inner_t *inner;
+    const btree_leaf_t *leaf;
+    node_t *found;
+    int i, first;
+
+    STATS_INC(STATS_NODES_VISITED);
+    if (node->is_leaf) {
+        leaf = (const btree_leaf_t*)node;
+        for (i = btree_leaf_ub(leaf, key); i < node->num; ++i) {
+            if (tree_key_ge(leaf->own_aug[i], min)) {
+                return btree_entry(leaf, i);
+            }
+        }
+        return NULL;
+    }
+
+    /* all keys in the children after 'first' are in range */
+    inner = (const btree_inner_t*)node;
+    first = btree_inner_ub(inner, key);
+    for (i = first; i < node->num; ++i) {
+        if (!tree_key_ge(inner->aug[i], min)) {
+            continue;
+        } else if (i > first) {
+            return btree_first_augmented(inner->children[i], min);
+        }
+
+        found = btree_do_ub_augmented(inner->children[i], key, min);
+        if (found != NULL) {
+            return found;
+        }
+    }
+    return NULL;
+}
+
+int tree_ub_augmented(const tree_t *tree, tree_key_t key, tree_key_t min,
+                      node_t **node_p)
+{
+    node_t *node;
+
+    assert(tree->augment != NULL);
+
+    if (tree->root == NULL) {
+        return -1;
+    }
+
+    node = btree_do_ub_augmented(tree->root, key, min);
+    if (node == NULL) {
+        return -1;
+    }
+
+    *node_p = node;
+    return 0;
+}
+
+int tree_successor_augmented(const tree_t *tree, tree_key_t min,
+                             node_t **node_p)
+{
+    btree_leaf_t *leaf = btree_entry_leaf(*node_p);
+    btree_inner_t *parent;
+    btree_node_t *child;
+    int i;
+
+    assert(tree->augment != NULL);
+
+    STATS_INC(STATS_SUCCESSOR_STEPS);
+    for (i = btree_entry_index(*node_p) + 1; i < leaf->hdr.num; ++i) {
+        if (tree_key_ge(leaf->own_aug[i], min)) {
+            *node_p = btree_entry(leaf, i);
+            return 0;
+        }
+    }
+
+    /* climb up, looking for a later subtree with a large enough value */
+    for (child = &leaf->hdr; child->parent != NULL; child = &parent->hdr) {
+        parent = child->parent;
+        for (i = btree_child_index(parent, child) + 1; i < parent->hdr.num;
+             ++i) {
+            if (tree_key_ge(parent->aug[i], min)) {
+                *node_p = btree_first_augmented(parent->children[i], min);
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+int tree_last_augmented(const tree_t *tree, tree_key_t min, node_t **node_p)
+{
+    const btree_inner_t *inner;
+    const btree_leaf_t *leaf;
+    const btree_node_t *node;
+    int i;
+
+    assert(tree->augment != NULL);
+
+    if ((tree->root == NULL) ||
+        !tree_key_ge(btree_node_aug(tree->root), min)) {
+        return -1;
+    }
+
+    node = tree->root;
+    while (!node->is_leaf) {
+        STATS_INC(STATS_NODES_VISITED);
+        inner = (const btree_inner_t*)node;
+        for (i = node->num - 1; !tree_key_ge(inner->aug[i], min); --i) {
+            assert(i > 0);
+        }
+        node = inner->children[i];
+    }
+
+    STATS_INC(STATS_NODES_VISITED);
+    leaf = (const btree_leaf_t*)node;
+    for (i = node->num - 1; !tree_key_ge(leaf->own_aug[i], min); --i) {
+        assert(i > 0);
+    }
+    *node_p = btree_entry(leaf, i);
+    return 0;
+}
+
+int tree_has_augmented(const tree_t *tree, tree_key_t key, tree_key_t min)
+{
+    node_t *node;
+
+    return tree_ub_augmented(tree, key, min, &node);
+}
@@ -0,0 +1,583 @@
+#include "image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define IMAGE_X86_64
+#endif
+
+
+/* sections are aligned to this many bytes */
+#define IMAGE_ALIGN(_size) (((_size) + 7) & ~(size_t)7)
+
+
+/* offsets of the sections of an image */
+typedef struct image_layout_s {
+    size_t  side_keys;
+    size_t  height_starts;
+    size_t  max_heights;
+    size_t  height_keys;
+    size_t  counts;
+    size_t  size;
+} image_layout_t;
+
+
+typedef uint32_t (*image_crc_func_t)(uint32_t crc, const uint8_t *buf,
+                                     size_t len);
+
+static uint32_t image_crc_table[256];
+static image_crc_func_t image_crc_kernel;
+static pthread_once_t image_crc_once = PTHREAD_ONCE_INIT;
+
+
+static tree_key_t image_key_max(tree_key_t k1, tree_key_t k2)
+{
+    return (k1 > k2) ? k1 : k2;
+}
+
+static uint32_t image_crc_table_kernel(uint32_t crc, const uint8_t *buf,
+                                       size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        crc = image_crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef IMAGE_X86_64
+__attribute__((target("sse4.2")))
+static uint32_t image_crc_sse42_kernel(uint32_t crc, const uint8_t *buf,
+                                       size_t len)
+{
+    uint64_t crc64, word;
+    size_t i;
+
+    crc64 = crc;
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, buf + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; i < len; ++i) {
+        crc = _mm_crc32_u8(crc, buf[i]);
+    }
+    return crc;
+}
+#endif
+
+/* build the table, and select the CRC instruction if the CPU has it */
+static void image_crc_init(void)
+{
+    uint32_t crc;
+    int i, bit;
+
+    for (i = 0; i < 256; ++i) {
+        crc = i;
+        for (bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+        }
+        image_crc_table[i] = crc;
+    }
+
+    image_crc_kernel = image_crc_table_kernel;
+#ifdef IMAGE_X86_64
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        image_crc_kernel = image_crc_sse42_kernel;
+    }
+#endif
+}
+
+uint32_t image_checksum(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&image_crc_once, image_crc_init);
+    return ~image_crc_kernel(~crc, buf, len);
+}
+
+static void image_layout(image_layout_t *layout, size_t num_sides,
+                         size_t num_heights, size_t tree_size)
+{
+    layout->side_keys     = IMAGE_ALIGN(sizeof(image_header_t));
+    layout->height_starts = layout->side_keys +
+                            IMAGE_ALIGN(num_sides * sizeof(tree_key_t));
+    layout->max_heights   = layout->height_starts +
+                            (num_sides + 1) * sizeof(uint64_t);
+    layout->height_keys   = layout->max_heights +
+                            IMAGE_ALIGN(2 * tree_size * sizeof(tree_key_t));
+    layout->counts        = layout->height_keys +
+                            IMAGE_ALIGN(num_heights * sizeof(tree_key_t));
+    layout->size          = layout->counts +
+                            IMAGE_ALIGN(num_heights * sizeof(uint64_t));
+}
+
+/* point the sections of the image into its data */
+static void image_set_sections(image_t *image, const uint8_t *data)
+{
+    const image_header_t *header = (const image_header_t*)data;
+    image_layout_t layout;
+
+    image->header      = header;
+    image->num_sides   = header->num_sides;
+    image->num_heights = header->num_heights;
+    image->tree_size   = header->tree_size;
+
+    image_layout(&layout, image->num_sides, image->num_heights,
+                 image->tree_size);
+    image->side_keys     = (const tree_key_t*)(data + layout.side_keys);
+    image->height_starts = (const uint64_t*)(data + layout.height_starts);
+    image->max_heights   = (const tree_key_t*)(data + layout.max_heights);
+    image->height_keys   = (const tree_key_t*)(data + layout.height_keys);
+    image->counts        = (const uint64_t*)(data + layout.counts);
+}
+
+/*fill the sections of the image from the trees
+ * time complexity o(n*m)*/
+static void image_fill(uint8_t *data, const tree_t *sidetree)
+{
+    const image_header_t *header = (const image_header_t*)data;
+    node_t *side_node, *height_node;
+    size_t num_sides, num_heights, start, i;
+    tree_key_t *side_keys, *max_heights, *height_keys;
+    const tree_t *height_tree;
+    uint64_t *height_starts, *counts, count;
+    image_t image;
+
+    /* the sections of a new image are writable */
+    image_set_sections(&image, data);
+    side_keys     = (tree_key_t*)image.side_keys;
+    height_starts = (uint64_t*)image.height_starts;
+    max_heights   = (tree_key_t*)image.max_heights;
+    height_keys   = (tree_key_t*)image.height_keys;
+    counts        = (uint64_t*)image.counts;
+
+    num_sides   = 0;
+    num_heights = 0;
+    if (!tree_ub(sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (const tree_t*)tree_node_get_value(side_node).ptr;
+            start       = num_heights;
+            if (tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                continue;
+            }
+
+            /* heights with a refcount of 0 are tombstones of the boxes,
+             * which are not saved
+             */
+            do {
+                count = tree_node_get_value(height_node).count;
+                if (count > 0) {
+                    height_keys[num_heights] = tree_node_get_key(height_node);
+                    counts[num_heights]      = count;
+                    ++num_heights;
+                }
+            } while (!tree_successor(height_tree, &height_node));
+            if (num_heights == start) {
+                continue;
+            }
+
+            side_keys[num_sides]     = tree_node_get_key(side_node);
+            height_starts[num_sides] = start;
+
+            /* heights are in order, so the last one is the maximal */
+            max_heights[header->tree_size + num_sides] =
+                    height_keys[num_heights - 1];
+            ++num_sides;
+        } while (!tree_successor(sidetree, &side_node));
+    }
+    height_starts[num_sides] = num_heights;
+
+    for (i = header->tree_size + num_sides; i < 2 * header->tree_size; ++i) {
+        max_heights[i] = TREE_KEY_MIN;
+    }
+    for (i = header->tree_size - 1; i > 0; --i) {
+        max_heights[i] = image_key_max(max_heights[2 * i],
+                                       max_heights[2 * i + 1]);
+    }
+    max_heights[0] = TREE_KEY_MIN; /* unused */
+}
+
+static int image_write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+uint8_t *image_build(const tree_t *sidetree, uint64_t lsn, size_t *size_p)
+{
+    node_t *side_node, *height_node;
+    size_t num_sides, num_heights, tree_size;
+    const tree_t *height_tree;
+    image_header_t *header;
+    image_layout_t layout;
+    uint64_t num_boxes, count;
+    int has_heights;
+    uint8_t *data;
+
+    /* count the sides and heights */
+    num_sides   = 0;
+    num_heights = 0;
+    num_boxes   = 0;
+    if (!tree_ub(sidetree, TREE_KEY_MIN, &side_node)) {
+        do {
+            height_tree = (const tree_t*)tree_node_get_value(side_node).ptr;
+            if (tree_ub(height_tree, TREE_KEY_MIN, &height_node)) {
+                continue;
+            }
+            has_heights = 0;
+            do {
+                count = tree_node_get_value(height_node).count;
+                if (count > 0) {
+                    has_heights = 1;
+                    ++num_heights;
+                    num_boxes += count;
+                }
+            } while (!tree_successor(height_tree, &height_node));
+            num_sides += has_heights;
+        } while (!tree_successor(sidetree, &side_node));
+    }
+
+    for (tree_size = 1; tree_size < num_sides; tree_size *= 2);
+    image_layout(&layout, num_sides, num_heights, tree_size);
+
+    data = calloc(1, layout.size); /* zeroed, so is the padding */
+    if (data == NULL) {
+        return NULL;
+    }
+
+    header = (image_header_t*)data;
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version     = IMAGE_VERSION;
+    header->header_size = sizeof(*header);
+    header->num_sides   = num_sides;
+    header->num_heights = num_heights;
+    header->tree_size   = tree_size;
+    header->num_boxes   = num_boxes;
+    header->size        = layout.size;
+    header->lsn         = lsn;
+    header->key_scale   = IMAGE_KEY_SCALE;
+
+    image_fill(data, sidetree);
+    *size_p = layout.size;
+    return data;
+}
+
+int image_write(uint8_t *data, size_t size, const char *path)
+{
+    image_header_t *header = (image_header_t*)data;
+    char *tmp_path;
+    int fd, saved_errno;
+
+    tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp_path == NULL) {
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    header->checksum = image_checksum(0, data + sizeof(*header),
+                                      size - sizeof(*header));
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        goto out_free;
+    }
+    if (image_write_all(fd, data, size) || fsync(fd)) {
+        saved_errno = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = saved_errno;
+        goto out_free;
+    }
+    if (close(fd) || rename(tmp_path, path)) {
+        saved_errno = errno;
+        unlink(tmp_path);
+        errno = saved_errno;
+        goto out_free;
+    }
+    free(tmp_path);
+    return 0;
+
+out_free:
+    free(tmp_path);
+    return -1;
+}
+
+/* check the header, which is in a file of 'size' bytes */
+static int image_check_header(const image_header_t *header, size_t size)
+{
+    image_layout_t layout;
+
+    if ((size < sizeof(*header)) ||
+        memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) ||
+        (header->version != IMAGE_VERSION) ||
+        (header->header_size != sizeof(*header)) ||
+        (header->size != size) || (header->key_scale != IMAGE_KEY_SCALE)) {
+        return -1;
+    }
+
+    /* the counts must fit the size before computing the layout from them */
+    if ((header->num_sides > size) || (header->num_heights > size) ||
+        (header->tree_size > size) ||
+        (header->tree_size < header->num_sides) ||
+        (header->tree_size & (header->tree_size - 1))) {
+        return -1;
+    }
+
+    image_layout(&layout, header->num_sides, header->num_heights,
+                 header->tree_size);
+    return (layout.size == size) ? 0 : -1;
+}
+
+/*check the structure of the sections, which the checksum does not: the
+ * heights of each side are a non-empty range of the height keys, the keys
+ * are increasing, the counts are positive and add up to the header's, and
+ * the implicit tree has the maximal heights. readers index the sections
+ * and build trees from them without checking.
+ * time complexity O(n*m)*/
+static int image_check_sections(const image_t *image)
+{
+    uint64_t num_boxes;
+    size_t i, j;
+
+    if ((image->height_starts[0] != 0) ||
+        (image->height_starts[image->num_sides] != image->num_heights)) {
+        return -1;
+    }
+
+    num_boxes = 0;
+    for (i = 0; i < image->num_sides; ++i) {
+        /* sides without heights are not saved */
+        if (image->height_starts[i + 1] <= image->height_starts[i]) {
+            return -1;
+        } else if ((i > 0) &&
+                   !(image->side_keys[i - 1] < image->side_keys[i])) {
+            return -1; /* also NaN */
+        }
+
+        for (j = image->height_starts[i]; j < image->height_starts[i + 1];
+             ++j) {
+            if (((j > image->height_starts[i]) &&
+                 !(image->height_keys[j - 1] < image->height_keys[j])) ||
+                (image->counts[j] == 0) ||
+                (image->counts[j] > UINT64_MAX - num_boxes)) {
+                return -1;
+            }
+            num_boxes += image->counts[j];
+        }
+
+        if (image->max_heights[image->tree_size + i] !=
+            image->height_keys[image->height_starts[i + 1] - 1]) {
+            return -1;
+        }
+    }
+    if (num_boxes != image->header->num_boxes) {
+        return -1;
+    }
+
+    for (i = image->tree_size + image->num_sides; i < 2 * image->tree_size;
+         ++i) {
+        if (image->max_heights[i] != TREE_KEY_MIN) {
+            return -1;
+        }
+    }
+    for (i = image->tree_size - 1; i > 0; --i) {
+        if (image->max_heights[i] !=
+            image_key_max(image->max_heights[2 * i],
+                          image->max_heights[2 * i + 1])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int image_open(image_t *image, const char *path)
+{
+    const image_header_t *header;
+    struct stat st;
+    int fd, saved_errno;
+    void *map;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st)) {
+        goto out_close;
+    }
+    if ((size_t)st.st_size < sizeof(*header)) {
+        errno = EINVAL;
+        goto out_close;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        goto out_close;
+    }
+    close(fd);
+
+    header = map;
+    if (image_check_header(header, st.st_size) ||
+        (header->checksum !=
+         image_checksum(0, (const uint8_t*)map + sizeof(*header),
+                        st.st_size - sizeof(*header)))) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    image->map      = map;
+    image->map_size = st.st_size;
+    image_set_sections(image, map);
+    if (image_check_sections(image)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+
+out_close:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+void image_close(image_t *image)
+{
+    munmap(image->map, image->map_size);
+    image->map = NULL;
+}
+
+/* lowest index in keys[start,end) with a key larger or equal to 'key', up
+ * to tree_key_equal, or 'end' if there is none
+ */
+static size_t image_lb(const tree_key_t *keys, size_t start, size_t end,
+                       tree_key_t key)
+{
+    size_t mid;
+
+    while (start < end) {
+        mid = start + (end - start) / 2;
+        if (tree_key_ge(keys[mid], key)) {
+            end = mid;
+        } else {
+            start = mid + 1;
+        }
+    }
+    return start;
+}
+
+/*lowest side from index 'i' whose maximal height is large enough, or
+ * num_sides if there is none
+ * time complexity O(log(n))*/
+static size_t image_next_side(const image_t *image, size_t i,
+                              tree_key_t height)
+{
+    const tree_key_t *max_heights = image->max_heights;
+    size_t x;
+
+    if (i >= image->num_sides) {
+        return image->num_sides;
+    }
+
+    x = image->tree_size + i;
+    for (;;) {
+        if (tree_key_ge(max_heights[x], height)) {
+            if (x >= image->tree_size) {
+                return x - image->tree_size;
+            }
+            x = 2 * x; /* the first side is in the left child, if any */
+            continue;
+        }
+
+        /* climb over right children, and go to the next subtree */
+        while (x & 1) {
+            x >>= 1;
+        }
+        if (x == 0) {
+            return image->num_sides; /* climbed from the root */
+        }
+        ++x;
+    }
+}
+
+/*like boxes_find_ub, on the image
+ * time complexity O(k*log(n*m)), k being the number of sides scanned*/
+int image_getbox(const image_t *image, float side, float height,
+                 float *found_side_p, float *found_height_p)
+{
+    float found_side, found_height, volume, min_volume;
+    float min_height;
+    tree_key_t side_key, height_key;
+    size_t i, j, end;
+    int is_found;
+
+    side_key   = tree_key_from_float(side);
+    height_key = tree_key_from_float(height);
+
+    /* lowest height which the search may find, with the key tolerance */
+    min_height = tree_key_to_float(height_key) - 2 * TREE_KEY_TOLERANCE;
+
+    is_found   = 0;
+    min_volume = INFINITY;
+    i = image_lb(image->side_keys, 0, image->num_sides, side_key);
+    for (i = image_next_side(image, i, height_key); i < image->num_sides;
+         i = image_next_side(image, i + 1, height_key)) {
+        found_side = tree_key_to_float(image->side_keys[i]);
+        if (is_found && (found_side >= 0) && (min_height >= 0) &&
+            (found_side * found_side * min_height >= min_volume)) {
+            break; /* remaining sides are too big to have a lower volume */
+        }
+
+        end = image->height_starts[i + 1];
+        j   = image_lb(image->height_keys, image->height_starts[i], end,
+                       height_key);
+        if (j == end) {
+            continue;
+        }
+
+        found_height = tree_key_to_float(image->height_keys[j]);
+        volume       = found_side * found_side * found_height;
+        if (!is_found || (volume < min_volume)) {
+            min_volume      = volume;
+            *found_side_p   = found_side;
+            *found_height_p = found_height;
+            is_found        = 1;
+        }
+    }
+
+    return is_found ? 0 : -1;
+}
+
+int image_checkbox(const image_t *image, float side, float height)
+{
+    size_t i;
+
+    i = image_lb(image->side_keys, 0, image->num_sides,
+                 tree_key_from_float(side));
+    return (image_next_side(image, i, tree_key_from_float(height)) <
+            image->num_sides) ? 0 : -1;
+}
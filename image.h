@@ -0,0 +1,121 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include "trees.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define IMAGE_MAGIC     "BOXIMAGE"
+#define IMAGE_VERSION   3
+
+/* header->key_scale of the images of this build, see tree_key_t */
+#ifdef TREE_INT_KEYS
+#define IMAGE_KEY_SCALE TREE_KEY_SCALE
+#else
+#define IMAGE_KEY_SCALE 0
+#endif
+
+
+/*
+ * Header of a binary image of the boxes, in host byte order.
+ * The header is followed by these sections, each aligned to 8 bytes:
+ *
+ *   tree_key_t  side_keys[num_sides]         increasing
+ *   uint64_t    height_starts[num_sides + 1] first height of each side
+ *   tree_key_t  max_heights[2 * tree_size]   implicit tree of the maximal
+ *                                            height of the sides, see below
+ *   tree_key_t  height_keys[num_heights]     increasing within each side
+ *   uint64_t    counts[num_heights]          refcounts of the heights
+ *
+ * max_heights[tree_size + i] is the maximal height of side i (TREE_KEY_MIN
+ * past the last side), and max_heights[i] the maximum of its two children
+ * 2*i and 2*i+1, like the augmented side tree. Keys are floats, or integers
+ * if the image was saved with integer keys (key_scale is not 0), and an
+ * image is only opened by a build with the same keys.
+ */
+typedef struct image_header_s {
+    char        magic[8];       /* IMAGE_MAGIC, not terminated */
+    uint32_t    version;        /* IMAGE_VERSION */
+    uint32_t    header_size;    /* sizeof(image_header_t) */
+    uint64_t    num_sides;
+    uint64_t    num_heights;
+    uint64_t    tree_size;      /* power of 2, at least num_sides */
+    uint64_t    num_boxes;      /* sum of the counts */
+    uint64_t    size;           /* of the whole image */
+    uint64_t    lsn;            /* last update of the write-ahead log which
+                                 * the image includes, 0 if none */
+    uint32_t    checksum;       /* CRC-32C of everything after the header */
+    uint32_t    key_scale;      /* IMAGE_KEY_SCALE */
+} image_header_t;
+
+
+/*
+ * Image mapped to memory, which answers queries in place, read-only
+ */
+typedef struct image_s {
+    void                  *map;
+    size_t                map_size;
+    const image_header_t  *header;
+    size_t                num_sides;
+    size_t                num_heights;
+    size_t                tree_size;
+    const tree_key_t      *side_keys;
+    const uint64_t        *height_starts;
+    const tree_key_t      *max_heights;
+    const tree_key_t      *height_keys;
+    const uint64_t        *counts;
+} image_t;
+
+
+/*
+ * build an image of a side tree of the boxes (augmented with the maximal
+ * height, and whose values are height trees of refcounts) in memory, which
+ * includes the updates of the write-ahead log up to 'lsn'. only the build
+ * reads the trees, so they may change while the image is written.
+ * returns the image of '*size_p' bytes, which the caller frees, or NULL if
+ * out of memory
+ */
+uint8_t *image_build(const tree_t *sidetree, uint64_t lsn, size_t *size_p);
+
+
+/*
+ * write an image built by image_build() to 'path', with its checksum.
+ * the image is written to a temporary file, which then replaces 'path'.
+ * returns 0 on success, -1 on failure with errno set
+ */
+int image_write(uint8_t *data, size_t size, const char *path);
+
+
+/*
+ * map the image at 'path', and check its header, checksum and sections
+ * returns 0 on success, -1 on failure with errno set (EINVAL if the file is
+ * not a valid image)
+ */
+int image_open(image_t *image, const char *path);
+
+
+/*
+ * unmap the image
+ */
+void image_close(image_t *image);
+
+
+/*
+ * GETBOX and CHECKBOX of the boxes in the image, with the same results as
+ * on the boxes it was saved from
+ * time complexity O(k*log(n*m)) and O(log(n)), like the boxes
+ */
+int image_getbox(const image_t *image, float side, float height,
+                 float *found_side_p, float *found_height_p);
+int image_checkbox(const image_t *image, float side, float height);
+
+
+/*
+ * CRC-32C of a buffer, continuing from 'crc' (0 for the first buffer)
+ */
+uint32_t image_checksum(uint32_t crc, const void *buf, size_t len);
+
+
+#endif
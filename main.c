@@ -1,94 +1,162 @@
 #include "trees.h"
 #include "boxes.h"
+#include "parser.h"
+#include "output.h"
+#include "replay.h"
+#include "wal.h"
 #include "util.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
 
 #define MAXLINE 100
 
-/*
- * parse a command with two floating-point arguments
- * syntax: "<command>(<arg1>,<arg2>)"
- * the length of command must be al least the length of the line
- */
-static int parse_line(const char *line, char *command, float *arg1_p, float *arg2_p)
-{
-    const char *p;
-    int ret;
-
-    p = line;
-
-    /* read until '(' and copy to 'command' */
-    while ((*p != '\0') && (*p != '(')) {
-        *(command++) = *(p++);
-    }
-    *command = '\0';
-
-    ret = sscanf(p, "(%f,%f)", arg1_p, arg2_p);
-    if (ret != 2) {
-        return -1;
-    }
-
-    return 0;
-}
-
-static void print_search_result(int ret, float side, float height)
-{
-    printf("A box which can fit (side: %.2f height: %.2f) is %sfound\n",
-            side, height, ret ? "not " : "");
-}
-
-static int do_command(boxes_t *boxes, const char *command, float side,
-                      float height)
+static int do_command(boxes_t *boxes, output_t *output,
+                      const command_t *command)
 {
+    float side = command->arg1, height = command->arg2;
     float found_side, found_height;
     int ret;
 
-    LOG("doing %s(%f,%f)", command, side, height);
-
-    if (!strcmp(command,"INSERTBOX")) {
-        INSERTBOX(boxes, side, height);
-    } else if (!strcmp(command,"REMOVEBOX")) {
-        ret = REMOVEBOX(boxes, side, height);
-        if (ret) {
-            printf("Failed to remove (side: %.2f height: %.2f)\n", side, height);
-        }
-    } else if (!strcmp(command,"GETBOX")) {
+    LOG("doing %.*s(%f,%f)", (int)command->name_len, command->name, side,
+        height);
+
+    switch (command->type) {
+    case COMMAND_INSERTBOX:
+        INSERTBOX_N(boxes, side, height, command->count);
+        break;
+    case COMMAND_REMOVEBOX:
+        ret = REMOVEBOX_N(boxes, side, height, command->count);
+        output_removebox(output, ret, side, height);
+        break;
+    case COMMAND_GETBOX:
         ret = GETBOX(boxes, side, height, &found_side, &found_height);
-        if (!ret) {
-            printf("The minimal volume of a box which can fit "
-                   "(side: %.2f height: %.2f) is: (side: %.2f height: %.2f)\n",
-                   side, height, found_side, found_height);
-        } else {
-            print_search_result(ret, side, height);
-        }
-    } else if (!strcmp(command,"CHECKBOX")) {
+        output_getbox(output, ret, side, height, found_side, found_height);
+        break;
+    case COMMAND_CHECKBOX:
         ret = CHECKBOX(boxes, side, height);
-        print_search_result(ret, side, height);
-     } else {
-        printf("Invalid command: '%s'\n", command);
+        output_checkbox(output, ret, side, height);
+        break;
+    default:
+        output_invalid_command(output, command);
         return -1;
     }
 
 #ifdef DEBUG
+    output_flush(output);
     printf("   ===== boxes ====\n");
     boxes_print(boxes, "   =  ");
     printf("   ================\n");
+    fflush(stdout);
 #endif
     return 0;
 }
 
+/* results are written once the updates before them are durable */
+static int sync_wal(void *arg)
+{
+    return wal_sync(arg);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-b] [-S] [-j threads] [-l image] [-s image] "
+           "[-w path] [command-file]\n", prog);
+    printf("    -b    write binary result records instead of text\n");
+    printf("    -S    print statistics of the boxes to stderr at exit\n");
+    printf("    -j    answer queries of the command file with this many "
+           "threads\n");
+    printf("    -l    load the boxes of an image before the commands\n");
+    printf("    -s    save an image of the boxes after the commands\n");
+    printf("    -w    recover the boxes from path.img and path.log, and log "
+           "their updates.\n"
+           "          results are written once the updates before them are "
+           "durable\n");
+}
+
 int main(int argc, char *argv[])
 {
-    char command[MAXLINE];
-    float side, height;
+    const char *load_path, *save_path, *wal_path;
+    char image_path[PATH_MAX], log_path[PATH_MAX];
+    wal_config_t wal_config;
+    output_format_t format;
+    char name[MAXLINE];
+    command_t command;
+    output_t output;
     boxes_t boxes;
-    int ret;
+    wal_t wal;
+    int ret, opt, num_threads, has_wal, print_stats;
+
+    format      = OUTPUT_TEXT;
+    num_threads = 1;
+    load_path   = NULL;
+    save_path   = NULL;
+    wal_path    = NULL;
+    has_wal     = 0;
+    print_stats = 0;
+    while ((opt = getopt(argc, argv, "bSj:l:s:w:")) != -1) {
+        switch (opt) {
+        case 'b':
+            format = OUTPUT_BINARY;
+            break;
+        case 'S':
+            print_stats = 1;
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            load_path = optarg;
+            break;
+        case 's':
+            save_path = optarg;
+            break;
+        case 'w':
+            wal_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (output_init(&output, STDOUT_FILENO, format)) {
+        printf("Failed to allocate the output buffer\n");
+        return -1;
+    }
 
     boxes_init(&boxes);
 
+    if (wal_path != NULL) {
+        snprintf(image_path, sizeof(image_path), "%s.img", wal_path);
+        snprintf(log_path, sizeof(log_path), "%s.log", wal_path);
+        wal_config_default(&wal_config);
+        wal_config.is_async = 1;
+        if (wal_open(&wal, &boxes, image_path, log_path, &wal_config)) {
+            output_message(&output, "Failed to recover '%s': %m\n",
+                           wal_path);
+            ret = -1;
+            goto out_cleanup;
+        }
+        output_set_flush_hook(&output, sync_wal, &wal);
+        has_wal = 1;
+    }
+
+    if ((load_path != NULL) && boxes_load(&boxes, load_path)) {
+        output_message(&output, "Failed to load '%s': %m\n", load_path);
+        ret = -1;
+        goto out_cleanup;
+    }
+
     /*there is not a file to read from so use menu*/
     if (argc == 1) {
         int cont;
@@ -101,13 +169,20 @@ int main(int argc, char *argv[])
 
         do {
             printf("Please choose which command to do: \n");
-            scanf("%s", command);
+            scanf("%99s", name);
             printf("Choose side length\n");
-            scanf("%f", &side);
+            scanf("%f", &command.arg1);
             printf("Choose height length\n");
-            scanf("%f", &height);
-
-            ret = do_command(&boxes, command, side, height);
+            scanf("%f", &command.arg2);
+
+            command.name     = name;
+            command.name_len = strlen(name);
+            command.type     = parser_command_type(name, command.name_len);
+            command.count    = 1;
+            /* the prompts are printed with stdio, and the result after them */
+            fflush(stdout);
+            ret = do_command(&boxes, &output, &command);
+            output_flush(&output);
             if (ret) {
                 goto out_cleanup;
             }
@@ -116,42 +191,58 @@ int main(int argc, char *argv[])
             scanf("%d", &cont);
         } while (cont);
     } else if (argc == 2) {
-        char line[MAXLINE];
-        int line_num;
-        FILE *fp;
+        parser_t parser;
 
-        fp = fopen(argv[1], "r");
-        if (!fp) {
-            printf("Failed to open '%s': %m\n", argv[1]);
-            ret = -1;
+        ret = parser_open(&parser, argv[1]);
+        if (ret) {
+            output_message(&output, "Failed to open '%s': %m\n", argv[1]);
             goto out_cleanup;
         }
 
-        line_num = 1;
-        while (fgets(line, sizeof(line), fp) != NULL) {
-            ret = parse_line(line, command, &side, &height);
-            if (ret) {
-                printf("Syntax error in line %d '%s'\n", line_num, line);
-                fclose(fp);
-                goto out_cleanup;
+        if (num_threads > 1) {
+            /* the calling thread answers queries as well */
+            ret = replay_run(&boxes, &parser, &output, num_threads - 1);
+        } else {
+            while ((ret = parser_next(&parser, &command)) > 0) {
+                ret = do_command(&boxes, &output, &command);
+                if (ret) {
+                    break;
+                }
             }
 
-            ret = do_command(&boxes, command, side, height);
-            if (ret) {
-                fclose(fp);
-                goto out_cleanup;
+            if ((ret < 0) && (parser.error != NULL)) {
+                output_syntax_error(&output, &parser);
             }
-
-            ++line_num;
         }
-
-        fclose(fp);
+        parser_close(&parser);
     } else {
-        printf("Invalid number of command line arguments\n");
+        output_message(&output, "Invalid number of command line arguments\n");
+        ret = -1;
+    }
+
+    if ((ret == 0) && (save_path != NULL) &&
+        boxes_save(&boxes, save_path)) {
+        output_message(&output, "Failed to save '%s': %m\n", save_path);
+        ret = -1;
     }
 
 out_cleanup:
+    if (print_stats) {
+        output_flush(&output);
+        boxes_stats_dump(&boxes, stderr);
+    }
+
+    if (has_wal) {
+        output_flush(&output);
+        output_set_flush_hook(&output, NULL, NULL);
+        if (wal_close(&wal)) {
+            output_message(&output, "Failed to log the updates: %m\n");
+            ret = -1;
+        }
+    }
+
     /*free the boxes data structure*/
     boxes_cleanup(&boxes);
+    output_cleanup(&output);
     return ret;
 }
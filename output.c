@@ -0,0 +1,269 @@
+#include "output.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+
+/* size of the output buffer */
+#define OUTPUT_BUF_SIZE        (64 * 1024)
+
+/* longest result, with 4 floats of the maximal length */
+#define OUTPUT_MAX_RESULT_LEN  (256 + 4 * OUTPUT_FLOAT_MAX_LEN)
+
+/* longer text is not kept in the buffer */
+#define OUTPUT_MAX_MESSAGE_LEN 1024
+
+
+int output_init(output_t *output, int fd, output_format_t format)
+{
+    output->buf = malloc(OUTPUT_BUF_SIZE);
+    if (output->buf == NULL) {
+        return -1;
+    }
+
+    output->fd     = fd;
+    output->format = format;
+    output->len    = 0;
+    output->size   = OUTPUT_BUF_SIZE;
+    output->flush_hook     = NULL;
+    output->flush_hook_arg = NULL;
+    return 0;
+}
+
+void output_cleanup(output_t *output)
+{
+    output_flush(output);
+    free(output->buf);
+    output->buf = NULL;
+}
+
+static int output_write(int fd, const char *data, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += ret;
+        len  -= ret;
+    }
+    return 0;
+}
+
+int output_flush(output_t *output)
+{
+    int ret;
+
+    if (output->len == 0) {
+        return 0;
+    }
+    if ((output->flush_hook != NULL) &&
+        output->flush_hook(output->flush_hook_arg)) {
+        ret = -1;
+    } else {
+        ret = output_write(output->fd, output->buf, output->len);
+    }
+    output->len = 0;
+    return ret;
+}
+
+void output_set_flush_hook(output_t *output, int (*hook)(void *arg),
+                           void *arg)
+{
+    output->flush_hook     = hook;
+    output->flush_hook_arg = arg;
+}
+
+/* make room for 'len' more bytes */
+static char *output_reserve(output_t *output, size_t len)
+{
+    if (output->size - output->len < len) {
+        output_flush(output);
+    }
+    return output->buf + output->len;
+}
+
+static char *output_put_str(char *p, const char *str, size_t len)
+{
+    memcpy(p, str, len);
+    return p + len;
+}
+
+#define OUTPUT_PUT_LITERAL(_p, _str) \
+        output_put_str(_p, _str, sizeof(_str) - 1)
+
+/*a float multiplied by 100 is exact in a double, so rounding it to an
+ * integer in the default rounding mode (to nearest, ties to even) is the
+ * same as the exact rounding printf does*/
+size_t output_format_float(char *buf, float value)
+{
+    char digits[24];
+    double scaled;
+    uint64_t n;
+    char *p;
+    int i;
+
+    scaled = nearbyint(fabs((double)value) * 100.0);
+    if (!isfinite(value) || (scaled >= 1e18)) {
+        return snprintf(buf, OUTPUT_FLOAT_MAX_LEN, "%.2f", value);
+    }
+
+    /* digits of the integer in reverse, with at least one before the point */
+    n = (uint64_t)scaled;
+    i = 0;
+    do {
+        digits[i++] = '0' + (n % 10);
+        n /= 10;
+    } while ((n > 0) || (i < 3));
+
+    p = buf;
+    if (signbit(value)) {
+        *(p++) = '-';
+    }
+    while (i > 2) {
+        *(p++) = digits[--i];
+    }
+    *(p++) = '.';
+    *(p++) = digits[1];
+    *(p++) = digits[0];
+    return p - buf;
+}
+
+static char *output_put_float(char *p, float value)
+{
+    return p + output_format_float(p, value);
+}
+
+/* "(side: %.2f height: %.2f)" */
+static char *output_put_box(char *p, float side, float height)
+{
+    p = OUTPUT_PUT_LITERAL(p, "(side: ");
+    p = output_put_float(p, side);
+    p = OUTPUT_PUT_LITERAL(p, " height: ");
+    p = output_put_float(p, height);
+    return OUTPUT_PUT_LITERAL(p, ")");
+}
+
+static void output_put_record(output_t *output, command_type_t command,
+                              int ret, float side, float height,
+                              float found_side, float found_height)
+{
+    output_record_t record;
+
+    record.command      = command;
+    record.status       = ret ? -1 : 0;
+    record.side         = side;
+    record.height       = height;
+    record.found_side   = found_side;
+    record.found_height = found_height;
+    memcpy(output_reserve(output, sizeof(record)), &record, sizeof(record));
+    output->len += sizeof(record);
+}
+
+void output_removebox(output_t *output, int ret, float side, float height)
+{
+    char *p;
+
+    if (output->format == OUTPUT_BINARY) {
+        output_put_record(output, COMMAND_REMOVEBOX, ret, side, height, 0, 0);
+        return;
+    } else if (!ret) {
+        return;
+    }
+
+    p = output_reserve(output, OUTPUT_MAX_RESULT_LEN);
+    p = OUTPUT_PUT_LITERAL(p, "Failed to remove ");
+    p = output_put_box(p, side, height);
+    p = OUTPUT_PUT_LITERAL(p, "\n");
+    output->len = p - output->buf;
+}
+
+void output_checkbox(output_t *output, int ret, float side, float height)
+{
+    char *p;
+
+    if (output->format == OUTPUT_BINARY) {
+        output_put_record(output, COMMAND_CHECKBOX, ret, side, height, 0, 0);
+        return;
+    }
+
+    p = output_reserve(output, OUTPUT_MAX_RESULT_LEN);
+    p = OUTPUT_PUT_LITERAL(p, "A box which can fit ");
+    p = output_put_box(p, side, height);
+    if (ret) {
+        p = OUTPUT_PUT_LITERAL(p, " is not found\n");
+    } else {
+        p = OUTPUT_PUT_LITERAL(p, " is found\n");
+    }
+    output->len = p - output->buf;
+}
+
+void output_getbox(output_t *output, int ret, float side, float height,
+                   float found_side, float found_height)
+{
+    char *p;
+
+    if (output->format == OUTPUT_BINARY) {
+        output_put_record(output, COMMAND_GETBOX, ret, side, height,
+                          ret ? 0 : found_side, ret ? 0 : found_height);
+        return;
+    } else if (ret) {
+        output_checkbox(output, ret, side, height);
+        return;
+    }
+
+    p = output_reserve(output, OUTPUT_MAX_RESULT_LEN);
+    p = OUTPUT_PUT_LITERAL(p, "The minimal volume of a box which can fit ");
+    p = output_put_box(p, side, height);
+    p = OUTPUT_PUT_LITERAL(p, " is: ");
+    p = output_put_box(p, found_side, found_height);
+    p = OUTPUT_PUT_LITERAL(p, "\n");
+    output->len = p - output->buf;
+}
+
+void output_message(output_t *output, const char *format, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, format);
+    if (output->format == OUTPUT_BINARY) {
+        vfprintf(stderr, format, ap);
+    } else {
+        len = vsnprintf(output_reserve(output, OUTPUT_MAX_MESSAGE_LEN),
+                        OUTPUT_MAX_MESSAGE_LEN, format, ap);
+        if (len >= OUTPUT_MAX_MESSAGE_LEN) {
+            /* too long for the buffer, write it separately */
+            va_end(ap);
+            va_start(ap, format);
+            output_flush(output);
+            vdprintf(output->fd, format, ap);
+        } else if (len > 0) {
+            output->len += len;
+        }
+    }
+    va_end(ap);
+}
+
+void output_invalid_command(output_t *output, const command_t *command)
+{
+    output_message(output, "Invalid command: '%.*s'\n",
+                   (int)command->name_len, command->name);
+}
+
+void output_syntax_error(output_t *output, const parser_t *parser)
+{
+    output_message(output, "Syntax error in line %d column %d: %s '%.*s'\n",
+                   parser->line_num, parser->error_column, parser->error,
+                   (int)parser->line_len, parser->line);
+}
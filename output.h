@@ -0,0 +1,109 @@
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include "parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Format of command results */
+typedef enum {
+    OUTPUT_TEXT,        /* the messages of the interactive mode */
+    OUTPUT_BINARY       /* an output_record_t per command */
+} output_format_t;
+
+
+/*
+ * Binary result of a REMOVEBOX, GETBOX or CHECKBOX command, in host byte
+ * order. INSERTBOX has no result.
+ */
+typedef struct output_record_s {
+    uint32_t    command;        /* command_type_t */
+    int32_t     status;         /* 0 if removed/found, -1 if not */
+    float       side;           /* the arguments of the command */
+    float       height;
+    float       found_side;     /* the box found by GETBOX, 0 otherwise */
+    float       found_height;
+} output_record_t;
+
+
+/*
+ * Writer of command results
+ * Results are formatted into a buffer, which is written to the file
+ * descriptor once it is full, or when flushed.
+ */
+typedef struct output_s {
+    int              fd;
+    output_format_t  format;
+    char             *buf;
+    size_t           len;
+    size_t           size;
+    int              (*flush_hook)(void *arg);  /* called before a write */
+    void             *flush_hook_arg;
+} output_t;
+
+
+/*
+ * init the writer, to write results to 'fd' in the given format
+ * returns 0 on success, -1 if out of memory
+ */
+int output_init(output_t *output, int fd, output_format_t format);
+
+
+/*
+ * flush and release the writer
+ */
+void output_cleanup(output_t *output);
+
+
+/*
+ * write all the buffered results
+ * returns 0 on success, -1 on failure with errno set
+ */
+int output_flush(output_t *output);
+
+
+/*
+ * call 'hook' before the buffered results are written, such as wal_sync()
+ * to write them once the updates before them are durable. if it fails, the
+ * results are dropped. NULL removes the hook.
+ */
+void output_set_flush_hook(output_t *output, int (*hook)(void *arg),
+                           void *arg);
+
+
+/*
+ * write the result of REMOVEBOX, GETBOX or CHECKBOX, which returned 'ret'
+ */
+void output_removebox(output_t *output, int ret, float side, float height);
+void output_getbox(output_t *output, int ret, float side, float height,
+                   float found_side, float found_height);
+void output_checkbox(output_t *output, int ret, float side, float height);
+
+
+/*
+ * write the error of a command whose name is not known, or of the syntax
+ * error the parser stopped at
+ */
+void output_invalid_command(output_t *output, const command_t *command);
+void output_syntax_error(output_t *output, const parser_t *parser);
+
+
+/*
+ * write a message which is not a command result, such as an error. in the
+ * binary format, the message is printed to stderr instead.
+ */
+void output_message(output_t *output, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+
+/*
+ * format 'value' like printf("%.2f") does, without terminating it
+ * returns the number of characters, which is at most OUTPUT_FLOAT_MAX_LEN
+ */
+#define OUTPUT_FLOAT_MAX_LEN 64
+size_t output_format_float(char *buf, float value);
+
+
+#endif
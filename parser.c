@@ -0,0 +1,419 @@
+#include "parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* size of reads of a file which can not be mapped */
+#define PARSER_READ_SIZE      (1 << 20)
+
+/* longest rest of a line which is copied to the stack for strtof, longer
+ * ones are copied to the heap */
+#define PARSER_MAX_NUMBER_LEN 127
+
+/* powers of ten which are exact in a float */
+#define PARSER_MAX_EXACT_POW10 10
+
+/* mantissas up to this value are exact in a float */
+#define PARSER_MAX_EXACT_MANTISSA ((uint64_t)1 << 24)
+
+
+static const char *command_names[] = {
+    [COMMAND_INSERTBOX] = "INSERTBOX",
+    [COMMAND_REMOVEBOX] = "REMOVEBOX",
+    [COMMAND_GETBOX]    = "GETBOX",
+    [COMMAND_CHECKBOX]  = "CHECKBOX",
+};
+
+static const float parser_pow10[PARSER_MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10
+};
+
+
+/*move the rest of the buffer, which is not parsed, to its start, and read
+ * more of the file after it. the buffer grows if the rest fills it, which
+ * is part of a line longer than the buffer
+ * returns 0 on success (with 'fd' closed at end of file), -1 on failure*/
+static int parser_refill(parser_t *parser)
+{
+    size_t rest, capacity;
+    char *buf;
+    ssize_t ret;
+
+    rest = parser->data + parser->size - parser->pos;
+    if (rest == parser->capacity) {
+        capacity = parser->capacity ? (2 * parser->capacity) :
+                   PARSER_READ_SIZE;
+        buf = realloc(parser->buf, capacity);
+        if (buf == NULL) {
+            return -1;
+        }
+        parser->buf      = buf;
+        parser->capacity = capacity;
+    } else {
+        memmove(parser->buf, parser->pos, rest);
+    }
+    parser->data = parser->buf;
+    parser->pos  = parser->buf;
+    parser->size = rest;
+
+    do {
+        ret = read(parser->fd, parser->buf + rest, parser->capacity - rest);
+    } while ((ret < 0) && (errno == EINTR));
+    if (ret < 0) {
+        return -1;
+    } else if (ret == 0) {
+        close(parser->fd);
+        parser->fd = -1;
+    }
+    parser->size += ret;
+    return 0;
+}
+
+int parser_open(parser_t *parser, const char *path)
+{
+    struct stat st;
+    void *data;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ret = -1;
+    if (fstat(fd, &st)) {
+        goto out_close;
+    }
+
+    data = MAP_FAILED;
+    if (S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    parser->buf      = NULL;
+    parser->capacity = 0;
+    if (data != MAP_FAILED) {
+        /* the file is parsed once from start to end */
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        parser->data      = data;
+        parser->size      = st.st_size;
+        parser->is_mapped = 1;
+        parser->fd        = -1;
+    } else {
+        /* read by parser_next(), once it parsed the lines of the buffer */
+        parser->data      = NULL;
+        parser->size      = 0;
+        parser->is_mapped = 0;
+        parser->fd        = fd;
+        fd = -1;
+    }
+
+    parser->pos          = parser->data;
+    parser->line_num     = 0;
+    parser->line         = parser->data;
+    parser->line_len     = 0;
+    parser->error_column = 0;
+    parser->error        = NULL;
+    ret = 0;
+
+out_close:
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ret;
+}
+
+void parser_close(parser_t *parser)
+{
+    if (parser->is_mapped) {
+        munmap((void*)parser->data, parser->size);
+    } else {
+        if (parser->fd >= 0) {
+            close(parser->fd);
+        }
+        free(parser->buf);
+    }
+    parser->data = NULL;
+    parser->size = 0;
+    parser->buf  = NULL;
+    parser->fd   = -1;
+}
+
+static int parser_is_space(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') ||
+           (c == '\v') || (c == '\f');
+}
+
+static const char *parser_skip_space(const char *p, const char *end)
+{
+    while ((p < end) && parser_is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+/*parse with strtof, from a terminated copy of the rest of the line. the
+ * copy is never shorter than the number, however long it is, since strtof
+ * may only know where the number ends by reading all of it*/
+static const char *parser_parse_float_slow(const char *p, const char *end,
+                                           float *value_p)
+{
+    char stack_buf[PARSER_MAX_NUMBER_LEN + 1];
+    char *buf, *num_end;
+    size_t len;
+
+    len = end - p;
+    buf = stack_buf;
+    if (len > PARSER_MAX_NUMBER_LEN) {
+        buf = malloc(len + 1);
+        if (buf == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+
+    *value_p = strtof(buf, &num_end);
+    p = (num_end == buf) ? NULL : (p + (num_end - buf));
+    if (buf != stack_buf) {
+        free(buf);
+    }
+    if (p == NULL) {
+        errno = EINVAL;
+    }
+    return p;
+}
+
+const char *parser_parse_float(const char *p, const char *end,
+                               float *value_p)
+{
+    const char *start, *digits;
+    int negative, exp, exp_sign, num_digits;
+    uint64_t mantissa;
+    float value;
+
+    p     = parser_skip_space(p, end);
+    start = p;
+
+    negative = 0;
+    if ((p < end) && ((*p == '-') || (*p == '+'))) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    /* decimal digits, with an optional point, into mantissa*10^exp */
+    mantissa   = 0;
+    exp        = 0;
+    num_digits = 0;
+    digits     = p;
+    for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+        mantissa = mantissa * 10 + (*p - '0');
+        ++num_digits;
+    }
+    if ((p < end) && (*p == '.')) {
+        for (++p; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++num_digits;
+            --exp;
+        }
+    }
+    if ((p == digits) || ((p == digits + 1) && (*digits == '.'))) {
+        /* not a decimal number, such as "inf" or "nan" */
+        return parser_parse_float_slow(start, end, value_p);
+    }
+
+    if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+        const char *exp_start = p;
+        int exp_value = 0;
+
+        ++p;
+        exp_sign = 1;
+        if ((p < end) && ((*p == '-') || (*p == '+'))) {
+            exp_sign = (*p == '-') ? -1 : 1;
+            ++p;
+        }
+        if ((p == end) || (*p < '0') || (*p > '9')) {
+            p = exp_start; /* not an exponent, like strtof */
+        } else {
+            for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+                if (exp_value < 10000) {
+                    exp_value = exp_value * 10 + (*p - '0');
+                }
+            }
+            exp += exp_sign * exp_value;
+        }
+    } else if ((p < end) && ((*p == 'x') || (*p == 'X'))) {
+        return parser_parse_float_slow(start, end, value_p); /* hex */
+    }
+
+    /* the mantissa and the power of ten are both exact in a float, so a
+     * single multiplication or division rounds the result correctly.
+     * otherwise, let strtof do it.
+     */
+    if ((num_digits > 19) || (mantissa > PARSER_MAX_EXACT_MANTISSA) ||
+        (exp > PARSER_MAX_EXACT_POW10) || (exp < -PARSER_MAX_EXACT_POW10)) {
+        return parser_parse_float_slow(start, end, value_p);
+    }
+
+    value = (float)mantissa;
+    if (exp >= 0) {
+        value *= parser_pow10[exp];
+    } else {
+        value /= parser_pow10[-exp];
+    }
+    *value_p = negative ? -value : value;
+    return p;
+}
+
+command_type_t parser_command_type(const char *name, size_t len)
+{
+    command_type_t type;
+
+    for (type = 0; type < COMMAND_INVALID; ++type) {
+        if ((strlen(command_names[type]) == len) &&
+            !memcmp(command_names[type], name, len)) {
+            return type;
+        }
+    }
+    return COMMAND_INVALID;
+}
+
+/* parse a positive decimal count at 'p', not beyond 'end', skipping leading
+ * whitespace. returns the end of the count, or NULL if there is none or it
+ * does not fit 64 bits
+ */
+static const char *parser_parse_count(const char *p, const char *end,
+                                      uint64_t *count_p)
+{
+    const char *digits;
+    uint64_t count;
+
+    p      = parser_skip_space(p, end);
+    digits = p;
+    count  = 0;
+    for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+        if (count > (UINT64_MAX - (*p - '0')) / 10) {
+            return NULL;
+        }
+        count = count * 10 + (*p - '0');
+    }
+    if ((p == digits) || (count == 0)) {
+        return NULL;
+    }
+
+    *count_p = count;
+    return p;
+}
+
+static int parser_error(parser_t *parser, const char *p, const char *error)
+{
+    parser->error_column = (p - parser->line) + 1;
+    parser->error        = error;
+    return -1;
+}
+
+/* report that parser_parse_float() failed at 'p' */
+static int parser_number_error(parser_t *parser, const char *p)
+{
+    return parser_error(parser, p, (errno == ENOMEM) ? "out of memory" :
+                                                       "expected a number");
+}
+
+/*parse "<command>(<arg1>,<arg2>)", or "<command>(<arg1>,<arg2>,<count>)" of
+ * INSERTBOX and REMOVEBOX, with optional whitespace around the arguments*/
+int parser_next(parser_t *parser, command_t *command)
+{
+    const char *end, *data_end, *p, *paren;
+    size_t scanned;
+
+    /* find the end of the line, reading more of a file which is not mapped
+     * until the line is in the buffer
+     */
+    scanned = 0;
+    for (;;) {
+        p        = parser->pos;
+        data_end = parser->data + parser->size;
+        end      = (p + scanned < data_end) ?
+                   memchr(p + scanned, '\n', data_end - p - scanned) : NULL;
+        if ((end != NULL) || (parser->fd < 0)) {
+            break;
+        }
+
+        scanned = data_end - p;
+        if (parser_refill(parser)) {
+            ++parser->line_num;
+            parser->line     = parser->pos;
+            parser->line_len = 0;
+            return parser_error(parser, parser->line,
+                                "failed to read the file");
+        }
+    }
+
+    if (p >= data_end) {
+        return 0;
+    } else if (end == NULL) {
+        end = data_end;
+    }
+    parser->pos      = (end < data_end) ? (end + 1) : end;
+    parser->line     = p;
+    parser->line_len = end - p;
+    ++parser->line_num;
+
+    paren = memchr(p, '(', end - p);
+    if (paren == NULL) {
+        return parser_error(parser, end, "expected '('");
+    }
+    command->name     = p;
+    command->name_len = paren - p;
+    command->type     = parser_command_type(p, paren - p);
+
+    p = parser_parse_float(paren + 1, end, &command->arg1);
+    if (p == NULL) {
+        return parser_number_error(parser,
+                                   parser_skip_space(paren + 1, end));
+    }
+    p = parser_skip_space(p, end);
+    if ((p == end) || (*p != ',')) {
+        return parser_error(parser, p, "expected ','");
+    }
+
+    paren = p;
+    p = parser_parse_float(p + 1, end, &command->arg2);
+    if (p == NULL) {
+        return parser_number_error(parser,
+                                   parser_skip_space(paren + 1, end));
+    }
+    p = parser_skip_space(p, end);
+
+    command->count = 1;
+    if ((p < end) && (*p == ',') &&
+        ((command->type == COMMAND_INSERTBOX) ||
+         (command->type == COMMAND_REMOVEBOX))) {
+        paren = p;
+        p = parser_parse_count(p + 1, end, &command->count);
+        if (p == NULL) {
+            return parser_error(parser, parser_skip_space(paren + 1, end),
+                                "expected a positive count");
+        }
+        p = parser_skip_space(p, end);
+    }
+
+    if ((p == end) || (*p != ')')) {
+        return parser_error(parser, p, "expected ')'");
+    }
+
+    p = parser_skip_space(p + 1, end);
+    if (p != end) {
+        return parser_error(parser, p, "unexpected characters after ')'");
+    }
+
+    return 1;
+}
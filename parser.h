@@ -0,0 +1,98 @@
+#ifndef _PARSER_H
+#define _PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Command of a command file */
+typedef enum {
+    COMMAND_INSERTBOX,
+    COMMAND_REMOVEBOX,
+    COMMAND_GETBOX,
+    COMMAND_CHECKBOX,
+    COMMAND_INVALID
+} command_type_t;
+
+
+/* Parsed command line "<command>(<arg1>,<arg2>)", or
+ * "<command>(<arg1>,<arg2>,<count>)" for INSERTBOX and REMOVEBOX
+ */
+typedef struct command_s {
+    command_type_t  type;
+    const char      *name;      /* command name in the file, not terminated */
+    size_t          name_len;
+    float           arg1;
+    float           arg2;
+    uint64_t        count;      /* of the boxes, 1 if not given */
+} command_t;
+
+
+/*
+ * Command file parser
+ * The file is mapped to memory and parsed in place, so lines of any length
+ * are parsed without copying. A file which can not be mapped, such as a
+ * pipe, is read through a buffer which is refilled once its lines are
+ * parsed (and grows to fit a longer line), so the whole file is never in
+ * memory.
+ */
+typedef struct parser_s {
+    const char   *data;         /* the mapped file, or the buffer */
+    size_t       size;
+    const char   *pos;          /* start of the next line */
+    int          is_mapped;
+    int          fd;            /* the file which is read, -1 if it is
+                                 * mapped or all of it was read */
+    char         *buf;          /* of the file which is read */
+    size_t       capacity;
+    int          line_num;      /* line of the last command, from 1 */
+    const char   *line;         /* the last line, not terminated */
+    size_t       line_len;
+    int          error_column;  /* column of a syntax error, from 1 */
+    const char   *error;        /* description of a syntax error */
+} parser_t;
+
+
+/*
+ * open the command file at 'path' for parsing
+ * returns 0 on success, -1 on failure with errno set
+ */
+int parser_open(parser_t *parser, const char *path);
+
+
+/*
+ * release the file
+ */
+void parser_close(parser_t *parser);
+
+
+/*
+ * parse the next line into 'command'. on a syntax error, 'line_num',
+ * 'error_column' and 'error' describe it. the command name and 'line' are
+ * in the parser's buffer, and a file which is read may overwrite them when
+ * the next line is parsed. a command name which is not known
+ * is not a syntax error, it is returned as COMMAND_INVALID. the count of
+ * INSERTBOX and REMOVEBOX is a positive decimal integer of up to 64 bits.
+ * returns 1 if a command was parsed, 0 at end of file, -1 on syntax error
+ */
+int parser_next(parser_t *parser, command_t *command);
+
+
+/*
+ * parse a float at 'p', not beyond 'end', skipping leading whitespace like
+ * scanf("%f") does. the result is the same as strtof(), for numbers of
+ * any length.
+ * returns the end of the number, or NULL with errno set: EINVAL if there
+ * is no number at 'p', ENOMEM if a long line could not be copied
+ */
+const char *parser_parse_float(const char *p, const char *end,
+                               float *value_p);
+
+
+/*
+ * get the type of the command called 'name' (of 'len' characters)
+ */
+command_type_t parser_command_type(const char *name, size_t len);
+
+
+#endif
@@ -0,0 +1,119 @@
+#include "pool.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+
+
+struct pool_slab_s {
+    pool_slab_t  *next;
+    max_align_t  objs[];
+};
+
+
+/* a released object holds the pointer to the next one on the free list */
+typedef struct pool_free_obj_s {
+    struct pool_free_obj_s *next;
+} pool_free_obj_t;
+
+
+void pool_init(pool_t *pool, size_t obj_size, size_t objs_per_slab)
+{
+    size_t align = sizeof(void*);
+
+    assert(objs_per_slab > 0);
+
+    /* every object must be able to hold the free list link, and be aligned */
+    if (obj_size < sizeof(pool_free_obj_t)) {
+        obj_size = sizeof(pool_free_obj_t);
+    }
+    pool->obj_size      = (obj_size + align - 1) & ~(align - 1);
+    pool->objs_per_slab = objs_per_slab;
+    pool->slabs         = NULL;
+    pool->next_obj      = NULL;
+    pool->slab_end      = NULL;
+    pool->free_list     = NULL;
+    pool->num_slabs     = 0;
+    pool->num_used      = 0;
+    pool->num_free      = 0;
+}
+
+void pool_cleanup(pool_t *pool)
+{
+    pool_slab_t *slab;
+
+    while (pool->slabs != NULL) {
+        slab        = pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+
+    pool_init(pool, pool->obj_size, pool->objs_per_slab);
+}
+
+/* add a new slab, and start allocating from it */
+static int pool_add_slab(pool_t *pool)
+{
+    pool_slab_t *slab;
+
+    STATS_INC(STATS_SLAB_ALLOCS);
+    slab = malloc(sizeof(*slab) + pool->objs_per_slab * pool->obj_size);
+    if (slab == NULL) {
+        return -1;
+    }
+
+    slab->next     = pool->slabs;
+    pool->slabs    = slab;
+    pool->next_obj = (char*)slab->objs;
+    pool->slab_end = pool->next_obj + pool->objs_per_slab * pool->obj_size;
+    ++pool->num_slabs;
+    return 0;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    pool_free_obj_t *obj;
+    void *ptr;
+
+    /* prefer recently released objects, which are likely to be cached */
+    if (pool->free_list != NULL) {
+        obj             = pool->free_list;
+        pool->free_list = obj->next;
+        --pool->num_free;
+        ++pool->num_used;
+        return obj;
+    }
+
+    if ((pool->next_obj == pool->slab_end) && pool_add_slab(pool)) {
+        return NULL;
+    }
+
+    ptr             = pool->next_obj;
+    pool->next_obj += pool->obj_size;
+    ++pool->num_used;
+    return ptr;
+}
+
+void pool_free(pool_t *pool, void *obj)
+{
+    pool_free_obj_t *free_obj = obj;
+
+    assert(pool->num_used > 0);
+
+    free_obj->next  = pool->free_list;
+    pool->free_list = free_obj;
+    --pool->num_used;
+    ++pool->num_free;
+}
+
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats)
+{
+    stats->obj_size  = pool->obj_size;
+    stats->num_slabs = pool->num_slabs;
+    stats->capacity  = pool->num_slabs * pool->objs_per_slab;
+    stats->num_used  = pool->num_used;
+    stats->num_free  = pool->num_free;
+    stats->bytes     = pool->num_slabs * (sizeof(pool_slab_t) +
+                                          pool->objs_per_slab * pool->obj_size);
+}
@@ -0,0 +1,71 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>
+
+
+/* Slab of pool objects */
+typedef struct pool_slab_s pool_slab_t;
+
+
+/*
+ * Pool of fixed-size objects, allocated from contiguous slabs.
+ * Released objects are kept on a free list and reused by later allocations,
+ * and the slabs themselves are only released when the pool is cleaned up.
+ */
+typedef struct pool_s {
+    size_t       obj_size;
+    size_t       objs_per_slab;
+    pool_slab_t  *slabs;        /* all slabs, most recent first */
+    char         *next_obj;     /* next never-used object in the first slab */
+    char         *slab_end;     /* end of the first slab */
+    void         *free_list;    /* released objects */
+    size_t       num_slabs;
+    size_t       num_used;
+    size_t       num_free;
+} pool_t;
+
+
+/* Pool usage statistics */
+typedef struct pool_stats_s {
+    size_t       obj_size;
+    size_t       num_slabs;
+    size_t       capacity;      /* objects in all slabs */
+    size_t       num_used;      /* allocated objects */
+    size_t       num_free;      /* objects on the free list */
+    size_t       bytes;         /* memory held by the slabs */
+} pool_stats_t;
+
+
+/*
+ * init the pool, for objects of 'obj_size' bytes
+ */
+void pool_init(pool_t *pool, size_t obj_size, size_t objs_per_slab);
+
+
+/*
+ * release all the slabs at once, including objects which are still in use
+ */
+void pool_cleanup(pool_t *pool);
+
+
+/*
+ * allocate an object
+ * returns NULL if out of memory
+ */
+void *pool_alloc(pool_t *pool);
+
+
+/*
+ * return an object to the pool
+ */
+void pool_free(pool_t *pool, void *obj);
+
+
+/*
+ * fill usage statistics of the pool
+ */
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats);
+
+
+#endif
@@ -0,0 +1,436 @@
+#include "ptree.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+
+#define PTREE_BLACK 0
+#define PTREE_RED   1
+
+
+static int ptree_is_red(const ptree_node_t *node)
+{
+    return (node != NULL) && (node->color == PTREE_RED);
+}
+
+static tree_key_t ptree_aug(const ptree_node_t *node)
+{
+    return (node != NULL) ? node->aug : TREE_KEY_MIN;
+}
+
+void ptree_init(ptree_t *tree, const ptree_ops_t *ops)
+{
+    tree->root = NULL;
+    tree->ops  = ops;
+}
+
+void ptree_node_ref(ptree_node_t *node)
+{
+    if (node != NULL) {
+        __atomic_add_fetch(&node->refcount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*release a reference, and the subtree once there are none
+ * time complexity o(k) for k released nodes*/
+void ptree_node_unref(const ptree_ops_t *ops, ptree_node_t *node)
+{
+    ptree_node_t *right;
+
+    while ((node != NULL) &&
+           (__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) == 0)) {
+        ptree_node_unref(ops, node->left);
+        if (ops->value_unref) {
+            ops->value_unref(node->value);
+        }
+        right = node->right;
+        free(node);
+        node = right;
+    }
+}
+
+void ptree_copy(const ptree_t *tree, ptree_t *copy)
+{
+    ptree_node_ref(tree->root);
+    copy->root = tree->root;
+    copy->ops  = tree->ops;
+}
+
+void ptree_release(ptree_t *tree)
+{
+    ptree_node_unref(tree->ops, tree->root);
+    tree->root = NULL;
+}
+
+/* recalculate the subtree augmented value of a node */
+static void ptree_augment_node(const ptree_t *tree, ptree_node_t *node)
+{
+    tree_key_t aug;
+
+    if (!tree->ops->augment) {
+        return;
+    }
+
+    aug = node->own_aug;
+    if (ptree_aug(node->left) > aug) {
+        aug = ptree_aug(node->left);
+    }
+    if (ptree_aug(node->right) > aug) {
+        aug = ptree_aug(node->right);
+    }
+    node->aug = aug;
+}
+
+static void ptree_set_own_aug(const ptree_t *tree, ptree_node_t *node)
+{
+    node->own_aug = tree->ops->augment ? tree->ops->augment(node->value) :
+                                         TREE_KEY_MIN;
+}
+
+static ptree_node_t *ptree_new_node(const ptree_t *tree, tree_key_t key,
+                                    tree_value_t value)
+{
+    ptree_node_t *node;
+
+    node = malloc(sizeof(*node));
+    node->left     = NULL;
+    node->right    = NULL;
+    node->key      = key;
+    node->value    = value;
+    node->refcount = 1;
+    node->color    = PTREE_RED;
+    ptree_set_own_aug(tree, node);
+    node->aug      = node->own_aug;
+    return node;
+}
+
+/*get a node which only the caller's version holds, and may be changed. a
+ * shared node is replaced by a copy, which shares its children and value.
+ * time complexity o(1)*/
+static ptree_node_t *ptree_own(const ptree_t *tree, ptree_node_t *node)
+{
+    ptree_node_t *copy;
+
+    if (__atomic_load_n(&node->refcount, __ATOMIC_ACQUIRE) == 1) {
+        return node;
+    }
+
+    copy = malloc(sizeof(*copy));
+    *copy = *node;
+    copy->refcount = 1;
+    ptree_node_ref(copy->left);
+    ptree_node_ref(copy->right);
+    if (tree->ops->value_ref) {
+        tree->ops->value_ref(copy->value);
+    }
+
+    ptree_node_unref(tree->ops, node);
+    return copy;
+}
+
+/* the rotations and color flips change only nodes the caller holds */
+static ptree_node_t *ptree_rotate_left(const ptree_t *tree, ptree_node_t *h)
+{
+    ptree_node_t *x;
+
+    x        = ptree_own(tree, h->right);
+    h->right = x->left;
+    x->left  = h;
+    x->color = h->color;
+    h->color = PTREE_RED;
+    ptree_augment_node(tree, h);
+    ptree_augment_node(tree, x);
+    return x;
+}
+
+static ptree_node_t *ptree_rotate_right(const ptree_t *tree, ptree_node_t *h)
+{
+    ptree_node_t *x;
+
+    x        = ptree_own(tree, h->left);
+    h->left  = x->right;
+    x->right = h;
+    x->color = h->color;
+    h->color = PTREE_RED;
+    ptree_augment_node(tree, h);
+    ptree_augment_node(tree, x);
+    return x;
+}
+
+static void ptree_flip_colors(const ptree_t *tree, ptree_node_t *h)
+{
+    h->left         = ptree_own(tree, h->left);
+    h->right        = ptree_own(tree, h->right);
+    h->color        = !h->color;
+    h->left->color  = !h->left->color;
+    h->right->color = !h->right->color;
+}
+
+/* restore the left-leaning red-black invariants on the way up */
+static ptree_node_t *ptree_balance(const ptree_t *tree, ptree_node_t *h)
+{
+    if (ptree_is_red(h->right) && !ptree_is_red(h->left)) {
+        h = ptree_rotate_left(tree, h);
+    }
+    if (ptree_is_red(h->left) && ptree_is_red(h->left->left)) {
+        h = ptree_rotate_right(tree, h);
+    }
+    if (ptree_is_red(h->left) && ptree_is_red(h->right)) {
+        ptree_flip_colors(tree, h);
+    }
+    ptree_augment_node(tree, h);
+    return h;
+}
+
+static ptree_node_t *ptree_move_red_left(const ptree_t *tree, ptree_node_t *h)
+{
+    ptree_flip_colors(tree, h);
+    if (ptree_is_red(h->right->left)) {
+        h->right = ptree_rotate_right(tree, h->right);
+        h = ptree_rotate_left(tree, h);
+        ptree_flip_colors(tree, h);
+    }
+    return h;
+}
+
+static ptree_node_t *ptree_move_red_right(const ptree_t *tree,
+                                          ptree_node_t *h)
+{
+    ptree_flip_colors(tree, h);
+    if (ptree_is_red(h->left->left)) {
+        h = ptree_rotate_right(tree, h);
+        ptree_flip_colors(tree, h);
+    }
+    return h;
+}
+
+static ptree_node_t *ptree_do_insert(const ptree_t *tree, ptree_node_t *h,
+                                     tree_key_t key, tree_value_t value)
+{
+    if (h == NULL) {
+        return ptree_new_node(tree, key, value);
+    }
+
+    h = ptree_own(tree, h);
+    if (key < h->key) {
+        h->left = ptree_do_insert(tree, h->left, key, value);
+    } else {
+        h->right = ptree_do_insert(tree, h->right, key, value);
+    }
+    return ptree_balance(tree, h);
+}
+
+void ptree_insert(ptree_t *tree, tree_key_t key, tree_value_t value)
+{
+    tree->root = ptree_do_insert(tree, tree->root, key, value);
+    tree->root->color = PTREE_BLACK;
+}
+
+/* remove the minimal node of the subtree, and pass its key and value (with
+ * its reference) to the caller
+ */
+static ptree_node_t *ptree_delete_min(const ptree_t *tree, ptree_node_t *h,
+                                      tree_key_t *key_p, tree_value_t *value_p)
+{
+    h = ptree_own(tree, h);
+    if (h->left == NULL) {
+        *key_p   = h->key;
+        *value_p = h->value;
+        free(h);
+        return NULL;
+    }
+
+    if (!ptree_is_red(h->left) && !ptree_is_red(h->left->left)) {
+        h = ptree_move_red_left(tree, h);
+    }
+    h->left = ptree_delete_min(tree, h->left, key_p, value_p);
+    return ptree_balance(tree, h);
+}
+
+static ptree_node_t *ptree_do_delete(const ptree_t *tree, ptree_node_t *h,
+                                     tree_key_t key)
+{
+    h = ptree_own(tree, h);
+    if (key < h->key) {
+        if (!ptree_is_red(h->left) && !ptree_is_red(h->left->left)) {
+            h = ptree_move_red_left(tree, h);
+        }
+        h->left = ptree_do_delete(tree, h->left, key);
+    } else {
+        if (ptree_is_red(h->left)) {
+            h = ptree_rotate_right(tree, h);
+        }
+        if ((key == h->key) && (h->right == NULL)) {
+            if (tree->ops->value_unref) {
+                tree->ops->value_unref(h->value);
+            }
+            free(h);
+            return NULL;
+        }
+        if (!ptree_is_red(h->right) && !ptree_is_red(h->right->left)) {
+            h = ptree_move_red_right(tree, h);
+        }
+        if (key == h->key) {
+            /* replace the node by its successor */
+            if (tree->ops->value_unref) {
+                tree->ops->value_unref(h->value);
+            }
+            h->right = ptree_delete_min(tree, h->right, &h->key, &h->value);
+            ptree_set_own_aug(tree, h);
+        } else {
+            h->right = ptree_do_delete(tree, h->right, key);
+        }
+    }
+    return ptree_balance(tree, h);
+}
+
+void ptree_delete(ptree_t *tree, tree_key_t key)
+{
+    if (!ptree_is_red(tree->root->left) && !ptree_is_red(tree->root->right)) {
+        tree->root = ptree_own(tree, tree->root);
+        tree->root->color = PTREE_RED;
+    }
+
+    tree->root = ptree_do_delete(tree, tree->root, key);
+    if (tree->root != NULL) {
+        tree->root->color = PTREE_BLACK;
+    }
+}
+
+static ptree_node_t *ptree_do_update(const ptree_t *tree, ptree_node_t *h,
+                                     tree_key_t key, ptree_update_cb_t cb,
+                                     void *arg)
+{
+    h = ptree_own(tree, h);
+    if (key < h->key) {
+        h->left = ptree_do_update(tree, h->left, key, cb, arg);
+    } else if (key > h->key) {
+        h->right = ptree_do_update(tree, h->right, key, cb, arg);
+    } else {
+        cb(&h->value, arg);
+        ptree_set_own_aug(tree, h);
+    }
+    ptree_augment_node(tree, h);
+    return h;
+}
+
+void ptree_update(ptree_t *tree, tree_key_t key, ptree_update_cb_t cb,
+                  void *arg)
+{
+    tree->root = ptree_do_update(tree, tree->root, key, cb, arg);
+}
+
+const ptree_node_t *ptree_find(const ptree_node_t *root, tree_key_t key)
+{
+    const ptree_node_t *x;
+
+    x = root;
+    while ((x != NULL) && (x->key != key)) {
+        x = (key < x->key) ? x->left : x->right;
+    }
+    return x;
+}
+
+/*the lowest key above 'key' on the search path, unless a key on the path is
+ * equal to it
+ * time complexity o(logn)*/
+const ptree_node_t *ptree_ub(const ptree_node_t *root, tree_key_t key)
+{
+    const ptree_node_t *x, *ub;
+
+    ub = NULL;
+    for (x = root; x != NULL; ) {
+        if (tree_key_equal(x->key, key)) {
+            return x;
+        } else if (key < x->key) {
+            ub = x;
+            x  = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+    return ub;
+}
+
+const ptree_node_t *ptree_last(const ptree_node_t *root)
+{
+    const ptree_node_t *x;
+
+    if (root == NULL) {
+        return NULL;
+    }
+
+    for (x = root; x->right != NULL; x = x->right);
+    return x;
+}
+
+/* push the left spine of a subtree, skipping subtrees with nothing large
+ * enough
+ */
+static void ptree_iter_push_left(ptree_iter_t *iter, const ptree_node_t *x,
+                                 tree_key_t min)
+{
+    while ((x != NULL) && tree_key_ge(x->aug, min)) {
+        iter->stack[iter->depth++] = x;
+        x = x->left;
+    }
+}
+
+const ptree_node_t *ptree_iter_next_augmented(ptree_iter_t *iter,
+                                              tree_key_t min)
+{
+    const ptree_node_t *x;
+
+    while (iter->depth > 0) {
+        x = iter->stack[--iter->depth];
+        ptree_iter_push_left(iter, x->right, min);
+        if (tree_key_ge(x->own_aug, min)) {
+            return x;
+        }
+    }
+    return NULL;
+}
+
+/*push the nodes in range on the search path, which are the next ones in
+ * order along with their right subtrees
+ * time complexity o(logn)*/
+const ptree_node_t *ptree_iter_ub_augmented(ptree_iter_t *iter,
+                                            const ptree_node_t *root,
+                                            tree_key_t key, tree_key_t min)
+{
+    const ptree_node_t *x;
+
+    iter->depth = 0;
+    x = root;
+    while ((x != NULL) && tree_key_ge(x->aug, min)) {
+        if (tree_key_ge(x->key, key)) {
+            iter->stack[iter->depth++] = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+    return ptree_iter_next_augmented(iter, min);
+}
+
+int ptree_has_augmented(const ptree_node_t *root, tree_key_t key,
+                        tree_key_t min)
+{
+    const ptree_node_t *x;
+
+    x = root;
+    while ((x != NULL) && tree_key_ge(x->aug, min)) {
+        if (tree_key_ge(x->key, key)) {
+            /* x is in range, and so is all of its right subtree */
+            if (tree_key_ge(x->own_aug, min) ||
+                tree_key_ge(ptree_aug(x->right), min)) {
+                return 0;
+            }
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+
+    return -1;
+}
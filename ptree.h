@@ -0,0 +1,137 @@
+#ifndef _PTREE_H
+#define _PTREE_H
+
+#include "trees.h"
+
+
+/* deepest path of a persistent tree, which is at most 2*log2(n+1) */
+#define PTREE_MAX_DEPTH 128
+
+
+/*
+ * Persistent (left-leaning) red-black tree node.
+ * Nodes are reference counted, and may be shared by several versions of a
+ * tree. A shared node is never changed, an update copies the path to it.
+ */
+typedef struct ptree_node_s ptree_node_t;
+struct ptree_node_s {
+    ptree_node_t  *left;
+    ptree_node_t  *right;
+    tree_value_t  value;
+    tree_key_t    key;
+    tree_key_t    own_aug;      /* augmented value of this node */
+    tree_key_t    aug;          /* maximal augmented value in the subtree */
+    unsigned      refcount;
+    unsigned char color;
+};
+
+
+/* How a persistent tree handles its values */
+typedef struct ptree_ops_s {
+    tree_augment_cb_t  augment;                 /* NULL if not augmented */
+    void               (*value_ref)(tree_value_t value);
+    void               (*value_unref)(tree_value_t value);
+} ptree_ops_t;
+
+
+/*
+ * Version of a persistent tree, which holds a reference to its root
+ */
+typedef struct ptree_s {
+    ptree_node_t       *root;
+    const ptree_ops_t  *ops;
+} ptree_t;
+
+
+/*
+ * Iterator over the nodes of a tree in order
+ */
+typedef struct ptree_iter_s {
+    const ptree_node_t *stack[PTREE_MAX_DEPTH];
+    int                depth;
+} ptree_iter_t;
+
+
+/* update callback of ptree_update(), which may change the value in place */
+typedef void (*ptree_update_cb_t)(tree_value_t *value, void *arg);
+
+
+/*
+ * init an empty tree. 'ops' may have NULL callbacks.
+ */
+void ptree_init(ptree_t *tree, const ptree_ops_t *ops);
+
+
+/*
+ * make 'copy' another version of 'tree', which shares all of its nodes
+ * time complexity o(1)
+ */
+void ptree_copy(const ptree_t *tree, ptree_t *copy);
+
+
+/*
+ * release the version, and the nodes no other version holds
+ */
+void ptree_release(ptree_t *tree);
+
+
+/* references to nodes, such as roots kept as values of another tree */
+void ptree_node_ref(ptree_node_t *node);
+void ptree_node_unref(const ptree_ops_t *ops, ptree_node_t *node);
+
+
+/*
+ * the updates take exact keys: insert a key which is not in the tree, and
+ * delete or update a key which is
+ * time complexity o(logn)
+ */
+void ptree_insert(ptree_t *tree, tree_key_t key, tree_value_t value);
+void ptree_delete(ptree_t *tree, tree_key_t key);
+void ptree_update(ptree_t *tree, tree_key_t key, ptree_update_cb_t cb,
+                  void *arg);
+
+
+/*
+ * find the node with exactly 'key'
+ * returns NULL if not found
+ */
+const ptree_node_t *ptree_find(const ptree_node_t *root, tree_key_t key);
+
+
+/*
+ * like tree_ub, find the lowest key which is larger or equal to 'key', with
+ * the key delta
+ * returns NULL if not found
+ */
+const ptree_node_t *ptree_ub(const ptree_node_t *root, tree_key_t key);
+
+
+/*
+ * find the last (largest) node
+ * returns NULL if the tree is empty
+ */
+const ptree_node_t *ptree_last(const ptree_node_t *root);
+
+
+/*
+ * like tree_ub_augmented and tree_successor_augmented, iterate in order over
+ * the nodes with key at least 'key' (with the key delta) and augmented value
+ * at least 'min'
+ * returns NULL when there are no more nodes
+ */
+const ptree_node_t *ptree_iter_ub_augmented(ptree_iter_t *iter,
+                                            const ptree_node_t *root,
+                                            tree_key_t key, tree_key_t min);
+const ptree_node_t *ptree_iter_next_augmented(ptree_iter_t *iter,
+                                              tree_key_t min);
+
+
+/*
+ * like tree_has_augmented
+ * returns 0 if there is such a node, -1 if not
+ */
+int ptree_has_augmented(const ptree_node_t *root, tree_key_t key,
+                        tree_key_t min);
+
+
+#endif
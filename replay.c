@@ -0,0 +1,363 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+
+/* commands in each batch of the parser thread */
+#define REPLAY_BATCH_SIZE   4096
+
+/* batches the parser thread may fill ahead of the executor */
+#define REPLAY_NUM_BATCHES  4
+
+/* shorter runs of queries are answered by the executor alone */
+#define REPLAY_MIN_PARALLEL 64
+
+/* queries which a thread takes from a run at once */
+#define REPLAY_CHUNK_SIZE   16
+
+
+/* Result of a command */
+typedef struct replay_result_s {
+    int     ret;
+    float   found_side;
+    float   found_height;
+} replay_result_t;
+
+
+/* Batch of parsed commands */
+typedef struct replay_batch_s {
+    command_t        commands[REPLAY_BATCH_SIZE];
+    replay_result_t  results[REPLAY_BATCH_SIZE];
+    size_t           num_commands;
+    int              is_filled;
+    int              status;    /* of the last parser_next: 0 at end of file,
+                                 * -1 on syntax error, 1 otherwise */
+} replay_batch_t;
+
+
+typedef struct replay_s {
+    boxes_t          *boxes;
+    parser_t         *parser;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   batch_cond;    /* a batch was filled or released */
+    pthread_cond_t   run_cond;      /* a run started, or its workers ended */
+    int              stop;
+
+    replay_batch_t   *batches;
+    pthread_t        parser_thread;
+
+    /* the run of queries being answered */
+    pthread_t        *workers;
+    int              num_workers;
+    replay_batch_t   *run_batch;
+    size_t           run_next;      /* next query to take */
+    size_t           run_end;
+    unsigned         run_generation;
+    int              run_pending;   /* workers which did not end the run */
+} replay_t;
+
+
+/* fill the batches in order, until the end of the file or a syntax error */
+static void *replay_parser_thread(void *arg)
+{
+    replay_t *replay = arg;
+    replay_batch_t *batch;
+    int i, status, stop;
+
+    status = 1;
+    for (i = 0; status > 0; i = (i + 1) % REPLAY_NUM_BATCHES) {
+        batch = &replay->batches[i];
+
+        pthread_mutex_lock(&replay->lock);
+        while (batch->is_filled && !replay->stop) {
+            pthread_cond_wait(&replay->batch_cond, &replay->lock);
+        }
+        stop = replay->stop;
+        pthread_mutex_unlock(&replay->lock);
+        if (stop) {
+            break;
+        }
+
+        batch->num_commands = 0;
+        while (batch->num_commands < REPLAY_BATCH_SIZE) {
+            status = parser_next(replay->parser,
+                                 &batch->commands[batch->num_commands]);
+            if (status <= 0) {
+                break;
+            }
+            if (batch->commands[batch->num_commands++].type ==
+                COMMAND_INVALID) {
+                /* the replay stops there, and its name is in the buffer
+                 * of the parser until the next line is parsed
+                 */
+                status = 0;
+                break;
+            }
+        }
+        batch->status = status;
+
+        pthread_mutex_lock(&replay->lock);
+        batch->is_filled = 1;
+        pthread_cond_broadcast(&replay->batch_cond);
+        pthread_mutex_unlock(&replay->lock);
+    }
+
+    return NULL;
+}
+
+static void replay_answer(replay_t *replay, replay_batch_t *batch, size_t i)
+{
+    const command_t *command = &batch->commands[i];
+    replay_result_t *result = &batch->results[i];
+
+    if (command->type == COMMAND_GETBOX) {
+        result->ret = GETBOX(replay->boxes, command->arg1, command->arg2,
+                             &result->found_side, &result->found_height);
+    } else {
+        result->ret = CHECKBOX(replay->boxes, command->arg1, command->arg2);
+    }
+}
+
+/* answer chunks of the current run until none are left */
+static void replay_answer_chunks(replay_t *replay)
+{
+    size_t start, end, i;
+
+    for (;;) {
+        start = __atomic_fetch_add(&replay->run_next, REPLAY_CHUNK_SIZE,
+                                   __ATOMIC_RELAXED);
+        if (start >= replay->run_end) {
+            break;
+        }
+        end = start + REPLAY_CHUNK_SIZE;
+        if (end > replay->run_end) {
+            end = replay->run_end;
+        }
+        for (i = start; i < end; ++i) {
+            replay_answer(replay, replay->run_batch, i);
+        }
+    }
+}
+
+static void *replay_worker_thread(void *arg)
+{
+    replay_t *replay = arg;
+    unsigned generation;
+    int stop;
+
+    generation = 0;
+    for (;;) {
+        pthread_mutex_lock(&replay->lock);
+        while ((replay->run_generation == generation) && !replay->stop) {
+            pthread_cond_wait(&replay->run_cond, &replay->lock);
+        }
+        generation = replay->run_generation;
+        stop       = replay->stop;
+        pthread_mutex_unlock(&replay->lock);
+        if (stop) {
+            break;
+        }
+
+        replay_answer_chunks(replay);
+
+        pthread_mutex_lock(&replay->lock);
+        if (--replay->run_pending == 0) {
+            pthread_cond_broadcast(&replay->run_cond);
+        }
+        pthread_mutex_unlock(&replay->lock);
+    }
+
+    return NULL;
+}
+
+/* answer the queries [start,end) of a batch, in parallel if there are
+ * enough of them. the boxes do not change until all are answered.
+ */
+static void replay_answer_run(replay_t *replay, replay_batch_t *batch,
+                              size_t start, size_t end)
+{
+    size_t i;
+
+    if ((replay->num_workers == 0) || (end - start < REPLAY_MIN_PARALLEL)) {
+        for (i = start; i < end; ++i) {
+            replay_answer(replay, batch, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&replay->lock);
+    replay->run_batch   = batch;
+    replay->run_next    = start;
+    replay->run_end     = end;
+    replay->run_pending = replay->num_workers;
+    ++replay->run_generation;
+    pthread_cond_broadcast(&replay->run_cond);
+    pthread_mutex_unlock(&replay->lock);
+
+    replay_answer_chunks(replay);
+
+    pthread_mutex_lock(&replay->lock);
+    while (replay->run_pending > 0) {
+        pthread_cond_wait(&replay->run_cond, &replay->lock);
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+static int replay_is_query(const command_t *command)
+{
+    return (command->type == COMMAND_GETBOX) ||
+           (command->type == COMMAND_CHECKBOX);
+}
+
+/*run the commands of a batch, and write their results in order
+ * returns 0 on success, -1 on an invalid command*/
+static int replay_batch(replay_t *replay, replay_batch_t *batch,
+                        output_t *output)
+{
+    const command_t *command;
+    replay_result_t *result;
+    size_t i, j, end;
+
+    /* run the commands, up to the first invalid one */
+    end = batch->num_commands;
+    for (i = 0; i < end; i = j) {
+        command = &batch->commands[i];
+        result  = &batch->results[i];
+        j = i + 1;
+
+        switch (command->type) {
+        case COMMAND_INSERTBOX:
+            INSERTBOX_N(replay->boxes, command->arg1, command->arg2,
+                        command->count);
+            break;
+        case COMMAND_REMOVEBOX:
+            result->ret = REMOVEBOX_N(replay->boxes, command->arg1,
+                                      command->arg2, command->count);
+            break;
+        case COMMAND_GETBOX:
+        case COMMAND_CHECKBOX:
+            while ((j < end) && replay_is_query(&batch->commands[j])) {
+                ++j;
+            }
+            replay_answer_run(replay, batch, i, j);
+            break;
+        default:
+            end = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < end; ++i) {
+        command = &batch->commands[i];
+        result  = &batch->results[i];
+
+        switch (command->type) {
+        case COMMAND_REMOVEBOX:
+            output_removebox(output, result->ret, command->arg1,
+                             command->arg2);
+            break;
+        case COMMAND_GETBOX:
+            output_getbox(output, result->ret, command->arg1, command->arg2,
+                          result->found_side, result->found_height);
+            break;
+        case COMMAND_CHECKBOX:
+            output_checkbox(output, result->ret, command->arg1,
+                            command->arg2);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (end < batch->num_commands) {
+        output_invalid_command(output, &batch->commands[end]);
+        return -1;
+    }
+    return 0;
+}
+
+int replay_run(boxes_t *boxes, parser_t *parser, output_t *output,
+               int num_workers)
+{
+    replay_batch_t *batch;
+    replay_t replay;
+    int i, ret, num_started;
+
+    replay.boxes          = boxes;
+    replay.parser         = parser;
+    replay.stop           = 0;
+    replay.num_workers    = 0;
+    replay.run_generation = 0;
+    replay.run_pending    = 0;
+    replay.batches = calloc(REPLAY_NUM_BATCHES, sizeof(*replay.batches));
+    replay.workers = calloc(num_workers + 1, sizeof(*replay.workers));
+    if ((replay.batches == NULL) || (replay.workers == NULL)) {
+        free(replay.batches);
+        free(replay.workers);
+        return -1;
+    }
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.batch_cond, NULL);
+    pthread_cond_init(&replay.run_cond, NULL);
+
+    ret = -1;
+    if (pthread_create(&replay.parser_thread, NULL, replay_parser_thread,
+                       &replay)) {
+        goto out_destroy;
+    }
+    for (num_started = 0; num_started < num_workers; ++num_started) {
+        if (pthread_create(&replay.workers[num_started], NULL,
+                           replay_worker_thread, &replay)) {
+            break; /* answer with the workers which started */
+        }
+    }
+    replay.num_workers = num_started;
+
+    /* run the batches in the order they were filled */
+    for (i = 0; ; i = (i + 1) % REPLAY_NUM_BATCHES) {
+        batch = &replay.batches[i];
+
+        pthread_mutex_lock(&replay.lock);
+        while (!batch->is_filled) {
+            pthread_cond_wait(&replay.batch_cond, &replay.lock);
+        }
+        pthread_mutex_unlock(&replay.lock);
+
+        ret = replay_batch(&replay, batch, output);
+        if (ret) {
+            break;
+        } else if (batch->status < 0) {
+            output_syntax_error(output, parser);
+            ret = -1;
+            break;
+        } else if (batch->status == 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&replay.lock);
+        batch->is_filled = 0;
+        pthread_cond_broadcast(&replay.batch_cond);
+        pthread_mutex_unlock(&replay.lock);
+    }
+
+    pthread_mutex_lock(&replay.lock);
+    replay.stop = 1;
+    pthread_cond_broadcast(&replay.batch_cond);
+    pthread_cond_broadcast(&replay.run_cond);
+    pthread_mutex_unlock(&replay.lock);
+
+    for (i = 0; i < replay.num_workers; ++i) {
+        pthread_join(replay.workers[i], NULL);
+    }
+    pthread_join(replay.parser_thread, NULL);
+
+out_destroy:
+    pthread_cond_destroy(&replay.run_cond);
+    pthread_cond_destroy(&replay.batch_cond);
+    pthread_mutex_destroy(&replay.lock);
+    free(replay.workers);
+    free(replay.batches);
+    return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include "boxes.h"
+#include "parser.h"
+#include "output.h"
+
+
+/*
+ * replay a command file on 'boxes', with the same results as running its
+ * commands one by one, written to 'output' in the order of the file.
+ * the file is parsed by a separate thread, in batches of commands. the
+ * INSERTBOX and REMOVEBOX commands of a batch are run in order, and every
+ * run of consecutive GETBOX and CHECKBOX commands between them is answered
+ * in parallel by 'num_workers' threads (and the calling thread), while the
+ * boxes do not change.
+ *
+ * returns 0 at the end of the file, -1 if a command name is not known or on
+ * a syntax error (after writing the error), or if out of resources
+ */
+int replay_run(boxes_t *boxes, parser_t *parser, output_t *output,
+               int num_workers);
+
+
+#endif
@@ -0,0 +1,420 @@
+#include "shards.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+/* shards are not rebalanced while they hold less than this many boxes per
+ * shard
+ */
+#define SHARDS_REBALANCE_MIN_BOXES 1024
+
+/* a shard holding at least this many times its share of the boxes is
+ * rebalanced
+ */
+#define SHARDS_MAX_SKEW            2
+
+/* after a rebalance, the boxes must grow by this fraction before the next
+ * one, so its cost is amortized over the insertions
+ */
+#define SHARDS_REBALANCE_GROWTH    4
+
+
+/* prefer writers, so a steady stream of readers does not starve them */
+static void shards_rwlock_init(pthread_rwlock_t *lock)
+{
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr,
+                        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+static void shards_init_shard(shard_t *shard)
+{
+    boxes_init(&shard->boxes);
+    shards_rwlock_init(&shard->lock);
+    shard->num_boxes = 0;
+}
+
+static void shards_cleanup_shard(shard_t *shard)
+{
+    boxes_cleanup(&shard->boxes);
+    pthread_rwlock_destroy(&shard->lock);
+}
+
+int shards_init(shards_t *shards, int num_shards)
+{
+    int i;
+
+    shards->shards = malloc(num_shards * sizeof(*shards->shards));
+    shards->bounds = malloc(num_shards * sizeof(*shards->bounds));
+    if ((shards->shards == NULL) || (shards->bounds == NULL)) {
+        free(shards->shards);
+        free(shards->bounds);
+        return -1;
+    }
+
+    for (i = 0; i < num_shards; ++i) {
+        shards_init_shard(&shards->shards[i]);
+    }
+    for (i = 0; i < num_shards - 1; ++i) {
+        shards->bounds[i] = INFINITY;
+    }
+    shards->num_shards     = num_shards;
+    shards->num_boxes      = 0;
+    shards->next_rebalance = SHARDS_REBALANCE_MIN_BOXES * num_shards;
+    shards_rwlock_init(&shards->routing_lock);
+    return 0;
+}
+
+void shards_cleanup(shards_t *shards)
+{
+    int i;
+
+    for (i = 0; i < shards->num_shards; ++i) {
+        shards_cleanup_shard(&shards->shards[i]);
+    }
+    free(shards->shards);
+    free(shards->bounds);
+    pthread_rwlock_destroy(&shards->routing_lock);
+}
+
+/*find the shard of a side, which is the number of bounds not above it
+ * time complexity o(log(shards))*/
+static int shards_route(const shards_t *shards, float side)
+{
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = shards->num_shards - 1;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (shards->bounds[mid] <= side) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* the neighbour of shard 'i' which may hold a side within the key delta of
+ * 'side', or -1 if there is none
+ */
+static int shards_neighbour(const shards_t *shards, int i, float side)
+{
+    if ((i > 0) && (side - shards->bounds[i - 1] < TREE_KEY_DELTA)) {
+        return i - 1;
+    } else if ((i < shards->num_shards - 1) &&
+               (shards->bounds[i] - side < TREE_KEY_DELTA)) {
+        return i + 1;
+    }
+    return -1;
+}
+
+/* lock shard 'i' and its neighbour (if not -1) for writing, in order */
+static void shards_write_lock(shards_t *shards, int i, int neighbour)
+{
+    if ((neighbour >= 0) && (neighbour < i)) {
+        pthread_rwlock_wrlock(&shards->shards[neighbour].lock);
+    }
+    pthread_rwlock_wrlock(&shards->shards[i].lock);
+    if (neighbour > i) {
+        pthread_rwlock_wrlock(&shards->shards[neighbour].lock);
+    }
+}
+
+static void shards_write_unlock(shards_t *shards, int i, int neighbour)
+{
+    pthread_rwlock_unlock(&shards->shards[i].lock);
+    if (neighbour >= 0) {
+        pthread_rwlock_unlock(&shards->shards[neighbour].lock);
+    }
+}
+
+/* does the shard have a side within the key delta of 'side' */
+static int shards_has_side(shard_t *shard, float side)
+{
+    node_t *node;
+
+    return !tree_search(&shard->boxes.sidetree, tree_key_from_float(side),
+                        &node);
+}
+
+/* does the shard hold too many of the boxes */
+static int shards_is_skewed(shards_t *shards, shard_t *shard)
+{
+    long total = __atomic_load_n(&shards->num_boxes, __ATOMIC_RELAXED);
+    long count = __atomic_load_n(&shard->num_boxes, __ATOMIC_RELAXED);
+
+    return (shards->num_shards > 1) &&
+           (total >= __atomic_load_n(&shards->next_rebalance,
+                                     __ATOMIC_RELAXED)) &&
+           (count * shards->num_shards >= SHARDS_MAX_SKEW * total);
+}
+
+static int shards_box_cmp(const void *a, const void *b)
+{
+    const box_t *box_a = a, *box_b = b;
+
+    if (box_a->side != box_b->side) {
+        return (box_a->side > box_b->side) - (box_a->side < box_b->side);
+    }
+    return (box_a->height > box_b->height) - (box_a->height < box_b->height);
+}
+
+/*collect all the boxes, and reload them into new shards whose bounds split
+ * them evenly. must be called with the routing lock held for writing.
+ * time complexity o(nlogn)*/
+static int shards_do_rebalance(shards_t *shards)
+{
+    size_t total, shard_n, start, end, i;
+    box_t *all, *shard_boxes;
+    shard_t *new_shards;
+    float *new_bounds;
+    int ret, k;
+
+    ret         = -1;
+    all         = NULL;
+    new_shards  = NULL;
+    new_bounds  = NULL;
+
+    /* the shards are side ranges, so their boxes are almost sorted. only
+     * sides within the key delta of a bound may be out of order.
+     */
+    total = 0;
+    for (k = 0; k < shards->num_shards; ++k) {
+        if (boxes_collect(&shards->shards[k].boxes, &shard_boxes, &shard_n)) {
+            goto out_free;
+        }
+        if (shard_n > 0) {
+            box_t *new_all = realloc(all, (total + shard_n) * sizeof(*all));
+            if (new_all == NULL) {
+                free(shard_boxes);
+                goto out_free;
+            }
+            all = new_all;
+            memcpy(all + total, shard_boxes, shard_n * sizeof(*all));
+            total += shard_n;
+        }
+        free(shard_boxes);
+    }
+    for (i = 1; i < total; ++i) {
+        if (shards_box_cmp(&all[i - 1], &all[i]) > 0) {
+            qsort(all, total, sizeof(*all), shards_box_cmp);
+            break;
+        }
+    }
+
+    new_shards = malloc(shards->num_shards * sizeof(*new_shards));
+    new_bounds = malloc(shards->num_shards * sizeof(*new_bounds));
+    if ((new_shards == NULL) || (new_bounds == NULL)) {
+        goto out_free;
+    }
+
+    /* bound k is the side of the box at the k'th quantile. all the boxes of
+     * a side go to the same shard, so a shard may get more or less than its
+     * share, or even nothing.
+     */
+    for (k = 0; k < shards->num_shards - 1; ++k) {
+        new_bounds[k] = (total > 0) ?
+                        all[(k + 1) * total / shards->num_shards].side :
+                        INFINITY;
+        if ((k > 0) && (new_bounds[k] < new_bounds[k - 1])) {
+            new_bounds[k] = new_bounds[k - 1];
+        }
+    }
+
+    start = 0;
+    for (k = 0; k < shards->num_shards; ++k) {
+        end = start;
+        while ((end < total) && ((k == shards->num_shards - 1) ||
+                                 (all[end].side < new_bounds[k]))) {
+            ++end;
+        }
+
+        shards_init_shard(&new_shards[k]);
+        if (boxes_bulk_load(&new_shards[k].boxes, all + start, end - start)) {
+            while (k >= 0) {
+                shards_cleanup_shard(&new_shards[k--]);
+            }
+            goto out_free;
+        }
+        new_shards[k].num_boxes = end - start;
+        start = end;
+    }
+
+    for (k = 0; k < shards->num_shards; ++k) {
+        shards_cleanup_shard(&shards->shards[k]);
+    }
+    free(shards->shards);
+    free(shards->bounds);
+    shards->shards = new_shards;
+    shards->bounds = new_bounds;
+    __atomic_store_n(&shards->next_rebalance,
+                     total + total / SHARDS_REBALANCE_GROWTH,
+                     __ATOMIC_RELAXED);
+    new_shards     = NULL;
+    new_bounds     = NULL;
+    ret = 0;
+
+out_free:
+    free(new_bounds);
+    free(new_shards);
+    free(all);
+    return ret;
+}
+
+int shards_rebalance(shards_t *shards)
+{
+    int ret;
+
+    pthread_rwlock_wrlock(&shards->routing_lock);
+    ret = shards_do_rebalance(shards);
+    pthread_rwlock_unlock(&shards->routing_lock);
+    return ret;
+}
+
+/* rebalance, unless another thread already did */
+static void shards_rebalance_skewed(shards_t *shards)
+{
+    int k;
+
+    pthread_rwlock_wrlock(&shards->routing_lock);
+    for (k = 0; k < shards->num_shards; ++k) {
+        if (shards_is_skewed(shards, &shards->shards[k])) {
+            shards_do_rebalance(shards);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&shards->routing_lock);
+}
+
+/*insert to the shard of the side, or to its neighbour if the neighbour
+ * already holds the side (within the key delta), like a single boxes_t
+ * time complexity O(log(n*m))*/
+void shards_insertbox(shards_t *shards, float side, float height)
+{
+    int i, neighbour, is_skewed;
+    shard_t *shard;
+
+    pthread_rwlock_rdlock(&shards->routing_lock);
+
+    i         = shards_route(shards, side);
+    neighbour = shards_neighbour(shards, i, side);
+    shards_write_lock(shards, i, neighbour);
+
+    shard = &shards->shards[i];
+    if ((neighbour >= 0) && !shards_has_side(shard, side) &&
+        shards_has_side(&shards->shards[neighbour], side)) {
+        shard = &shards->shards[neighbour];
+    }
+    INSERTBOX(&shard->boxes, side, height);
+    __atomic_add_fetch(&shard->num_boxes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shards->num_boxes, 1, __ATOMIC_RELAXED);
+
+    shards_write_unlock(shards, i, neighbour);
+    is_skewed = shards_is_skewed(shards, shard);
+    pthread_rwlock_unlock(&shards->routing_lock);
+
+    if (is_skewed) {
+        shards_rebalance_skewed(shards);
+    }
+}
+
+int shards_removebox(shards_t *shards, float side, float height)
+{
+    int i, neighbour, ret;
+    shard_t *shard;
+
+    pthread_rwlock_rdlock(&shards->routing_lock);
+
+    i         = shards_route(shards, side);
+    neighbour = shards_neighbour(shards, i, side);
+    shards_write_lock(shards, i, neighbour);
+
+    shard = &shards->shards[i];
+    ret   = REMOVEBOX(&shard->boxes, side, height);
+    if (ret && (neighbour >= 0)) {
+        shard = &shards->shards[neighbour];
+        ret   = REMOVEBOX(&shard->boxes, side, height);
+    }
+    if (!ret) {
+        __atomic_sub_fetch(&shard->num_boxes, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&shards->num_boxes, 1, __ATOMIC_RELAXED);
+    }
+
+    shards_write_unlock(shards, i, neighbour);
+    pthread_rwlock_unlock(&shards->routing_lock);
+    return ret;
+}
+
+/*query the shards from the one which may hold the side upwards, and keep the
+ * minimal volume. a shard whose lowest side can not improve the volume ends
+ * the search, like the side scan of GETBOX.
+ * time complexity O(k*log(n*m)) for k shards queried*/
+int shards_getbox(shards_t *shards, float side, float height,
+                  float *found_side_p, float *found_height_p)
+{
+    float found_side, found_height, volume, min_volume, min_height, bound;
+    shard_t *shard;
+    int i, is_found;
+
+    pthread_rwlock_rdlock(&shards->routing_lock);
+
+    /* lowest height which GETBOX may return, up to the key delta */
+    min_height = height - 2 * TREE_KEY_DELTA;
+
+    is_found   = 0;
+    min_volume = INFINITY;
+    for (i = shards_route(shards, side - TREE_KEY_DELTA);
+         i < shards->num_shards; ++i) {
+        if (is_found && (i > 0)) {
+            bound = shards->bounds[i - 1];
+            if ((bound >= 0) && (min_height >= 0) &&
+                (bound * bound * min_height >= min_volume)) {
+                break; /* remaining shards are too big to have a lower volume */
+            }
+        }
+
+        shard = &shards->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        if (!GETBOX(&shard->boxes, side, height, &found_side, &found_height)) {
+            volume = found_side * found_side * found_height;
+            if (!is_found || (volume < min_volume)) {
+                min_volume      = volume;
+                *found_side_p   = found_side;
+                *found_height_p = found_height;
+                is_found        = 1;
+            }
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    pthread_rwlock_unlock(&shards->routing_lock);
+    return is_found ? 0 : -1;
+}
+
+int shards_checkbox(shards_t *shards, float side, float height)
+{
+    shard_t *shard;
+    int i, ret;
+
+    pthread_rwlock_rdlock(&shards->routing_lock);
+
+    ret = -1;
+    for (i = shards_route(shards, side - TREE_KEY_DELTA);
+         (i < shards->num_shards) && ret; ++i) {
+        shard = &shards->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        ret = CHECKBOX(&shard->boxes, side, height);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    pthread_rwlock_unlock(&shards->routing_lock);
+    return ret;
+}
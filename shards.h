@@ -0,0 +1,68 @@
+#ifndef _SHARDS_H
+#define _SHARDS_H
+
+#include "boxes.h"
+
+#include <pthread.h>
+
+
+/* Shard of the boxes, with its own lock */
+typedef struct shard_s {
+    boxes_t           boxes;
+    pthread_rwlock_t  lock;
+    long              num_boxes;
+} shard_t;
+
+
+/*
+ * Boxes partitioned by side into range shards.
+ * Shard i holds the sides in [bounds[i-1], bounds[i]), the first and the
+ * last shards are unbounded below and above. Updates of different shards run
+ * in parallel. The shard bounds are moved by a rebalance, which runs alone,
+ * once a shard holds too many of the boxes.
+ */
+typedef struct shards_s {
+    shard_t           *shards;
+    float             *bounds;          /* num_shards - 1 bounds */
+    int               num_shards;
+    long              num_boxes;
+    long              next_rebalance;   /* no automatic rebalance before the
+                                         * boxes reach this number */
+    pthread_rwlock_t  routing_lock;     /* held for writing by a rebalance */
+} shards_t;
+
+
+/*
+ * init 'num_shards' empty shards. until the first rebalance, all boxes are
+ * in the first shard.
+ * returns 0 on success, -1 if out of memory
+ */
+int shards_init(shards_t *shards, int num_shards);
+
+
+/*
+ * release all the boxes
+ */
+void shards_cleanup(shards_t *shards);
+
+
+/*
+ * same as INSERTBOX, REMOVEBOX, GETBOX and CHECKBOX of boxes_t, and safe to
+ * call from several threads at once. a query sees each shard at a single
+ * point in time, but different shards may be seen at different times.
+ */
+void shards_insertbox(shards_t *shards, float side, float height);
+int shards_removebox(shards_t *shards, float side, float height);
+int shards_getbox(shards_t *shards, float side, float height,
+                  float *found_side_p, float *found_height_p);
+int shards_checkbox(shards_t *shards, float side, float height);
+
+
+/*
+ * move the shard bounds so every shard holds about the same number of boxes
+ * returns 0 on success, -1 if out of memory (the shards are not changed)
+ */
+int shards_rebalance(shards_t *shards);
+
+
+#endif
@@ -0,0 +1,262 @@
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+static const char *stats_counter_names[STATS_NUM_COUNTERS] = {
+    "nodes visited",
+    "successor steps",
+    "sides scanned",
+    "rotations",
+    "node allocs",
+    "node frees",
+    "slab allocs",
+    "nodes rebuilt"
+};
+
+static const char *stats_op_names[STATS_NUM_OPS] = {
+    "INSERTBOX",
+    "REMOVEBOX",
+    "GETBOX",
+    "CHECKBOX",
+    "TAKEBOX"
+};
+
+/* percentiles which are printed for every operation */
+static const double stats_percentiles[] = {50, 90, 99, 99.9};
+
+#define STATS_NUM_PERCENTILES \
+        (sizeof(stats_percentiles) / sizeof(stats_percentiles[0]))
+
+
+/* all threads which registered, which are kept after they exit */
+static stats_thread_t *stats_threads;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef BOXES_STATS
+__thread stats_thread_t *stats_local;
+
+/* events of threads which could not register */
+static stats_thread_t stats_lost;
+#endif
+
+
+/* bucket of a value, see stats_histogram_t */
+static unsigned stats_bucket(uint64_t value)
+{
+    int shift;
+
+    if (value < STATS_SUB_BUCKETS) {
+        return value;
+    }
+
+    shift = 63 - __builtin_clzll(value) - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_BUCKETS +
+           ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* highest value of a bucket */
+static uint64_t stats_bucket_max(unsigned bucket)
+{
+    unsigned shift;
+
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    shift = bucket / STATS_SUB_BUCKETS - 1;
+    return ((uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS + 1)
+            << shift) - 1;
+}
+
+#ifdef BOXES_STATS
+stats_thread_t *stats_register(void)
+{
+    stats_thread_t *thread;
+
+    /* never released, since stats_dump() may read it after the thread
+     * exits. if out of memory, the events of the thread are not counted.
+     */
+    thread = calloc(1, sizeof(*thread));
+    if (thread == NULL) {
+        stats_local = &stats_lost;
+        return stats_local;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    thread->next  = stats_threads;
+    stats_threads = thread;
+    pthread_mutex_unlock(&stats_lock);
+
+    stats_local = thread;
+    return thread;
+}
+
+void stats_record(stats_op_t op, uint64_t ns)
+{
+    stats_histogram_record(&stats_thread()->histograms[op], ns);
+}
+#endif
+
+static uint64_t stats_load(const uint64_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/* relaxed, so stats_dump() may read the histograms of running threads */
+static void stats_store(uint64_t *value, uint64_t n)
+{
+    __atomic_store_n(value, n, __ATOMIC_RELAXED);
+}
+
+void stats_histogram_record(stats_histogram_t *histogram, uint64_t value)
+{
+    uint64_t *bucket = &histogram->buckets[stats_bucket(value)];
+
+    stats_store(bucket, stats_load(bucket) + 1);
+    stats_store(&histogram->count, stats_load(&histogram->count) + 1);
+    stats_store(&histogram->sum, stats_load(&histogram->sum) + value);
+    if (value > stats_load(&histogram->max)) {
+        stats_store(&histogram->max, value);
+    }
+}
+
+int stats_enabled(void)
+{
+#ifdef BOXES_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* sum the histograms of an operation over all threads, with the lock held */
+static void stats_sum_histogram(stats_op_t op, stats_histogram_t *sum)
+{
+    const stats_histogram_t *histogram;
+    stats_thread_t *thread;
+    uint64_t max;
+    unsigned i;
+
+    memset(sum, 0, sizeof(*sum));
+    for (thread = stats_threads; thread != NULL; thread = thread->next) {
+        histogram = &thread->histograms[op];
+        for (i = 0; i < STATS_NUM_BUCKETS; ++i) {
+            sum->buckets[i] += stats_load(&histogram->buckets[i]);
+        }
+        sum->count += stats_load(&histogram->count);
+        sum->sum   += stats_load(&histogram->sum);
+        max = stats_load(&histogram->max);
+        if (max > sum->max) {
+            sum->max = max;
+        }
+    }
+}
+
+uint64_t stats_histogram_percentile(const stats_histogram_t *histogram,
+                                    double percentile)
+{
+    uint64_t rank, seen, value;
+    unsigned i;
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t)(percentile / 100 * histogram->count);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    seen = 0;
+    for (i = 0; i < STATS_NUM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = stats_bucket_max(i);
+    return (value < histogram->max) ? value : histogram->max;
+}
+
+static uint64_t stats_do_counter(stats_counter_t counter)
+{
+    stats_thread_t *thread;
+    uint64_t sum;
+
+    sum = 0;
+    for (thread = stats_threads; thread != NULL; thread = thread->next) {
+        sum += stats_load(&thread->counters[counter]);
+    }
+    return sum;
+}
+
+uint64_t stats_counter(stats_counter_t counter)
+{
+    uint64_t sum;
+
+    pthread_mutex_lock(&stats_lock);
+    sum = stats_do_counter(counter);
+    pthread_mutex_unlock(&stats_lock);
+    return sum;
+}
+
+void stats_dump(FILE *file)
+{
+    static stats_histogram_t histogram;
+    unsigned op, i;
+
+    if (!stats_enabled()) {
+        fprintf(file, "latency and counters: not compiled in, build with "
+                "'make STATS=1'\n");
+        return;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+
+    fprintf(file, "%-10s %10s %10s", "latency ns", "count", "mean");
+    for (i = 0; i < STATS_NUM_PERCENTILES; ++i) {
+        fprintf(file, "      p%-4g", stats_percentiles[i]);
+    }
+    fprintf(file, " %10s\n", "max");
+
+    for (op = 0; op < STATS_NUM_OPS; ++op) {
+        stats_sum_histogram(op, &histogram);
+        if (histogram.count == 0) {
+            continue;
+        }
+
+        fprintf(file, "%-10s %10llu %10llu", stats_op_names[op],
+                (unsigned long long)histogram.count,
+                (unsigned long long)(histogram.sum / histogram.count));
+        for (i = 0; i < STATS_NUM_PERCENTILES; ++i) {
+            fprintf(file, " %10llu", (unsigned long long)
+                    stats_histogram_percentile(&histogram,
+                                               stats_percentiles[i]));
+        }
+        fprintf(file, " %10llu\n", (unsigned long long)histogram.max);
+    }
+
+    for (i = 0; i < STATS_NUM_COUNTERS; ++i) {
+        fprintf(file, "%-16s %16llu\n", stats_counter_names[i],
+                (unsigned long long)stats_do_counter(i));
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_reset(void)
+{
+    stats_thread_t *thread, *next;
+
+    pthread_mutex_lock(&stats_lock);
+    for (thread = stats_threads; thread != NULL; thread = next) {
+        next = thread->next;
+        memset(thread, 0, sizeof(*thread));
+        thread->next = next;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
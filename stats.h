@@ -0,0 +1,152 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "util.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/*
+ * Instrumentation of the hot paths, compiled in with -DBOXES_STATS (make
+ * STATS=1). Otherwise the macros below are empty, and cost nothing.
+ *
+ * Every thread counts into its own counters and histograms, without locked
+ * atomic operations, and stats_dump() sums them over all threads.
+ */
+
+
+/* Event counters */
+typedef enum {
+    STATS_NODES_VISITED,    /* tree nodes visited by searches */
+    STATS_SUCCESSOR_STEPS,  /* tree successor steps */
+    STATS_SIDES_SCANNED,    /* sides scanned by GETBOX */
+    STATS_ROTATIONS,        /* RB tree rotations, or B+-tree node splits,
+                             * borrows and merges */
+    STATS_NODE_ALLOCS,      /* tree nodes allocated */
+    STATS_NODE_FREES,       /* tree nodes released */
+    STATS_SLAB_ALLOCS,      /* pool slabs allocated */
+    STATS_NODES_REBUILT,    /* range tree nodes rebuilt, see vtree.h */
+    STATS_NUM_COUNTERS
+} stats_counter_t;
+
+
+/* Timed operations, each with a latency histogram */
+typedef enum {
+    STATS_OP_INSERTBOX,
+    STATS_OP_REMOVEBOX,
+    STATS_OP_GETBOX,
+    STATS_OP_CHECKBOX,
+    STATS_OP_TAKEBOX,       /* boxes_take_best_fit() */
+    STATS_NUM_OPS
+} stats_op_t;
+
+
+/*
+ * Log-linear (HDR-style) latency histogram in nanoseconds. Values below
+ * STATS_SUB_BUCKETS have a bucket each, and every power of 2 above is split
+ * into STATS_SUB_BUCKETS buckets, so a bucket is within 1/16 of its values.
+ */
+#define STATS_SUB_BITS      4
+#define STATS_SUB_BUCKETS   (1 << STATS_SUB_BITS)
+#define STATS_NUM_BUCKETS   (64 * STATS_SUB_BUCKETS)
+
+typedef struct stats_histogram_s {
+    uint64_t    buckets[STATS_NUM_BUCKETS];
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+} stats_histogram_t;
+
+
+/* Instrumentation of a thread */
+typedef struct stats_thread_s stats_thread_t;
+struct stats_thread_s {
+    uint64_t            counters[STATS_NUM_COUNTERS];
+    stats_histogram_t   histograms[STATS_NUM_OPS];
+    stats_thread_t      *next;      /* of all the threads */
+};
+
+
+#ifdef BOXES_STATS
+
+extern __thread stats_thread_t *stats_local;
+
+/* register the instrumentation of the calling thread, on its first event */
+stats_thread_t *stats_register(void);
+
+static inline stats_thread_t *stats_thread(void)
+{
+    if (__builtin_expect(stats_local == NULL, 0)) {
+        return stats_register();
+    }
+    return stats_local;
+}
+
+/* relaxed, so stats_dump() may read the counters of running threads */
+static inline void stats_add(uint64_t *value, uint64_t n)
+{
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+void stats_record(stats_op_t op, uint64_t ns);
+
+#define STATS_ADD(_counter, _n) \
+        stats_add(&stats_thread()->counters[_counter], (_n))
+#define STATS_INC(_counter) \
+        STATS_ADD(_counter, 1)
+#define STATS_TIMER_START(_timer) \
+        uint64_t _timer = util_now_ns()
+#define STATS_TIMER_END(_timer, _op) \
+        stats_record((_op), util_now_ns() - (_timer))
+
+#else
+
+#define STATS_ADD(_counter, _n)
+#define STATS_INC(_counter)
+#define STATS_TIMER_START(_timer)
+#define STATS_TIMER_END(_timer, _op)
+
+#endif
+
+
+/* nonzero if the instrumentation is compiled in */
+int stats_enabled(void);
+
+
+/*
+ * print the latency percentiles of every operation, and the counters, summed
+ * over all threads
+ */
+void stats_dump(FILE *file);
+
+
+/*
+ * zero the counters and histograms of all threads, while no thread is
+ * counting
+ */
+void stats_reset(void);
+
+
+/*
+ * value of a counter, summed over all threads
+ */
+uint64_t stats_counter(stats_counter_t counter);
+
+
+/*
+ * add a value to a histogram, which is available without BOXES_STATS too
+ */
+void stats_histogram_record(stats_histogram_t *histogram, uint64_t value);
+
+
+/*
+ * value of a histogram at a percentile (0-100), up to the precision of the
+ * buckets
+ */
+uint64_t stats_histogram_percentile(const stats_histogram_t *histogram,
+                                    double percentile);
+
+
+#endif
@@ -1,4 +1,5 @@
 #include "trees.h"
+#include "stats.h"
 #include "assert.h"
 
 #include <stdlib.h>
@@ -6,37 +7,133 @@
 #include <math.h>
 
 
-static int float_equal(float n1, float n2)
+static inline node_t *node_parent(const node_t *node)
 {
-    float delta = 0.001;
-    return fabs(n1 - n2) < delta;
+    return (node_t*)(node->parent_color & ~(uintptr_t)1);
+}
+
+static inline color_t node_color(const node_t *node)
+{
+    return (color_t)(node->parent_color & 1);
+}
+
+static inline void node_set_parent(node_t *node, node_t *parent)
+{
+    node->parent_color = (uintptr_t)parent | (node->parent_color & 1);
+}
+
+static inline void node_set_color(node_t *node, color_t color)
+{
+    node->parent_color = (node->parent_color & ~(uintptr_t)1) | color;
 }
 
 void tree_init(tree_t *tree)
 {
-    tree->root       = &tree->nil;
-    tree->nil.color  = BLACK;
-    tree->nil.left   = NULL;
-    tree->nil.right  = NULL;
-    tree->nil.parent = NULL;
+    tree->root        = &tree->nil;
+    tree->augment     = NULL;
+    tree->pool        = NULL;
+    tree->nil.own_aug = TREE_KEY_MIN;
+    tree->nil.aug     = TREE_KEY_MIN;
+    tree->nil.left    = NULL;
+    tree->nil.right   = NULL;
+    tree->nil.parent_color = BLACK; /* no parent */
 }
 
-static void tree_do_cleanup(tree_t *tree, node_t *root,
-                            tree_cleanup_cb_t cb)
+void tree_init_augmented(tree_t *tree, tree_augment_cb_t augment)
 {
-    if (root == &tree->nil) {
+    tree_init(tree);
+    tree->augment = augment;
+}
+
+size_t tree_node_size(int augmented)
+{
+    return augmented ? sizeof(node_t) : offsetof(node_t, own_aug);
+}
+
+void tree_set_pool(tree_t *tree, pool_t *pool)
+{
+    assert(tree_is_empty(tree));
+    tree->pool = pool;
+}
+
+static void tree_free_node(tree_t *tree, node_t *node)
+{
+    STATS_INC(STATS_NODE_FREES);
+    if (tree->pool) {
+        pool_free(tree->pool, node);
+    } else {
+        free(node);
+    }
+}
+
+/* recalculate the subtree augmented value of a node from its own value and
+ * its children
+ * time complexity o(1)*/
+static void tree_augment_node(tree_t *tree, node_t *x)
+{
+    tree_key_t aug;
+
+    aug = x->own_aug;
+    if (x->left->aug > aug) {
+        aug = x->left->aug;
+    }
+    if (x->right->aug > aug) {
+        aug = x->right->aug;
+    }
+    x->aug = aug;
+}
+
+/* recalculate the augmented values on the path from x to the root */
+static void tree_augment_path(tree_t *tree, node_t *x)
+{
+    for (; x != &tree->nil; x = node_parent(x)) {
+        tree_augment_node(tree, x);
+    }
+}
+
+void tree_augment_update(tree_t *tree, node_t *node)
+{
+    node_t *x;
+    tree_key_t prev_aug;
+
+    if (!tree->augment) {
         return;
     }
 
-    cb(root->value);
-    tree_do_cleanup(tree, root->left, cb);
-    tree_do_cleanup(tree, root->right, cb);
-    free(root);
+    node->own_aug = tree->augment(node->value);
+
+    /* once a node's augmented value is unchanged, so are its ancestors' */
+    for (x = node; x != &tree->nil; x = node_parent(x)) {
+        prev_aug = x->aug;
+        tree_augment_node(tree, x);
+        if (x->aug == prev_aug) {
+            break;
+        }
+    }
 }
 
+/*free the nodes in order, rotating every left child up until the node has
+ * none. each rotation moves a node off the left spine for good, so there are
+ * less than n of them, and no stack is needed however deep the tree is.
+ * time complexity o(n), space o(1)*/
 void tree_cleanup(tree_t *tree, tree_cleanup_cb_t cb)
 {
-    tree_do_cleanup(tree, tree->root, cb);
+    node_t *x, *y;
+
+    x = tree->root;
+    while (x != &tree->nil) {
+        if (x->left != &tree->nil) {
+            y        = x->left;
+            x->left  = y->right;
+            y->right = x;
+            x        = y;
+        } else {
+            y = x->right;
+            cb(x->value);
+            tree_free_node(tree, x);
+            x = y;
+        }
+    }
     tree->root = &tree->nil;
 }
 
@@ -45,62 +142,104 @@ int tree_is_empty(const tree_t *tree)
     return tree->root == &tree->nil;
 }
 
-static void tree_do_print(const tree_t *tree, node_t *root, char type,
-                          int indent, tree_print_cb_t cb, const char *prefix)
+/*the node after x in a preorder walk, by the parent pointers, and update
+ * 'depth_p' to its depth. returns nil after the last node.
+ * time complexity o(1) amortized*/
+static node_t *tree_preorder_next(const tree_t *tree, node_t *x,
+                                  size_t *depth_p)
 {
-    if (root == &tree->nil) {
-        return;
+    node_t *parent;
+
+    if (x->left != &tree->nil) {
+        ++*depth_p;
+        return x->left;
+    } else if (x->right != &tree->nil) {
+        ++*depth_p;
+        return x->right;
     }
 
-    printf("%s%*s[%c] %.2f\n", prefix, indent, "", type, root->key);
-    cb(indent + 2, root->value, prefix);
-
-    tree_do_print(tree, root->left,  'l', indent + 2, cb, prefix);
-    tree_do_print(tree, root->right, 'r', indent + 2, cb, prefix);
+    /* climb to the first ancestor whose right subtree is not walked yet */
+    for (parent = node_parent(x); parent != &tree->nil;
+         x = parent, parent = node_parent(x)) {
+        if ((x == parent->left) && (parent->right != &tree->nil)) {
+            return parent->right;
+        }
+        --*depth_p;
+    }
+    return (node_t*)&tree->nil;
 }
 
 void tree_print(const tree_t *tree, tree_print_cb_t cb, const char *prefix)
 {
-    tree_do_print(tree, tree->root, '*', 0, cb, prefix);
+    node_t *x, *parent;
+    size_t depth;
+    int indent;
+    char type;
+
+    depth = 0;
+    for (x = tree->root; x != &tree->nil;
+         x = tree_preorder_next(tree, x, &depth)) {
+        parent = node_parent(x);
+        if (parent == &tree->nil) {
+            type = '*';
+        } else {
+            type = (x == parent->left) ? 'l' : 'r';
+        }
+        indent = 2 * depth;
+
+        printf("%s%*s[%c] %.2f\n", prefix, indent, "", type,
+               tree_key_to_float(x->key));
+        cb(indent + 2, x->value, prefix);
+    }
 }
 
-static node_t* tree_do_search(const tree_t *tree, node_t *root, float key)
+/*find a node whose key is equal to the given key, by tree_key_equal()
+ * time complexity o(logn)*/
+int tree_search(const tree_t *tree, tree_key_t key, node_t **node_p)
 {
-    if ((root == &tree->nil) || float_equal(key, root->key)) {
-        return root;
-    } else {
-        node_t *node = tree_do_search(tree, root->left, key);
-        if (node != &tree->nil) {
-            return node;
+    node_t *x;
+
+    /* if 'key' is not equal to x->key and is lower than it, every key in the
+     * right subtree is even further away, so only the left one can match
+     * (and vice versa)
+     */
+    x = tree->root;
+    while ((x != &tree->nil) && !tree_key_equal(key, x->key)) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (key < x->key) {
+            x = x->left;
         } else {
-            return tree_do_search(tree, root->right, key);
+            x = x->right;
         }
     }
-}
 
-int tree_search(const tree_t *tree, float key, node_t **node_p)
-{
-    node_t *node = tree_do_search(tree, tree->root, key);
-    if (node == &tree->nil) {
+    if (x == &tree->nil) {
         return -1; /* not found */
-    } else {
-        *node_p = node;
-        return 0;
     }
+    *node_p = x;
+    return 0;
 }
 
-static node_t *tree_new_node(tree_t *tree, float key, void *value,
+static node_t *tree_new_node(tree_t *tree, tree_key_t key, tree_value_t value,
                              color_t color)
 {
     node_t *node;
 
-    node = (node_t*)malloc(sizeof(*node));
-    node->key    = key;
-    node->value  = value;
-    node->color  = color;
-    node->left   = &tree->nil;
-    node->right  = &tree->nil;
-    node->parent = &tree->nil;
+    STATS_INC(STATS_NODE_ALLOCS);
+    if (tree->pool) {
+        node = (node_t*)pool_alloc(tree->pool);
+    } else {
+        node = (node_t*)malloc(tree_node_size(tree->augment != NULL));
+    }
+    node->key          = key;
+    node->value        = value;
+    node->left         = &tree->nil;
+    node->right        = &tree->nil;
+    node->parent_color = (uintptr_t)&tree->nil | color;
+    if (tree->augment) {
+        node->own_aug = tree->augment(value);
+        node->aug     = node->own_aug;
+    }
     return node;
 }
 
@@ -110,25 +249,32 @@ void tree_left_rotate(tree_t *tree, node_t *x)
 {
     node_t *y;
 
+    STATS_INC(STATS_ROTATIONS);
     y        = x->right;
     x->right = y->left;
 
     if (y->left != &tree->nil) {
-        y->left->parent = x;
+        node_set_parent(y->left, x);
     }
 
-    y->parent = x->parent;
+    node_set_parent(y, node_parent(x));
 
-    if (x->parent == &tree->nil) {
+    if (node_parent(x) == &tree->nil) {
         tree->root = y;
-    } else if (x == x->parent->left) {
-        x->parent->left = y;
+    } else if (x == node_parent(x)->left) {
+        node_parent(x)->left = y;
     } else {
-        x->parent->right = y;
+        node_parent(x)->right = y;
     }
 
     y->left   = x;
-    x->parent = y;
+    node_set_parent(x, y);
+
+    if (tree->augment) {
+        /* y now roots the same subtree x did */
+        y->aug = x->aug;
+        tree_augment_node(tree, x);
+    }
 }
 
 /*rotation of a node to the right
@@ -137,25 +283,32 @@ void tree_right_rotate(tree_t *tree, node_t *x)
 {
     node_t *y;
 
+    STATS_INC(STATS_ROTATIONS);
     y       = x->left;
     x->left = y->right;
 
     if (y->right != &tree->nil) {
-        y->right->parent = x;
+        node_set_parent(y->right, x);
     }
 
-    y->parent = x->parent;
+    node_set_parent(y, node_parent(x));
 
-    if (x->parent == &tree->nil) {
+    if (node_parent(x) == &tree->nil) {
         tree->root = y;
-    } else if (x == x->parent->right) {
-        x->parent->right = y;
+    } else if (x == node_parent(x)->right) {
+        node_parent(x)->right = y;
     } else {
-        x->parent->left = y;
+        node_parent(x)->left = y;
     }
 
     y->right  = x;
-    x->parent = y;
+    node_set_parent(x, y);
+
+    if (tree->augment) {
+        /* y now roots the same subtree x did */
+        y->aug = x->aug;
+        tree_augment_node(tree, x);
+    }
 }
 /*
  * fix red black tree (with n nodes) violations of inserting a new node
@@ -165,76 +318,132 @@ static void tree_insert_fixup(tree_t *tree, node_t *z)
 {
     node_t *y;
 
-    while ((z != tree->root) && (z->parent->color == RED)) {
-        if (z->parent == z->parent->parent->left) {
-            y = z->parent->parent->right;
-            if (y->color == RED) {
-                z->parent->color         = BLACK;
-                y->color                 = BLACK;
-                z->parent->parent->color = RED;
-                z                        = z->parent->parent;
+    while ((z != tree->root) && (node_color(node_parent(z)) == RED)) {
+        if (node_parent(z) == node_parent(node_parent(z))->left) {
+            y = node_parent(node_parent(z))->right;
+            if (node_color(y) == RED) {
+                node_set_color(node_parent(z), BLACK);
+                node_set_color(y, BLACK);
+                node_set_color(node_parent(node_parent(z)), RED);
+                z = node_parent(node_parent(z));
             } else {
-                if (z == z->parent->right) {
-                    z = z->parent;
+                if (z == node_parent(z)->right) {
+                    z = node_parent(z);
                     tree_left_rotate(tree, z);
                 }
-                z->parent->color         = BLACK;
-                z->parent->parent->color = RED;
-                tree_right_rotate(tree, z->parent->parent);
+                node_set_color(node_parent(z), BLACK);
+                node_set_color(node_parent(node_parent(z)), RED);
+                tree_right_rotate(tree, node_parent(node_parent(z)));
             }
         } else {
-            y = z->parent->parent->left;
-            if (y->color == RED) {
-                z->parent->color         = BLACK;
-                y->color                 = BLACK;
-                z->parent->parent->color = RED;
-                z                        = z->parent->parent;
+            y = node_parent(node_parent(z))->left;
+            if (node_color(y) == RED) {
+                node_set_color(node_parent(z), BLACK);
+                node_set_color(y, BLACK);
+                node_set_color(node_parent(node_parent(z)), RED);
+                z = node_parent(node_parent(z));
             } else {
-                if (z == z->parent->left) {
-                    z = z->parent;
+                if (z == node_parent(z)->left) {
+                    z = node_parent(z);
                     tree_right_rotate(tree, z);
                 }
-                z->parent->color         = BLACK;
-                z->parent->parent->color = RED;
-                tree_left_rotate(tree, z->parent->parent);
+                node_set_color(node_parent(z), BLACK);
+                node_set_color(node_parent(node_parent(z)), RED);
+                tree_left_rotate(tree, node_parent(node_parent(z)));
             }
         }
     }
-    tree->root->color = BLACK;
+    node_set_color(tree->root, BLACK);
 }
 
-int tree_insert(tree_t *tree, float key, void *value)
+int tree_insert(tree_t *tree, tree_key_t key, tree_value_t value)
 {
     node_t *x, *y, *z;
 
-    z = tree_new_node(tree, key, value, RED);
     y = &tree->nil;
     x = tree->root;
 
     while (x != &tree->nil){
         y = x;
-        if (z->key < x->key) {
+        if (key < x->key) {
             x = x->left;
-        } else {
+        } else if (key > x->key) {
             x = x->right;
+        } else {
+            return -1; /* already exists */
         }
     }
 
-    z->parent = y;
+    z = tree_new_node(tree, key, value, RED);
+    node_set_parent(z, y);
     if (y == &tree->nil) {
         tree->root = z;
     } else if (z->key < y->key) {
         y->left = z;
-    } else if (z->key > y->key) {
-        y->right = z;
     } else {
-        return -1; /* already exists */
+        y->right = z;
+    }
+
+    if (tree->augment) {
+        for (x = y; (x != &tree->nil) && (x->aug < z->aug);
+             x = node_parent(x)) {
+            x->aug = z->aug;
+        }
     }
 
     tree_insert_fixup(tree, z);
     return 0;
 }
 
+/*build a balanced subtree of keys[lo..hi), whose nodes in 'red_depth' are
+ * red and all others are black
+ * time complexity o(n)*/
+static node_t *tree_do_build(tree_t *tree, const tree_key_t *keys,
+                             const tree_value_t *values, size_t lo, size_t hi,
+                             int depth, int red_depth, node_t *parent)
+{
+    node_t *x;
+    size_t mid;
+
+    if (lo == hi) {
+        return &tree->nil;
+    }
+
+    mid = lo + (hi - lo) / 2;
+    x   = tree_new_node(tree, keys[mid], values[mid],
+                        (depth == red_depth) ? RED : BLACK);
+    node_set_parent(x, parent);
+    x->left  = tree_do_build(tree, keys, values, lo, mid, depth + 1,
+                             red_depth, x);
+    x->right = tree_do_build(tree, keys, values, mid + 1, hi, depth + 1,
+                             red_depth, x);
+    if (tree->augment) {
+        tree_augment_node(tree, x);
+    }
+    return x;
+}
+
+int tree_build_sorted(tree_t *tree, const tree_key_t *keys,
+                      const tree_value_t *values, size_t n)
+{
+    int height;
+
+    if (!tree_is_empty(tree)) {
+        return -1;
+    }
+
+    /* splitting at the middle puts all the leaves in the last two levels.
+     * if the last level is not full, making it red keeps the same number of
+     * black nodes on every path.
+     */
+    for (height = 0; (((size_t)1 << height) - 1) < n; ++height);
+    tree->root = tree_do_build(tree, keys, values, 0, n, 0,
+                               ((((size_t)1 << height) - 1) == n) ? -1 :
+                                                               (height - 1),
+                               &tree->nil);
+    return 0;
+}
+
 /*find a minimum key in a tree with n nodes
  * time complexity o(logn)*/
 static node_t* tree_find_min(const tree_t* tree, node_t *root)
@@ -253,16 +462,17 @@ static node_t* tree_get_successor(const tree_t *tree, node_t *x)
 {
     node_t *y;
 
+    STATS_INC(STATS_SUCCESSOR_STEPS);
     if (x->right != &tree->nil) {
         /* right tree nonempty, so successor is there */
         return tree_find_min(tree, x->right);
     }
 
     /* climb up */
-    y = x->parent;
+    y = node_parent(x);
     while ((y != &tree->nil) && (x == y->right)) {
         x = y;
-        y = y->parent;
+        y = node_parent(y);
     }
     return y;
 }
@@ -271,60 +481,62 @@ void tree_delete_fixup(tree_t *tree, node_t *x)
 {
     node_t *w;
 
-    while ((x != tree->root) && (x->color == BLACK)) {
-        if (x == x->parent->left) {
-            w = x->parent->right;
-            if (w->color == RED) {
-                w->color         = BLACK;
-                x->parent->color = RED;
-                tree_left_rotate(tree, x->parent);
-                w = x->parent->right;
+    while ((x != tree->root) && (node_color(x) == BLACK)) {
+        if (x == node_parent(x)->left) {
+            w = node_parent(x)->right;
+            if (node_color(w) == RED) {
+                node_set_color(w, BLACK);
+                node_set_color(node_parent(x), RED);
+                tree_left_rotate(tree, node_parent(x));
+                w = node_parent(x)->right;
             }
-            if ((w->left->color == BLACK) && (w->right->color == BLACK)) {
-                w->color = RED;
-                x        = x->parent;
+            if ((node_color(w->left) == BLACK) &&
+                (node_color(w->right) == BLACK)) {
+                node_set_color(w, RED);
+                x = node_parent(x);
             } else {
-                if (w->right->color == BLACK){
-                    w->left->color = BLACK;
-                    w->color       = RED;
+                if (node_color(w->right) == BLACK){
+                    node_set_color(w->left, BLACK);
+                    node_set_color(w, RED);
                     tree_right_rotate(tree, w);
-                    w = x->parent->right;
+                    w = node_parent(x)->right;
                 }
 
-                w->color =               x->parent->color;
-                x->parent->parent->color = BLACK;
-                w->right->color          = BLACK;
-                tree_left_rotate(tree, x->parent);
+                node_set_color(w, node_color(node_parent(x)));
+                node_set_color(node_parent(x), BLACK);
+                node_set_color(w->right, BLACK);
+                tree_left_rotate(tree, node_parent(x));
                 x = tree->root;
             }
         } else {
-            w = x->parent->left;
-            if (w->color == RED) {
-                w->color         = BLACK;
-                x->parent->color = RED;
-                tree_right_rotate(tree, x->parent);
-                w = x->parent->left;
+            w = node_parent(x)->left;
+            if (node_color(w) == RED) {
+                node_set_color(w, BLACK);
+                node_set_color(node_parent(x), RED);
+                tree_right_rotate(tree, node_parent(x));
+                w = node_parent(x)->left;
             }
-            if ((w->right->color == BLACK) && (w->left->color == BLACK)) {
-                w->color = RED;
-                x        = x->parent;
+            if ((node_color(w->right) == BLACK) &&
+                (node_color(w->left) == BLACK)) {
+                node_set_color(w, RED);
+                x = node_parent(x);
             } else {
-                if (w->left->color == BLACK){
-                    w->right->color = BLACK;
-                    w->color        = RED;
+                if (node_color(w->left) == BLACK){
+                    node_set_color(w->right, BLACK);
+                    node_set_color(w, RED);
                     tree_left_rotate(tree, w);
-                    w = x->parent->left;
+                    w = node_parent(x)->left;
                 }
 
-                w->color =               x->parent->color;
-                x->parent->parent->color = BLACK;
-                w->left->color           = BLACK;
-                tree_right_rotate(tree, x->parent);
+                node_set_color(w, node_color(node_parent(x)));
+                node_set_color(node_parent(x), BLACK);
+                node_set_color(w->left, BLACK);
+                tree_right_rotate(tree, node_parent(x));
                 x = tree->root;
             }
         }
     }
-    tree->root->color = BLACK;
+    node_set_color(x, BLACK);
 }
 
 void tree_delete(tree_t *tree, node_t *node)
@@ -343,67 +555,85 @@ void tree_delete(tree_t *tree, node_t *node)
         x = y->right;
     }
 
-    x->parent = y->parent;
-    if (y->parent == &tree->nil) {
+    node_set_parent(x, node_parent(y));
+    if (node_parent(y) == &tree->nil) {
         tree->root = x;
-    } else if (y == y->parent->left) {
-        y->parent->left = x;
+    } else if (y == node_parent(y)->left) {
+        node_parent(y)->left = x;
     } else {
-        y->parent->right = x;
+        node_parent(y)->right = x;
     }
 
     if (y != node) {
         node->key   = y->key;
         node->value = y->value;
+        if (tree->augment) {
+            node->own_aug = y->own_aug;
+        }
+    }
+
+    if (tree->augment) {
+        /* 'node' (if it was replaced by y) is on the path as well */
+        tree_augment_path(tree, node_parent(x));
     }
 
-    if (y->color == BLACK) {
+    if (node_color(y) == BLACK) {
         tree_delete_fixup(tree, x);
     }
 
-    free(y);
+    tree_free_node(tree, y);
 }
 
-static node_t *tree_do_ub(const tree_t *tree, node_t *root, float key)
+/*the lowest node which is not lower than 'key', or nil
+ * time complexity o(logn)*/
+static node_t *tree_do_ub(const tree_t *tree, tree_key_t key)
 {
-    if ((root == &tree->nil) || float_equal(root->key, key)) {
-        return root;
-    } else if (key < root->key) {
-        /* key is lower than root, so upper bound is either in the left
-         * subtree, or the root itself
-         */
-        node_t *node = tree_do_ub(tree, root->left, key);
-        if (node != &tree->nil) {
-            return node;
+    node_t *x, *ub;
+
+    ub = (node_t*)&tree->nil;
+    for (x = tree->root; x != &tree->nil; ) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (tree_key_equal(x->key, key)) {
+            return x;
+        } else if (key < x->key) {
+            /* key is lower than x, so the upper bound is either in the left
+             * subtree, or x itself
+             */
+            ub = x;
+            x  = x->left;
         } else {
-            return root;
+            /* key is larger than x, so the upper bound, if exists, must be
+             * on the right subtree.
+             */
+            x = x->right;
         }
-    } else {
-        /* key is larger than root, so the upper bound, if exists, must be
-         * on the right subtree.
-         */
-        return tree_do_ub(tree, root->right, key);
     }
+    return ub;
 }
 
-float tree_node_get_key(node_t *node)
+tree_key_t tree_node_get_key(node_t *node)
 {
     return node->key;
 }
 
-void* tree_node_get_value(node_t *node)
+tree_value_t tree_node_get_value(node_t *node)
 {
     return node->value;
 }
 
-int tree_ub(const tree_t *tree, float key, node_t **node_p)
+void tree_node_set_value(node_t *node, tree_value_t value)
+{
+    node->value = value;
+}
+
+int tree_ub(const tree_t *tree, tree_key_t key, node_t **node_p)
 {
-    node_t *node = tree_do_ub(tree, tree->root, key);
+    node_t *node = tree_do_ub(tree, key);
 
     if (node == &tree->nil) {
         return -1;
     } else {
-        assert(node->key >= key);
+        assert(tree_key_ge(node->key, key));
         *node_p = node;
         return 0;
     }
@@ -419,3 +649,219 @@ int tree_successor(const tree_t *tree, node_t **node_p)
         return 0;
     }
 }
+
+int tree_predecessor(const tree_t *tree, node_t **node_p)
+{
+    node_t *x = *node_p;
+    node_t *y;
+
+    if (x->left != &tree->nil) {
+        /* left tree nonempty, so predecessor is its maximum */
+        for (x = x->left; x->right != &tree->nil; x = x->right);
+        *node_p = x;
+        return 0;
+    }
+
+    /* climb up */
+    y = node_parent(x);
+    while ((y != &tree->nil) && (x == y->left)) {
+        x = y;
+        y = node_parent(y);
+    }
+
+    if (y == &tree->nil) {
+        return -1;
+    }
+    *node_p = y;
+    return 0;
+}
+
+int tree_last(const tree_t *tree, node_t **node_p)
+{
+    node_t *x;
+
+    if (tree_is_empty(tree)) {
+        return -1;
+    }
+
+    for (x = tree->root; x->right != &tree->nil; x = x->right);
+    *node_p = x;
+    return 0;
+}
+
+size_t tree_depth(const tree_t *tree)
+{
+    size_t depth, max_depth;
+    node_t *x;
+
+    if (tree_is_empty(tree)) {
+        return 0;
+    }
+
+    depth     = 0;
+    max_depth = 0;
+    for (x = tree->root; x != &tree->nil;
+         x = tree_preorder_next(tree, x, &depth)) {
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+    return max_depth + 1;
+}
+
+/* @return nonzero if the subtree of x has a node whose own augmented value is
+ * at least 'min'. nil has none, though its aug (TREE_KEY_MIN) may be 'min' */
+static int tree_subtree_has(const tree_t *tree, const node_t *x,
+                            tree_key_t min)
+{
+    return (x != &tree->nil) && tree_key_ge(x->aug, min);
+}
+
+/*find the first node (in order) in the subtree of x whose own augmented value
+ * is at least 'min'. x->aug must be at least 'min'.
+ * time complexity o(logn)*/
+static node_t *tree_first_augmented(const tree_t *tree, node_t *x,
+                                    tree_key_t min)
+{
+    for (;;) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (tree_subtree_has(tree, x->left, min)) {
+            x = x->left;
+        } else if (tree_key_ge(x->own_aug, min)) {
+            return x;
+        } else {
+            x = x->right;
+        }
+    }
+}
+
+/*the first node in range of 'key' whose own augmented value is at least
+ * 'min', or NULL. the answer is in the left subtree of the lowest node in
+ * range on the search path which has one, or else that node itself or its
+ * right subtree, which are all in range.
+ * time complexity o(logn)*/
+static node_t *tree_do_ub_augmented(const tree_t *tree, tree_key_t key,
+                                    tree_key_t min)
+{
+    node_t *x, *fallback;
+
+    fallback = NULL;
+    x        = tree->root;
+    while (tree_subtree_has(tree, x, min)) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (tree_key_ge(x->key, key)) {
+            /* x is in range, so all of the right subtree is as well */
+            if (tree_key_ge(x->own_aug, min) ||
+                tree_subtree_has(tree, x->right, min)) {
+                fallback = x;
+            }
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+
+    if ((fallback == NULL) || tree_key_ge(fallback->own_aug, min)) {
+        return fallback;
+    }
+    return tree_first_augmented(tree, fallback->right, min);
+}
+
+int tree_ub_augmented(const tree_t *tree, tree_key_t key, tree_key_t min,
+                      node_t **node_p)
+{
+    node_t *node;
+
+    assert(tree->augment != NULL);
+    node = tree_do_ub_augmented(tree, key, min);
+    if (node == NULL) {
+        return -1;
+    } else {
+        *node_p = node;
+        return 0;
+    }
+}
+
+int tree_successor_augmented(const tree_t *tree, tree_key_t min,
+                             node_t **node_p)
+{
+    node_t *x, *y;
+
+    assert(tree->augment != NULL);
+
+    STATS_INC(STATS_SUCCESSOR_STEPS);
+    x = *node_p;
+    if (tree_subtree_has(tree, x->right, min)) {
+        *node_p = tree_first_augmented(tree, x->right, min);
+        return 0;
+    }
+
+    /* climb up, checking every ancestor we reach from its left subtree */
+    for (y = node_parent(x); y != &tree->nil; x = y, y = node_parent(y)) {
+        if (x != y->left) {
+            continue;
+        } else if (!tree_key_ge(y->aug, min)) {
+            continue; /* y's subtree (which includes x) has nothing */
+        } else if (tree_key_ge(y->own_aug, min)) {
+            *node_p = y;
+            return 0;
+        } else if (tree_subtree_has(tree, y->right, min)) {
+            *node_p = tree_first_augmented(tree, y->right, min);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*the last node in the tree whose own augmented value is at least 'min' is
+ * in the right subtree if it has one, or else it is the node itself or in
+ * its left subtree
+ * time complexity o(logn)*/
+int tree_last_augmented(const tree_t *tree, tree_key_t min, node_t **node_p)
+{
+    node_t *x;
+
+    assert(tree->augment != NULL);
+
+    x = tree->root;
+    if (!tree_subtree_has(tree, x, min)) {
+        return -1;
+    }
+
+    for (;;) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (tree_subtree_has(tree, x->right, min)) {
+            x = x->right;
+        } else if (tree_key_ge(x->own_aug, min)) {
+            *node_p = x;
+            return 0;
+        } else {
+            x = x->left;
+        }
+    }
+}
+
+int tree_has_augmented(const tree_t *tree, tree_key_t key, tree_key_t min)
+{
+    node_t *x;
+
+    assert(tree->augment != NULL);
+
+    x = tree->root;
+    while (tree_subtree_has(tree, x, min)) {
+        STATS_INC(STATS_NODES_VISITED);
+        if (tree_key_ge(x->key, key)) {
+            /* x is in range, and so is all of its right subtree */
+            if (tree_key_ge(x->own_aug, min) ||
+                tree_subtree_has(tree, x->right, min)) {
+                return 0;
+            }
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+
+    return -1;
+}
@@ -7,6 +7,130 @@
 #ifndef _TREES_H
 #define _TREES_H
 
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+
+/* keys which differ by less than this are considered equal */
+#define TREE_KEY_DELTA 0.001
+
+
+#ifdef TREE_INT_KEYS
+
+/*
+ * Keys quantized to integer multiples of TREE_KEY_DELTA (make KEYS=int).
+ * Box dimensions are rounded to the nearest multiple once, at the API of the
+ * boxes, and the trees compare keys exactly. Dimensions beyond the range of
+ * tree_key_t (about +-2.1e6) are saturated, the low ones to TREE_KEY_MIN + 1,
+ * so no key is the augmented value of an empty subtree.
+ */
+typedef int32_t tree_key_t;
+
+#define TREE_KEY_SCALE      1000    /* 1 / TREE_KEY_DELTA */
+#define TREE_KEY_MIN        INT32_MIN
+#define TREE_KEY_MAX        INT32_MAX
+
+/* keys whose dimensions differ by less than this compare equal */
+#define TREE_KEY_TOLERANCE  0
+
+static inline int tree_key_equal(tree_key_t k1, tree_key_t k2)
+{
+    return k1 == k2;
+}
+
+/* @return nonzero if 'k' is larger or equal to 'min' */
+static inline int tree_key_ge(tree_key_t k, tree_key_t min)
+{
+    return k >= min;
+}
+
+static inline tree_key_t tree_key_from_float(float value)
+{
+    double scaled = floor((double)value * TREE_KEY_SCALE + 0.5);
+
+    if (!(scaled > TREE_KEY_MIN)) {
+        return TREE_KEY_MIN + 1; /* also NaN */
+    } else if (scaled >= TREE_KEY_MAX) {
+        return TREE_KEY_MAX;
+    }
+    return (tree_key_t)scaled;
+}
+
+static inline float tree_key_to_float(tree_key_t key)
+{
+    return (float)((double)key / TREE_KEY_SCALE);
+}
+
+#else
+
+/* Keys are box dimensions, and compare equal within TREE_KEY_DELTA */
+typedef float tree_key_t;
+
+#define TREE_KEY_MIN        (-INFINITY)
+#define TREE_KEY_MAX        INFINITY
+#define TREE_KEY_TOLERANCE  TREE_KEY_DELTA
+
+static inline int tree_key_equal(tree_key_t k1, tree_key_t k2)
+{
+    float delta = TREE_KEY_DELTA;
+    return fabs(k1 - k2) < delta;
+}
+
+/* @return nonzero if 'k' is larger or equal to 'min', up to tree_key_equal */
+static inline int tree_key_ge(tree_key_t k, tree_key_t min)
+{
+    return (k >= min) || tree_key_equal(k, min);
+}
+
+static inline tree_key_t tree_key_from_float(float value)
+{
+    return value;
+}
+
+static inline float tree_key_to_float(tree_key_t key)
+{
+    return key;
+}
+
+#endif
+
+
+/* Value of a tree node: a pointer, or a counter kept inline in the node */
+typedef union tree_value_u {
+    void      *ptr;
+    uint64_t  count;
+} tree_value_t;
+
+
+/*
+ * return the augmented value of a node, computed from its value only.
+ * an augmented tree keeps in every node the maximal augmented value of its
+ * subtree, so searches can skip subtrees which have nothing large enough.
+ */
+typedef tree_key_t (*tree_augment_cb_t)(tree_value_t value);
+
+
+#ifdef TREE_BTREE
+
+/*
+ * B+-tree backend (btree.c), selected at build time.
+ * Keys and values are kept in wide leaves which are linked in key order. A
+ * node_t pointer refers to an entry in a leaf, and is invalidated by any
+ * insertion to or deletion from the same tree.
+ */
+typedef struct node_s node_t;
+typedef struct btree_node_s btree_node_t;
+
+typedef struct tree_s {
+    btree_node_t      *root;    /* NULL if empty */
+    tree_augment_cb_t augment;
+    pool_t            *pool;    /* unused, nodes are allocated aligned */
+} tree_t;
+
+#else
 
 /* Red-Black color type */
 typedef enum {
@@ -15,28 +139,41 @@ typedef enum {
 } color_t;
 
 
-/* Red-Black tree node */
+/*
+ * Red-Black tree node
+ * The color is kept in the lowest bit of the parent pointer. Nodes of trees
+ * which are not augmented are allocated without the augmentation fields at
+ * the end, see tree_node_size().
+ */
 typedef struct node_s node_t;
 struct node_s {
-    float     key;
-    color_t   color;
-    void      *value;
-    node_t    *parent;
-    node_t    *left;
-    node_t    *right;
+    node_t        *left;
+    node_t        *right;
+    uintptr_t     parent_color;     /* parent pointer | color */
+    tree_value_t  value;
+    tree_key_t    key;
+    /* augmented trees only */
+    tree_key_t    own_aug;          /* augmented value of this node */
+    tree_key_t    aug;              /* maximal augmented value of the
+                                     * subtree */
 };
 
 
 /* Red-Black tree */
 typedef struct tree_s {
-    node_t    *root;
-    node_t    nil;
+    node_t            *root;
+    node_t            nil;
+    tree_augment_cb_t augment;
+    pool_t            *pool;    /* if not NULL, nodes are allocated from it */
 } tree_t;
 
+#endif
 
-typedef void (*tree_cleanup_cb_t)(void *value);
 
-typedef void (*tree_print_cb_t)(int indent, void *value, const char *prefix);
+typedef void (*tree_cleanup_cb_t)(tree_value_t value);
+
+typedef void (*tree_print_cb_t)(int indent, tree_value_t value,
+                                const char *prefix);
 
 
 /*
@@ -45,6 +182,25 @@ typedef void (*tree_print_cb_t)(int indent, void *value, const char *prefix);
 void tree_init(tree_t *tree);
 
 
+/*
+ * init an augmented tree, which uses 'augment' to get the value of each node
+ */
+void tree_init_augmented(tree_t *tree, tree_augment_cb_t augment);
+
+
+/*
+ * size of a node in an augmented or a non-augmented tree
+ */
+size_t tree_node_size(int augmented);
+
+
+/*
+ * allocate the tree nodes from 'pool', whose objects must be at least
+ * tree_node_size() bytes. must be called while the tree is empty.
+ */
+void tree_set_pool(tree_t *tree, pool_t *pool);
+
+
 /*
  * cleanup the tree, call 'cb' for each removed key/value pair
  */
@@ -64,14 +220,24 @@ void tree_print(const tree_t *tree, tree_print_cb_t cb, const char *prefix);
 /*
  * returns 0 on success, -1 on failure
  * */
-int tree_search(const tree_t *tree, float key, node_t **node_p);
+int tree_search(const tree_t *tree, tree_key_t key, node_t **node_p);
 
 
 /*
  * insert <key,value> into the tree
  * returns 0 on success, -1 on failure
  */
-int tree_insert(tree_t *tree, float key, void *value);
+int tree_insert(tree_t *tree, tree_key_t key, tree_value_t value);
+
+
+/*
+ * build the tree from 'n' keys in strictly increasing order, and their
+ * values, without any rotations
+ * time complexity o(n)
+ * returns 0 on success, -1 if the tree is not empty
+ */
+int tree_build_sorted(tree_t *tree, const tree_key_t *keys,
+                      const tree_value_t *values, size_t n);
 
 
 /*
@@ -85,7 +251,7 @@ void tree_delete(tree_t *tree, node_t *node);
  * find lowest key which is larger or equal to the provided "ub"
  * returns 0 on success, -1 on failure
  */
-int tree_ub(const tree_t *tree, float key, node_t **node_p);
+int tree_ub(const tree_t *tree, tree_key_t key, node_t **node_p);
 
 
 /* move node_p to point to the tree successor node
@@ -94,9 +260,76 @@ int tree_ub(const tree_t *tree, float key, node_t **node_p);
 int tree_successor(const tree_t *tree, node_t **node_p);
 
 
+/* move node_p to point to the tree predecessor node
+ * return 0 if success, -1 if no predecessor (*node_p was first node in the tree)
+ */
+int tree_predecessor(const tree_t *tree, node_t **node_p);
+
+
+/*
+ * find the last (largest) node in the tree
+ * returns 0 on success, -1 if the tree is empty
+ */
+int tree_last(const tree_t *tree, node_t **node_p);
+
+
+/*
+ * number of levels of the tree: the depth of its deepest node, or of its
+ * leaves in a B+-tree. 0 if the tree is empty.
+ * time complexity o(n), or o(logn) for a B+-tree
+ */
+size_t tree_depth(const tree_t *tree);
+
+
+/*
+ * must be called after a change to the value of 'node' in an augmented tree
+ * changed its augmented value (which is cached in the node)
+ */
+void tree_augment_update(tree_t *tree, node_t *node);
+
+
+/*
+ * like tree_ub, but skip nodes whose augmented value is lower than "min"
+ * returns 0 on success, -1 on failure
+ */
+int tree_ub_augmented(const tree_t *tree, tree_key_t key, tree_key_t min,
+                      node_t **node_p);
+
+
+/*
+ * like tree_successor, but skip nodes whose augmented value is lower than
+ * "min"
+ * return 0 if success, -1 if no such successor
+ */
+int tree_successor_augmented(const tree_t *tree, tree_key_t min,
+                             node_t **node_p);
+
+
+/*
+ * find the last (largest) node whose augmented value is at least "min"
+ * returns 0 on success, -1 if there is none
+ */
+int tree_last_augmented(const tree_t *tree, tree_key_t min, node_t **node_p);
+
+
+/*
+ * check if there is a node with key larger or equal to "key" whose augmented
+ * value is at least "min", in a single root-to-leaf descent
+ * returns 0 if there is one, -1 if not
+ */
+int tree_has_augmented(const tree_t *tree, tree_key_t key, tree_key_t min);
+
+
 /* Get key/value of node pointer */
-float tree_node_get_key(node_t *node);
-void* tree_node_get_value(node_t *node);
+tree_key_t tree_node_get_key(node_t *node);
+tree_value_t tree_node_get_value(node_t *node);
+
+
+/*
+ * Set the value of a node. In an augmented tree, tree_augment_update() must
+ * be called if the augmented value changed.
+ */
+void tree_node_set_value(node_t *node, tree_value_t value);
 
 
 #endif
@@ -1,6 +1,9 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#include <stdint.h>
+#include <time.h>
+
 
 //#define DEBUG
 
@@ -14,5 +17,35 @@
 #define LOG(...)
 #endif
 
+/**
+ * Monotonic time, in nanoseconds and in seconds
+ */
+static inline uint64_t util_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline double util_now(void)
+{
+    return util_now_ns() * 1e-9;
+}
+
+/**
+ * Next random number of the splitmix64 sequence of 'state', which any
+ * value seeds
+ */
+static inline uint64_t util_random(uint64_t *state)
+{
+    uint64_t z;
+
+    z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
 
 #endif
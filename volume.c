@@ -0,0 +1,209 @@
+#include "volume.h"
+
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOLUME_X86
+#endif
+
+
+typedef size_t (*volume_argmin_func_t)(const float *sides,
+                                       const float *heights, size_t n,
+                                       float *min_volume_p);
+
+
+size_t volume_argmin_scalar(const float *sides, const float *heights,
+                            size_t n, float *min_volume_p)
+{
+    float volume, min_volume;
+    size_t i, min_i;
+
+    assert(n > 0);
+
+    min_volume = sides[0] * sides[0] * heights[0];
+    min_i      = 0;
+    for (i = 1; i < n; ++i) {
+        volume = sides[i] * sides[i] * heights[i];
+        if (volume < min_volume) {
+            min_volume = volume;
+            min_i      = i;
+        }
+    }
+
+    *min_volume_p = min_volume;
+    return min_i;
+}
+
+/*
+ * every SIMD lane keeps the first minimum of the boxes it has seen. reduce
+ * the lanes to the overall first minimum, and continue with the scalar loop
+ * on the boxes from 'start' which did not fill a vector.
+ */
+static size_t volume_reduce_lanes(const float *lane_mins,
+                                  const int32_t *lane_idxs, int num_lanes,
+                                  const float *sides, const float *heights,
+                                  size_t start, size_t n, float *min_volume_p)
+{
+    float volume, min_volume;
+    size_t i, min_i;
+    int lane;
+
+    min_volume = lane_mins[0];
+    min_i      = lane_idxs[0];
+    for (lane = 1; lane < num_lanes; ++lane) {
+        if ((lane_mins[lane] < min_volume) ||
+            ((lane_mins[lane] == min_volume) && (lane_idxs[lane] < min_i))) {
+            min_volume = lane_mins[lane];
+            min_i      = lane_idxs[lane];
+        }
+    }
+
+    for (i = start; i < n; ++i) {
+        volume = sides[i] * sides[i] * heights[i];
+        if (volume < min_volume) {
+            min_volume = volume;
+            min_i      = i;
+        }
+    }
+
+    *min_volume_p = min_volume;
+    return min_i;
+}
+
+#ifdef VOLUME_X86
+
+/* lanes can not order NaN volumes like the scalar loop, so when there are
+ * any, the scalar loop is used instead
+ */
+__attribute__((target("avx2")))
+static size_t volume_argmin_avx2(const float *sides, const float *heights,
+                                 size_t n, float *min_volume_p)
+{
+    __m256 s, h, volumes, mins, is_less, is_nan;
+    __m256i idxs, min_idxs, step;
+    int32_t lane_idxs[8];
+    float lane_mins[8];
+    size_t i;
+
+    if (n < 8) {
+        return volume_argmin_scalar(sides, heights, n, min_volume_p);
+    }
+
+    s        = _mm256_loadu_ps(sides);
+    h        = _mm256_loadu_ps(heights);
+    mins     = _mm256_mul_ps(_mm256_mul_ps(s, s), h);
+    is_nan   = _mm256_cmp_ps(mins, mins, _CMP_UNORD_Q);
+    idxs     = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    min_idxs = idxs;
+    step     = _mm256_set1_epi32(8);
+
+    for (i = 8; i + 8 <= n; i += 8) {
+        s        = _mm256_loadu_ps(sides + i);
+        h        = _mm256_loadu_ps(heights + i);
+        volumes  = _mm256_mul_ps(_mm256_mul_ps(s, s), h);
+        idxs     = _mm256_add_epi32(idxs, step);
+        is_nan   = _mm256_or_ps(is_nan,
+                                _mm256_cmp_ps(volumes, volumes, _CMP_UNORD_Q));
+        is_less  = _mm256_cmp_ps(volumes, mins, _CMP_LT_OQ);
+        mins     = _mm256_blendv_ps(mins, volumes, is_less);
+        min_idxs = _mm256_blendv_epi8(min_idxs, idxs,
+                                      _mm256_castps_si256(is_less));
+    }
+
+    if (_mm256_movemask_ps(is_nan)) {
+        return volume_argmin_scalar(sides, heights, n, min_volume_p);
+    }
+
+    _mm256_storeu_ps(lane_mins, mins);
+    _mm256_storeu_si256((__m256i*)lane_idxs, min_idxs);
+    return volume_reduce_lanes(lane_mins, lane_idxs, 8, sides, heights, i, n,
+                               min_volume_p);
+}
+
+/* SSE2 is part of x86-64, so this kernel avoids the SSE4.1 blend */
+__attribute__((target("sse2")))
+static size_t volume_argmin_sse(const float *sides, const float *heights,
+                                size_t n, float *min_volume_p)
+{
+    __m128 s, h, volumes, mins, is_less, is_nan;
+    __m128i idxs, min_idxs, step, less_mask;
+    int32_t lane_idxs[4];
+    float lane_mins[4];
+    size_t i;
+
+    if (n < 4) {
+        return volume_argmin_scalar(sides, heights, n, min_volume_p);
+    }
+
+    s        = _mm_loadu_ps(sides);
+    h        = _mm_loadu_ps(heights);
+    mins     = _mm_mul_ps(_mm_mul_ps(s, s), h);
+    is_nan   = _mm_cmpunord_ps(mins, mins);
+    idxs     = _mm_setr_epi32(0, 1, 2, 3);
+    min_idxs = idxs;
+    step     = _mm_set1_epi32(4);
+
+    for (i = 4; i + 4 <= n; i += 4) {
+        s         = _mm_loadu_ps(sides + i);
+        h         = _mm_loadu_ps(heights + i);
+        volumes   = _mm_mul_ps(_mm_mul_ps(s, s), h);
+        idxs      = _mm_add_epi32(idxs, step);
+        is_nan    = _mm_or_ps(is_nan, _mm_cmpunord_ps(volumes, volumes));
+        is_less   = _mm_cmplt_ps(volumes, mins);
+        mins      = _mm_or_ps(_mm_and_ps(is_less, volumes),
+                              _mm_andnot_ps(is_less, mins));
+        less_mask = _mm_castps_si128(is_less);
+        min_idxs  = _mm_or_si128(_mm_and_si128(less_mask, idxs),
+                                 _mm_andnot_si128(less_mask, min_idxs));
+    }
+
+    if (_mm_movemask_ps(is_nan)) {
+        return volume_argmin_scalar(sides, heights, n, min_volume_p);
+    }
+
+    _mm_storeu_ps(lane_mins, mins);
+    _mm_storeu_si128((__m128i*)lane_idxs, min_idxs);
+    return volume_reduce_lanes(lane_mins, lane_idxs, 4, sides, heights, i, n,
+                               min_volume_p);
+}
+
+#endif
+
+static volume_argmin_func_t volume_kernel;
+static const char *volume_kernel_str;
+static pthread_once_t volume_kernel_once = PTHREAD_ONCE_INIT;
+
+/* select the best kernel the CPU supports */
+static void volume_select_kernel(void)
+{
+#ifdef VOLUME_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        volume_kernel_str = "avx2";
+        volume_kernel     = volume_argmin_avx2;
+        return;
+    } else if (__builtin_cpu_supports("sse2")) {
+        volume_kernel_str = "sse";
+        volume_kernel     = volume_argmin_sse;
+        return;
+    }
+#endif
+    volume_kernel_str = "scalar";
+    volume_kernel     = volume_argmin_scalar;
+}
+
+size_t volume_argmin(const float *sides, const float *heights, size_t n,
+                     float *min_volume_p)
+{
+    pthread_once(&volume_kernel_once, volume_select_kernel);
+    return volume_kernel(sides, heights, n, min_volume_p);
+}
+
+const char *volume_kernel_name(void)
+{
+    pthread_once(&volume_kernel_once, volume_select_kernel);
+    return volume_kernel_str;
+}
@@ -0,0 +1,35 @@
+#ifndef _VOLUME_H
+#define _VOLUME_H
+
+#include <stddef.h>
+
+
+/*
+ * find the box with the minimal volume side*side*height among 'n' boxes,
+ * given as arrays of sides and heights. volumes are calculated exactly as
+ * in scalar code, and ties go to the first box, so the result does not
+ * depend on the kernel which is used.
+ * a SIMD kernel (AVX2 or SSE) is selected at runtime when the CPU supports
+ * it, otherwise a scalar loop is used.
+ *
+ * @return the index of the box, and its volume in 'min_volume_p'.
+ *         'n' must be positive.
+ */
+size_t volume_argmin(const float *sides, const float *heights, size_t n,
+                     float *min_volume_p);
+
+
+/*
+ * same as volume_argmin, always using the scalar loop
+ */
+size_t volume_argmin_scalar(const float *sides, const float *heights,
+                            size_t n, float *min_volume_p);
+
+
+/*
+ * @return the name of the kernel used by volume_argmin
+ */
+const char *volume_kernel_name(void);
+
+
+#endif
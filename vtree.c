@@ -0,0 +1,904 @@
+#include "vtree.h"
+#include "util.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+
+/* number of objects in each slab of the pools */
+#define VTREE_POOL_SLAB_OBJS 1024
+
+/* only the side tree nodes at every VTREE_INDEX_STRIDE depth, with at least
+ * VTREE_MIN_INDEXED nodes in their subtree, have a height tree. the others
+ * are searched through their children, which saves most of the height tree
+ * updates and memory for a constant factor of the searches
+ */
+#define VTREE_INDEX_STRIDE 2
+#define VTREE_MIN_INDEXED  32
+
+
+struct vtree_height_node_s {
+    tree_key_t           side;
+    tree_key_t           height;
+    vtree_height_node_t  *left;
+    vtree_height_node_t  *right;
+    tree_key_t           best_side;     /* minimal volume box of the
+                                         * subtree, by its keys */
+    tree_key_t           best_height;
+};
+
+struct vtree_node_s {
+    tree_key_t           side;
+    tree_key_t           height;
+    vtree_node_t         *left;
+    vtree_node_t         *right;
+    vtree_height_node_t  *heights;  /* live boxes of the subtree, if
+                                     * indexed */
+    size_t               size;      /* nodes of the subtree, including
+                                     * deleted */
+    int                  is_deleted;
+    int                  is_indexed;
+};
+
+
+static int vtree_key_cmp(tree_key_t k1, tree_key_t k2)
+{
+    return (k1 > k2) - (k1 < k2);
+}
+
+/* order of the side tree: by side, then by height */
+static int vtree_cmp(tree_key_t side1, tree_key_t height1, tree_key_t side2,
+                     tree_key_t height2)
+{
+    int cmp = vtree_key_cmp(side1, side2);
+
+    return (cmp != 0) ? cmp : vtree_key_cmp(height1, height2);
+}
+
+/* order of the height trees: by height, then by side */
+static int vtree_height_cmp(tree_key_t side, tree_key_t height,
+                            const vtree_height_node_t *node)
+{
+    return vtree_cmp(height, side, node->height, node->side);
+}
+
+static int vtree_box_height_cmp(const vtree_box_t *box1,
+                                const vtree_box_t *box2)
+{
+    return vtree_cmp(box1->height, box1->side, box2->height, box2->side);
+}
+
+/* volume of a box, calculated like volume_argmin() does */
+static float vtree_volume(tree_key_t side, tree_key_t height)
+{
+    float side_f = tree_key_to_float(side);
+
+    return side_f * side_f * tree_key_to_float(height);
+}
+
+/* is box 1 better than box 2: lower volume, then lower side and height. a
+ * volume which is not a number is worse than any other
+ */
+static int vtree_less(tree_key_t side1, tree_key_t height1, tree_key_t side2,
+                      tree_key_t height2)
+{
+    float volume1 = vtree_volume(side1, height1);
+    float volume2 = vtree_volume(side2, height2);
+
+    if (volume1 < volume2) {
+        return 1;
+    } else if (volume1 > volume2) {
+        return 0;
+    } else if (isnan(volume1) != isnan(volume2)) {
+        return isnan(volume2);
+    }
+    return vtree_cmp(side1, height1, side2, height2) < 0;
+}
+
+/* treap priority of a box, hashed from its keys */
+static uint64_t vtree_priority(tree_key_t side, tree_key_t height)
+{
+    uint32_t side_bits, height_bits;
+    uint64_t state;
+
+    memcpy(&side_bits, &side, sizeof(side_bits));
+    memcpy(&height_bits, &height, sizeof(height_bits));
+    state = ((uint64_t)side_bits << 32) | height_bits;
+    return util_random(&state);
+}
+
+static uint64_t vtree_height_priority(const vtree_height_node_t *node)
+{
+    return vtree_priority(node->side, node->height);
+}
+
+/* make a box the minimal volume box of a height node's subtree if it is
+ * better
+ */
+static void vtree_height_improve(vtree_height_node_t *node, tree_key_t side,
+                                 tree_key_t height)
+{
+    if (vtree_less(side, height, node->best_side, node->best_height)) {
+        node->best_side   = side;
+        node->best_height = height;
+    }
+}
+
+/* recalculate the minimal volume box of a height node's subtree */
+static void vtree_height_augment(vtree_height_node_t *node)
+{
+    node->best_side   = node->side;
+    node->best_height = node->height;
+    if (node->left != NULL) {
+        vtree_height_improve(node, node->left->best_side,
+                             node->left->best_height);
+    }
+    if (node->right != NULL) {
+        vtree_height_improve(node, node->right->best_side,
+                             node->right->best_height);
+    }
+}
+
+static vtree_height_node_t *vtree_height_rotate_right(
+                                                vtree_height_node_t *node)
+{
+    vtree_height_node_t *left = node->left;
+
+    node->left  = left->right;
+    left->right = node;
+    vtree_height_augment(node);
+    vtree_height_augment(left);
+    return left;
+}
+
+static vtree_height_node_t *vtree_height_rotate_left(
+                                                vtree_height_node_t *node)
+{
+    vtree_height_node_t *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    vtree_height_augment(node);
+    vtree_height_augment(right);
+    return right;
+}
+
+static void vtree_height_node_init(vtree_height_node_t *node,
+                                   tree_key_t side, tree_key_t height)
+{
+    node->side   = side;
+    node->height = height;
+    node->left   = NULL;
+    node->right  = NULL;
+    node->best_side   = side;
+    node->best_height = height;
+}
+
+/*insert an initialized node to the treap of 'root', and rotate it up by
+ * its priority. the minimal volume boxes are updated on the way down, so
+ * only the rotated nodes are recalculated
+ * time complexity O(log(n)), expected
+ * returns the new root*/
+static vtree_height_node_t *vtree_height_insert(vtree_height_node_t *root,
+                                                vtree_height_node_t *node,
+                                                uint64_t priority)
+{
+    if (root == NULL) {
+        return node;
+    }
+
+    vtree_height_improve(root, node->side, node->height);
+    if (vtree_height_cmp(node->side, node->height, root) < 0) {
+        root->left = vtree_height_insert(root->left, node, priority);
+        if ((root->left == node) &&
+            (priority > vtree_height_priority(root))) {
+            return vtree_height_rotate_right(root);
+        }
+    } else {
+        root->right = vtree_height_insert(root->right, node, priority);
+        if ((root->right == node) &&
+            (priority > vtree_height_priority(root))) {
+            return vtree_height_rotate_left(root);
+        }
+    }
+    return root;
+}
+
+/*delete the box from the treap of 'root', by rotating it down to a leaf.
+ * only the nodes whose minimal volume box it was are recalculated
+ * time complexity O(log(n)), expected
+ * returns the new root*/
+static vtree_height_node_t *vtree_height_delete(vtree_t *tree,
+                                                vtree_height_node_t *root,
+                                                tree_key_t side,
+                                                tree_key_t height)
+{
+    vtree_height_node_t *child;
+    int cmp;
+
+    if (root == NULL) {
+        return NULL;
+    }
+
+    cmp = vtree_height_cmp(side, height, root);
+    if (cmp < 0) {
+        root->left = vtree_height_delete(tree, root->left, side, height);
+    } else if (cmp > 0) {
+        root->right = vtree_height_delete(tree, root->right, side, height);
+    } else if ((root->left == NULL) || (root->right == NULL)) {
+        child = (root->left != NULL) ? root->left : root->right;
+        pool_free(&tree->height_node_pool, root);
+        return child;
+    } else if (vtree_height_priority(root->left) >
+               vtree_height_priority(root->right)) {
+        root = vtree_height_rotate_right(root);
+        root->right = vtree_height_delete(tree, root->right, side, height);
+    } else {
+        root = vtree_height_rotate_left(root);
+        root->left = vtree_height_delete(tree, root->left, side, height);
+    }
+    if ((root->best_side == side) && (root->best_height == height)) {
+        vtree_height_augment(root);
+    }
+    return root;
+}
+
+static void vtree_height_free(vtree_t *tree, vtree_height_node_t *node)
+{
+    vtree_height_node_t *right;
+
+    while (node != NULL) {
+        vtree_height_free(tree, node->left);
+        right = node->right;
+        pool_free(&tree->height_node_pool, node);
+        node = right;
+    }
+}
+
+/* set the minimal volume boxes of a treap which was built */
+static void vtree_height_augment_all(vtree_height_node_t *node)
+{
+    if (node != NULL) {
+        vtree_height_augment_all(node->left);
+        vtree_height_augment_all(node->right);
+        vtree_height_augment(node);
+    }
+}
+
+/*build a treap of 'n' boxes in the order of the height trees. while it is
+ * built, the right links of its rightmost path point up instead of down
+ * time complexity O(n)
+ * returns 0 on success, -1 if out of memory*/
+static int vtree_height_build(vtree_t *tree, const vtree_box_t *boxes,
+                              size_t n, vtree_height_node_t **root_p)
+{
+    vtree_height_node_t *root, *top, *last, *node, *up;
+    uint64_t priority;
+    size_t i;
+
+    top = NULL;
+    for (i = 0; i < n; ++i) {
+        node = pool_alloc(&tree->height_node_pool);
+        if (node == NULL) {
+            break;
+        }
+        vtree_height_node_init(node, boxes[i].side, boxes[i].height);
+
+        priority = vtree_priority(node->side, node->height);
+        last     = NULL;
+        while ((top != NULL) && (vtree_height_priority(top) < priority)) {
+            up         = top->right;
+            top->right = last;
+            last       = top;
+            top        = up;
+        }
+        node->left  = last;
+        node->right = top;
+        top         = node;
+    }
+
+    root = NULL;
+    while (top != NULL) {
+        up         = top->right;
+        top->right = root;
+        root       = top;
+        top        = up;
+    }
+
+    if (i < n) {
+        vtree_height_free(tree, root);
+        return -1;
+    }
+
+    vtree_height_augment_all(root);
+    *root_p = root;
+    return 0;
+}
+
+/* can a box be better than the best box found so far */
+static int vtree_may_improve(tree_key_t side, tree_key_t height,
+                             const vtree_box_t *best, int is_found)
+{
+    return !is_found || vtree_less(side, height, best->side, best->height);
+}
+
+/* consider a box for the best box found so far */
+static void vtree_consider(tree_key_t side, tree_key_t height,
+                           vtree_box_t *best, int *is_found_p)
+{
+    if (vtree_may_improve(side, height, best, *is_found_p)) {
+        best->side   = side;
+        best->height = height;
+        *is_found_p  = 1;
+    }
+}
+
+/*consider the minimal volume box of a treap whose height fits. a subtree
+ * whose minimal volume box, whatever its height, is not better than the
+ * best box found so far is skipped
+ * time complexity O(log(n)), expected*/
+static void vtree_height_find(const vtree_height_node_t *node,
+                              tree_key_t height, vtree_box_t *best,
+                              int *is_found_p)
+{
+    while ((node != NULL) &&
+           vtree_may_improve(node->best_side, node->best_height, best,
+                             *is_found_p)) {
+        if (tree_key_ge(node->height, height)) {
+            /* the node and all the heights to its right fit */
+            vtree_consider(node->side, node->height, best, is_found_p);
+            if (node->right != NULL) {
+                vtree_consider(node->right->best_side,
+                               node->right->best_height, best, is_found_p);
+            }
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+}
+
+/*consider the minimal volume box of a side subtree whose height fits, by
+ * the height trees of its highest indexed nodes
+ * time complexity O(log(n)), expected*/
+static void vtree_subtree_find(const vtree_node_t *node, tree_key_t height,
+                               vtree_box_t *best, int *is_found_p)
+{
+    while (node != NULL) {
+        if (node->is_indexed) {
+            vtree_height_find(node->heights, height, best, is_found_p);
+            return;
+        }
+        if (!node->is_deleted && tree_key_ge(node->height, height)) {
+            vtree_consider(node->side, node->height, best, is_found_p);
+        }
+        vtree_subtree_find(node->left, height, best, is_found_p);
+        node = node->right;
+    }
+}
+
+static size_t vtree_size(const vtree_node_t *node)
+{
+    return (node != NULL) ? node->size : 0;
+}
+
+/* does a side tree node at 'depth' with 'size' nodes have a height tree */
+static int vtree_is_indexed(size_t depth, size_t size)
+{
+    return (depth % VTREE_INDEX_STRIDE == 0) && (size >= VTREE_MIN_INDEXED);
+}
+
+/* is one side of a node more than 3/4 of its nodes */
+static int vtree_is_unbalanced(const vtree_node_t *node)
+{
+    size_t max_size = vtree_size(node->left);
+
+    if (vtree_size(node->right) > max_size) {
+        max_size = vtree_size(node->right);
+    }
+    return 4 * max_size > 3 * node->size;
+}
+
+/* collect the nodes of a subtree in order */
+static void vtree_collect(vtree_node_t *node, vtree_node_t **nodes,
+                          size_t *n_p)
+{
+    while (node != NULL) {
+        vtree_collect(node->left, nodes, n_p);
+        nodes[(*n_p)++] = node;
+        node = node->right;
+    }
+}
+
+/*build the height trees of the nodes[lo,hi) subtree of a balanced shape at
+ * 'depth', into heights[lo,hi). the live boxes of the subtree are left in
+ * 'by_height' in the order of the height trees, merged from those of the
+ * subtrees of its root, with the same space in 'scratch'.
+ * time complexity O(n*log(n))
+ * returns 0 on success, -1 if out of memory*/
+static int vtree_build_heights(vtree_t *tree, vtree_node_t *const *nodes,
+                               vtree_height_node_t **heights, size_t lo,
+                               size_t hi, size_t depth,
+                               vtree_box_t *by_height, vtree_box_t *scratch,
+                               size_t *num_p)
+{
+    size_t mid, num_left, num_right, n, i, j, k;
+    vtree_box_t own;
+
+    *num_p = 0;
+    if (lo == hi) {
+        return 0;
+    }
+
+    mid = lo + (hi - lo) / 2;
+    if (vtree_build_heights(tree, nodes, heights, lo, mid, depth + 1,
+                            by_height, scratch, &num_left)) {
+        return -1;
+    }
+
+    /* the root's own box goes in order into the boxes of the left subtree
+     */
+    if (!nodes[mid]->is_deleted) {
+        own.side   = nodes[mid]->side;
+        own.height = nodes[mid]->height;
+        for (i = num_left;
+             (i > 0) && (vtree_box_height_cmp(&by_height[i - 1], &own) > 0);
+             --i) {
+            by_height[i] = by_height[i - 1];
+        }
+        by_height[i] = own;
+        ++num_left;
+    }
+
+    if (vtree_build_heights(tree, nodes, heights, mid + 1, hi, depth + 1,
+                            by_height + num_left, scratch + num_left,
+                            &num_right)) {
+        return -1;
+    }
+
+    /* merge the boxes of the left subtree and the root with the right */
+    n = num_left + num_right;
+    i = 0;
+    j = num_left;
+    for (k = 0; k < n; ++k) {
+        if ((j == n) || ((i < num_left) &&
+                         (vtree_box_height_cmp(&by_height[i],
+                                               &by_height[j]) < 0))) {
+            scratch[k] = by_height[i++];
+        } else {
+            scratch[k] = by_height[j++];
+        }
+    }
+    memcpy(by_height, scratch, n * sizeof(*by_height));
+
+    if (vtree_is_indexed(depth, hi - lo) &&
+        vtree_height_build(tree, by_height, n, &heights[mid])) {
+        return -1;
+    }
+    *num_p = n;
+    return 0;
+}
+
+/*build the height trees of 'n' nodes in order, for a balanced subtree of
+ * them at 'depth'
+ * time complexity O(n*log(n))
+ * returns the height tree of each node, or NULL if out of memory*/
+static vtree_height_node_t **vtree_build_all_heights(
+        vtree_t *tree, vtree_node_t *const *nodes, size_t n, size_t depth)
+{
+    vtree_height_node_t **heights;
+    vtree_box_t *by_height, *scratch;
+    size_t num_live, i;
+
+    heights   = calloc(n + 1, sizeof(*heights));
+    by_height = malloc((n + 1) * sizeof(*by_height));
+    scratch   = malloc((n + 1) * sizeof(*scratch));
+    if ((heights == NULL) || (by_height == NULL) || (scratch == NULL)) {
+        goto out_fail;
+    }
+
+    if (vtree_build_heights(tree, nodes, heights, 0, n, depth, by_height,
+                            scratch, &num_live)) {
+        for (i = 0; i < n; ++i) {
+            vtree_height_free(tree, heights[i]);
+        }
+        goto out_fail;
+    }
+
+    STATS_ADD(STATS_NODES_REBUILT, n);
+    free(scratch);
+    free(by_height);
+    return heights;
+
+out_fail:
+    free(scratch);
+    free(by_height);
+    free(heights);
+    return NULL;
+}
+
+/* link the nodes[lo,hi) into a balanced subtree at 'depth', with their new
+ * height trees
+ */
+static vtree_node_t *vtree_link(vtree_node_t *const *nodes,
+                                vtree_height_node_t *const *heights,
+                                size_t lo, size_t hi, size_t depth)
+{
+    vtree_node_t *node;
+    size_t mid;
+
+    if (lo == hi) {
+        return NULL;
+    }
+
+    mid           = lo + (hi - lo) / 2;
+    node          = nodes[mid];
+    node->left       = vtree_link(nodes, heights, lo, mid, depth + 1);
+    node->right      = vtree_link(nodes, heights, mid + 1, hi, depth + 1);
+    node->heights    = heights[mid];
+    node->size       = hi - lo;
+    node->is_indexed = vtree_is_indexed(depth, hi - lo);
+    return node;
+}
+
+/* release the height trees of a subtree, and its deleted nodes if they are
+ * dropped
+ */
+static void vtree_release(vtree_t *tree, vtree_node_t *node,
+                          int drop_deleted)
+{
+    vtree_node_t *right;
+
+    while (node != NULL) {
+        vtree_release(tree, node->left, drop_deleted);
+        vtree_height_free(tree, node->heights);
+        right = node->right;
+        if (drop_deleted && node->is_deleted) {
+            pool_free(&tree->node_pool, node);
+        }
+        node = right;
+    }
+}
+
+/*rebuild the subtree at '*link' and 'depth' balanced, without its deleted
+ * nodes if they are dropped. they are kept otherwise, so the sizes of the
+ * ancestors do not change. the new height trees are built before the old
+ * ones are released, so nothing is changed if out of memory.
+ * time complexity O(n*log(n))
+ * returns 0 on success, -1 if out of memory*/
+static int vtree_rebuild(vtree_t *tree, vtree_node_t **link, size_t depth,
+                         int drop_deleted)
+{
+    vtree_height_node_t **heights;
+    size_t num_nodes, num_kept, i;
+    vtree_node_t **nodes;
+
+    nodes = malloc(((*link)->size + 1) * sizeof(*nodes));
+    if (nodes == NULL) {
+        return -1;
+    }
+    num_nodes = 0;
+    vtree_collect(*link, nodes, &num_nodes);
+
+    num_kept = 0;
+    for (i = 0; i < num_nodes; ++i) {
+        if (!drop_deleted || !nodes[i]->is_deleted) {
+            nodes[num_kept++] = nodes[i];
+        }
+    }
+
+    heights = vtree_build_all_heights(tree, nodes, num_kept, depth);
+    if (heights == NULL) {
+        free(nodes);
+        return -1;
+    }
+
+    vtree_release(tree, *link, drop_deleted);
+    *link = vtree_link(nodes, heights, 0, num_kept, depth);
+    if (drop_deleted) {
+        tree->num_nodes   -= num_nodes - num_kept;
+        tree->num_deleted -= num_nodes - num_kept;
+    }
+
+    free(heights);
+    free(nodes);
+    return 0;
+}
+
+/* add the live boxes of a subtree to 'boxes', in the order of the height
+ * trees
+ */
+static void vtree_collect_boxes(const vtree_node_t *node, vtree_box_t *boxes,
+                                size_t *n_p)
+{
+    vtree_box_t box;
+    size_t i;
+
+    while (node != NULL) {
+        if (!node->is_deleted) {
+            box.side   = node->side;
+            box.height = node->height;
+            for (i = *n_p;
+                 (i > 0) && (vtree_box_height_cmp(&boxes[i - 1], &box) > 0);
+                 --i) {
+                boxes[i] = boxes[i - 1];
+            }
+            boxes[i] = box;
+            ++*n_p;
+        }
+        vtree_collect_boxes(node->left, boxes, n_p);
+        node = node->right;
+    }
+}
+
+/*build the height tree of a node which becomes indexed with a new box in
+ * its subtree, which has VTREE_MIN_INDEXED nodes with it
+ * time complexity O(1)
+ * returns 0 on success, -1 if out of memory*/
+static int vtree_index(vtree_t *tree, const vtree_node_t *node,
+                       tree_key_t side, tree_key_t height,
+                       vtree_height_node_t **heights_p)
+{
+    vtree_box_t boxes[VTREE_MIN_INDEXED];
+    size_t n;
+
+    boxes[0].side   = side;
+    boxes[0].height = height;
+    n               = 1;
+    vtree_collect_boxes(node, boxes, &n);
+    return vtree_height_build(tree, boxes, n, heights_p);
+}
+
+void vtree_init(vtree_t *tree)
+{
+    pool_init(&tree->node_pool, sizeof(vtree_node_t), VTREE_POOL_SLAB_OBJS);
+    pool_init(&tree->height_node_pool, sizeof(vtree_height_node_t),
+              VTREE_POOL_SLAB_OBJS);
+    tree->root        = NULL;
+    tree->num_nodes   = 0;
+    tree->num_deleted = 0;
+}
+
+void vtree_cleanup(vtree_t *tree)
+{
+    /* all the nodes are in the slabs */
+    pool_cleanup(&tree->height_node_pool);
+    pool_cleanup(&tree->node_pool);
+    tree->root        = NULL;
+    tree->num_nodes   = 0;
+    tree->num_deleted = 0;
+}
+
+int vtree_build(vtree_t *tree, const vtree_box_t *boxes, size_t n)
+{
+    vtree_height_node_t **heights;
+    vtree_node_t **nodes;
+    size_t i;
+
+    nodes = calloc(n + 1, sizeof(*nodes));
+    if (nodes == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        nodes[i] = pool_alloc(&tree->node_pool);
+        if (nodes[i] == NULL) {
+            break;
+        }
+        nodes[i]->side       = boxes[i].side;
+        nodes[i]->height     = boxes[i].height;
+        nodes[i]->is_deleted = 0;
+    }
+
+    heights = (i == n) ? vtree_build_all_heights(tree, nodes, n, 0) : NULL;
+    if (heights == NULL) {
+        while (i > 0) {
+            pool_free(&tree->node_pool, nodes[--i]);
+        }
+        free(nodes);
+        return -1;
+    }
+
+    tree->root      = vtree_link(nodes, heights, 0, n, 0);
+    tree->num_nodes = n;
+
+    free(heights);
+    free(nodes);
+    return 0;
+}
+
+int vtree_insert(vtree_t *tree, tree_key_t side, tree_key_t height)
+{
+    vtree_height_node_t *height_nodes[VTREE_MAX_DEPTH], *new_heights;
+    vtree_node_t *node, *new_node, *new_indexed, **link;
+    size_t depth, num_indexed, i;
+    uint64_t priority;
+    int cmp;
+
+    /* the box is added to the height trees of the indexed nodes down to its
+     * own, and the node which becomes indexed with it gets a new height
+     * tree. they are allocated first, so a failure changes nothing. a new
+     * leaf is never indexed
+     */
+    depth       = 0;
+    num_indexed = 0;
+    new_indexed = NULL;
+    cmp         = 1;
+    for (node = tree->root; node != NULL;
+         node = (cmp < 0) ? node->left : node->right) {
+        if (node->is_indexed) {
+            ++num_indexed;
+        } else if (vtree_is_indexed(depth, node->size + 1)) {
+            new_indexed = node;
+        }
+        ++depth;
+        cmp = vtree_cmp(side, height, node->side, node->height);
+        if (cmp == 0) {
+            break; /* the node of a deleted box */
+        }
+    }
+
+    if (depth + (cmp != 0) > VTREE_MAX_DEPTH) {
+        return -1; /* only if rebuilds ran out of memory */
+    }
+
+    new_node    = NULL;
+    new_heights = NULL;
+    if (cmp != 0) {
+        new_node = pool_alloc(&tree->node_pool);
+        if (new_node == NULL) {
+            return -1;
+        }
+        if ((new_indexed != NULL) &&
+            vtree_index(tree, new_indexed, side, height, &new_heights)) {
+            pool_free(&tree->node_pool, new_node);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < num_indexed; ++i) {
+        height_nodes[i] = pool_alloc(&tree->height_node_pool);
+        if (height_nodes[i] == NULL) {
+            break;
+        }
+        vtree_height_node_init(height_nodes[i], side, height);
+    }
+    if (i < num_indexed) {
+        while (i > 0) {
+            pool_free(&tree->height_node_pool, height_nodes[--i]);
+        }
+        vtree_height_free(tree, new_heights);
+        if (new_node != NULL) {
+            pool_free(&tree->node_pool, new_node);
+        }
+        return -1;
+    }
+
+    priority = vtree_priority(side, height);
+    i        = 0;
+    for (link = &tree->root; *link != NULL;
+         link = (cmp < 0) ? &node->left : &node->right) {
+        node = *link;
+        if (node->is_indexed) {
+            node->heights = vtree_height_insert(node->heights,
+                                                height_nodes[i++], priority);
+        }
+        cmp = vtree_cmp(side, height, node->side, node->height);
+        if (cmp == 0) {
+            break;
+        }
+        /* the sizes on the path of a deleted box do not change */
+        if (new_node != NULL) {
+            ++node->size;
+            if (node == new_indexed) {
+                node->heights    = new_heights;
+                node->is_indexed = 1;
+            }
+        }
+    }
+
+    if (new_node == NULL) {
+        node->is_deleted = 0;
+        --tree->num_deleted;
+        return 0;
+    }
+
+    new_node->side       = side;
+    new_node->height     = height;
+    new_node->left       = NULL;
+    new_node->right      = NULL;
+    new_node->heights    = NULL;
+    new_node->size       = 1;
+    new_node->is_deleted = 0;
+    new_node->is_indexed = 0;
+    *link = new_node;
+    ++tree->num_nodes;
+
+    /* rebuild the highest subtree on the path which is out of balance. the
+     * tree is still correct if out of memory, and the next insertion on
+     * the path tries again
+     */
+    depth = 0;
+    for (link = &tree->root; *link != new_node;
+         link = (cmp < 0) ? &(*link)->left : &(*link)->right, ++depth) {
+        if (vtree_is_unbalanced(*link)) {
+            vtree_rebuild(tree, link, depth, 0);
+            break;
+        }
+        cmp = vtree_cmp(side, height, (*link)->side, (*link)->height);
+    }
+    return 0;
+}
+
+void vtree_delete(vtree_t *tree, tree_key_t side, tree_key_t height)
+{
+    vtree_node_t *node;
+    int cmp;
+
+    for (node = tree->root; node != NULL;
+         node = (cmp < 0) ? node->left : node->right) {
+        if (node->is_indexed) {
+            node->heights = vtree_height_delete(tree, node->heights, side,
+                                                height);
+        }
+        cmp = vtree_cmp(side, height, node->side, node->height);
+        if (cmp == 0) {
+            node->is_deleted = 1;
+            ++tree->num_deleted;
+            break;
+        }
+    }
+
+    /* drop the deleted nodes once they are most of the tree */
+    if (2 * tree->num_deleted > tree->num_nodes) {
+        vtree_rebuild(tree, &tree->root, 0, 1);
+    }
+}
+
+int vtree_find(const vtree_t *tree, tree_key_t side, tree_key_t height,
+               vtree_box_t *box_p)
+{
+    const vtree_node_t *fits[VTREE_MAX_DEPTH], *node;
+    float found_side, min_height;
+    size_t num_fits;
+    int is_found;
+
+    /* the sides which fit are a suffix of the side tree, so each node on
+     * the path to its start either fits with its right subtree, or does
+     * not fit with its left subtree
+     */
+    num_fits = 0;
+    for (node = tree->root; node != NULL; ) {
+        if (tree_key_ge(node->side, side)) {
+            fits[num_fits++] = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    /* lowest height which tree_key_ge() accepts */
+    min_height = tree_key_to_float(height) - 2 * TREE_KEY_TOLERANCE;
+
+    /* the lowest sides first, which likely have the lowest volumes, so
+     * more of the larger sides are skipped
+     */
+    is_found = 0;
+    while (num_fits > 0) {
+        node       = fits[--num_fits];
+        found_side = tree_key_to_float(node->side);
+        if (is_found && (found_side >= 0) && (min_height >= 0) &&
+            (found_side * found_side * min_height >=
+             vtree_volume(box_p->side, box_p->height))) {
+            break; /* remaining sides are too big to have a lower volume */
+        }
+        if (!node->is_deleted && tree_key_ge(node->height, height)) {
+            vtree_consider(node->side, node->height, box_p, &is_found);
+        }
+        vtree_subtree_find(node->right, height, box_p, &is_found);
+    }
+    return is_found ? 0 : -1;
+}
@@ -0,0 +1,103 @@
+#ifndef _VTREE_H
+#define _VTREE_H
+
+#include "trees.h"
+#include "pool.h"
+
+#include <stddef.h>
+
+
+/* deepest path of the side tree, which is at most log(n)/log(4/3) + 2 */
+#define VTREE_MAX_DEPTH 160
+
+
+/* Box of the range tree, by its keys in the side and height trees */
+typedef struct vtree_box_s {
+    tree_key_t  side;
+    tree_key_t  height;
+} vtree_box_t;
+
+
+typedef struct vtree_node_s vtree_node_t;
+typedef struct vtree_height_node_s vtree_height_node_t;
+
+
+/*
+ * Range tree of the boxes, which finds the minimal volume box that fits in
+ * polylogarithmic time.
+ *
+ * The side tree orders the boxes by side, then by height. Its nodes at every
+ * other depth, but for small subtrees, have a height tree of all the boxes
+ * in their subtree, ordered by height, then by side, where each node keeps
+ * the minimal volume box of its own subtree. The boxes whose side fits a
+ * query are O(log(n)) subtrees of the side tree, each searched by at most
+ * two height trees, and the boxes of a height tree whose height fits are
+ * O(log(n)) of its subtrees, each with its minimal volume box at hand.
+ *
+ * The side tree is kept balanced by rebuilding a subtree once one of its
+ * sides has more than 3/4 of its nodes. a deleted box only marks its node,
+ * until most nodes are deleted and the whole tree is rebuilt. height trees
+ * are treaps, with priorities hashed from the keys.
+ *
+ * Every box takes a node in the height trees of half of its ancestors, so
+ * the memory is O(n*log(n)) for n boxes.
+ */
+typedef struct vtree_s {
+    vtree_node_t  *root;
+    pool_t        node_pool;        /* side tree nodes */
+    pool_t        height_node_pool; /* height tree nodes */
+    size_t        num_nodes;        /* side tree nodes, including deleted */
+    size_t        num_deleted;      /* side tree nodes of deleted boxes */
+} vtree_t;
+
+
+/*
+ * init an empty tree
+ */
+void vtree_init(vtree_t *tree);
+
+
+/*
+ * release all the nodes of the tree
+ */
+void vtree_cleanup(vtree_t *tree);
+
+
+/*
+ * build the tree from 'n' boxes in strictly increasing order of side, then
+ * height. the tree must be empty.
+ * time complexity O(n*log(n))
+ * returns 0 on success, -1 if out of memory, and the tree is left empty
+ */
+int vtree_build(vtree_t *tree, const vtree_box_t *boxes, size_t n);
+
+
+/*
+ * insert a box which is not in the tree, with the exact keys it has in the
+ * side and height trees
+ * time complexity O(log(n)^2), amortized
+ * returns 0 on success, -1 if out of memory, and the tree is not changed
+ */
+int vtree_insert(vtree_t *tree, tree_key_t side, tree_key_t height);
+
+
+/*
+ * delete a box which is in the tree, by its exact keys
+ * time complexity O(log(n)^2), amortized
+ */
+void vtree_delete(vtree_t *tree, tree_key_t side, tree_key_t height);
+
+
+/*
+ * find the minimal volume side*side*height box whose side and height are
+ * larger or equal to 'side' and 'height', up to tree_key_ge(). boxes of the
+ * same volume are ordered by side, then by height, like GETBOX does, and a
+ * box whose volume is not a number is only found if no other box fits.
+ * time complexity O(log(n)^2)
+ * returns 0 if found, -1 if not found
+ */
+int vtree_find(const vtree_t *tree, tree_key_t side, tree_key_t height,
+               vtree_box_t *box_p);
+
+
+#endif
@@ -0,0 +1,631 @@
+#include "wal.h"
+#include "image.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <libgen.h>
+
+
+#define WAL_DEFAULT_GROUP_SIZE          256
+#define WAL_DEFAULT_GROUP_DELAY_MS      10
+#define WAL_DEFAULT_CHECKPOINT_RECORDS  (1 << 20)
+
+/* records copied at once to a new log */
+#define WAL_COPY_RECORDS                4096
+
+
+static uint32_t wal_record_checksum(const wal_record_t *record)
+{
+    return image_checksum(0, record, offsetof(wal_record_t, checksum));
+}
+
+/* keep the first failure, which the next sync returns */
+static void wal_set_error(wal_t *wal)
+{
+    if (!wal->error) {
+        wal->error = errno;
+    }
+}
+
+static int wal_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p   += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* sync the directory of 'path', so a file renamed into it is durable */
+static int wal_sync_dir(const char *path)
+{
+    char *copy;
+    int fd, ret;
+
+    copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if (fd < 0) {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+void wal_config_default(wal_config_t *config)
+{
+    config->is_async           = 0;
+    config->group_size         = WAL_DEFAULT_GROUP_SIZE;
+    config->group_delay_ms     = WAL_DEFAULT_GROUP_DELAY_MS;
+    config->checkpoint_records = WAL_DEFAULT_CHECKPOINT_RECORDS;
+}
+
+/* double the capacity of the buffer, with the lock held */
+static int wal_grow(wal_t *wal)
+{
+    wal_record_t *buf;
+
+    buf = realloc(wal->buf, 2 * wal->capacity * sizeof(*buf));
+    if (buf == NULL) {
+        return -1;
+    }
+    wal->buf       = buf;
+    wal->capacity *= 2;
+    return 0;
+}
+
+/*write and sync the buffered records as groups, until the record of 'lsn'
+ * is durable, with the lock held. a group is swapped to the second buffer
+ * and written with the lock released, and a thread which finds another one
+ * writing waits for it, then syncs the records appended meanwhile.
+ * returns 0 on success, -1 on failure*/
+static int wal_sync_to(wal_t *wal, uint64_t lsn)
+{
+    wal_record_t *records;
+    size_t len, capacity;
+    int ret, saved_errno;
+
+    while (!wal->error && (wal->synced_lsn < lsn)) {
+        if (wal->is_syncing) {
+            pthread_cond_wait(&wal->synced_cond, &wal->lock);
+            continue;
+        } else if (wal->len == 0) {
+            break; /* not appended */
+        }
+
+        records             = wal->buf;
+        len                 = wal->len;
+        capacity            = wal->capacity;
+        wal->buf            = wal->sync_buf;
+        wal->capacity       = wal->sync_capacity;
+        wal->sync_buf       = records;
+        wal->sync_capacity  = capacity;
+        wal->len            = 0;
+        wal->is_syncing     = 1;
+        pthread_mutex_unlock(&wal->lock);
+
+        ret = wal_write_all(wal->fd, records, len * sizeof(*records)) ||
+              fdatasync(wal->fd);
+        saved_errno = errno;
+
+        pthread_mutex_lock(&wal->lock);
+        wal->is_syncing = 0;
+        if (ret) {
+            /* the records are lost, and so is the log */
+            errno = saved_errno;
+            wal_set_error(wal);
+        } else {
+            wal->synced_lsn = records[len - 1].lsn;
+            ++wal->num_syncs;
+        }
+        pthread_cond_broadcast(&wal->synced_cond);
+    }
+    return wal->error ? -1 : 0;
+}
+
+/* sync the records of the async log once they are a group, or waited for
+ * the group delay */
+static void *wal_flusher_thread(void *arg)
+{
+    wal_t *wal = arg;
+    struct timespec ts;
+    double deadline;
+
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->stop) {
+        if ((wal->len == 0) || wal->error) {
+            pthread_cond_wait(&wal->cond, &wal->lock);
+            continue;
+        }
+
+        deadline = wal->unsynced_since + wal->config.group_delay_ms * 1e-3;
+        if ((wal->len >= wal->config.group_size) ||
+            ((wal->config.group_delay_ms > 0) && (util_now() >= deadline))) {
+            wal_sync_to(wal, wal->buf[wal->len - 1].lsn);
+        } else if (wal->config.group_delay_ms == 0) {
+            pthread_cond_wait(&wal->cond, &wal->lock);
+        } else {
+            ts.tv_sec  = (time_t)deadline;
+            ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+            pthread_cond_timedwait(&wal->cond, &wal->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+/*write a new log of the records from 'start_lsn' to 'end_lsn', which are
+ * copied from the current log (if any), and rename it over the current log.
+ * the current log is not written meanwhile, but stays open until the new
+ * one replaces it with wal_replace_log()
+ * returns 0 on success with the new log in '*fd_p', -1 on failure*/
+static int wal_new_log(wal_t *wal, uint64_t start_lsn, uint64_t end_lsn,
+                       int *fd_p)
+{
+    wal_record_t *records;
+    wal_header_t header;
+    uint64_t lsn, num;
+    char *tmp_path;
+    off_t offset;
+    int fd, ret;
+
+    ret      = -1;
+    fd       = -1;
+    records  = malloc(WAL_COPY_RECORDS * sizeof(*records));
+    tmp_path = malloc(strlen(wal->log_path) + sizeof(".tmp"));
+    if ((records == NULL) || (tmp_path == NULL)) {
+        goto out_free;
+    }
+    sprintf(tmp_path, "%s.tmp", wal->log_path);
+
+    /* readable, to copy its records to the log of the next checkpoint */
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        goto out_free;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.version     = WAL_VERSION;
+    header.header_size = sizeof(header);
+    header.start_lsn   = start_lsn;
+    if (wal_write_all(fd, &header, sizeof(header))) {
+        goto out_unlink;
+    }
+
+    /* records of the current log are consecutive from its start */
+    for (lsn = start_lsn; (wal->fd >= 0) && (lsn <= end_lsn); lsn += num) {
+        num = end_lsn + 1 - lsn;
+        if (num > WAL_COPY_RECORDS) {
+            num = WAL_COPY_RECORDS;
+        }
+        offset = sizeof(header) + (lsn - wal->start_lsn) * sizeof(*records);
+        if ((pread(wal->fd, records, num * sizeof(*records), offset) !=
+             (ssize_t)(num * sizeof(*records))) ||
+            wal_write_all(fd, records, num * sizeof(*records))) {
+            goto out_unlink;
+        }
+    }
+
+    if (fsync(fd) || rename(tmp_path, wal->log_path) ||
+        wal_sync_dir(wal->log_path)) {
+        goto out_unlink;
+    }
+
+    *fd_p = fd;
+    fd  = -1;
+    ret = 0;
+    goto out_free;
+
+out_unlink:
+    unlink(tmp_path);
+out_free:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(tmp_path);
+    free(records);
+    return ret;
+}
+
+/* continue logging to a new log of the records from 'start_lsn' */
+static void wal_replace_log(wal_t *wal, int fd, uint64_t start_lsn)
+{
+    if (wal->fd >= 0) {
+        close(wal->fd);
+    }
+    wal->fd        = fd;
+    wal->start_lsn = start_lsn;
+}
+
+/*apply the records of the log which the image (up to 'image_lsn') does not
+ * include, and drop a torn record at its end
+ * returns 0 on success, -1 on failure*/
+static int wal_replay(wal_t *wal, uint64_t image_lsn)
+{
+    wal_record_t *records;
+    wal_header_t header;
+    size_t i, num;
+    ssize_t ret;
+    off_t end;
+    int is_torn, fd;
+
+    if (pread(wal->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) ||
+        (header.version != WAL_VERSION) ||
+        (header.header_size != sizeof(header)) ||
+        (header.start_lsn > image_lsn + 1)) {
+        errno = EINVAL; /* not a log, or of another image */
+        return -1;
+    }
+
+    records = malloc(WAL_COPY_RECORDS * sizeof(*records));
+    if (records == NULL) {
+        return -1;
+    }
+
+    wal->start_lsn = header.start_lsn;
+    wal->next_lsn  = header.start_lsn;
+    end     = sizeof(header);
+    is_torn = 0;
+    while (!is_torn) {
+        ret = pread(wal->fd, records, WAL_COPY_RECORDS * sizeof(*records),
+                    end);
+        if (ret < 0) {
+            free(records);
+            return -1;
+        }
+        num = ret / sizeof(*records);
+        for (i = 0; i < num; ++i) {
+            if ((records[i].lsn != wal->next_lsn) ||
+                (records[i].checksum != wal_record_checksum(&records[i]))) {
+                is_torn = 1;
+                break;
+            }
+
+            if (records[i].lsn > image_lsn) {
+                if (records[i].command == COMMAND_INSERTBOX) {
+                    INSERTBOX_N(wal->boxes, records[i].side,
+                                records[i].height, records[i].count);
+                } else {
+                    REMOVEBOX_N(wal->boxes, records[i].side,
+                                records[i].height, records[i].count);
+                }
+            }
+            ++wal->next_lsn;
+            end += sizeof(*records);
+        }
+        if (num < WAL_COPY_RECORDS) {
+            break; /* end of the log, maybe in the middle of a record */
+        }
+    }
+    free(records);
+
+    if (wal->next_lsn <= image_lsn) {
+        /* the image has all the records of the log, and later ones which
+         * were not written. new records continue a new log.
+         */
+        wal->next_lsn = image_lsn + 1;
+        if (wal_new_log(wal, wal->next_lsn, image_lsn, &fd)) {
+            return -1;
+        }
+        wal_replace_log(wal, fd, wal->next_lsn);
+        return 0;
+    }
+
+    if (ftruncate(wal->fd, end) || (lseek(wal->fd, end, SEEK_SET) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* read the LSN of the image which was saved to 'path' */
+static int wal_read_image_lsn(const char *path, uint64_t *lsn_p)
+{
+    image_header_t header;
+    ssize_t ret;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    ret = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (ret != sizeof(header)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *lsn_p = header.lsn;
+    return 0;
+}
+
+int wal_open(wal_t *wal, boxes_t *boxes, const char *image_path,
+             const char *log_path, const wal_config_t *config)
+{
+    pthread_condattr_t attr;
+    uint64_t image_lsn;
+    image_t image;
+    int ret, fd;
+
+    wal->boxes              = boxes;
+    wal->config             = *config;
+    wal->fd                 = -1;
+    wal->len                = 0;
+    wal->is_syncing         = 0;
+    wal->num_syncs          = 0;
+    wal->checkpoint_pending = 0;
+    wal->error              = 0;
+    wal->stop               = 0;
+    wal->has_flusher        = 0;
+    if (wal->config.group_size == 0) {
+        wal->config.group_size = 1;
+    }
+
+    /* the buffers grow past a group if its sync is slow */
+    wal->capacity      = wal->config.group_size;
+    wal->sync_capacity = wal->config.group_size;
+    wal->image_path = strdup(image_path);
+    wal->log_path   = strdup(log_path);
+    wal->buf      = malloc(wal->capacity * sizeof(*wal->buf));
+    wal->sync_buf = malloc(wal->sync_capacity * sizeof(*wal->sync_buf));
+    if ((wal->image_path == NULL) || (wal->log_path == NULL) ||
+        (wal->buf == NULL) || (wal->sync_buf == NULL)) {
+        goto out_free;
+    }
+
+    /* the image, then the records it does not include */
+    image_lsn = 0;
+    ret = image_open(&image, image_path);
+    if (!ret) {
+        image_lsn = image.header->lsn;
+        ret = boxes_load_image(boxes, &image);
+        image_close(&image);
+        if (ret) {
+            goto out_free;
+        }
+    } else if (errno != ENOENT) {
+        goto out_free;
+    }
+
+    wal->fd = open(log_path, O_RDWR);
+    if (wal->fd >= 0) {
+        ret = wal_replay(wal, image_lsn);
+    } else if (errno == ENOENT) {
+        wal->next_lsn = image_lsn + 1;
+        ret = wal_new_log(wal, wal->next_lsn, image_lsn, &fd);
+        if (!ret) {
+            wal_replace_log(wal, fd, wal->next_lsn);
+        }
+    } else {
+        ret = -1;
+    }
+    if (ret) {
+        goto out_close;
+    }
+    wal->synced_lsn = wal->next_lsn - 1;
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_mutex_init(&wal->checkpoint_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&wal->synced_cond, NULL);
+
+    if (wal->config.is_async) {
+        /* without the thread, records are synced by wal_sync() */
+        wal->has_flusher = !pthread_create(&wal->flusher, NULL,
+                                           wal_flusher_thread, wal);
+    }
+
+    boxes->wal = wal;
+    return 0;
+
+out_close:
+    if (wal->fd >= 0) {
+        close(wal->fd);
+    }
+out_free:
+    ret = errno;
+    free(wal->sync_buf);
+    free(wal->buf);
+    free(wal->log_path);
+    free(wal->image_path);
+    errno = ret;
+    return -1;
+}
+
+int wal_close(wal_t *wal)
+{
+    int ret;
+
+    wal->boxes->wal = NULL;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = 1;
+    pthread_cond_broadcast(&wal->cond);
+    pthread_mutex_unlock(&wal->lock);
+    if (wal->has_flusher) {
+        pthread_join(wal->flusher, NULL);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    ret = wal_sync_to(wal, wal->next_lsn - 1);
+    pthread_mutex_unlock(&wal->lock);
+    if (close(wal->fd) && !ret) {
+        wal_set_error(wal);
+        ret = -1;
+    }
+
+    pthread_cond_destroy(&wal->synced_cond);
+    pthread_cond_destroy(&wal->cond);
+    pthread_mutex_destroy(&wal->checkpoint_lock);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->sync_buf);
+    free(wal->buf);
+    free(wal->log_path);
+    free(wal->image_path);
+
+    if (ret) {
+        errno = wal->error;
+    }
+    return ret;
+}
+
+int wal_append(wal_t *wal, command_type_t command, float side, float height,
+               uint64_t count, uint64_t *lsn_p)
+{
+    wal_record_t *record;
+    int is_due;
+
+    pthread_mutex_lock(&wal->lock);
+    if ((wal->len == wal->capacity) && !wal->error && wal_grow(wal)) {
+        wal_set_error(wal);
+    }
+    if (wal->error) {
+        *lsn_p = 0;
+        pthread_mutex_unlock(&wal->lock);
+        return 0; /* the log is broken, and the next sync fails */
+    }
+
+    record = &wal->buf[wal->len++];
+    record->lsn      = wal->next_lsn++;
+    record->count    = count;
+    record->command  = command;
+    record->side     = side;
+    record->height   = height;
+    record->checksum = wal_record_checksum(record);
+    *lsn_p = record->lsn;
+
+    /* the flusher of an async log waits for the first record of a group,
+     * and for a full group
+     */
+    if (wal->len == 1) {
+        wal->unsynced_since = util_now();
+        pthread_cond_signal(&wal->cond);
+    } else if (wal->len == wal->config.group_size) {
+        pthread_cond_signal(&wal->cond);
+    }
+
+    is_due = 0;
+    if ((wal->config.checkpoint_records > 0) && !wal->checkpoint_pending &&
+        (wal->next_lsn - wal->start_lsn >= wal->config.checkpoint_records)) {
+        wal->checkpoint_pending = 1;
+        is_due = 1;
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return is_due;
+}
+
+int wal_wait(wal_t *wal, uint64_t lsn)
+{
+    int ret;
+
+    pthread_mutex_lock(&wal->lock);
+    ret = wal_sync_to(wal, lsn);
+    if (ret) {
+        errno = wal->error;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+int wal_sync(wal_t *wal)
+{
+    int ret;
+
+    pthread_mutex_lock(&wal->lock);
+    ret = wal_sync_to(wal, wal->next_lsn - 1);
+    if (ret) {
+        errno = wal->error;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return ret;
+}
+
+int wal_checkpoint(wal_t *wal)
+{
+    uint64_t image_lsn, end_lsn;
+    int ret, fd, saved_errno;
+
+    pthread_mutex_lock(&wal->checkpoint_lock);
+
+    /* updates wait while the image is built in memory, and continue with
+     * later LSNs while it is written. if it is not saved, the log is kept.
+     */
+    ret = boxes_save(wal->boxes, wal->image_path);
+    if (!ret) {
+        ret = wal_read_image_lsn(wal->image_path, &image_lsn);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    if (!ret) {
+        ret = wal_sync_to(wal, image_lsn);
+        while (!ret && wal->is_syncing) {
+            pthread_cond_wait(&wal->synced_cond, &wal->lock);
+            ret = wal->error ? -1 : 0;
+        }
+        if (ret) {
+            errno = wal->error;
+        }
+    }
+    if (!ret) {
+        /* the synced records after the image are copied to the new log
+         * without the lock, and the log is not synced meanwhile. updates
+         * keep appending to the buffer, which is synced to the new log.
+         */
+        wal->is_syncing = 1;
+        end_lsn = wal->synced_lsn;
+        pthread_mutex_unlock(&wal->lock);
+        ret = wal_new_log(wal, image_lsn + 1, end_lsn, &fd);
+        saved_errno = errno;
+        pthread_mutex_lock(&wal->lock);
+
+        if (ret) {
+            errno = saved_errno;
+            wal_set_error(wal);
+        } else {
+            wal_replace_log(wal, fd, image_lsn + 1);
+        }
+        wal->is_syncing = 0;
+        pthread_cond_broadcast(&wal->synced_cond);
+        if (ret) {
+            errno = wal->error;
+        }
+    }
+    wal->checkpoint_pending = 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    pthread_mutex_unlock(&wal->checkpoint_lock);
+    return ret;
+}
+
+uint64_t wal_last_lsn(const wal_t *wal)
+{
+    return wal->next_lsn - 1;
+}
@@ -0,0 +1,172 @@
+#ifndef _WAL_H
+#define _WAL_H
+
+#include "boxes.h"
+#include "parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+#define WAL_MAGIC       "BOXESWAL"
+#define WAL_VERSION     2
+
+
+/*
+ * Header of a log file, in host byte order. It is followed by records of
+ * consecutive LSNs, from 'start_lsn'.
+ */
+typedef struct wal_header_s {
+    char        magic[8];       /* WAL_MAGIC, not terminated */
+    uint32_t    version;        /* WAL_VERSION */
+    uint32_t    header_size;    /* sizeof(wal_header_t) */
+    uint64_t    start_lsn;      /* of the first record */
+} wal_header_t;
+
+
+/*
+ * Logged update of the boxes
+ */
+typedef struct wal_record_s {
+    uint64_t    lsn;            /* log sequence number, from 1 */
+    uint64_t    count;          /* of the boxes inserted or removed */
+    uint32_t    command;        /* COMMAND_INSERTBOX or COMMAND_REMOVEBOX */
+    float       side;
+    float       height;
+    uint32_t    checksum;       /* CRC-32C of the fields above */
+} wal_record_t;
+
+
+/* Group commit and checkpoint policy */
+typedef struct wal_config_s {
+    int         is_async;           /* updates return before they are
+                                     * durable, see wal_t */
+    size_t      group_size;         /* fsync once this many records are
+                                     * not synced, 1 to sync every update
+                                     * (if async) */
+    unsigned    group_delay_ms;     /* fsync records which are not synced
+                                     * for this long, 0 to wait for a full
+                                     * group (if async) */
+    uint64_t    checkpoint_records; /* checkpoint once the log has this many
+                                     * records, 0 for no checkpoints */
+} wal_config_t;
+
+
+/*
+ * Write-ahead log of the updates of boxes, on top of an image of them.
+ * INSERTBOX, REMOVEBOX and bulk loads of the boxes append records to a
+ * buffer, while the boxes are locked. the buffer is then written and synced
+ * as a group, from a second buffer, so updates keep appending to the first
+ * one and neither lock is held during the I/O.
+ *
+ * by default, an update returns once it is durable: after unlocking the
+ * boxes, it waits for the group of its record to be synced, and syncs it
+ * if no other update is syncing. updates which arrive during a sync make
+ * the next group.
+ * if the log is async, updates return at once, and a background thread
+ * syncs the records once 'group_size' of them are not synced, or once the
+ * first of them waited 'group_delay_ms'. an update is durable when
+ * wal_sync() returns after it, which is the point to acknowledge it.
+ */
+typedef struct wal_s {
+    boxes_t          *boxes;
+    wal_config_t     config;
+    char             *image_path;
+    char             *log_path;
+    int              fd;
+
+    pthread_mutex_t  lock;          /* of the fields below */
+    pthread_cond_t   cond;          /* records were appended, or stop */
+    pthread_cond_t   synced_cond;   /* a sync ended */
+    wal_record_t     *buf;          /* records which are not written */
+    size_t           len;
+    size_t           capacity;
+    wal_record_t     *sync_buf;     /* records which are being written */
+    size_t           sync_capacity;
+    int              is_syncing;    /* the log is written by a thread, with
+                                     * the lock released */
+    uint64_t         start_lsn;     /* of the first record of the log */
+    uint64_t         next_lsn;      /* of the next record */
+    uint64_t         synced_lsn;    /* last record which is durable */
+    uint64_t         num_syncs;
+    double           unsynced_since;    /* time of the first record which
+                                         * is not synced */
+    int              checkpoint_pending;
+    int              error;         /* errno of the first failure, or 0 */
+    int              stop;
+
+    pthread_t        flusher;
+    int              has_flusher;
+    pthread_mutex_t  checkpoint_lock;
+} wal_t;
+
+
+/*
+ * fill 'config' with the default policy
+ */
+void wal_config_default(wal_config_t *config);
+
+
+/*
+ * recover the empty 'boxes' from the image at 'image_path' and the log at
+ * 'log_path' (either may not exist yet), then log their updates.
+ * records of the log which the image includes are skipped, and a torn
+ * record at the end of the log (of a crash during a write) is dropped.
+ * returns 0 on success, -1 on failure with errno set (EINVAL if a file is
+ * not valid)
+ */
+int wal_open(wal_t *wal, boxes_t *boxes, const char *image_path,
+             const char *log_path, const wal_config_t *config);
+
+
+/*
+ * sync the log, and stop logging the updates of the boxes
+ * returns 0 if all the updates were logged, -1 with errno set otherwise
+ */
+int wal_close(wal_t *wal);
+
+
+/*
+ * append an update of 'count' boxes, while they are locked for writing,
+ * and set '*lsn_p' to the LSN of its record.
+ * called by the boxes for every update.
+ * returns nonzero if a checkpoint is due, which the caller should take with
+ * wal_checkpoint() after unlocking the boxes
+ */
+int wal_append(wal_t *wal, command_type_t command, float side, float height,
+               uint64_t count, uint64_t *lsn_p);
+
+
+/*
+ * wait until the record of 'lsn' is durable, while the boxes are not
+ * locked. called by the boxes after every update, unless the log is async.
+ * returns 0 on success, -1 on failure with errno set
+ */
+int wal_wait(wal_t *wal, uint64_t lsn);
+
+
+/*
+ * make all the appended updates durable
+ * returns 0 on success, -1 on failure with errno set
+ */
+int wal_sync(wal_t *wal);
+
+
+/*
+ * save an image of the boxes, and drop the records it includes from the log.
+ * updates wait while the image is built in memory (see boxes_save()), but
+ * not while it is written, nor while the later records are copied to the
+ * new log.
+ * returns 0 on success, -1 on failure with errno set
+ */
+int wal_checkpoint(wal_t *wal);
+
+
+/*
+ * last LSN which was appended, while the boxes are locked
+ */
+uint64_t wal_last_lsn(const wal_t *wal);
+
+
+#endif
@@ -0,0 +1,274 @@
+#include "workload.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+
+/* Percent of each command in a mix */
+typedef struct workload_mix_percents_s {
+    unsigned    insertbox;
+    unsigned    removebox;
+    unsigned    getbox;
+    unsigned    checkbox;
+} workload_mix_percents_t;
+
+static const workload_mix_percents_t workload_mixes[WORKLOAD_NUM_MIXES] = {
+    [WORKLOAD_INSERT_HEAVY] = {70, 10, 10, 10},
+    [WORKLOAD_QUERY_HEAVY]  = { 5,  5, 45, 45},
+    [WORKLOAD_CHURN]        = {45, 45,  5,  5},
+};
+
+static const char *workload_dist_names[WORKLOAD_NUM_DISTS] = {
+    [WORKLOAD_UNIFORM]   = "uniform",
+    [WORKLOAD_ZIPF]      = "zipf",
+    [WORKLOAD_CLUSTERED] = "clustered",
+};
+
+static const char *workload_mix_names[WORKLOAD_NUM_MIXES] = {
+    [WORKLOAD_INSERT_HEAVY] = "insert",
+    [WORKLOAD_QUERY_HEAVY]  = "query",
+    [WORKLOAD_CHURN]        = "churn",
+};
+
+/* odd multipliers which scatter the Zipf ranks over the values, differently
+ * for sides and heights */
+#define WORKLOAD_SIDE_SCATTER       2654435761ull
+#define WORKLOAD_HEIGHT_SCATTER     40503ull
+
+
+/* uniform in [0,1) */
+static double workload_uniform(uint64_t *state)
+{
+    return (util_random(state) >> 11) * (1.0 / (1ull << 53));
+}
+
+/* first rank whose cumulative probability is above u */
+static uint64_t workload_zipf_rank(const workload_t *workload, double u)
+{
+    uint64_t low, high, mid;
+
+    low  = 0;
+    high = workload->num_values - 1;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (workload->zipf_cdf[mid] > u) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+static uint64_t workload_clamp(const workload_t *workload, double value)
+{
+    if (value < 0) {
+        return 0;
+    }
+    if (value >= workload->num_values) {
+        return workload->num_values - 1;
+    }
+    return value;
+}
+
+/* random box of the distribution, from the sequence of 'state' */
+static void workload_box(const workload_t *workload, uint64_t *state,
+                         float *side_p, float *height_p)
+{
+    const float *center;
+    uint64_t side, height;
+    double radius, angle, sigma;
+
+    switch (workload->config.dist) {
+    case WORKLOAD_ZIPF:
+        side   = workload_zipf_rank(workload, workload_uniform(state));
+        height = workload_zipf_rank(workload, workload_uniform(state));
+        side   = (side + 1) * WORKLOAD_SIDE_SCATTER % workload->num_values;
+        height = (height + 1) * WORKLOAD_HEIGHT_SCATTER %
+                 workload->num_values;
+        break;
+
+    case WORKLOAD_CLUSTERED:
+        /* Box-Muller: a normal offset of both dimensions from a center */
+        center = workload->centers[util_random(state) %
+                                   workload->config.num_clusters];
+        radius = sqrt(-2 * log(1 - workload_uniform(state)));
+        angle  = 2 * M_PI * workload_uniform(state);
+        sigma  = workload->num_values / 100.0;
+        side   = workload_clamp(workload, center[0] * 100 +
+                                sigma * radius * cos(angle));
+        height = workload_clamp(workload, center[1] * 100 +
+                                sigma * radius * sin(angle));
+        break;
+
+    default:
+        side   = util_random(state) % workload->num_values;
+        height = util_random(state) % workload->num_values;
+        break;
+    }
+
+    *side_p   = side / 100.0;
+    *height_p = height / 100.0;
+}
+
+/* box of an insertion number, which is the same every time */
+static void workload_inserted_box(const workload_t *workload, uint64_t num,
+                                  float *side_p, float *height_p)
+{
+    uint64_t state;
+
+    state = workload->config.seed ^ (num * 0xd6e8feb86659fd93ull);
+    util_random(&state);
+    workload_box(workload, &state, side_p, height_p);
+}
+
+void workload_config_default(workload_config_t *config)
+{
+    config->dist         = WORKLOAD_UNIFORM;
+    config->mix          = WORKLOAD_QUERY_HEAVY;
+    config->num_boxes    = 1000000;
+    config->num_ops      = 1000000;
+    config->max_dim      = 1000;
+    config->zipf_s       = 0.99;
+    config->num_clusters = 16;
+    config->seed         = 1;
+}
+
+int workload_dist_parse(const char *name)
+{
+    int dist;
+
+    for (dist = 0; dist < WORKLOAD_NUM_DISTS; ++dist) {
+        if (!strcmp(name, workload_dist_names[dist])) {
+            return dist;
+        }
+    }
+    return -1;
+}
+
+int workload_mix_parse(const char *name)
+{
+    int mix;
+
+    for (mix = 0; mix < WORKLOAD_NUM_MIXES; ++mix) {
+        if (!strcmp(name, workload_mix_names[mix])) {
+            return mix;
+        }
+    }
+    return -1;
+}
+
+const char *workload_dist_name(workload_dist_t dist)
+{
+    return workload_dist_names[dist];
+}
+
+const char *workload_mix_name(workload_mix_t mix)
+{
+    return workload_mix_names[mix];
+}
+
+int workload_init(workload_t *workload, const workload_config_t *config)
+{
+    uint64_t state, i;
+    double sum;
+
+    if (config->dist >= WORKLOAD_NUM_DISTS ||
+        config->mix >= WORKLOAD_NUM_MIXES || !(config->max_dim >= 0.01) ||
+        config->num_clusters == 0 ||
+        config->num_clusters > WORKLOAD_MAX_CLUSTERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(workload, 0, sizeof(*workload));
+    workload->config     = *config;
+    workload->num_values = (uint64_t)(config->max_dim * 100);
+    workload->random     = config->seed ^ 0x5851f42d4c957f2dull;
+
+    if (config->dist == WORKLOAD_ZIPF) {
+        workload->zipf_cdf = malloc(workload->num_values *
+                                    sizeof(*workload->zipf_cdf));
+        if (workload->zipf_cdf == NULL) {
+            return -1;
+        }
+
+        sum = 0;
+        for (i = 0; i < workload->num_values; ++i) {
+            sum += pow(i + 1, -config->zipf_s);
+            workload->zipf_cdf[i] = sum;
+        }
+        for (i = 0; i < workload->num_values; ++i) {
+            workload->zipf_cdf[i] /= sum;
+        }
+    }
+
+    state = config->seed;
+    for (i = 0; i < config->num_clusters; ++i) {
+        workload->centers[i][0] = workload_uniform(&state) * config->max_dim;
+        workload->centers[i][1] = workload_uniform(&state) * config->max_dim;
+    }
+
+    return 0;
+}
+
+void workload_cleanup(workload_t *workload)
+{
+    free(workload->zipf_cdf);
+    workload->zipf_cdf = NULL;
+}
+
+int workload_next(workload_t *workload, command_t *command)
+{
+    const workload_mix_percents_t *mix;
+    const workload_config_t *config = &workload->config;
+    unsigned percent;
+
+    if (workload->num_generated >= config->num_boxes + config->num_ops) {
+        return 0;
+    }
+
+    if (workload->num_generated < config->num_boxes) {
+        command->type = COMMAND_INSERTBOX;
+    } else {
+        mix     = &workload_mixes[config->mix];
+        percent = util_random(&workload->random) % 100;
+        if (percent < mix->insertbox) {
+            command->type = COMMAND_INSERTBOX;
+        } else if (percent < mix->insertbox + mix->removebox) {
+            command->type = COMMAND_REMOVEBOX;
+        } else if (percent < mix->insertbox + mix->removebox + mix->getbox) {
+            command->type = COMMAND_GETBOX;
+        } else {
+            command->type = COMMAND_CHECKBOX;
+        }
+    }
+
+    /* nothing to remove, so insert instead */
+    if (command->type == COMMAND_REMOVEBOX &&
+        workload->next_remove == workload->next_insert) {
+        command->type = COMMAND_INSERTBOX;
+    }
+
+    switch (command->type) {
+    case COMMAND_INSERTBOX:
+        workload_inserted_box(workload, workload->next_insert++,
+                              &command->arg1, &command->arg2);
+        break;
+    case COMMAND_REMOVEBOX:
+        workload_inserted_box(workload, workload->next_remove++,
+                              &command->arg1, &command->arg2);
+        break;
+    default:
+        workload_box(workload, &workload->random,
+                     &command->arg1, &command->arg2);
+        break;
+    }
+
+    command->count = 1;
+    ++workload->num_generated;
+    return 1;
+}
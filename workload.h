@@ -0,0 +1,101 @@
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include "parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Distribution of the sides and heights of the boxes and queries */
+typedef enum {
+    WORKLOAD_UNIFORM,       /* uniform in [0,max_dim) */
+    WORKLOAD_ZIPF,          /* few hot values, with exponent zipf_s */
+    WORKLOAD_CLUSTERED,     /* normal around a few random centers */
+    WORKLOAD_NUM_DISTS
+} workload_dist_t;
+
+
+/* Mix of the commands, after the boxes are inserted */
+typedef enum {
+    WORKLOAD_INSERT_HEAVY,  /* mostly INSERTBOX, the boxes grow */
+    WORKLOAD_QUERY_HEAVY,   /* mostly GETBOX and CHECKBOX */
+    WORKLOAD_CHURN,         /* INSERTBOX and REMOVEBOX in equal parts */
+    WORKLOAD_NUM_MIXES
+} workload_mix_t;
+
+
+#define WORKLOAD_MAX_CLUSTERS   64
+
+
+/* Parameters of a workload */
+typedef struct workload_config_s {
+    workload_dist_t  dist;
+    workload_mix_t   mix;
+    uint64_t         num_boxes;     /* inserted first */
+    uint64_t         num_ops;       /* of the mix, after the boxes */
+    float            max_dim;       /* dimensions are in [0,max_dim), with a
+                                     * 0.01 resolution */
+    double           zipf_s;        /* exponent of WORKLOAD_ZIPF */
+    unsigned         num_clusters;  /* of WORKLOAD_CLUSTERED */
+    uint64_t         seed;
+} workload_config_t;
+
+
+/*
+ * Generator of a workload. The same config always generates the same
+ * commands. Inserted boxes are derived from their insertion number, so
+ * REMOVEBOX removes the oldest box which is still inserted without keeping
+ * the boxes, and any number of boxes is generated in O(1) memory.
+ */
+typedef struct workload_s {
+    workload_config_t  config;
+    uint64_t           num_values;      /* distinct values of a dimension */
+    double             *zipf_cdf;       /* of the ranks of WORKLOAD_ZIPF */
+    float              centers[WORKLOAD_MAX_CLUSTERS][2];
+    uint64_t           random;          /* state of the query generator */
+    uint64_t           next_insert;     /* insertion number of the next box */
+    uint64_t           next_remove;     /* oldest box which is inserted */
+    uint64_t           num_generated;   /* commands generated */
+} workload_t;
+
+
+/*
+ * fill 'config' with a uniform, query-heavy workload of 1e6 boxes and 1e6
+ * commands in [0,1000)
+ */
+void workload_config_default(workload_config_t *config);
+
+
+/*
+ * get the distribution or mix called 'name', or -1 if there is none
+ */
+int workload_dist_parse(const char *name);
+int workload_mix_parse(const char *name);
+const char *workload_dist_name(workload_dist_t dist);
+const char *workload_mix_name(workload_mix_t mix);
+
+
+/*
+ * initialize the generator of a workload
+ * returns 0 on success, -1 on failure with errno set
+ */
+int workload_init(workload_t *workload, const workload_config_t *config);
+
+
+/*
+ * release the generator
+ */
+void workload_cleanup(workload_t *workload);
+
+
+/*
+ * generate the next command: first 'num_boxes' INSERTBOX, then 'num_ops'
+ * commands of the mix. only 'type', 'arg1', 'arg2' and 'count' (always 1)
+ * are set.
+ * returns 1 if a command was generated, 0 at the end of the workload
+ */
+int workload_next(workload_t *workload, command_t *command);
+
+
+#endif